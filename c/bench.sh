@@ -0,0 +1,97 @@
+#!/bin/sh
+# The benchmark suite, for make bench and the PGO training run.
+#
+#   sh bench.sh run RUN         Run every benchmark with the RUN binary, printing their results
+#   sh bench.sh compare FILE... Line up the results of several runs, one column per file,
+#                               with the speedup of each over the first one
+#
+# The sizes are scaled down from the benchmarks' defaults so a run takes about a minute.
+
+set -e
+
+run_suite() {
+    run=$1
+    tmp=$(mktemp -d /tmp/bench.XXXXXX)
+    trap 'rm -rf "$tmp"' EXIT
+
+    "$run" 3 bench-errlog 100000 4
+    "$run" 3 bench-errevent 500000
+    "$run" 5 bench-rwf "$tmp/rwf" 10000
+    "$run" 5 bench-fdtable 20000
+    "$run" 5 bench-offset "$tmp/offset" 4 100000
+    "$run" 6 bench-env 10000
+    "$run" 7 bench-slab 200000
+    "$run" 7 bench-arena 200000
+    "$run" 7 bench-hugeheap 256 2000000
+    "$run" 7 bench-falseshare 4 20000000
+    "$run" 7 bench-churn 20000 10
+    "$run" 7 bench-shmheap 4 200000
+    "$run" 7 bench-heapprof 500000 "$tmp/heapprof"
+    "$run" 7 bench-pressure 64
+    "$run" 7 bench-freebatch 1000000
+    "$run" 8 bench-pwcache 100000
+    "$run" 8 bench-pwbatch 100000
+    "$run" 8 bench-pwgroup 20000 100
+    "$run" 8 bench-pwindex 50000
+    "$run" 8 bench-pwmap
+}
+
+compare() {
+    # Results are "<name> <value> <unit>" lines, anything else is commentary
+    awk '
+    FNR == 1 {
+        nfiles++
+        path = FILENAME
+        sub(/\/bench\.txt$/, "", path)
+        sub(/.*\//, "", path)
+        label[nfiles] = path
+    }
+    NF == 3 && $2 ~ /^-?[0-9.]+$/ {
+        if (!($1 in unit)) {
+            order[++nnames] = $1
+            unit[$1] = $3
+        }
+        value[$1, nfiles] = $2
+    }
+    END {
+        printf "%-48s", "benchmark"
+        for (f = 1; f <= nfiles; f++)
+            printf " %23s", label[f]
+        printf "  unit\n"
+        for (n = 1; n <= nnames; n++) {
+            name = order[n]
+            # Rates are better higher, times better lower, other counts have no direction
+            rate = unit[name] ~ /\/s$/
+            time = unit[name] ~ /^(ms|ns)(\/|$)/
+            printf "%-48s", name
+            for (f = 1; f <= nfiles; f++) {
+                if (!((name, f) in value)) {
+                    printf " %23s", "-"
+                    continue
+                }
+                v = value[name, f]
+                base = value[name, 1]
+                if (f > 1 && base > 0 && v > 0 && (rate || time))
+                    printf " %14.3f (x%5.2f)", v, rate ? v / base : base / v
+                else
+                    printf " %23.3f", v
+            }
+            printf "  %s\n", unit[name]
+        }
+    }' "$@"
+}
+
+case "$1" in
+    run)
+        [ $# -eq 2 ] || { echo "Usage: bench.sh run RUN" >&2; exit 1; }
+        run_suite "$2"
+        ;;
+    compare)
+        shift
+        compare "$@"
+        ;;
+    *)
+        echo "Usage: bench.sh run RUN | bench.sh compare FILE..." >&2
+        exit 1
+        ;;
+esac
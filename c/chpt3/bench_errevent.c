@@ -0,0 +1,135 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../shared/bench.h"
+#include "../shared/errors.h"
+#include "../shared/utils.h"
+#include "bench_errevent.h"
+
+#define ERREVENT_BENCH_PATH "/srv/backup/2024/photos/IMG_0042.jpg"
+#define ERREVENT_BENCH_CHECK_MS 100 // Rate limiting window for the check
+#define ERREVENT_BENCH_CHECK_WINDOWS 5
+
+typedef enum {
+    ERRLOG,
+    EVENT,
+} errevent_case;
+
+/**
+ * Log num_events times the same failure, returning the nanoseconds per call.
+ */
+static double log_events(errevent_case kind, long num_events) {
+    double begin = bench_now();
+    for (long i = 0; i < num_events; i++) {
+        if (kind == ERRLOG) {
+            errLogEN(EIO, "Failed to read %s at offset %ld", ERREVENT_BENCH_PATH, i * 4096);
+        } else {
+            errEvent("bench.read_failed", EIO, EV_STR("path", ERREVENT_BENCH_PATH), EV_INT("offset", i * 4096));
+        }
+    }
+    return (bench_now() - begin) * 1e9 / num_events;
+}
+
+/**
+ * Point stderr to filepath, returning a descriptor for the previous one.
+ */
+static int redirect_stderr(const char * filepath) {
+    int saved = dup(STDERR_FILENO);
+    int fd = open(filepath, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, S_IRUSR | S_IWUSR);
+    if (saved == -1 || fd == -1 || dup2(fd, STDERR_FILENO) == -1) {
+        errExit("redirect stderr to %s", filepath);
+    }
+    safe_close(fd);
+    return saved;
+}
+
+static void restore_stderr(int saved) {
+    if (dup2(saved, STDERR_FILENO) == -1) {
+        errExit("dup2");
+    }
+    safe_close(saved);
+}
+
+/**
+ * Hammer one call site for a few windows, then wait for a fresh window and emit once more, so that
+ * the last event reports what was suppressed since the previous one. Every event must be accounted for,
+ * and no window may have more than the limit.
+ */
+static void check_rate_limit() {
+    char filepath[] = "/tmp/errevent-check-XXXXXX";
+    int fd = mkstemp(filepath);
+    if (fd == -1) {
+        errExit("mkstemp");
+    }
+    safe_close(fd);
+
+    errEventSetLimit(ERR_EVENT_LIMIT, ERREVENT_BENCH_CHECK_MS);
+    int saved = redirect_stderr(filepath);
+    long num_events = 0;
+    double end = bench_now() + ERREVENT_BENCH_CHECK_WINDOWS * ERREVENT_BENCH_CHECK_MS / 1e3;
+    Boolean last = FALSE;
+    while (!last) {
+        if (bench_now() >= end) {
+            struct timespec pause = { 0, ERREVENT_BENCH_CHECK_MS * 1000000L };
+            nanosleep(&pause, NULL);
+            last = TRUE;
+        }
+        errEvent("bench.check", ENOSPC, EV_INT("n", num_events), EV_STR("quote", "say \"hi\"\n"));
+        num_events++;
+    }
+    restore_stderr(saved);
+    errEventSetLimit(ERR_EVENT_LIMIT, ERR_EVENT_WINDOW_MS);
+
+    FILE * f = fopen(filepath, "r");
+    if (f == NULL) {
+        errExit("fopen %s", filepath);
+    }
+    char line[ERR_LINE_MAX + 1];
+    long emitted = 0, suppressed = 0;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (strncmp(line, "{\"ts_ns\":", 9) != 0 || strcmp(line + strlen(line) - 2, "}\n") != 0 ||
+            strstr(line, "\"event\":\"bench.check\"") == NULL || strstr(line, "\"errno\":\"ENOSPC\"") == NULL ||
+            strstr(line, "\"quote\":\"say \\\"hi\\\"\\u000a\"") == NULL) {
+            fatal("Malformed event in %s: %s", filepath, line);
+        }
+        const char * count = strstr(line, "\"suppressed\":");
+        if (count != NULL) {
+            suppressed += strtol(count + 13, NULL, 10);
+        }
+        emitted++;
+    }
+    fclose(f);
+
+    if (emitted + suppressed != num_events) {
+        fatal("%ld events were emitted and %ld suppressed, out of %ld", emitted, suppressed, num_events);
+    }
+    if (emitted > (ERREVENT_BENCH_CHECK_WINDOWS + 2) * ERR_EVENT_LIMIT) {
+        fatal("%ld events were emitted in about %d windows of %d", emitted, ERREVENT_BENCH_CHECK_WINDOWS + 1, ERR_EVENT_LIMIT);
+    }
+    printf("%ld events in %d windows of %dms: %ld emitted, %ld suppressed and reported\n",
+        num_events, ERREVENT_BENCH_CHECK_WINDOWS + 1, ERREVENT_BENCH_CHECK_MS, emitted, suppressed);
+    if (unlink(filepath) == -1) {
+        errExit("unlink %s", filepath);
+    }
+}
+
+void chpt3_bench_errevent(long num_events) {
+    int saved = redirect_stderr("/dev/null");
+    double errlog_ns = log_events(ERRLOG, num_events);
+    errEventSetLimit(0, ERR_EVENT_WINDOW_MS);
+    double emitted_ns = log_events(EVENT, num_events);
+    errEventSetLimit(ERR_EVENT_LIMIT, ERR_EVENT_WINDOW_MS);
+    double suppressed_ns = log_events(EVENT, num_events);
+    restore_stderr(saved);
+
+    bench_report("errevent/errlog", errlog_ns, "ns/line");
+    bench_report("errevent/emitted", emitted_ns, "ns/event");
+    bench_report("errevent/suppressed", suppressed_ns, "ns/event");
+
+    check_rate_limit();
+}
@@ -0,0 +1,11 @@
+#ifndef __CHPT3_BENCH_ERREVENT_H__
+#define __CHPT3_BENCH_ERREVENT_H__
+
+/**
+ * Measure the cost of a structured event when its call site is over the rate limit (suppressed),
+ * and when it is written (emitted), next to a plain errLog line. Then check that a rate-limited
+ * call site accounts for every event, either emitted or in a "suppressed" count.
+ */
+void chpt3_bench_errevent(long num_events);
+
+#endif
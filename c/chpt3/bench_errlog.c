@@ -0,0 +1,231 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "../shared/bench.h"
+#include "../shared/errors.h"
+#include "../shared/utils.h"
+#include "bench_errlog.h"
+
+#define ERRLOG_BENCH_PAYLOAD "the quick brown fox jumps over the lazy dog, twice: the quick brown fox"
+#define ERRLOG_BENCH_RING_SLOTS 4096
+#define ERRLOG_BENCH_CHECK_LINES 20000 // Per thread, the check reads the whole file back
+#define ERRLOG_BENCH_SIGNAL_US 200
+
+typedef enum {
+    STDIO,
+    DIRECT,
+    RING,
+} errlog_path;
+
+typedef struct {
+    errlog_path path;
+    int index;
+    long num_lines;
+    pthread_barrier_t * start;
+} errlog_worker;
+
+static long signal_lines;
+
+/**
+ * outputError as it was before errLog: stdio, three buffers and two fflush calls.
+ */
+static void stdio_line(const char * format, ...) {
+    #define STDIO_BUF_SIZE 500
+    char buf[3*STDIO_BUF_SIZE], userMsg[STDIO_BUF_SIZE], errText[STDIO_BUF_SIZE];
+    va_list ap;
+
+    va_start(ap, format);
+    vsnprintf(userMsg, STDIO_BUF_SIZE, format, ap);
+    va_end(ap);
+    snprintf(errText, STDIO_BUF_SIZE, ":");
+    snprintf(buf, 3*STDIO_BUF_SIZE, "ERROR%s %s\n", errText, userMsg);
+    fflush(stdout);
+    fputs(buf, stderr);
+    fflush(stderr);
+}
+
+static void * log_lines(void * arg) {
+    errlog_worker * w = arg;
+
+    pthread_barrier_wait(w->start);
+    for (long i = 0; i < w->num_lines; i++) {
+        if (w->path == STDIO) {
+            stdio_line("thread %d line %ld %s", w->index, i, ERRLOG_BENCH_PAYLOAD);
+        } else {
+            errLogEN(0, "thread %d line %ld %s", w->index, i, ERRLOG_BENCH_PAYLOAD);
+        }
+    }
+    return NULL;
+}
+
+static void log_from_handler(int sig) {
+    errLogEN(0, "signal %ld %s", __atomic_fetch_add(&signal_lines, 1, __ATOMIC_RELAXED), ERRLOG_BENCH_PAYLOAD);
+}
+
+/**
+ * Point stderr to filepath, returning a descriptor for the previous one.
+ */
+static int redirect_stderr(const char * filepath) {
+    int saved = dup(STDERR_FILENO);
+    int fd = open(filepath, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, S_IRUSR | S_IWUSR);
+    if (saved == -1 || fd == -1 || dup2(fd, STDERR_FILENO) == -1) {
+        errExit("redirect stderr to %s", filepath);
+    }
+    safe_close(fd);
+    return saved;
+}
+
+static void restore_stderr(int saved) {
+    if (dup2(saved, STDERR_FILENO) == -1) {
+        errExit("dup2");
+    }
+    safe_close(saved);
+}
+
+/**
+ * Log num_lines lines from each of nthreads threads, returning the lines per second, ring drain included.
+ */
+static double log_from_threads(errlog_path path, int nthreads, long num_lines) {
+    pthread_t threads[nthreads];
+    errlog_worker workers[nthreads];
+    pthread_barrier_t start;
+    pthread_barrier_init(&start, NULL, nthreads + 1);
+
+    if (path == RING && errRingStart(ERRLOG_BENCH_RING_SLOTS) == -1) {
+        errExit("errRingStart");
+    }
+    for (int i = 0; i < nthreads; i++) {
+        workers[i] = (errlog_worker) { path, i, num_lines, &start };
+        int s = pthread_create(&threads[i], NULL, log_lines, &workers[i]);
+        if (s != 0) {
+            errExitEN(s, "pthread_create");
+        }
+    }
+
+    pthread_barrier_wait(&start);
+    double begin = bench_now();
+    for (int i = 0; i < nthreads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    if (path == RING) {
+        errRingStop();
+    }
+    double elapsed = bench_now() - begin;
+
+    pthread_barrier_destroy(&start);
+    return nthreads * num_lines / elapsed;
+}
+
+/**
+ * Check that filepath holds every line of log_lines in order for each thread, plus the signal handler's lines,
+ * each of them whole.
+ */
+static void check_lines(const char * filepath, int nthreads, long num_lines, long num_signal_lines) {
+    FILE * f = fopen(filepath, "r");
+    if (f == NULL) {
+        errExit("fopen %s", filepath);
+    }
+
+    long next[nthreads];
+    memset(next, 0, sizeof(next));
+    long seen_signal_lines = 0;
+    char line[ERR_LINE_MAX + 1];
+    while (fgets(line, sizeof(line), f) != NULL) {
+        int index, rest = -1;
+        long i;
+        if (sscanf(line, "ERROR: thread %d line %ld %n", &index, &i, &rest) == 2 && rest != -1 &&
+            index >= 0 && index < nthreads && i == next[index]) {
+            next[index]++;
+        } else if (sscanf(line, "ERROR: signal %ld %n", &i, &rest) == 1 && rest != -1) {
+            seen_signal_lines++;
+        } else {
+            fatal("Garbled or out of order line in %s: %s", filepath, line);
+        }
+        if (strcmp(line + rest, ERRLOG_BENCH_PAYLOAD "\n") != 0) {
+            fatal("Garbled line in %s: %s", filepath, line);
+        }
+    }
+    fclose(f);
+
+    for (int t = 0; t < nthreads; t++) {
+        if (next[t] != num_lines) {
+            fatal("%s has %ld lines from thread %d instead of %ld", filepath, next[t], t, num_lines);
+        }
+    }
+    if (seen_signal_lines != num_signal_lines) {
+        fatal("%s has %ld lines from the signal handler instead of %ld", filepath, seen_signal_lines, num_signal_lines);
+    }
+}
+
+/**
+ * Log from nthreads threads with a timer signal interrupting them to log too, then check the result.
+ */
+static void check_interleaving(errlog_path path, int nthreads, long num_lines) {
+    char filepath[] = "/tmp/errlog-check-XXXXXX";
+    int fd = mkstemp(filepath);
+    if (fd == -1) {
+        errExit("mkstemp");
+    }
+    safe_close(fd);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = log_from_handler;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    struct itimerval timer = { { 0, ERRLOG_BENCH_SIGNAL_US }, { 0, ERRLOG_BENCH_SIGNAL_US } };
+    struct itimerval stop_timer = { { 0, 0 }, { 0, 0 } };
+    if (sigaction(SIGALRM, &sa, NULL) == -1 || setitimer(ITIMER_REAL, &timer, NULL) == -1) {
+        errExit("start SIGALRM timer");
+    }
+
+    signal_lines = 0;
+    int saved = redirect_stderr(filepath);
+    log_from_threads(path, nthreads, num_lines);
+    if (setitimer(ITIMER_REAL, &stop_timer, NULL) == -1) {
+        errExit("setitimer");
+    }
+    signal(SIGALRM, SIG_IGN); // In case one is still pending
+    restore_stderr(saved);
+    signal(SIGALRM, SIG_DFL);
+
+    check_lines(filepath, nthreads, num_lines, signal_lines);
+    printf("%s: %d threads x %ld lines and %ld lines from a signal handler, all whole and in order\n",
+        path == RING ? "ring" : "direct", nthreads, num_lines, signal_lines);
+    if (unlink(filepath) == -1) {
+        errExit("unlink %s", filepath);
+    }
+}
+
+void chpt3_bench_errlog(long num_lines, int nthreads) {
+    static const char * names[] = { "stdio", "direct", "ring" };
+    char name[64];
+
+    int saved = redirect_stderr("/dev/null");
+    double results[2][3];
+    for (errlog_path path = STDIO; path <= RING; path++) {
+        results[0][path] = log_from_threads(path, 1, num_lines);
+        results[1][path] = log_from_threads(path, nthreads, num_lines / nthreads);
+    }
+    restore_stderr(saved);
+
+    for (errlog_path path = STDIO; path <= RING; path++) {
+        snprintf(name, sizeof(name), "errlog/%s/1thread", names[path]);
+        bench_report(name, results[0][path], "lines/s");
+    }
+    for (errlog_path path = STDIO; path <= RING; path++) {
+        snprintf(name, sizeof(name), "errlog/%s/%dthreads", names[path], nthreads);
+        bench_report(name, results[1][path], "lines/s");
+    }
+
+    check_interleaving(DIRECT, nthreads, min(num_lines, ERRLOG_BENCH_CHECK_LINES));
+    check_interleaving(RING, nthreads, min(num_lines, ERRLOG_BENCH_CHECK_LINES));
+}
@@ -0,0 +1,11 @@
+#ifndef __CHPT3_BENCH_ERRLOG_H__
+#define __CHPT3_BENCH_ERRLOG_H__
+
+/**
+ * Compare the cost of an error line through stdio (the old outputError) and through errLog, written directly
+ * or queued on the ring, from one and from nthreads threads. Then check that lines logged by nthreads threads
+ * and by a signal handler interrupting them reach a file whole, in both modes.
+ */
+void chpt3_bench_errlog(long num_lines, int nthreads);
+
+#endif
@@ -0,0 +1,36 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "../shared/errors.h"
+#include "../shared/utils.h"
+#include "bench_errevent.h"
+#include "bench_errlog.h"
+
+void chpt3_run(const char* q, int argc, char* argv[]) {
+    const char * bench_errlog_usage = "chpt3 bench-errlog [NUM LINES] [NUM THREADS]\n";
+    const char * bench_errevent_usage = "chpt3 bench-errevent [NUM EVENTS]\n";
+
+    if (strcmp(q, "bench-errlog") == 0) {
+        long num_lines = 200000;
+        long num_threads = 4;
+        char *parsing_end;
+        if (argc > 1 && ((num_lines = strtol(argv[1], &parsing_end, 10)) <= 0 || *parsing_end != '\0')) {
+            usageErr(bench_errlog_usage);
+        }
+        if (argc > 2 && ((num_threads = strtol(argv[2], &parsing_end, 10)) <= 0 || *parsing_end != '\0')) {
+            usageErr(bench_errlog_usage);
+        }
+
+        chpt3_bench_errlog(num_lines, num_threads);
+    } else if (strcmp(q, "bench-errevent") == 0) {
+        long num_events = 1000000;
+        char *parsing_end;
+        if (argc > 1 && ((num_events = strtol(argv[1], &parsing_end, 10)) <= 0 || *parsing_end != '\0')) {
+            usageErr(bench_errevent_usage);
+        }
+
+        chpt3_bench_errevent(num_events);
+    } else {
+        usageErr("Chapter 3 has no solution for \"%s\"\n", q);
+    }
+}
@@ -0,0 +1,6 @@
+#ifndef __CHPT3_CHPT3_H__
+#define __CHPT3_CHPT3_H__
+
+void chpt3_run(const char* q, int argc, char* args[]);
+
+#endif
@@ -34,11 +34,11 @@ void chpt4_run(const char* q, int argc, char* argv[]) {
         while (idx < argc) {
             if (!filepath_read) {
                 filepath_read = TRUE;
-                strncpy(filepath, argv[idx], Q1_FILEPATH_SZ);
-                if (filepath[Q1_FILEPATH_SZ-1] != '\0') {
+                if (strlen(argv[idx]) >= Q1_FILEPATH_SZ) {
                     fprintf(stderr, "ERROR: FILEPATH over 255 characters\n");
                     usageErr(q1_usage);
                 }
+                strcpy(filepath, argv[idx]);
             } else {
                 fprintf(stderr, "Skipping argument \"%s\"\n", argv[idx]);
             }
@@ -35,12 +35,14 @@ void q2_std(const char* src_file, const char* dst_file) {
 
 	int src_fd = open(src_file, O_RDONLY);
 	if (src_fd == -1) {
+		errEvent("copy.open_failed", errno, EV_STR("src", src_file), EV_STR("dst", dst_file), EV_STR("side", "src"));
 		errExit("Error on src open\n");
 	}
 
 	mode_t dst_creat_permissions = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH;
 	int dst_fd = open(dst_file, O_WRONLY | O_CREAT | O_TRUNC, dst_creat_permissions);
 	if (dst_fd == -1) {
+		errEvent("copy.open_failed", errno, EV_STR("src", src_file), EV_STR("dst", dst_file), EV_STR("side", "dst"));
 		errExit("Error on dst open\n");
 	}
 
@@ -102,6 +104,8 @@ void q2_std(const char* src_file, const char* dst_file) {
 			deliver_write(dst_fd, buffer, nread);
 		}
 		if (nread == -1) {
+			errEvent("copy.read_failed", errno, EV_STR("src", src_file), EV_STR("dst", dst_file),
+				EV_INT("offset", data_begin+read_within_region), EV_INT("region_end", data_end));
 			errExit("Failed to read file between offsets %ld - %ld\n", (long) (data_begin+read_within_region), (long) data_end);
 		}
 	}
@@ -0,0 +1,123 @@
+#define _GNU_SOURCE /* For close_range */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "../shared/bench.h"
+#include "../shared/errors.h"
+#include "../shared/utils.h"
+#include "bench_fdtable.h"
+#include "q4.h"
+
+#define FDTABLE_BENCH_CYCLES 200000
+
+/**
+ * Raise RLIMIT_NOFILE so that descriptors up to max_fds can be opened, raising the hard limit too when allowed
+ * (CAP_SYS_RESOURCE, up to /proc/sys/fs/nr_open). Returns how many descriptors the limit allows.
+ */
+static long raise_nofile(long max_fds) {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == -1) {
+        errExit("getrlimit");
+    }
+    struct rlimit wanted = { max_fds, max(limit.rlim_max, (rlim_t) max_fds) };
+    if (setrlimit(RLIMIT_NOFILE, &wanted) == -1) {
+        // Not privileged: go as far as the hard limit
+        wanted.rlim_cur = wanted.rlim_max = limit.rlim_max;
+        if (setrlimit(RLIMIT_NOFILE, &wanted) == -1) {
+            errExit("setrlimit");
+        }
+    }
+    return wanted.rlim_cur;
+}
+
+/**
+ * Time close(hole) followed by a dup that must find it, with a table full up to top.
+ * With hint, the dup is F_DUPFD with hole as the minimum descriptor, which skips the search below it.
+ */
+static double reuse_ns(int src_fd, int hole, Boolean hint) {
+    double start = bench_now();
+    for (long i = 0; i < FDTABLE_BENCH_CYCLES; i++) {
+        if (close(hole) == -1) {
+            errExit("close");
+        }
+        int fd = hint ? fcntl(src_fd, F_DUPFD, hole) : __dup(src_fd);
+        if (fd != hole) {
+            fatal("Got descriptor %d instead of %d\n", fd, hole);
+        }
+    }
+    return (bench_now() - start) / FDTABLE_BENCH_CYCLES * 1e9;
+}
+
+void chpt5_bench_fdtable(long max_fds) {
+    long limit = raise_nofile(max_fds);
+    if (limit < max_fds) {
+        printf("RLIMIT_NOFILE can't be raised above %ld, stopping there\n", limit);
+    }
+    int src_fd = open("/dev/null", O_RDONLY);
+    if (src_fd == -1) {
+        errExit("open");
+    }
+    char label[64];
+
+    // Grow the table, timing each decade
+    int top = src_fd;
+    for (long stage = 1000; top < limit - 1; stage *= 10) {
+        long target = min(stage, limit - 1);
+        long count = target - top;
+        double start = bench_now();
+        while (top < target) {
+            if ((top = __dup(src_fd)) == -1) {
+                errExit("dup");
+            }
+        }
+        snprintf(label, sizeof(label), "fdtable/dup_growing_to/%ld", target);
+        bench_report(label, (bench_now() - start) / count * 1e9, "ns/dup");
+    }
+
+    // The lowest free descriptor is found with a two level bitmap (full_fds_bits), so even a hole at the top is found quickly
+    snprintf(label, sizeof(label), "fdtable/%d/close+dup/hole_at_bottom", top + 1);
+    bench_report(label, reuse_ns(src_fd, src_fd + 1, FALSE), "ns");
+    snprintf(label, sizeof(label), "fdtable/%d/close+dup/hole_at_top", top + 1);
+    bench_report(label, reuse_ns(src_fd, top, FALSE), "ns");
+    snprintf(label, sizeof(label), "fdtable/%d/close+F_DUPFD(hint)/hole_at_top", top + 1);
+    bench_report(label, reuse_ns(src_fd, top, TRUE), "ns");
+
+    double start = bench_now();
+    for (int fd = src_fd + 1; fd <= top; fd++) {
+        if (close(fd) == -1) {
+            errExit("close");
+        }
+    }
+    snprintf(label, sizeof(label), "fdtable/%d/close_loop", top + 1);
+    bench_report(label, (bench_now() - start) * 1e3, "ms");
+
+    // Same again, with a single close_range
+    for (int fd = src_fd + 1; fd <= top; fd++) {
+        if (__dup(src_fd) == -1) {
+            errExit("dup");
+        }
+    }
+    start = bench_now();
+    if (close_range(src_fd + 1, ~0U, 0) == -1) {
+        errExit("close_range");
+    }
+    snprintf(label, sizeof(label), "fdtable/%d/close_range", top + 1);
+    bench_report(label, (bench_now() - start) * 1e3, "ms");
+
+    // Table already grown: allocation without expansion
+    start = bench_now();
+    for (int fd = src_fd + 1; fd <= top; fd++) {
+        if (__dup(src_fd) == -1) {
+            errExit("dup");
+        }
+    }
+    snprintf(label, sizeof(label), "fdtable/%d/dup_grown_table", top + 1);
+    bench_report(label, (bench_now() - start) / (top - src_fd) * 1e9, "ns/dup");
+    if (close_range(FDTABLE_BENCH_FIRST_FD, ~0U, 0) == -1) {
+        errExit("close_range");
+    }
+}
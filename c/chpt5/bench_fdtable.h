@@ -0,0 +1,12 @@
+#ifndef __CHPT5_BENCH_FDTABLE_H__
+#define __CHPT5_BENCH_FDTABLE_H__
+
+#define FDTABLE_BENCH_FIRST_FD 3 // After stdin, stdout and stderr
+
+/**
+ * Measure descriptor allocation as the descriptor table grows to max_fds entries (RLIMIT_NOFILE is raised for it):
+ * the cost of each dup while the table grows, the search for the lowest free descriptor, and bulk cleanup with close_range.
+ */
+void chpt5_bench_fdtable(long max_fds);
+
+#endif
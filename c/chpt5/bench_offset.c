@@ -0,0 +1,174 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../shared/bench.h"
+#include "../shared/errors.h"
+#include "../shared/utils.h"
+#include "bench_offset.h"
+
+#define OFFSET_BENCH_RECORD_SZ 64
+#define OFFSET_BENCH_LOCK_STAT "/proc/lock_stat"
+
+typedef enum {
+    SHARED_FD,
+    DUP_FDS,
+    PWRITE_FD,
+    OPEN_FDS,
+} offset_case;
+
+typedef struct {
+    offset_case kind;
+    const char * filepath;
+    int shared_fd;
+    int index;
+    long num_writes;
+    pthread_barrier_t * start;
+} offset_worker;
+
+static void * write_records(void * arg) {
+    offset_worker * w = arg;
+    char record[OFFSET_BENCH_RECORD_SZ];
+    memset(record, 'a' + w->index % 26, OFFSET_BENCH_RECORD_SZ - 1);
+    record[OFFSET_BENCH_RECORD_SZ - 1] = '\n';
+    off_t region = (off_t) w->index * w->num_writes * OFFSET_BENCH_RECORD_SZ;
+
+    int fd = w->shared_fd;
+    if (w->kind == DUP_FDS && (fd = dup(w->shared_fd)) == -1) {
+        errExit("dup");
+    } else if (w->kind == OPEN_FDS) {
+        // Own offset: start at our own region, like pwrite
+        if ((fd = open(w->filepath, O_WRONLY)) == -1 || lseek(fd, region, SEEK_SET) == -1) {
+            errExit("open %s", w->filepath);
+        }
+    }
+
+    pthread_barrier_wait(w->start);
+    for (long i = 0; i < w->num_writes; i++) {
+        ssize_t written = w->kind == PWRITE_FD ?
+            pwrite(fd, record, OFFSET_BENCH_RECORD_SZ, region + i * OFFSET_BENCH_RECORD_SZ) :
+            write(fd, record, OFFSET_BENCH_RECORD_SZ);
+        if (written != OFFSET_BENCH_RECORD_SZ) {
+            errExit("write");
+        }
+    }
+
+    if (fd != w->shared_fd) {
+        safe_close(fd);
+    }
+    return NULL;
+}
+
+/**
+ * Clear the kernel lock statistics. Returns FALSE if they aren't available (the kernel needs CONFIG_LOCK_STAT).
+ */
+static Boolean lock_stat_reset() {
+    int fd = open(OFFSET_BENCH_LOCK_STAT, O_WRONLY);
+    if (fd == -1) {
+        return FALSE;
+    }
+    Boolean ok = write(fd, "0", 1) == 1;
+    safe_close(fd);
+    return ok;
+}
+
+/**
+ * Report the contentions of the locks a write to a regular file can wait on.
+ */
+static void lock_stat_report(const char * case_name) {
+    FILE * f = fopen(OFFSET_BENCH_LOCK_STAT, "r");
+    if (f == NULL) {
+        return;
+    }
+    const char * locks[] = { "f_pos_lock", "i_rwsem", "sb_writers" };
+    long contentions[3] = { 0 };
+    char line[512];
+    while (fgets(line, sizeof(line), f) != NULL) {
+        // Class lines look like "  &f->f_pos_lock:  <con-bounces> <contentions> ..."
+        char * colon = strchr(line, ':');
+        for (int i = 0; colon != NULL && i < 3; i++) {
+            long bounces, count;
+            if (strstr(line, locks[i]) != NULL && strstr(line, locks[i]) < colon &&
+                sscanf(colon + 1, "%ld %ld", &bounces, &count) == 2) {
+                contentions[i] += count;
+            }
+        }
+    }
+    fclose(f);
+
+    char label[64];
+    for (int i = 0; i < 3; i++) {
+        snprintf(label, sizeof(label), "offset/%s/%s", case_name, locks[i]);
+        bench_report(label, contentions[i], "contentions");
+    }
+}
+
+static void run_case(const char * name, offset_case kind, const char * filepath, int nthreads, long num_writes, Boolean lock_stat) {
+    int fd = open(filepath, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    if (fd == -1) {
+        errExit("open %s", filepath);
+    }
+    pthread_t * threads = malloc(nthreads * sizeof(pthread_t));
+    offset_worker * workers = malloc(nthreads * sizeof(offset_worker));
+    if (threads == NULL || workers == NULL) {
+        errExit("malloc");
+    }
+    pthread_barrier_t start_barrier;
+    pthread_barrier_init(&start_barrier, NULL, nthreads + 1);
+    for (int i = 0; i < nthreads; i++) {
+        workers[i] = (offset_worker) { kind, filepath, fd, i, num_writes, &start_barrier };
+        if ((errno = pthread_create(&threads[i], NULL, write_records, &workers[i])) != 0) {
+            errExit("pthread_create");
+        }
+    }
+
+    if (lock_stat) {
+        lock_stat_reset();
+    }
+    pthread_barrier_wait(&start_barrier);
+    double start = bench_now();
+    for (int i = 0; i < nthreads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    double elapsed = bench_now() - start;
+
+    char label[64];
+    snprintf(label, sizeof(label), "offset/%s/%dthreads", name, nthreads);
+    bench_report(label, nthreads * num_writes / elapsed, "writes/s");
+    if (lock_stat) {
+        lock_stat_report(name);
+    }
+
+    // Whatever the case, no record may be lost or overwritten
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        errExit("fstat");
+    }
+    if (st.st_size != (off_t) nthreads * num_writes * OFFSET_BENCH_RECORD_SZ) {
+        fatal("%s: file is %lld bytes instead of %lld\n", name, (long long) st.st_size, (long long) nthreads * num_writes * OFFSET_BENCH_RECORD_SZ);
+    }
+
+    pthread_barrier_destroy(&start_barrier);
+    free(workers);
+    free(threads);
+    safe_close(fd);
+}
+
+void chpt5_bench_offset(const char * filepath, int nthreads, long num_writes) {
+    Boolean lock_stat = lock_stat_reset();
+    if (!lock_stat) {
+        printf("%s isn't available (needs CONFIG_LOCK_STAT and root): timing only\n", OFFSET_BENCH_LOCK_STAT);
+    }
+    run_case("shared_fd_write", SHARED_FD, filepath, nthreads, num_writes, lock_stat);
+    run_case("dup_fds_write", DUP_FDS, filepath, nthreads, num_writes, lock_stat);
+    run_case("shared_fd_pwrite", PWRITE_FD, filepath, nthreads, num_writes, lock_stat);
+    run_case("open_fds_write", OPEN_FDS, filepath, nthreads, num_writes, lock_stat);
+    if (unlink(filepath) == -1) {
+        errExit("unlink");
+    }
+}
@@ -0,0 +1,11 @@
+#ifndef __CHPT5_BENCH_OFFSET_H__
+#define __CHPT5_BENCH_OFFSET_H__
+
+/**
+ * Compare nthreads threads writing num_writes records each into filepath through:
+ * one shared descriptor, dup'ed descriptors (same open file, so same offset), pwrite on one descriptor,
+ * and separately opened descriptors. Reports throughput, and kernel lock contention if /proc/lock_stat is available.
+ */
+void chpt5_bench_offset(const char * filepath, int nthreads, long num_writes);
+
+#endif
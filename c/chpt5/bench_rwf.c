@@ -0,0 +1,96 @@
+#define _GNU_SOURCE /* For pwritev2 and the RWF_* flags */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../shared/batchwrite.h"
+#include "../shared/bench.h"
+#include "../shared/errors.h"
+#include "../shared/utils.h"
+#include "bench_rwf.h"
+
+#define RWF_BENCH_RECORD_SZ 64
+#define RWF_BENCH_BATCH 16
+
+static int open_truncated(const char * filepath, int extra_flags) {
+    int fd = open(filepath, O_WRONLY | O_CREAT | O_TRUNC | extra_flags, S_IRUSR | S_IWUSR);
+    if (fd == -1) {
+        errExit("Failed to open %s\n", filepath);
+    }
+    return fd;
+}
+
+/**
+ * Write num_writes records, batch records per syscall, and report the rate.
+ * open_flags == -1 means the case uses batch_pwritev with rwf_flags, otherwise plain writev on a descriptor opened with open_flags.
+ * If sync_every > 0, RWF_DSYNC is added only to every sync_every-th call.
+ */
+static void run_case(const char * name, const char * filepath, long num_writes, int batch, int open_flags, int rwf_flags, int sync_every) {
+    char record[RWF_BENCH_RECORD_SZ];
+    memset(record, 'r', RWF_BENCH_RECORD_SZ - 1);
+    record[RWF_BENCH_RECORD_SZ - 1] = '\n';
+
+    struct iovec iov[RWF_BENCH_BATCH];
+    for (int i = 0; i < batch; i++) {
+        iov[i].iov_base = record;
+        iov[i].iov_len = RWF_BENCH_RECORD_SZ;
+    }
+
+    int fd = open_truncated(filepath, open_flags == -1 ? 0 : open_flags);
+    long nagain = 0;
+    double start = bench_now();
+    long ncalls = 0;
+    for (long i = 0; i < num_writes; i += batch, ncalls++) {
+        int call_flags = rwf_flags;
+        if (sync_every > 0 && ncalls % sync_every == sync_every - 1) {
+            call_flags |= RWF_DSYNC;
+        }
+        ssize_t nwritten = (open_flags == -1) ?
+            batch_pwritev(fd, iov, batch, -1, call_flags) :
+            writev(fd, iov, batch);
+        if (nwritten == -1) {
+            if (errno == EAGAIN) {
+                // RWF_NOWAIT refused to block. Count it and move on.
+                nagain++;
+                continue;
+            }
+            errExit("%s: write failed\n", name);
+        }
+    }
+    double elapsed = bench_now() - start;
+    safe_close(fd);
+
+    char label[64];
+    snprintf(label, sizeof(label), "rwf/%s", name);
+    bench_report(label, num_writes / elapsed, "records/s");
+    if (nagain > 0) {
+        snprintf(label, sizeof(label), "rwf/%s/eagain", name);
+        bench_report(label, nagain, "calls");
+    }
+}
+
+void chpt5_bench_rwf(const char * filepath, long num_writes) {
+    run_case("write", filepath, num_writes, 1, 0, 0, 0);
+    run_case("O_APPEND", filepath, num_writes, 1, O_APPEND, 0, 0);
+    run_case("RWF_APPEND", filepath, num_writes, 1, -1, RWF_APPEND, 0);
+    run_case("O_DSYNC", filepath, num_writes, 1, O_DSYNC, 0, 0);
+    run_case("RWF_DSYNC", filepath, num_writes, 1, -1, RWF_DSYNC, 0);
+    run_case("RWF_APPEND|RWF_DSYNC", filepath, num_writes, 1, -1, RWF_APPEND | RWF_DSYNC, 0);
+    //
+    // Per-call flags pay off when only some writes need to be durable (e.g. a commit record),
+    // or when many records can share one synced call.
+    // O_DSYNC can't express either: every write on the descriptor is synced.
+    //
+    run_case("RWF_DSYNC_1in16", filepath, num_writes, 1, -1, 0, RWF_BENCH_BATCH);
+    run_case("O_DSYNC_batch16", filepath, num_writes, RWF_BENCH_BATCH, O_DSYNC, 0, 0);
+    run_case("RWF_DSYNC_batch16", filepath, num_writes, RWF_BENCH_BATCH, -1, RWF_DSYNC, 0);
+    run_case("RWF_NOWAIT", filepath, num_writes, 1, -1, RWF_NOWAIT, 0);
+    run_case("RWF_HIPRI", filepath, num_writes, 1, -1, RWF_HIPRI, 0);
+
+    if (unlink(filepath) == -1) {
+        errExit("Failed to remove %s\n", filepath);
+    }
+}
@@ -0,0 +1,10 @@
+#ifndef __CHPT5_BENCH_RWF_H__
+#define __CHPT5_BENCH_RWF_H__
+
+/**
+ * Compare the open-time O_APPEND/O_DSYNC flags with the per-call RWF_* flags of pwritev2.
+ * Each case writes num_writes records into filepath, which is truncated in between cases.
+ */
+void chpt5_bench_rwf(const char * filepath, long num_writes);
+
+#endif
@@ -11,10 +11,21 @@
 #include "q5.h"
 #include "q6.h"
 #include "q7.h"
+#include "bench_fdtable.h"
+#include "bench_offset.h"
+#include "bench_rwf.h"
+#include "sparsegen.h"
 
 void chpt5_run(const char* q, int argc, char* argv[]) {
     const char * q1_usage = "chpt5 q1 <FILEPATH (255)> <OFFSET>\n";
-    const char * q3_usage = "chpt5 q3 <FILEPATH (255)> <NUM BYTES> [x]\n";
+    const char * q3_usage = "chpt5 q3 <FILEPATH (255)> <NUM BYTES> [x] [b]\n";
+    const char * bench_rwf_usage = "chpt5 bench-rwf <FILEPATH> [NUM WRITES]\n";
+    const char * bench_fdtable_usage = "chpt5 bench-fdtable [MAX FDS]\n";
+    const char * bench_offset_usage = "chpt5 bench-offset <FILEPATH> [NUM THREADS] [NUM WRITES]\n";
+    const char * sparsegen_usage = "chpt5 sparsegen <FILEPATH> <SIZE> [holes=RATIO] [extent=SIZE] [align=SIZE] "
+        "[layout=periodic|random] [pattern=zero|random|compressible] [threads=N] [seed=N] [manifest=FILEPATH]\n"
+        "SIZE takes a K, M, G or T suffix\n";
+    const char * sparse_verify_usage = "chpt5 sparse-verify <FILEPATH> <MANIFEST>\n";
 
     #define Q1_FILEPATH_SZ 256
     char filepath[Q1_FILEPATH_SZ] = "";
@@ -24,10 +35,10 @@ void chpt5_run(const char* q, int argc, char* argv[]) {
             usageErr(q1_usage);
         }
 
-        strncpy(filepath, argv[1], Q1_FILEPATH_SZ);
-        if (filepath[Q1_FILEPATH_SZ-1] != '\0') {
+        if (strlen(argv[1]) >= Q1_FILEPATH_SZ) {
             usageErr(q1_usage);
         }
+        strcpy(filepath, argv[1]);
 
         char *parsing_end;
         long long offset = strtoll(argv[2], &parsing_end, 10);
@@ -46,10 +57,10 @@ void chpt5_run(const char* q, int argc, char* argv[]) {
             usageErr(q3_usage);
         }
 
-        strncpy(filepath, argv[1], Q1_FILEPATH_SZ);
-        if (filepath[Q1_FILEPATH_SZ-1] != '\0') {
+        if (strlen(argv[1]) >= Q1_FILEPATH_SZ) {
             usageErr(q3_usage);
         }
+        strcpy(filepath, argv[1]);
 
         char *parsing_end;
         long num_bytes = strtol(argv[2], &parsing_end, 10);
@@ -59,7 +70,17 @@ void chpt5_run(const char* q, int argc, char* argv[]) {
             errExit("ERROR: Number of bytes %ld is nonpositive\n", num_bytes);
         }
 
-        chpt5_q3(filepath, num_bytes, argc < 4);
+        Boolean append = TRUE;
+        Boolean buffered = FALSE;
+        for (int i = 3; i < argc; i++) {
+            if (strcmp(argv[i], "b") == 0) {
+                buffered = TRUE;
+            } else {
+                append = FALSE;
+            }
+        }
+
+        chpt5_q3(filepath, num_bytes, append, buffered);
 
     } else if (cmp_question(q, 4)) {
         chpt5_q4();
@@ -69,6 +90,110 @@ void chpt5_run(const char* q, int argc, char* argv[]) {
         chpt5_q6();
     } else if (cmp_question(q, 7)) {
         chpt5_q7();
+    } else if (strcmp(q, "bench-rwf") == 0) {
+        if (argc < 2) {
+            usageErr(bench_rwf_usage);
+        }
+
+        long num_writes = 10000;
+        if (argc > 2) {
+            char *parsing_end;
+            num_writes = strtol(argv[2], &parsing_end, 10);
+            if (*parsing_end != '\0' || num_writes <= 0) {
+                usageErr(bench_rwf_usage);
+            }
+        }
+
+        chpt5_bench_rwf(argv[1], num_writes);
+    } else if (strcmp(q, "bench-fdtable") == 0) {
+        long max_fds = 1 << 20;
+        if (argc > 1) {
+            char *parsing_end;
+            max_fds = strtol(argv[1], &parsing_end, 10);
+            if (*parsing_end != '\0' || max_fds <= FDTABLE_BENCH_FIRST_FD) {
+                usageErr(bench_fdtable_usage);
+            }
+        }
+
+        chpt5_bench_fdtable(max_fds);
+    } else if (strcmp(q, "bench-offset") == 0) {
+        if (argc < 2) {
+            usageErr(bench_offset_usage);
+        }
+
+        long num_threads = 4;
+        long num_writes = 100000;
+        char *parsing_end;
+        if (argc > 2 && ((num_threads = strtol(argv[2], &parsing_end, 10)) <= 0 || *parsing_end != '\0')) {
+            usageErr(bench_offset_usage);
+        }
+        if (argc > 3 && ((num_writes = strtol(argv[3], &parsing_end, 10)) <= 0 || *parsing_end != '\0')) {
+            usageErr(bench_offset_usage);
+        }
+
+        chpt5_bench_offset(argv[1], num_threads, num_writes);
+    } else if (strcmp(q, "sparsegen") == 0) {
+        if (argc < 3) {
+            usageErr(sparsegen_usage);
+        }
+
+        sparse_spec spec = { sparse_parse_size(argv[2]), 0.9, 1 << 20, 4096, SPARSE_PERIODIC, SPARSE_RANDOM_DATA, 4, 1 };
+        char manifest[Q1_FILEPATH_SZ + 16] = ""; // FILEPATH.manifest unless given
+        for (int i = 3; i < argc; i++) {
+            char *value = strchr(argv[i], '=');
+            char *parsing_end = "";
+            if (value == NULL) {
+                usageErr(sparsegen_usage);
+            }
+            *value++ = '\0';
+            if (strcmp(argv[i], "holes") == 0) {
+                spec.hole_ratio = strtod(value, &parsing_end);
+            } else if (strcmp(argv[i], "extent") == 0) {
+                spec.extent_sz = sparse_parse_size(value);
+            } else if (strcmp(argv[i], "align") == 0) {
+                spec.alignment = sparse_parse_size(value);
+            } else if (strcmp(argv[i], "layout") == 0 && strcmp(value, "periodic") == 0) {
+                spec.layout = SPARSE_PERIODIC;
+            } else if (strcmp(argv[i], "layout") == 0 && strcmp(value, "random") == 0) {
+                spec.layout = SPARSE_RANDOM;
+            } else if (strcmp(argv[i], "pattern") == 0 && strcmp(value, "zero") == 0) {
+                spec.pattern = SPARSE_ZERO;
+            } else if (strcmp(argv[i], "pattern") == 0 && strcmp(value, "random") == 0) {
+                spec.pattern = SPARSE_RANDOM_DATA;
+            } else if (strcmp(argv[i], "pattern") == 0 && strcmp(value, "compressible") == 0) {
+                spec.pattern = SPARSE_COMPRESSIBLE;
+            } else if (strcmp(argv[i], "threads") == 0) {
+                spec.nthreads = strtol(value, &parsing_end, 10);
+            } else if (strcmp(argv[i], "seed") == 0) {
+                spec.seed = strtoull(value, &parsing_end, 10);
+            } else if (strcmp(argv[i], "manifest") == 0) {
+                if (snprintf(manifest, sizeof(manifest), "%s", value) >= (int) sizeof(manifest)) {
+                    usageErr(sparsegen_usage);
+                }
+            } else {
+                usageErr(sparsegen_usage);
+            }
+            if (*parsing_end != '\0') {
+                usageErr(sparsegen_usage);
+            }
+        }
+        if (manifest[0] == '\0' && snprintf(manifest, sizeof(manifest), "%s.manifest", argv[1]) >= (int) sizeof(manifest)) {
+            usageErr(sparsegen_usage);
+        }
+        if (spec.size <= 0 || spec.extent_sz <= 0 || spec.alignment <= 0 || spec.alignment % 512 != 0 ||
+            spec.hole_ratio < 0 || spec.hole_ratio >= 1 || spec.nthreads <= 0) {
+            usageErr(sparsegen_usage);
+        }
+
+        sparse_generate(argv[1], &spec, manifest);
+    } else if (strcmp(q, "sparse-verify") == 0) {
+        if (argc != 3) {
+            usageErr(sparse_verify_usage);
+        }
+        if (!sparse_verify(argv[1], argv[2])) {
+            exit(EXIT_FAILURE);
+        }
+        printf("%s matches %s\n", argv[1], argv[2]);
     } else {
         usageErr("Chapter 5 has no solution for \"%s\"\n", q);
     }
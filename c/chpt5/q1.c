@@ -24,4 +24,6 @@ void chpt5_q1(const char* filepath, long long offset) {
 
     if (write(fd, "test", 4) == -1)
         errExit("write");
+
+    safe_close(fd);
 }
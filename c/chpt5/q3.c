@@ -1,11 +1,14 @@
 #include <fcntl.h>
 #include <unistd.h>
 
+#include "../shared/bufwriter.h"
 #include "../shared/errors.h"
 #include "../shared/utils.h"
 #include "q3.h"
 
-void chpt5_q3(const char * filepath, long num_bytes, Boolean append) {
+#define Q3_BUFFER_SZ 4096
+
+void chpt5_q3(const char * filepath, long num_bytes, Boolean append, Boolean buffered) {
     int open_flags = O_WRONLY | O_CREAT | (append ? O_APPEND : 0);
     mode_t create_flags = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH;
     int fd = open(filepath, open_flags, create_flags);
@@ -14,12 +17,29 @@ void chpt5_q3(const char * filepath, long num_bytes, Boolean append) {
     }
 
     const char data[] = "a";
-    while (num_bytes > 0) {
-        if (!append && lseek(fd, 0, SEEK_END) == -1) {
-            errExit("Error at lseek after writing %d bytes.\n", num_bytes);
+    if (buffered) {
+        //
+        // Without O_APPEND we can only seek the end right before a buffer starts filling,
+        // so the race window grows from one byte to a whole buffer.
+        //
+        buffered_writer bw;
+        bw_init(&bw, fd, Q3_BUFFER_SZ);
+        while (num_bytes > 0) {
+            if (!append && bw.pending == 0 && lseek(fd, 0, SEEK_END) == -1) {
+                errExit("Error at lseek with %ld bytes left.\n", num_bytes);
+            }
+            bw_write(&bw, data, 1);
+            num_bytes--;
+        }
+        bw_destroy(&bw);
+    } else {
+        while (num_bytes > 0) {
+            if (!append && lseek(fd, 0, SEEK_END) == -1) {
+                errExit("Error at lseek with %ld bytes left.\n", num_bytes);
+            }
+            deliver_write(fd, data, 1);
+            num_bytes--;
         }
-        deliver_write(fd, data, 1);
-        num_bytes--;
     }
 
     safe_close(fd);
@@ -3,6 +3,10 @@
 
 #include "../shared/utils.h"
 
-void chpt5_q3(const char * filepath, long num_bytes, Boolean append);
+/**
+ * Write num_bytes to filepath one byte at a time.
+ * If buffered, bytes go through a buffered_writer instead of one write(2) each.
+ */
+void chpt5_q3(const char * filepath, long num_bytes, Boolean append, Boolean buffered);
 
 #endif
\ No newline at end of file
@@ -1,4 +1,4 @@
-#define _GNU_SOURCE /* For the O_PATH flag */
+#define _GNU_SOURCE /* For the O_PATH flag and dup3 */
 
 #include <assert.h>
 #include <errno.h>
@@ -9,15 +9,6 @@
 #include "../shared/errors.h"
 #include "q4.h"
 
-/**
- * My implementation of the dup(2) syscall.
- */
-int __dup(int old_fd);
-/**
- * My implementation of the dup2(2) syscall.
- */
-int __dup2(int old_fd, int newfd);
-
 void chpt5_q4() {
     int tmp_fd = open("/tmp", O_RDWR | O_TMPFILE);
     int tmp_fd_flags = fcntl(tmp_fd, F_GETFL);
@@ -30,6 +21,10 @@ void chpt5_q4() {
     assert(__dup(1) == 5);
     assert(__dup(2) == 6);
     assert(__dup(tmp_fd) == 7);
+    assert(!(fcntl(7, F_GETFD) & FD_CLOEXEC));
+    assert(__dup_cloexec(tmp_fd) == 8 && (fcntl(8, F_GETFD) & FD_CLOEXEC));
+    assert(__dup_cloexec(-1) == -1 && errno == EBADF);
+    close(8);
     
     //
     // dup2(int, int)
@@ -38,56 +33,63 @@ void chpt5_q4() {
     assert(__dup2(0, 8) == 8); // Normal behavior
     assert(__dup2(8, 8) == 8); // If old_fd is valid and old_fd == new_fd, just return the descriptor
     assert(__dup2(8, -1) == -1 && errno == EBADF); // If new_fd is invalid, set EBADF error
+    assert(__dup2(8, 1 << 30) == -1 && errno == EBADF); // Past the limit on descriptors too
     assert(__dup2(-1, tmp_fd) == -1 && errno == EBADF && fcntl(tmp_fd, F_GETFL) == tmp_fd_flags); // If old_fd is invalid, don't close new_fd
     assert(__dup2(0, tmp_fd) == tmp_fd && fcntl(tmp_fd, F_GETFL) != tmp_fd_flags); // If new_fd is already open, close new_fd before duplication. File status flags should be different for new fd.
+
+    //
+    // dup3(int, int, int)
+    //
+    assert(__dup3(0, 9, O_CLOEXEC) == 9 && (fcntl(9, F_GETFD) & FD_CLOEXEC));
+    assert(__dup3(0, 9, 0) == 9 && !(fcntl(9, F_GETFD) & FD_CLOEXEC)); // Replaces 9, without the flag this time
+    assert(__dup3(9, 9, 0) == -1 && errno == EINVAL); // Unlike dup2, equal descriptors are an error
+    assert(__dup3(0, 10, O_APPEND) == -1 && errno == EINVAL && fcntl(10, F_GETFD) == -1); // Only O_CLOEXEC is allowed
+    assert(__dup3(-1, 10, 0) == -1 && errno == EBADF);
+    assert(__dup2(9, 9) == 9 && !(fcntl(9, F_GETFD) & FD_CLOEXEC));
 }
 
 int __dup(int old_fd) {
-    if (fcntl(old_fd, F_GETFD) == -1) {
-        if (errno == EBADF) {
-            return -1;
-        } else {
-            errExit("Failed to get descriptor status for old_fd=%d", old_fd);
-        }
-    }
+    // F_DUPFD fails with EBADF itself: no need to check old_fd first
     return fcntl(old_fd, F_DUPFD, 0);
 }
 
-/**
- * Note: this is not done atomically.
- */
+int __dup_cloexec(int old_fd) {
+    return fcntl(old_fd, F_DUPFD_CLOEXEC, 0);
+}
+
 int __dup2(int old_fd, int new_fd) {
+    // F_GETFD checks old_fd before new_fd gets closed: if old_fd is invalid new_fd must stay open
     if (fcntl(old_fd, F_GETFD) == -1) {
-        if (errno == EBADF) {
-            return -1;
-        }
-        // Unexpected error.
-        errExit("Failed to get descriptor status for old_fd=%d", old_fd);
+        return -1;
     }
-
     if (old_fd == new_fd) {
-        // Descriptors are equal, do nothing, return them.
         return old_fd;
     }
-
-    if (fcntl(new_fd, F_GETFD) != -1) {
-        // new_fd is already open.
-        // close it silently. Don't report errors.
-        close(new_fd);
-    } else if (errno != EBADF) {
-        // Unexpected error
-        errExit("Failed to get descriptor status for new_fd=%d", new_fd);
+    if (new_fd < 0) {
+        errno = EBADF;
+        return -1;
     }
 
-    if (fcntl(old_fd, F_DUPFD, new_fd) == -1) {
+    // Silently, like dup2. Fails with EBADF if new_fd wasn't open, which is fine.
+    close(new_fd);
+    // Not atomic: another thread may take new_fd right after the close, and F_DUPFD then returns a higher descriptor
+    int fd = fcntl(old_fd, F_DUPFD, new_fd);
+    if (fd == -1) {
         if (errno == EINVAL) {
-            // new_fd is an invalid value for a descriptor
+            // new_fd is past the limit on descriptors
             errno = EBADF;
-            return -1;
         }
-        // Unexpected error.
-        errExit("Failed to duplicate descriptor from %d to %d", old_fd, new_fd);
+        return -1;
     }
+    if (fd != new_fd) {
+        // Lost the race. dup2 fails with EBUSY when it loses the same one inside the kernel
+        close(fd);
+        errno = EBUSY;
+        return -1;
+    }
+    return fd;
+}
 
-    return new_fd;
-}
\ No newline at end of file
+int __dup3(int old_fd, int new_fd, int flags) {
+    return dup3(old_fd, new_fd, flags);
+}
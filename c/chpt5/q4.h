@@ -1,7 +1,30 @@
 #ifndef __CHPT5_Q4_H__
 #define __CHPT5_Q4_H__
 
-
 void chpt5_q4();
 
+/**
+ * My implementation of the dup(2) syscall. One fcntl(F_DUPFD) call.
+ */
+int __dup(int old_fd);
+
+/**
+ * Same as __dup, with the close-on-exec flag set on the new descriptor.
+ */
+int __dup_cloexec(int old_fd);
+
+/**
+ * My implementation of the dup2(2) syscall, with fcntl and close as the exercise asks.
+ * Not atomic: closing new_fd and duplicating into it are two syscalls, and if another thread takes new_fd in between,
+ * it fails with EBUSY. Use __dup3 when descriptors are opened concurrently.
+ */
+int __dup2(int old_fd, int new_fd);
+
+/**
+ * A thin wrapper over the dup3(2) syscall, for the atomic duplication __dup2 can't do from user space:
+ * the kernel closes new_fd and duplicates into it under the descriptor table lock.
+ * Flags are O_CLOEXEC or 0, and old_fd == new_fd is an error (EINVAL).
+ */
+int __dup3(int old_fd, int new_fd, int flags);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,347 @@
+#define _GNU_SOURCE /* For SEEK_DATA, SEEK_HOLE and fallocate */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../shared/bufwriter.h"
+#include "../shared/errors.h"
+#include "sparsegen.h"
+
+#define SPARSE_CHUNK_SZ (1 << 20) // Extents are generated and checked this many bytes at a time
+#define SPARSE_CHECKSUM_BASIS 14695981039346656037ull
+
+typedef struct {
+    off_t offset;
+    off_t length;
+    uint64_t checksum; // Of the content, 0 for zero extents
+} sparse_extent;
+
+static const char * pattern_names[] = { "zero", "random", "compressible" };
+
+static uint64_t mix64(uint64_t x) {
+    // splitmix64 finalizer
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ull;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+/**
+ * Content of the file from offset to offset + len. Both multiples of 8.
+ */
+static void fill_pattern(uint64_t * words, size_t len, off_t offset, sparse_pattern pattern, uint64_t seed) {
+    uint64_t first = offset / 8;
+    for (size_t i = 0; i < len / 8; i++) {
+        uint64_t word = first + i;
+        if (pattern == SPARSE_RANDOM_DATA) {
+            words[i] = mix64(seed ^ (word * 0x9e3779b97f4a7c15ull));
+        } else if (word % 8 == 0) {
+            words[i] = word * 8; // Offset of the record
+        } else {
+            memcpy(&words[i], "sparse  ", 8);
+        }
+    }
+}
+
+/**
+ * Checksum chunks of content in order, 8 bytes at a time (FNV-1a style on words).
+ */
+static uint64_t checksum_update(uint64_t checksum, const uint64_t * words, size_t len) {
+    for (size_t i = 0; i < len / 8; i++) {
+        checksum = (checksum ^ words[i]) * 1099511628211ull;
+    }
+    return checksum;
+}
+
+//
+// Layout
+//
+
+static off_t align_down(off_t n, off_t alignment) {
+    return n / alignment * alignment;
+}
+
+/**
+ * Place the extents: the file is split in periods of equal length, each holding one extent.
+ * Returns the extents, and their count in *nextents.
+ */
+static sparse_extent * plan_extents(const sparse_spec * spec, size_t * nextents) {
+    off_t data = spec->size - (off_t) (spec->size * spec->hole_ratio);
+    off_t extent_sz = max(align_down(spec->extent_sz, spec->alignment), spec->alignment);
+    size_t n = max(data / extent_sz, (off_t) 1);
+    off_t period = align_down(spec->size / n, spec->alignment);
+    if (period < extent_sz) {
+        fatal("%lld bytes can't hold %zu extents of %lld bytes\n", (long long) spec->size, n, (long long) extent_sz);
+    }
+
+    sparse_extent * extents = malloc(n * sizeof(sparse_extent));
+    if (extents == NULL) {
+        errExit("malloc");
+    }
+    uint64_t state = spec->seed;
+    for (size_t i = 0; i < n; i++) {
+        off_t start = (off_t) i * period;
+        off_t length = extent_sz;
+        if (spec->layout == SPARSE_RANDOM) {
+            // Length in [extent_sz / 2, 3 * extent_sz / 2], anywhere within the period
+            state = mix64(state + i);
+            length = max(align_down(extent_sz / 2 + (off_t) (state % (uint64_t) (extent_sz + 1)), spec->alignment), spec->alignment);
+            length = min(length, period);
+            start += align_down((off_t) (mix64(state) % (uint64_t) (period - length + 1)), spec->alignment);
+        }
+        extents[i].offset = start;
+        extents[i].length = length;
+        extents[i].checksum = 0;
+    }
+    *nextents = n;
+    return extents;
+}
+
+//
+// Writing
+//
+
+typedef struct {
+    int fd;
+    const sparse_spec * spec;
+    sparse_extent * extents;
+    size_t nextents;
+    int index; // This worker writes extents index, index + nthreads, ...
+} sparse_worker;
+
+static void * write_extents(void * arg) {
+    sparse_worker * w = arg;
+    const sparse_spec * spec = w->spec;
+    uint64_t * chunk = NULL;
+    if (spec->pattern != SPARSE_ZERO && (chunk = malloc(SPARSE_CHUNK_SZ)) == NULL) {
+        errExit("malloc");
+    }
+
+    for (size_t i = w->index; i < w->nextents; i += spec->nthreads) {
+        sparse_extent * e = &w->extents[i];
+        if (spec->pattern == SPARSE_ZERO) {
+            // Allocated but unwritten: reads as zeroes, without writing a byte
+            if (fallocate(w->fd, 0, e->offset, e->length) == -1) {
+                errExit("fallocate %lld+%lld", (long long) e->offset, (long long) e->length);
+            }
+            continue;
+        }
+        uint64_t checksum = SPARSE_CHECKSUM_BASIS;
+        for (off_t done = 0; done < e->length; ) {
+            size_t len = min(e->length - done, (off_t) SPARSE_CHUNK_SZ);
+            fill_pattern(chunk, len, e->offset + done, spec->pattern, spec->seed);
+            checksum = checksum_update(checksum, chunk, len);
+            ssize_t written = pwrite(w->fd, chunk, len, e->offset + done);
+            if (written <= 0) {
+                errExit("pwrite at %lld", (long long) (e->offset + done));
+            }
+            done += written;
+            if ((size_t) written < len) {
+                // Short write: the checksum must be recomputed from here
+                fatal("Short write at %lld\n", (long long) (e->offset + done));
+            }
+        }
+        e->checksum = checksum;
+    }
+
+    free(chunk);
+    return NULL;
+}
+
+static void write_manifest(const char * manifest_path, const sparse_spec * spec, const sparse_extent * extents, size_t nextents) {
+    int fd = open(manifest_path, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (fd == -1) {
+        errExit("open %s", manifest_path);
+    }
+    buffered_writer bw;
+    bw_init(&bw, fd, 1 << 16);
+    off_t data = 0;
+    for (size_t i = 0; i < nextents; i++) {
+        data += extents[i].length;
+    }
+
+    char line[128];
+    int len = snprintf(line, sizeof(line), "# sparsegen %d\nsize %lld\npattern %s\nseed %" PRIu64 "\nextents %zu\ndata %lld\n",
+        SPARSE_MANIFEST_VERSION, (long long) spec->size, pattern_names[spec->pattern], spec->seed, nextents, (long long) data);
+    bw_write(&bw, line, len);
+    for (size_t i = 0; i < nextents; i++) {
+        len = snprintf(line, sizeof(line), "extent %lld %lld %016" PRIx64 "\n",
+            (long long) extents[i].offset, (long long) extents[i].length, extents[i].checksum);
+        bw_write(&bw, line, len);
+    }
+    bw_destroy(&bw);
+    safe_close(fd);
+}
+
+void sparse_generate(const char * path, const sparse_spec * spec, const char * manifest_path) {
+    if (spec->alignment <= 0 || spec->alignment % 512 != 0 || spec->hole_ratio < 0 || spec->hole_ratio >= 1 ||
+        spec->size <= 0 || spec->extent_sz <= 0 || spec->nthreads <= 0) {
+        fatal("Invalid sparse file specification\n");
+    }
+    size_t nextents;
+    sparse_extent * extents = plan_extents(spec, &nextents);
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (fd == -1) {
+        errExit("open %s", path);
+    }
+    // A file of the full size that's all hole, then extents are filled in
+    if (ftruncate(fd, spec->size) == -1) {
+        errExit("ftruncate %s to %lld", path, (long long) spec->size);
+    }
+
+    pthread_t * threads = malloc(spec->nthreads * sizeof(pthread_t));
+    sparse_worker * workers = malloc(spec->nthreads * sizeof(sparse_worker));
+    if (threads == NULL || workers == NULL) {
+        errExit("malloc");
+    }
+    for (int i = 0; i < spec->nthreads; i++) {
+        workers[i] = (sparse_worker) { fd, spec, extents, nextents, i };
+        if ((errno = pthread_create(&threads[i], NULL, write_extents, &workers[i])) != 0) {
+            errExit("pthread_create");
+        }
+    }
+    for (int i = 0; i < spec->nthreads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    safe_close(fd);
+
+    write_manifest(manifest_path, spec, extents, nextents);
+    free(workers);
+    free(threads);
+    free(extents);
+}
+
+//
+// Verification
+//
+
+static Boolean check_extent(int fd, const sparse_extent * e, sparse_pattern pattern, uint64_t * chunk) {
+    if (pattern == SPARSE_ZERO) {
+        // Sample the first and last blocks
+        off_t samples[] = { e->offset, e->offset + e->length - min(e->length, (off_t) 4096) };
+        for (int s = 0; s < 2; s++) {
+            size_t len = min(e->length, (off_t) 4096);
+            if (pread(fd, chunk, len, samples[s]) != (ssize_t) len) {
+                return FALSE;
+            }
+            for (size_t i = 0; i < len / 8; i++) {
+                if (chunk[i] != 0) {
+                    return FALSE;
+                }
+            }
+        }
+        return TRUE;
+    }
+
+    uint64_t checksum = SPARSE_CHECKSUM_BASIS;
+    for (off_t done = 0; done < e->length; ) {
+        size_t len = min(e->length - done, (off_t) SPARSE_CHUNK_SZ);
+        ssize_t nread = pread(fd, chunk, len, e->offset + done);
+        if (nread != (ssize_t) len) {
+            return FALSE;
+        }
+        checksum = checksum_update(checksum, chunk, len);
+        done += len;
+    }
+    return checksum == e->checksum;
+}
+
+Boolean sparse_verify(const char * path, const char * manifest_path) {
+    FILE * manifest = fopen(manifest_path, "r");
+    if (manifest == NULL) {
+        errExit("fopen %s", manifest_path);
+    }
+    int version;
+    long long size, data;
+    char pattern_name[32];
+    uint64_t seed;
+    size_t nextents;
+    if (fscanf(manifest, "# sparsegen %d size %lld pattern %31s seed %" SCNu64 " extents %zu data %lld",
+            &version, &size, pattern_name, &seed, &nextents, &data) != 6 || version != SPARSE_MANIFEST_VERSION) {
+        fatal("%s isn't a sparsegen manifest\n", manifest_path);
+    }
+    sparse_pattern pattern = SPARSE_ZERO;
+    while (pattern <= SPARSE_COMPRESSIBLE && strcmp(pattern_names[pattern], pattern_name) != 0) {
+        pattern++;
+    }
+    if (pattern > SPARSE_COMPRESSIBLE) {
+        fprintf(stderr, "%s: unknown pattern %s\n", manifest_path, pattern_name);
+        fclose(manifest);
+        return FALSE;
+    }
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        errExit("open %s", path);
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        errExit("fstat");
+    }
+    Boolean ok = TRUE;
+    if (st.st_size != size) {
+        fprintf(stderr, "%s: size is %lld instead of %lld\n", path, (long long) st.st_size, size);
+        ok = FALSE;
+    }
+
+    uint64_t * chunk = malloc(SPARSE_CHUNK_SZ);
+    if (chunk == NULL) {
+        errExit("malloc");
+    }
+    off_t block = st.st_blksize;
+    off_t hole_start = 0; // End of the previous extent, rounded up to a block
+    for (size_t i = 0; i <= nextents; i++) {
+        sparse_extent e = { size, 0, 0 }; // Past the last extent, check the trailing hole
+        if (i < nextents) {
+            if (fscanf(manifest, " extent %lld %lld %" SCNx64, (long long *) &e.offset, (long long *) &e.length, &e.checksum) != 3) {
+                fatal("%s: truncated manifest\n", manifest_path);
+            }
+            if (!check_extent(fd, &e, pattern, chunk)) {
+                fprintf(stderr, "%s: extent %lld+%lld differs\n", path, (long long) e.offset, (long long) e.length);
+                ok = FALSE;
+            }
+        }
+
+        // There must be no data between the previous extent and this one, give or take a block
+        off_t hole_end = i < nextents ? align_down(e.offset, block) : e.offset;
+        off_t data_start = hole_start < hole_end ? lseek(fd, hole_start, SEEK_DATA) : -1;
+        if (data_start != -1 && data_start < hole_end) {
+            fprintf(stderr, "%s: data at %lld, in the hole between %lld and %lld\n",
+                path, (long long) data_start, (long long) hole_start, (long long) hole_end);
+            ok = FALSE;
+        }
+        hole_start = (e.offset + e.length + block - 1) / block * block;
+    }
+
+    free(chunk);
+    safe_close(fd);
+    fclose(manifest);
+    return ok;
+}
+
+off_t sparse_parse_size(const char * s) {
+    char * end;
+    long long n = strtoll(s, &end, 10);
+    const char * suffixes = "KMGT";
+    const char * suffix = *end != '\0' ? strchr(suffixes, *end) : NULL;
+    if (n < 0 || end == s || (*end != '\0' && (suffix == NULL || end[1] != '\0'))) {
+        return -1;
+    }
+    for (int shift = suffix != NULL ? (suffix - suffixes + 1) * 10 : 0; shift > 0; shift -= 10) {
+        if (n > (LLONG_MAX >> 10)) {
+            return -1;
+        }
+        n <<= 10;
+    }
+    return n;
+}
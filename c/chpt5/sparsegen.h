@@ -0,0 +1,59 @@
+#ifndef __CHPT5_SPARSEGEN_H__
+#define __CHPT5_SPARSEGEN_H__
+
+#include <stdint.h>
+#include <sys/types.h> /* For off_t */
+
+#include "../shared/utils.h"
+
+/**
+ * Generator of large sparse files with a known layout of data extents and holes, to test sparse copies at scale.
+ *
+ * Extents are written in parallel, and their content is a function of the seed and of the file offset only,
+ * so any extent can be regenerated or checked on its own. The generator writes a manifest listing every extent
+ * with a checksum of its content, which sparse_verify checks a file (e.g. a copy) against.
+ */
+
+typedef enum {
+    SPARSE_PERIODIC, // One extent at the start of each period
+    SPARSE_RANDOM, // One extent of random length at a random place within each period
+} sparse_layout;
+
+typedef enum {
+    SPARSE_ZERO, // Allocated with fallocate, never written: instant, whatever the size
+    SPARSE_RANDOM_DATA, // Incompressible
+    SPARSE_COMPRESSIBLE, // 64 byte records of repeated text and their offset
+} sparse_pattern;
+
+typedef struct {
+    off_t size;
+    double hole_ratio; // Target fraction of size left in holes, in [0, 1)
+    off_t extent_sz; // Mean length of data extents
+    off_t alignment; // Extent offsets and lengths are multiples of it. A multiple of 512.
+    sparse_layout layout;
+    sparse_pattern pattern;
+    int nthreads;
+    uint64_t seed;
+} sparse_spec;
+
+#define SPARSE_MANIFEST_VERSION 1
+
+/**
+ * Create the file at path as described by spec, and its manifest at manifest_path.
+ */
+void sparse_generate(const char * path, const sparse_spec * spec, const char * manifest_path);
+
+/**
+ * Check the file at path against a manifest: its size, the checksum of every data extent, and that data
+ * (as reported by SEEK_DATA/SEEK_HOLE, rounded to the file system block) only lies within extents, so holes stayed holes.
+ * Zero extents are checked by sampling their first and last blocks only, since they can be terabytes.
+ * Prints every mismatch on stderr. Returns whether the file matches.
+ */
+Boolean sparse_verify(const char * path, const char * manifest_path);
+
+/**
+ * Parse a size with an optional K, M, G or T suffix (powers of 1024). Returns -1 if it isn't one.
+ */
+off_t sparse_parse_size(const char * s);
+
+#endif
@@ -0,0 +1,71 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../shared/bench.h"
+#include "../shared/errors.h"
+#include "bench_env.h"
+#include "envindex.h"
+#include "q3.h"
+
+#define BENCH_ENV_NAME_SZ 40
+#define BENCH_ENV_LOOKUP_ROUNDS 10
+
+static void bench_env_mode(const char * mode, char (*names)[BENCH_ENV_NAME_SZ], long num_vars) {
+    char label[64];
+    double start;
+
+    start = bench_now();
+    for (long i = 0; i < num_vars; i++) {
+        if (__setenv(names[i], "initial-value", 1) == -1) {
+            errExit("__setenv");
+        }
+    }
+    snprintf(label, sizeof(label), "env/%s/set", mode);
+    bench_report(label, num_vars / (bench_now() - start), "ops/s");
+
+    start = bench_now();
+    for (int round = 0; round < BENCH_ENV_LOOKUP_ROUNDS; round++) {
+        for (long i = 0; i < num_vars; i++) {
+            if (__getenv(names[i]) == NULL) {
+                fatal("%s is missing from the environment\n", names[i]);
+            }
+        }
+    }
+    snprintf(label, sizeof(label), "env/%s/get", mode);
+    bench_report(label, BENCH_ENV_LOOKUP_ROUNDS * num_vars / (bench_now() - start), "ops/s");
+
+    start = bench_now();
+    for (long i = 0; i < num_vars; i++) {
+        if (__setenv(names[i], "overwritten-value", 1) == -1) {
+            errExit("__setenv");
+        }
+    }
+    snprintf(label, sizeof(label), "env/%s/overwrite", mode);
+    bench_report(label, num_vars / (bench_now() - start), "ops/s");
+
+    start = bench_now();
+    for (long i = 0; i < num_vars; i++) {
+        if (__unsetenv(names[i]) == -1) {
+            errExit("__unsetenv");
+        }
+    }
+    snprintf(label, sizeof(label), "env/%s/unset", mode);
+    bench_report(label, num_vars / (bench_now() - start), "ops/s");
+}
+
+void chpt6_bench_env(long num_vars) {
+    char (*names)[BENCH_ENV_NAME_SZ] = malloc(num_vars * BENCH_ENV_NAME_SZ);
+    if (names == NULL) {
+        errExit("malloc");
+    }
+    for (long i = 0; i < num_vars; i++) {
+        snprintf(names[i], BENCH_ENV_NAME_SZ, "BENCH_ENV_VARIABLE_%ld", i);
+    }
+
+    bench_env_mode("linear", names, num_vars);
+    envidx_enable();
+    bench_env_mode("indexed", names, num_vars);
+    envidx_disable();
+
+    free(names);
+}
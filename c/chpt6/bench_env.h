@@ -0,0 +1,9 @@
+#ifndef __CHPT6_BENCH_ENV_H__
+#define __CHPT6_BENCH_ENV_H__
+
+/**
+ * Set, look up, overwrite and unset num_vars variables with and without the environment hash index.
+ */
+void chpt6_bench_env(long num_vars);
+
+#endif
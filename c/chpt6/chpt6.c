@@ -1,14 +1,38 @@
+#include <stdlib.h>
+#include <string.h>
 
 #include "../shared/errors.h"
 #include "../shared/utils.h"
 #include "q2.h"
 #include "q3.h"
+#include "bench_env.h"
+#include "stress_env.h"
 
 void chpt6_run(const char* q, int argc, char* args[]) {
     if (cmp_question(q, 2)) {
         chpt6_q2();
     } else if (cmp_question(q, 3)) {
         chpt6_q3();
+    } else if (strcmp(q, "bench-env") == 0) {
+        long num_vars = 10000;
+        if (argc > 1) {
+            char * end_ptr;
+            num_vars = strtol(args[1], &end_ptr, 10);
+            if (*end_ptr != '\0' || num_vars <= 0) {
+                usageErr("chpt6 bench-env [NUM VARIABLES]\n");
+            }
+        }
+        chpt6_bench_env(num_vars);
+    } else if (strcmp(q, "stress-env") == 0) {
+        long num_overwrites = 10000000;
+        if (argc > 1) {
+            char * end_ptr;
+            num_overwrites = strtol(args[1], &end_ptr, 10);
+            if (*end_ptr != '\0' || num_overwrites <= 0) {
+                usageErr("chpt6 stress-env [NUM OVERWRITES]\n");
+            }
+        }
+        chpt6_stress_env(num_overwrites);
     } else {
         usageErr("Chapter 6 has no solution for \"%s\"\n", q);
     }
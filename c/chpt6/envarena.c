@@ -0,0 +1,101 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "envarena.h"
+
+extern char ** environ;
+
+//
+// Every string is preceded by its capacity, so released bytes can be accounted for and reused.
+// Blocks are kept aligned to the header.
+//
+typedef uint32_t envarena_header;
+#define ENVARENA_HEADER_SZ sizeof(envarena_header)
+#define ENVARENA_ALIGN(n) (((n) + ENVARENA_HEADER_SZ - 1) & ~(ENVARENA_HEADER_SZ - 1))
+#define ENVARENA_MIN_CAPACITY 4096
+
+static char * arena = NULL;
+static size_t arena_capacity = 0;
+static size_t arena_used = 0;
+static size_t arena_released = 0;
+static unsigned long arena_compactions = 0;
+
+#define HEADER_OF(string) ((envarena_header *) ((string) - ENVARENA_HEADER_SZ))
+
+Boolean envarena_owns(const char * string) {
+    return arena != NULL && string >= arena && string < arena + arena_used;
+}
+
+size_t envarena_capacity(const char * string) {
+    return *HEADER_OF(string);
+}
+
+/**
+ * Copy the arena strings referenced by environ into a new buffer able to hold them plus extra bytes.
+ * The old buffer is left for the caller to free, in *retired.
+ */
+static int compact(size_t extra, char ** retired) {
+    size_t live = 0;
+    for (char ** ep = environ; ep != NULL && *ep != NULL; ep++) {
+        if (envarena_owns(*ep)) {
+            live += ENVARENA_HEADER_SZ + *HEADER_OF(*ep);
+        }
+    }
+
+    size_t capacity = max(2 * (live + extra), (size_t) ENVARENA_MIN_CAPACITY);
+    char * new_arena = malloc(capacity);
+    if (new_arena == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    size_t used = 0;
+    for (char ** ep = environ; ep != NULL && *ep != NULL; ep++) {
+        if (envarena_owns(*ep)) {
+            size_t block_sz = ENVARENA_HEADER_SZ + *HEADER_OF(*ep);
+            memcpy(new_arena + used, HEADER_OF(*ep), block_sz);
+            *ep = new_arena + used + ENVARENA_HEADER_SZ;
+            used += block_sz;
+        }
+    }
+
+    *retired = arena;
+    arena = new_arena;
+    arena_capacity = capacity;
+    arena_used = used;
+    arena_released = 0;
+    arena_compactions++;
+    return 0;
+}
+
+char * envarena_alloc(size_t nbytes, char ** retired) {
+    *retired = NULL;
+    size_t block_sz = ENVARENA_HEADER_SZ + ENVARENA_ALIGN(nbytes);
+    if (block_sz > UINT32_MAX) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    if (arena_used + block_sz > arena_capacity && compact(block_sz, retired) == -1) {
+        return NULL;
+    }
+
+    envarena_header * header = (envarena_header *) (arena + arena_used);
+    *header = block_sz - ENVARENA_HEADER_SZ;
+    arena_used += block_sz;
+    return (char *) header + ENVARENA_HEADER_SZ;
+}
+
+void envarena_release(char * string) {
+    if (string != NULL && envarena_owns(string)) {
+        arena_released += ENVARENA_HEADER_SZ + *HEADER_OF(string);
+    }
+}
+
+void envarena_get_stats(envarena_stats * stats) {
+    stats->capacity = arena_capacity;
+    stats->used = arena_used;
+    stats->released = arena_released;
+    stats->compactions = arena_compactions;
+}
@@ -0,0 +1,51 @@
+#ifndef __CHPT6_ENVARENA_H__
+#define __CHPT6_ENVARENA_H__
+
+#include <stddef.h> /* For size_t */
+
+#include "../shared/utils.h"
+
+/**
+ * Arena holding the "name=value" strings created by __setenv.
+ *
+ * Strings are bump-allocated from one buffer, each prefixed by its capacity.
+ * A string replaced or removed from the environment is released, and its bytes are reclaimed by compaction:
+ * when the arena fills up, the strings still referenced by environ are copied into a new buffer (twice the live size)
+ * and environ is repointed. Strings no longer referenced by environ are dropped even if nobody released them.
+ *
+ * NOTE: This means pointers returned by getenv for arena strings are only valid until the next __setenv/__unsetenv call.
+ */
+
+/**
+ * Return storage for a string of nbytes (including the terminating null byte), NULL and errno = ENOMEM on failure.
+ * Might compact the arena, which moves all arena strings referenced by environ. The old buffer is then handed back in
+ * *retired rather than freed, as the caller may still be reading strings from it (a value from getenv, say):
+ * free(*retired) once done. *retired is NULL when the arena didn't move.
+ */
+char * envarena_alloc(size_t nbytes, char ** retired);
+
+/**
+ * Whether string was allocated by the arena.
+ */
+Boolean envarena_owns(const char * string);
+
+/**
+ * Number of bytes string can hold, including the terminating null byte. string must be owned by the arena.
+ */
+size_t envarena_capacity(const char * string);
+
+/**
+ * Mark string as no longer part of the environment. Strings not owned by the arena are ignored.
+ */
+void envarena_release(char * string);
+
+typedef struct {
+    size_t capacity; // Size of the arena buffer.
+    size_t used; // Bytes handed out since the last compaction.
+    size_t released; // Bytes of used released since the last compaction.
+    unsigned long compactions;
+} envarena_stats;
+
+void envarena_get_stats(envarena_stats * stats);
+
+#endif
@@ -0,0 +1,251 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../shared/errors.h"
+#include "envindex.h"
+
+extern char ** environ;
+
+typedef struct {
+    uint32_t hash; // Cached hash of the name, so probing and deletion don't rescan strings.
+    uint32_t env_pos; // Position in env_array + 1. 0 marks an empty slot.
+} envidx_slot;
+
+static Boolean enabled = FALSE;
+
+static char ** env_array = NULL; // Array owned by the index. environ == env_array while the index is fresh.
+static size_t env_count = 0;
+static size_t env_capacity = 0; // Not counting the NULL terminator.
+static size_t env_duplicates = 0; // Entries whose name is already at an earlier position, so not indexed.
+
+static envidx_slot * slots = NULL;
+static size_t slots_mask = 0; // Number of slots - 1. Number of slots is a power of 2.
+
+#define ENVIDX_MIN_SLOTS 64
+
+static uint32_t name_hash(const char * name, size_t name_len) {
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < name_len; i++) {
+        hash ^= (unsigned char) name[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static size_t env_name_len(const char * env_string) {
+    const char * eq = strchr(env_string, '=');
+    return eq == NULL ? strlen(env_string) : (size_t) (eq - env_string);
+}
+
+static Boolean name_matches(const char * env_string, const char * name, size_t name_len) {
+    return strncmp(env_string, name, name_len) == 0 && env_string[name_len] == '=';
+}
+
+/**
+ * Find the slot holding name, or the empty slot where it would be inserted.
+ */
+static size_t probe(const char * name, size_t name_len, uint32_t hash) {
+    size_t i = hash & slots_mask;
+    while (slots[i].env_pos != 0) {
+        if (slots[i].hash == hash && name_matches(env_array[slots[i].env_pos - 1], name, name_len)) {
+            break;
+        }
+        i = (i + 1) & slots_mask;
+    }
+    return i;
+}
+
+static void rehash(size_t nslots) {
+    free(slots);
+    slots = calloc(nslots, sizeof(envidx_slot));
+    if (slots == NULL) {
+        errExit("calloc");
+    }
+    slots_mask = nslots - 1;
+    env_duplicates = 0;
+    for (size_t pos = 0; pos < env_count; pos++) {
+        size_t name_len = env_name_len(env_array[pos]);
+        uint32_t hash = name_hash(env_array[pos], name_len);
+        size_t i = probe(env_array[pos], name_len, hash);
+        if (slots[i].env_pos == 0) {
+            slots[i].hash = hash;
+            slots[i].env_pos = pos + 1;
+        } else {
+            // Duplicate name in environ. getenv only sees the first one, so do we.
+            env_duplicates++;
+        }
+    }
+}
+
+static size_t slots_for(size_t count) {
+    size_t nslots = ENVIDX_MIN_SLOTS;
+    while (nslots < 2 * count) { // Keep load factor under 1/2
+        nslots *= 2;
+    }
+    return nslots;
+}
+
+/**
+ * Take ownership of the current environ: copy it into env_array and index it.
+ */
+static void rebuild() {
+    size_t count = 0;
+    while (environ != NULL && environ[count] != NULL) {
+        count++;
+    }
+    size_t capacity = max(count * 2, (size_t) 16);
+    char ** array = malloc((capacity + 1) * sizeof(char *));
+    if (array == NULL) {
+        errExit("malloc");
+    }
+    if (count > 0) {
+        memcpy(array, environ, count * sizeof(char *));
+    }
+    array[count] = NULL;
+
+    //
+    // Whether environ was replaced or env_array shrunk in place, the copy replaces env_array.
+    //
+    free(env_array);
+    env_array = array;
+    env_count = count;
+    env_capacity = capacity;
+    environ = env_array;
+
+    rehash(slots_for(count));
+}
+
+/**
+ * Rebuild the index if environ was changed behind our back.
+ */
+static void ensure_fresh() {
+    if (environ != env_array ||
+        env_array[env_count] != NULL ||
+        (env_count > 0 && env_array[env_count - 1] == NULL)) {
+        rebuild();
+    }
+}
+
+void envidx_enable() {
+    if (!enabled) {
+        enabled = TRUE;
+        rebuild();
+    }
+}
+
+void envidx_disable() {
+    enabled = FALSE;
+    free(slots);
+    slots = NULL;
+    // env_array stays alive as environ points to it.
+}
+
+Boolean envidx_enabled() {
+    return enabled;
+}
+
+char * envidx_get(const char * name, size_t name_len) {
+    ensure_fresh();
+    size_t i = probe(name, name_len, name_hash(name, name_len));
+    return slots[i].env_pos == 0 ? NULL : env_array[slots[i].env_pos - 1];
+}
+
+char * envidx_put(char * string, size_t name_len, Boolean * inserted) {
+    ensure_fresh();
+    *inserted = FALSE;
+    uint32_t hash = name_hash(string, name_len);
+    size_t i = probe(string, name_len, hash);
+    if (slots[i].env_pos != 0) {
+        // Replace in place
+        char ** entry = &env_array[slots[i].env_pos - 1];
+        char * replaced = *entry;
+        *entry = string;
+        *inserted = TRUE;
+        return replaced;
+    }
+
+    if (env_count == env_capacity) {
+        char ** array = realloc(env_array, (2 * env_capacity + 1) * sizeof(char *));
+        if (array == NULL) {
+            errno = ENOMEM;
+            return NULL;
+        }
+        env_array = environ = array;
+        env_capacity *= 2;
+    }
+    env_array[env_count] = string;
+    env_array[env_count + 1] = NULL;
+    env_count++;
+    slots[i].hash = hash;
+    slots[i].env_pos = env_count;
+    *inserted = TRUE;
+
+    if (2 * env_count > slots_mask + 1) {
+        rehash(2 * (slots_mask + 1));
+    }
+    return NULL;
+}
+
+char * envidx_remove(const char * name, size_t name_len) {
+    ensure_fresh();
+    size_t i = probe(name, name_len, name_hash(name, name_len));
+    if (slots[i].env_pos == 0) {
+        return NULL;
+    }
+    size_t pos = slots[i].env_pos - 1;
+    size_t last = env_count - 1;
+    char * removed = env_array[pos];
+
+    if (env_duplicates > 0) {
+        //
+        // environ came with duplicate names. Like unsetenv, remove every entry with this one, and keep the order
+        // of the others: moving the last entry into the gap could put a duplicate before the entry getenv sees.
+        // Then index the list again. O(n), but only until the duplicates are gone.
+        //
+        size_t kept = 0;
+        for (size_t k = 0; k < env_count; k++) {
+            if (!name_matches(env_array[k], name, name_len)) {
+                env_array[kept++] = env_array[k];
+            }
+        }
+        env_array[kept] = NULL;
+        env_count = kept;
+        rehash(slots_mask + 1);
+        return removed;
+    }
+
+    //
+    // Backward shift deletion: pull later entries of the probe sequence into the hole,
+    // as long as that doesn't move them before their home slot.
+    //
+    size_t hole = i;
+    size_t j = (i + 1) & slots_mask;
+    while (slots[j].env_pos != 0) {
+        size_t home = slots[j].hash & slots_mask;
+        Boolean movable = (hole <= j) ? (home <= hole || home > j) : (home <= hole && home > j);
+        if (movable) {
+            slots[hole] = slots[j];
+            hole = j;
+        }
+        j = (j + 1) & slots_mask;
+    }
+    slots[hole].env_pos = 0;
+
+    if (pos != last) {
+        // The last entry fills the gap in env_array. Point its slot to the new position.
+        size_t last_name_len = env_name_len(env_array[last]);
+        size_t k = probe(env_array[last], last_name_len, name_hash(env_array[last], last_name_len));
+        if (slots[k].env_pos == last + 1) {
+            slots[k].env_pos = pos + 1;
+        }
+        // else: the last entry is a duplicate name that isn't indexed.
+        env_array[pos] = env_array[last];
+    }
+    env_array[last] = NULL;
+    env_count--;
+
+    return removed;
+}
@@ -0,0 +1,47 @@
+#ifndef __CHPT6_ENVINDEX_H__
+#define __CHPT6_ENVINDEX_H__
+
+#include <stddef.h> /* For size_t */
+
+#include "../shared/utils.h"
+
+/**
+ * Optional hash index over the environment list.
+ *
+ * While enabled, environ points to an array owned by the index, so that new variables can be appended
+ * and removed in O(1). The index maps a name to its position in that array (open addressing, linear probing).
+ * environ is always a valid NULL terminated list, so it can be passed to execve as is.
+ *
+ * If someone else replaces environ (e.g. libc's setenv/putenv) or shrinks it in place (libc's unsetenv),
+ * the index notices on the next call and is rebuilt from the current environ.
+ */
+void envidx_enable();
+
+/**
+ * Stop using the index. environ is left pointing to the current list.
+ */
+void envidx_disable();
+
+Boolean envidx_enabled();
+
+/**
+ * Return the "name=value" string for the name_len bytes of name, or NULL if not set.
+ */
+char * envidx_get(const char * name, size_t name_len);
+
+/**
+ * Insert string ("name=value", name being its first name_len bytes), or replace the string with the same name.
+ * Returns the replaced string, NULL if the name was new. Sets *inserted when the string was placed.
+ * Returns NULL with *inserted unset and errno = ENOMEM if the list can't grow.
+ */
+char * envidx_put(char * string, size_t name_len, Boolean * inserted);
+
+/**
+ * Remove the variable named by the name_len bytes of name and return its string, NULL if not set.
+ * If environ had duplicates of the name, they are removed too, and the string returned is the first one's.
+ * NOTE: The list order is not maintained. The last entry takes the place of the removed one,
+ * unless environ has duplicate names.
+ */
+char * envidx_remove(const char * name, size_t name_len);
+
+#endif
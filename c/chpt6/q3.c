@@ -4,13 +4,12 @@
 #include <string.h>
 #include <stdio.h>
 
+#include "envarena.h"
+#include "envindex.h"
 #include "q3.h"
 
 extern char** environ;
 
-int __setenv(const char * name, const char * value, int overwrite);
-int __unsetenv(const char * name);
-
 //
 // For debugging 
 //
@@ -51,6 +50,78 @@ void chpt6_q3() {
     assert(__unsetenv("OLDPWD") == 0 && getenv("OLDPWD") == NULL);
     printf("\nAfter unsetenv:\n\n");
     printenv();
+    //
+    // Same operations through the hash index
+    //
+    envidx_enable();
+    assert(__setenv("SHELL", "/bin/bash", 0) == 0 && strcmp(__getenv("SHELL"), "/bin/sh") == 0);
+    assert(__setenv("SHELL", "/bin/bash", 1) == 0 && strcmp(__getenv("SHELL"), "/bin/bash") == 0 && strcmp(getenv("SHELL"), "/bin/bash") == 0);
+    assert(__setenv("MY_INDEXED_ENV_VARIABLE", "1", 0) == 0 && strcmp(getenv("MY_INDEXED_ENV_VARIABLE"), "1") == 0);
+    assert(__setenv("MY_INDEXED_ENV_VARIABLE_2", NULL, 0) == 0 && strcmp(__getenv("MY_INDEXED_ENV_VARIABLE_2"), "") == 0);
+    assert(__unsetenv("MY_INDEXED_ENV_VARIABLE") == 0 && __getenv("MY_INDEXED_ENV_VARIABLE") == NULL && getenv("MY_INDEXED_ENV_VARIABLE") == NULL);
+    assert(__unsetenv("MY_INDEXED_ENV_VARIABLE") == 0);
+    assert(strcmp(__getenv("MY_INDEXED_ENV_VARIABLE_2"), "") == 0);
+    // Changes made by libc replace environ. The index must pick them up.
+    assert(setenv("MY_LIBC_ENV_VARIABLE", "libc", 1) == 0 && strcmp(__getenv("MY_LIBC_ENV_VARIABLE"), "libc") == 0);
+    assert(__unsetenv("MY_LIBC_ENV_VARIABLE") == 0 && getenv("MY_LIBC_ENV_VARIABLE") == NULL);
+    assert(unsetenv("MY_INDEXED_ENV_VARIABLE_2") == 0 && __getenv("MY_INDEXED_ENV_VARIABLE_2") == NULL);
+    //
+    // A value read from the arena stays valid while the arena compacts to make room for its copy.
+    //
+    envarena_stats stats;
+    envarena_get_stats(&stats);
+    unsigned long compactions = stats.compactions;
+    assert(__setenv("MY_SOURCE_ENV_VARIABLE", "copied over and over, across a compaction of the arena", 1) == 0);
+    for (int i = 0; stats.compactions == compactions; i++) {
+        char name[64];
+        snprintf(name, sizeof(name), "MY_COPIED_ENV_VARIABLE_%d", i);
+        assert(__setenv(name, getenv("MY_SOURCE_ENV_VARIABLE"), 1) == 0);
+        assert(strcmp(__getenv(name), "copied over and over, across a compaction of the arena") == 0);
+        assert(__unsetenv(name) == 0);
+        envarena_get_stats(&stats);
+    }
+    //
+    // The new value may be a suffix of the old one, rewritten in place.
+    //
+    assert(__setenv("MY_SOURCE_ENV_VARIABLE", __getenv("MY_SOURCE_ENV_VARIABLE") + strlen("copied over and "), 1) == 0);
+    assert(strcmp(__getenv("MY_SOURCE_ENV_VARIABLE"), "over, across a compaction of the arena") == 0);
+    assert(__unsetenv("MY_SOURCE_ENV_VARIABLE") == 0);
+
+    //
+    // environ built elsewhere can hold duplicate names. unsetenv removes all of them, and must not move the
+    // second MY_DUP_ENV_VARIABLE_B in front of the first one, which is the one getenv sees.
+    //
+    size_t env_len = 0;
+    while (environ[env_len] != NULL) env_len++;
+    char ** dup_env = malloc((env_len + 5) * sizeof(char *));
+    assert(dup_env != NULL);
+    dup_env[0] = "MY_DUP_ENV_VARIABLE_A=first";
+    dup_env[1] = "MY_DUP_ENV_VARIABLE_B=first";
+    memcpy(dup_env + 2, environ, env_len * sizeof(char *));
+    dup_env[env_len + 2] = "MY_DUP_ENV_VARIABLE_A=second";
+    dup_env[env_len + 3] = "MY_DUP_ENV_VARIABLE_B=second";
+    dup_env[env_len + 4] = NULL;
+    environ = dup_env;
+    assert(strcmp(__getenv("MY_DUP_ENV_VARIABLE_A"), "first") == 0); // the index now holds its own copy
+    free(dup_env);
+    assert(__unsetenv("MY_DUP_ENV_VARIABLE_A") == 0);
+    assert(__getenv("MY_DUP_ENV_VARIABLE_A") == NULL && getenv("MY_DUP_ENV_VARIABLE_A") == NULL);
+    assert(strcmp(__getenv("MY_DUP_ENV_VARIABLE_B"), "first") == 0);
+    assert(strcmp(getenv("MY_DUP_ENV_VARIABLE_B"), "first") == 0);
+    assert(__unsetenv("MY_DUP_ENV_VARIABLE_B") == 0);
+    assert(__getenv("MY_DUP_ENV_VARIABLE_B") == NULL && getenv("MY_DUP_ENV_VARIABLE_B") == NULL);
+    envidx_disable();
+    printf("\nAfter indexed setenv/unsetenv:\n\n");
+    printenv();
+}
+
+char * __getenv(const char * name) {
+    if (!envidx_enabled()) {
+        return getenv(name);
+    }
+    size_t name_len = strlen(name);
+    char * env_string = envidx_get(name, name_len);
+    return env_string == NULL ? NULL : env_string + name_len + 1;
 }
 
 int __setenv(const char * name, const char * value, int overwrite) {
@@ -66,14 +137,41 @@ int __setenv(const char * name, const char * value, int overwrite) {
         }
     }
 
-    if (!overwrite && getenv(name) != NULL) {
+    char * old_env_string;
+    if (envidx_enabled()) {
+        old_env_string = envidx_get(name, name_len);
+    } else {
+        char * old_value = getenv(name);
+        old_env_string = old_value == NULL ? NULL : old_value - name_len - 1;
+    }
+
+    if (!overwrite && old_env_string != NULL) {
         // Variable exists and we must not overwrite
         return 0;
     }
 
     size_t value_len = value == NULL ? 0 : strlen(value);
+    size_t env_string_sz = name_len + 1 + value_len + 1; // <name>=<value> string
+
+    if (old_env_string != NULL && envarena_owns(old_env_string) && envarena_capacity(old_env_string) >= env_string_sz) {
+        //
+        // We created the current string and the new value fits in it. Reuse it, it's already in the list.
+        //
+        if (value) {
+            memmove(old_env_string + name_len + 1, value, value_len + 1); // value may be a suffix of the old one
+        } else {
+            old_env_string[name_len + 1] = '\0';
+        }
+        return 0;
+    }
+
+    //
+    // The old string is about to leave the list. Release it before allocating, since allocating might move it.
+    //
+    envarena_release(old_env_string);
 
-    char * new_env_buffer = (char *) malloc(name_len + 1 + value_len + 1); // <name>=<value> string
+    char * retired_arena;
+    char * new_env_buffer = envarena_alloc(env_string_sz, &retired_arena);
     if (new_env_buffer == NULL) {
         errno = ENOMEM;
         return -1;
@@ -86,12 +184,23 @@ int __setenv(const char * name, const char * value, int overwrite) {
     } else {
         new_env_buffer[name_len + 1] = '\0';
     }
+    //
+    // name and value may point into the arena from before a compaction: only free it once they're copied.
+    //
+    free(retired_arena);
 
     //
     // Note that if there is an environment string already, existing pointers to it won't break
-    // but will become outdated - the string they point to is not part of the environment list anymore.
+    // until the arena reclaims it, but will become outdated - the string they point to is not part of the environment list anymore.
+    // An unused new_env_buffer is reclaimed by the arena as well.
     //
-    if (putenv(new_env_buffer) != 0) {
+    if (envidx_enabled()) {
+        Boolean inserted;
+        envidx_put(new_env_buffer, name_len, &inserted);
+        if (!inserted) {
+            return -1;
+        }
+    } else if (putenv(new_env_buffer) != 0) {
         return -1;
     }
 
@@ -114,6 +223,11 @@ int __unsetenv(const char * name) {
         }
     }
 
+    if (envidx_enabled()) {
+        envarena_release(envidx_remove(name, name_len));
+        return 0;
+    }
+
     char ** env_ptr = environ;
     char ** env_var_found = NULL;
 
@@ -131,6 +245,7 @@ int __unsetenv(const char * name) {
     }
 
     if (env_var_found) {
+        envarena_release(*env_var_found);
         // Find last variable of environment list
         while (*(env_ptr+1) != NULL) {
             env_ptr++;
@@ -3,4 +3,11 @@
 
 void chpt6_q3();
 
+int __setenv(const char * name, const char * value, int overwrite);
+int __unsetenv(const char * name);
+/**
+ * getenv that goes through the hash index when it is enabled (see envindex.h).
+ */
+char * __getenv(const char * name);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,63 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#include "../shared/errors.h"
+#include "envarena.h"
+#include "envindex.h"
+#include "q3.h"
+#include "stress_env.h"
+
+#define STRESS_ENV_NUM_VARS 64
+#define STRESS_ENV_MAX_VALUE_SZ 64
+#define STRESS_ENV_WARMUP 100000
+#define STRESS_ENV_MAX_GROWTH_KB 4096
+
+static long max_rss_kb() {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == -1) {
+        errExit("getrusage");
+    }
+    return usage.ru_maxrss;
+}
+
+static void overwrite_loop(long from, long to) {
+    char name[32], value[STRESS_ENV_MAX_VALUE_SZ];
+    memset(value, 'v', STRESS_ENV_MAX_VALUE_SZ);
+    for (long i = from; i < to; i++) {
+        snprintf(name, sizeof(name), "STRESS_ENV_VARIABLE_%ld", i % STRESS_ENV_NUM_VARS);
+        // Values of varying lengths, so strings can't always be reused in place
+        size_t value_len = (i / STRESS_ENV_NUM_VARS * 13) % STRESS_ENV_MAX_VALUE_SZ;
+        value[value_len] = '\0';
+        assert(__setenv(name, value, 1) == 0);
+        value[value_len] = 'v';
+    }
+}
+
+static void stress(const char * mode, long num_overwrites) {
+    overwrite_loop(0, STRESS_ENV_WARMUP);
+    long rss_before = max_rss_kb();
+    overwrite_loop(STRESS_ENV_WARMUP, num_overwrites);
+    long rss_after = max_rss_kb();
+
+    envarena_stats stats;
+    envarena_get_stats(&stats);
+    printf("%s: %ld overwrites, max RSS %ld KB -> %ld KB, arena %zu bytes, %lu compactions\n",
+        mode, num_overwrites, rss_before, rss_after, stats.capacity, stats.compactions);
+    assert(rss_after - rss_before <= STRESS_ENV_MAX_GROWTH_KB);
+}
+
+void chpt6_stress_env(long num_overwrites) {
+    stress("putenv", num_overwrites);
+    envidx_enable();
+    stress("indexed", num_overwrites);
+    envidx_disable();
+
+    char name[32];
+    for (int i = 0; i < STRESS_ENV_NUM_VARS; i++) {
+        snprintf(name, sizeof(name), "STRESS_ENV_VARIABLE_%d", i);
+        assert(__unsetenv(name) == 0 && getenv(name) == NULL);
+    }
+}
@@ -0,0 +1,10 @@
+#ifndef __CHPT6_STRESS_ENV_H__
+#define __CHPT6_STRESS_ENV_H__
+
+/**
+ * Overwrite a few variables num_overwrites times through __setenv, with and without the hash index,
+ * and assert the process' memory stays bounded.
+ */
+void chpt6_stress_env(long num_overwrites);
+
+#endif
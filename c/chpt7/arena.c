@@ -0,0 +1,111 @@
+#include <errno.h>
+#include <stdint.h>
+
+#include "../shared/utils.h"
+#include "q2.h"
+#include "arena.h"
+
+/**
+ * Header of each __malloc block the arena allocates from, followed by size bytes.
+ */
+struct arena_chunk {
+    arena_chunk * next;
+    size_t size;
+};
+
+static char * chunk_start(arena_chunk * chunk) {
+    return (char *) (chunk + 1);
+}
+
+static char * align_ptr(char * p, size_t align) {
+    return (char *) (((uintptr_t) p + align - 1) & ~(uintptr_t) (align - 1));
+}
+
+void arena_init(arena * a, size_t chunk_size) {
+    *a = (arena) {
+        .chunk_size = chunk_size == 0 ? ARENA_DEFAULT_CHUNK_SZ : chunk_size,
+    };
+}
+
+void arena_destroy(arena * a) {
+    arena_chunk * chunk = a->first;
+    while (chunk != NULL) {
+        arena_chunk * next = chunk->next;
+        __free(chunk);
+        chunk = next;
+    }
+    arena_init(a, a->chunk_size);
+}
+
+/**
+ * Move on to the chunk after the current one, or to a new one if it's missing or too small, then allocate from it.
+ */
+static void * arena_alloc_chunk(arena * a, size_t size, size_t align) {
+    arena_chunk * chunk = a->current == NULL ? a->first : a->current->next;
+    if (size > SIZE_MAX - sizeof(arena_chunk) - align) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    //
+    // __malloc blocks have no particular alignment, so make room to align the first allocation.
+    //
+    size_t needed = size + align - 1;
+    if (chunk == NULL || chunk->size < needed) {
+        //
+        // A chunk too small to reuse now stays right after the new one, for the next allocations.
+        //
+        size_t chunk_size = max(a->chunk_size, needed);
+        arena_chunk * new_chunk = __malloc(sizeof(arena_chunk) + chunk_size);
+        if (new_chunk == NULL) {
+            errno = ENOMEM;
+            return NULL;
+        }
+        new_chunk->size = chunk_size;
+        new_chunk->next = chunk;
+        if (a->current == NULL) {
+            a->first = new_chunk;
+        } else {
+            a->current->next = new_chunk;
+        }
+        a->heap_bytes += sizeof(arena_chunk) + chunk_size;
+        chunk = new_chunk;
+    }
+
+    a->current = chunk;
+    char * p = align_ptr(chunk_start(chunk), align);
+    a->next = p + size;
+    a->end = chunk_start(chunk) + chunk->size;
+    return p;
+}
+
+void * arena_alloc_aligned(arena * a, size_t size, size_t align) {
+    char * p = align_ptr(a->next, align);
+    if (a->current != NULL && p <= a->end && size <= (size_t) (a->end - p)) {
+        a->next = p + size;
+        return p;
+    }
+    return arena_alloc_chunk(a, size, align);
+}
+
+void * arena_alloc(arena * a, size_t size) {
+    return arena_alloc_aligned(a, size, ARENA_ALIGN);
+}
+
+arena_mark arena_save(const arena * a) {
+    return (arena_mark) { a->current, a->next };
+}
+
+void arena_rewind(arena * a, arena_mark mark) {
+    if (mark.chunk == NULL) {
+        arena_reset(a);
+        return;
+    }
+    a->current = mark.chunk;
+    a->next = mark.next;
+    a->end = chunk_start(mark.chunk) + mark.chunk->size;
+}
+
+void arena_reset(arena * a) {
+    a->current = NULL;
+    a->next = a->end = NULL;
+}
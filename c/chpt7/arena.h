@@ -0,0 +1,72 @@
+#ifndef __CHPT7_ARENA_H__
+#define __CHPT7_ARENA_H__
+
+#include <stddef.h>
+
+/**
+ * Region allocator for memory that is all released at once, such as everything a request allocates.
+ *
+ * Allocations bump a pointer through chunks taken from __malloc, and are never freed one by one.
+ * arena_save marks the current position and arena_rewind releases everything allocated after a mark, like a scope.
+ * arena_reset releases everything: both are O(1), and keep the chunks to be reused by later allocations.
+ * Only arena_destroy hands the chunks back to __malloc.
+ *
+ * Not thread safe, like __malloc.
+ */
+
+#define ARENA_DEFAULT_CHUNK_SZ (64 * 1024)
+#define ARENA_ALIGN 16 // Alignment of arena_alloc, enough for any type like malloc's
+
+typedef struct arena_chunk arena_chunk;
+
+typedef struct {
+    arena_chunk * first; // Chunks in the order they're filled. Those after current are empty, kept for reuse
+    arena_chunk * current; // NULL until the first allocation
+    char * next; // Free space in current
+    char * end;
+    size_t chunk_size;
+    size_t heap_bytes; // Bytes taken from __malloc
+} arena;
+
+/**
+ * Position in an arena, from arena_save.
+ */
+typedef struct {
+    arena_chunk * chunk;
+    char * next;
+} arena_mark;
+
+/**
+ * Initialize an empty arena that gets chunk_size bytes at a time from __malloc (0 for ARENA_DEFAULT_CHUNK_SZ).
+ * Larger allocations get a chunk of their own.
+ */
+void arena_init(arena * a, size_t chunk_size);
+
+/**
+ * Return every chunk to __malloc. The arena can be used again, as if just initialized.
+ */
+void arena_destroy(arena * a);
+
+/**
+ * Allocate size bytes aligned to ARENA_ALIGN, or return NULL with errno set to ENOMEM.
+ */
+void * arena_alloc(arena * a, size_t size);
+
+/**
+ * Same as arena_alloc, aligned to align bytes instead (a power of two).
+ */
+void * arena_alloc_aligned(arena * a, size_t size, size_t align);
+
+arena_mark arena_save(const arena * a);
+
+/**
+ * Release everything allocated since mark was saved. Marks saved after it are no longer valid.
+ */
+void arena_rewind(arena * a, arena_mark mark);
+
+/**
+ * Release everything allocated from a.
+ */
+void arena_reset(arena * a);
+
+#endif
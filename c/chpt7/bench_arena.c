@@ -0,0 +1,149 @@
+#define _DEFAULT_SOURCE /** Unlocks sbrk() in glibc */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "../shared/bench.h"
+#include "../shared/errors.h"
+#include "q2.h"
+#include "arena.h"
+#include "bench_arena.h"
+
+#define BENCH_ARENA_OBJECTS 64 // Allocated by each request, and kept until it ends
+#define BENCH_ARENA_SCRATCH 16 // Temporaries each request allocates halfway through, and releases right away
+#define BENCH_ARENA_MIN_SZ 16
+#define BENCH_ARENA_MAX_SZ 512
+
+typedef enum {
+    ARENA,
+    MALLOC,
+    GLIBC,
+} arena_bench_allocator;
+
+typedef struct {
+    double requests_per_s;
+    double heap_bytes;
+} arena_bench_result;
+
+typedef struct {
+    arena_bench_allocator allocator;
+    arena a;
+    uint64_t seed;
+} request_ctx;
+
+/**
+ * Object sizes, the same sequence for every allocator.
+ */
+static size_t next_size(request_ctx * ctx) {
+    return BENCH_ARENA_MIN_SZ + bench_xorshift(&ctx->seed) % (BENCH_ARENA_MAX_SZ - BENCH_ARENA_MIN_SZ + 1);
+}
+
+static void * request_alloc(request_ctx * ctx) {
+    size_t size = next_size(ctx);
+    void * p;
+    switch (ctx->allocator) {
+    case ARENA:
+        p = arena_alloc(&ctx->a, size);
+        break;
+    case MALLOC:
+        p = __malloc(size);
+        break;
+    default:
+        p = malloc(size);
+    }
+    if (p == NULL) {
+        fatal("Out of heap allocating %zu bytes", size);
+    }
+    *(uintptr_t *) p = size; // Touch it, as the request would
+    return p;
+}
+
+/**
+ * Free objects one by one, in allocation order, unless they're in the arena.
+ */
+static void request_free(request_ctx * ctx, void ** objects, int n) {
+    for (int i = 0; i < n && ctx->allocator != ARENA; i++) {
+        if (ctx->allocator == MALLOC) {
+            __free(objects[i]);
+        } else {
+            free(objects[i]);
+        }
+    }
+}
+
+static void run_request(request_ctx * ctx) {
+    void * objects[BENCH_ARENA_OBJECTS];
+    void * scratch[BENCH_ARENA_SCRATCH];
+
+    for (int i = 0; i < BENCH_ARENA_OBJECTS; i++) {
+        objects[i] = request_alloc(ctx);
+        if (i == BENCH_ARENA_OBJECTS / 2) {
+            arena_mark mark = arena_save(&ctx->a);
+            for (int j = 0; j < BENCH_ARENA_SCRATCH; j++) {
+                scratch[j] = request_alloc(ctx);
+            }
+            request_free(ctx, scratch, BENCH_ARENA_SCRATCH);
+            if (ctx->allocator == ARENA) {
+                arena_rewind(&ctx->a, mark);
+            }
+        }
+    }
+
+    request_free(ctx, objects, BENCH_ARENA_OBJECTS);
+    if (ctx->allocator == ARENA) {
+        arena_reset(&ctx->a);
+    }
+}
+
+/**
+ * Serve nrequests requests, on a fresh heap: call it in a child that never used __malloc.
+ */
+static arena_bench_result run_allocator(arena_bench_allocator allocator, long nrequests) {
+    request_ctx ctx = { .allocator = allocator, .seed = BENCH_SEED };
+    arena_init(&ctx.a, 0);
+
+    void * heap_start = sbrk(0);
+    double start = bench_now();
+    for (long i = 0; i < nrequests; i++) {
+        run_request(&ctx);
+    }
+    double elapsed = bench_now() - start;
+    arena_destroy(&ctx.a);
+
+    return (arena_bench_result) { nrequests / elapsed, (double) (sbrk(0) - heap_start) };
+}
+
+typedef struct {
+    arena_bench_allocator allocator;
+    long nrequests;
+} arena_bench_args;
+
+/**
+ * run_allocator for bench_run_in_child, so that each run starts from an empty heap, and glibc's malloc stays out of __malloc's way.
+ */
+static void run_allocator_job(void * arg, void * result) {
+    arena_bench_args * args = arg;
+    *(arena_bench_result *) result = run_allocator(args->allocator, args->nrequests);
+}
+
+void chpt7_bench_arena(long nrequests) {
+    static const char * names[] = { "arena", "__malloc", "glibc" };
+    char name[64];
+
+    for (arena_bench_allocator allocator = ARENA; allocator <= GLIBC; allocator++) {
+        arena_bench_result result;
+        bench_run_in_child(run_allocator_job, &(arena_bench_args) { allocator, nrequests }, &result, sizeof(result));
+
+        snprintf(name, sizeof(name), "arena/%s/requests", names[allocator]);
+        bench_report(name, result.requests_per_s, "requests/s");
+        //
+        // The child inherits glibc's heap, which has more than enough free space left for a request
+        //
+        if (allocator != GLIBC) {
+            snprintf(name, sizeof(name), "arena/%s/heap", names[allocator]);
+            bench_report(name, result.heap_bytes / 1024, "KiB");
+        }
+    }
+}
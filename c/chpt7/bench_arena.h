@@ -0,0 +1,11 @@
+#ifndef __CHPT7_BENCH_ARENA_H__
+#define __CHPT7_BENCH_ARENA_H__
+
+/**
+ * Serve nrequests simulated requests, each allocating objects of random sizes that all go away when it ends,
+ * plus a few temporaries in a nested scope. Compare an arena reset per request with __malloc/__free and glibc's
+ * malloc/free: requests per second and the heap used.
+ */
+void chpt7_bench_arena(long nrequests);
+
+#endif
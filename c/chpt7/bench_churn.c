@@ -0,0 +1,230 @@
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "../shared/bench.h"
+#include "../shared/errors.h"
+#include "../shared/utils.h"
+#include "q2.h"
+#include "handle.h"
+#include "bench_churn.h"
+
+#define CHURN_HOURS 24
+#define CHURN_REPLACED_PER_TICK 0.01 // Share of the live objects freed and replaced by new ones each tick
+#define CHURN_MIN_LIVE 0.2 // Live objects at night, relative to the peak at noon
+#define CHURN_COMPACT_INTERVAL_MS 10
+#define CHURN_COMPACT_MAX_BYTES (64 * 1024 * 1024) // Enough for a whole pass over the heap
+
+typedef enum {
+    MALLOC,
+    MALLOC_TRIM,
+    HANDLE,
+} churn_allocator;
+
+typedef struct {
+    double live_mib;
+    double heap_mib;
+    double free_pct; // Share of the heap in free blocks
+    double rss_mib;
+} churn_sample;
+
+typedef struct {
+    churn_sample hours[CHURN_HOURS];
+    double ops_per_s;
+    double peak_heap_mib;
+    double moved_mib;
+    size_t ncompactions;
+} churn_result;
+
+/**
+ * Mostly small objects, some medium ones and a few large ones: sizes spread over three orders of magnitude.
+ */
+static size_t object_size(uint64_t * seed) {
+    uint64_t r = bench_xorshift(seed);
+    switch (r % 20) {
+    case 0:
+        return 4096 + (r >> 8) % 28672;
+    case 1: case 2: case 3: case 4: case 5:
+        return 256 + (r >> 8) % 3840;
+    default:
+        return 16 + (r >> 8) % 240;
+    }
+}
+
+/**
+ * Resident set size, read with a plain read so that glibc's malloc stays out of the way.
+ */
+static double rss_mib() {
+    char buf[128];
+    long size, resident;
+    int fd = open("/proc/self/statm", O_RDONLY);
+    ssize_t n = fd == -1 ? -1 : read(fd, buf, sizeof(buf) - 1);
+    if (fd != -1) {
+        safe_close(fd);
+    }
+    if (n <= 0) {
+        return -1;
+    }
+    buf[n] = '\0';
+    if (sscanf(buf, "%ld %ld", &size, &resident) != 2) {
+        return -1;
+    }
+    return resident * (double) sysconf(_SC_PAGESIZE) / (1024 * 1024);
+}
+
+static uintptr_t churn_alloc(churn_allocator allocator, size_t size) {
+    void * p;
+    if (allocator == HANDLE) {
+        handle h = handle_alloc(size);
+        if (h == HANDLE_NULL) {
+            fatal("Out of heap allocating %zu bytes", size);
+        }
+        p = handle_pin(h);
+        memset(p, 0, min(size, (size_t) 64));
+        handle_unpin(h);
+        return h;
+    }
+    if ((p = __malloc(size)) == NULL) {
+        fatal("Out of heap allocating %zu bytes", size);
+    }
+    memset(p, 0, min(size, (size_t) 64));
+    return (uintptr_t) p;
+}
+
+static void churn_free(churn_allocator allocator, uintptr_t object) {
+    if (allocator == HANDLE) {
+        handle_free(object);
+    } else {
+        __free((void *) object);
+    }
+}
+
+/**
+ * Simulate a day of a caching service whose live objects follow the daily traffic, between CHURN_MIN_LIVE * peak_live
+ * at midnight and peak_live at noon, each tick replacing some of them with objects of other sizes.
+ * Runs on a fresh heap: call it in a child that never used __malloc.
+ */
+static churn_result run_day(churn_allocator allocator, long peak_live, long ticks_per_hour) {
+    churn_result result;
+    memset(&result, 0, sizeof(result));
+    //
+    // Start the compactor before the heap, see handle_compactor_start
+    //
+    if (allocator == HANDLE && handle_compactor_start(CHURN_COMPACT_INTERVAL_MS, CHURN_COMPACT_MAX_BYTES) == -1) {
+        errExit("handle_compactor_start");
+    }
+
+    uintptr_t * live = mmap(NULL, peak_live * sizeof(uintptr_t), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    size_t * sizes = mmap(NULL, peak_live * sizeof(size_t), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (live == MAP_FAILED || sizes == MAP_FAILED) {
+        errExit("mmap");
+    }
+    long nlive = 0, ops = 0;
+    size_t live_bytes = 0;
+    uint64_t seed = BENCH_SEED;
+
+    double start = bench_now();
+    for (int hour = 0; hour < CHURN_HOURS; hour++) {
+        for (long tick = 0; tick < ticks_per_hour; tick++) {
+            //
+            // Traffic ramps up linearly from midnight to noon, then back down
+            //
+            double day = (hour + (double) tick / ticks_per_hour) / CHURN_HOURS;
+            double traffic = day < 0.5 ? 2 * day : 2 - 2 * day;
+            long target = peak_live * (CHURN_MIN_LIVE + (1 - CHURN_MIN_LIVE) * traffic);
+
+            //
+            // Free random objects: those replaced, plus those above the target, then allocate up to the target.
+            //
+            long nfreed = nlive * CHURN_REPLACED_PER_TICK + max(nlive - target, 0L);
+            for (long i = 0; i < nfreed; i++) {
+                long victim = bench_xorshift(&seed) % nlive;
+                churn_free(allocator, live[victim]);
+                live_bytes -= sizes[victim];
+                nlive--;
+                live[victim] = live[nlive];
+                sizes[victim] = sizes[nlive];
+            }
+            while (nlive < target) {
+                sizes[nlive] = object_size(&seed);
+                live[nlive] = churn_alloc(allocator, sizes[nlive]);
+                live_bytes += sizes[nlive++];
+                ops++;
+            }
+            ops += nfreed;
+            if (allocator == MALLOC_TRIM) {
+                __malloc_trim(0);
+            }
+        }
+
+        //
+        // The handle stats are taken with the compactor out of the way, the heap's included.
+        //
+        handle_stats stats;
+        handle_get_stats(&stats);
+        result.hours[hour] = (churn_sample) {
+            .live_mib = live_bytes / (1024.0 * 1024),
+            .heap_mib = stats.heap.heap_bytes / (1024.0 * 1024),
+            .free_pct = stats.heap.heap_bytes == 0 ? 0 : 100.0 * stats.heap.free_bytes / stats.heap.heap_bytes,
+            .rss_mib = rss_mib(),
+        };
+        result.peak_heap_mib = max(result.peak_heap_mib, result.hours[hour].heap_mib);
+        result.moved_mib = stats.moved_bytes / (1024.0 * 1024);
+        result.ncompactions = stats.ncompactions;
+    }
+    result.ops_per_s = ops / (bench_now() - start);
+
+    handle_compactor_stop();
+    return result;
+}
+
+typedef struct {
+    churn_allocator allocator;
+    long peak_live;
+    long ticks_per_hour;
+} churn_args;
+
+/**
+ * run_day for bench_run_in_child, so that each run starts from an empty heap.
+ */
+static void run_day_job(void * arg, void * result) {
+    churn_args * args = arg;
+    *(churn_result *) result = run_day(args->allocator, args->peak_live, args->ticks_per_hour);
+}
+
+void chpt7_bench_churn(long peak_live, long ticks_per_hour) {
+    static const char * names[] = { "__malloc", "__malloc+trim", "handle" };
+    char name[64];
+
+    for (churn_allocator allocator = MALLOC; allocator <= HANDLE; allocator++) {
+        churn_result result;
+        bench_run_in_child(run_day_job, &(churn_args) { allocator, peak_live, ticks_per_hour }, &result, sizeof(result));
+
+        printf("%s, hourly: live MiB, heap MiB, free %%, RSS MiB\n", names[allocator]);
+        for (int hour = 0; hour < CHURN_HOURS; hour++) {
+            churn_sample * sample = &result.hours[hour];
+            printf("  %02d:00 %8.1f %8.1f %6.1f%% %8.1f\n",
+                hour + 1, sample->live_mib, sample->heap_mib, sample->free_pct, sample->rss_mib);
+        }
+
+        snprintf(name, sizeof(name), "churn/%s/ops", names[allocator]);
+        bench_report(name, result.ops_per_s, "ops/s");
+        snprintf(name, sizeof(name), "churn/%s/peak_heap", names[allocator]);
+        bench_report(name, result.peak_heap_mib, "MiB");
+        snprintf(name, sizeof(name), "churn/%s/midnight_heap", names[allocator]);
+        bench_report(name, result.hours[CHURN_HOURS - 1].heap_mib, "MiB");
+        snprintf(name, sizeof(name), "churn/%s/midnight_rss", names[allocator]);
+        bench_report(name, result.hours[CHURN_HOURS - 1].rss_mib, "MiB");
+        snprintf(name, sizeof(name), "churn/%s/midnight_free", names[allocator]);
+        bench_report(name, result.hours[CHURN_HOURS - 1].free_pct, "%");
+        if (allocator == HANDLE) {
+            snprintf(name, sizeof(name), "churn/%s/moved", names[allocator]);
+            bench_report(name, result.moved_mib, "MiB");
+            snprintf(name, sizeof(name), "churn/%s/compactions", names[allocator]);
+            bench_report(name, result.ncompactions, "compactions");
+        }
+    }
+}
@@ -0,0 +1,11 @@
+#ifndef __CHPT7_BENCH_CHURN_H__
+#define __CHPT7_BENCH_CHURN_H__
+
+/**
+ * Simulate a day of churn in a long-lived cache, up to peak_live objects of 16 bytes to 32 KiB at noon,
+ * in ticks_per_hour steps per hour, with __malloc, __malloc trimmed every step, and handles compacted in the background.
+ * Prints the live memory, heap size, free share of the heap and RSS every hour.
+ */
+void chpt7_bench_churn(long peak_live, long ticks_per_hour);
+
+#endif
@@ -0,0 +1,113 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "../shared/bench.h"
+#include "../shared/errors.h"
+#include "../shared/utils.h"
+#include "q2.h"
+#include "hot.h"
+#include "bench_falseshare.h"
+
+typedef struct {
+    volatile long * counter;
+    long nincrements;
+    pthread_barrier_t * start;
+} counter_worker;
+
+static void * count(void * arg) {
+    counter_worker * w = arg;
+
+    pthread_barrier_wait(w->start);
+    for (long i = 0; i < w->nincrements; i++) {
+        (*w->counter)++;
+    }
+    return NULL;
+}
+
+/**
+ * Have each of nthreads threads increment its own counter nincrements times, returning the increments per second.
+ */
+static double count_from_threads(volatile long ** counters, int nthreads, long nincrements) {
+    pthread_t threads[nthreads];
+    counter_worker workers[nthreads];
+    pthread_barrier_t start;
+    pthread_barrier_init(&start, NULL, nthreads + 1);
+
+    for (int i = 0; i < nthreads; i++) {
+        *counters[i] = 0;
+        workers[i] = (counter_worker) { counters[i], nincrements, &start };
+        int s = pthread_create(&threads[i], NULL, count, &workers[i]);
+        if (s != 0) {
+            errExitEN(s, "pthread_create");
+        }
+    }
+
+    pthread_barrier_wait(&start);
+    double begin = bench_now();
+    for (int i = 0; i < nthreads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    double elapsed = bench_now() - begin;
+
+    pthread_barrier_destroy(&start);
+    for (int i = 0; i < nthreads; i++) {
+        if (*counters[i] != nincrements) {
+            fatal("Counter %d is at %ld instead of %ld", i, *counters[i], nincrements);
+        }
+    }
+    return nthreads * nincrements / elapsed;
+}
+
+/**
+ * Number of distinct cache lines the counters are on.
+ */
+static int count_lines(volatile long ** counters, int n) {
+    int lines = 0;
+    for (int i = 0; i < n; i++) {
+        Boolean shared = FALSE;
+        for (int j = 0; j < i && !shared; j++) {
+            shared = (uintptr_t) counters[i] / CACHE_LINE_SZ == (uintptr_t) counters[j] / CACHE_LINE_SZ;
+        }
+        lines += !shared;
+    }
+    return lines;
+}
+
+void chpt7_bench_falseshare(int nthreads, long nincrements) {
+    static const char * names[] = { "array", "__malloc", "hot" };
+    volatile long * counters[3][nthreads];
+    char name[64];
+
+    //
+    // Allocate all counters up front, as a program setting up its threads would:
+    // in a single array, with one __malloc each and then with one __malloc_hot each.
+    // The threads only touch their own counter.
+    //
+    volatile long * array = __malloc(nthreads * sizeof(long));
+    if (array == NULL) {
+        errExit("Allocating counters");
+    }
+    for (int i = 0; i < nthreads; i++) {
+        counters[0][i] = &array[i];
+        counters[1][i] = __malloc(sizeof(long));
+        counters[2][i] = __malloc_hot(sizeof(long));
+        if (counters[1][i] == NULL || counters[2][i] == NULL) {
+            errExit("Allocating counter %d", i);
+        }
+    }
+
+    for (int variant = 0; variant < 3; variant++) {
+        double rate = count_from_threads(counters[variant], nthreads, nincrements);
+        snprintf(name, sizeof(name), "falseshare/%s/%dthreads", names[variant], nthreads);
+        bench_report(name, rate, "increments/s");
+        snprintf(name, sizeof(name), "falseshare/%s/lines", names[variant]);
+        bench_report(name, count_lines(counters[variant], nthreads), "lines");
+    }
+
+    __free((void *) array);
+    for (int i = 0; i < nthreads; i++) {
+        __free((void *) counters[1][i]);
+        __free_hot((void *) counters[2][i]);
+    }
+}
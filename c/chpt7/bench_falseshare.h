@@ -0,0 +1,10 @@
+#ifndef __CHPT7_BENCH_FALSESHARE_H__
+#define __CHPT7_BENCH_FALSESHARE_H__
+
+/**
+ * Have nthreads threads each increment its own counter nincrements times, with the counters allocated by __malloc
+ * (packed, sharing cache lines) and then by __malloc_hot (a cache line each).
+ */
+void chpt7_bench_falseshare(int nthreads, long nincrements);
+
+#endif
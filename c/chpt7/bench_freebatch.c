@@ -0,0 +1,143 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "../shared/bench.h"
+#include "../shared/errors.h"
+#include "q2.h"
+#include "bench_freebatch.h"
+
+typedef struct node node;
+
+struct node {
+    uint64_t key;
+    node * left;
+    node * right;
+};
+
+typedef enum {
+    FREE_EACH, // __free
+    FREE_SIZED, // __free_sized
+    FREE_BATCH, // __free_batch
+} free_variant;
+
+typedef struct {
+    double build_s;
+    double free_s;
+    double collect_s; // Of free_s, gathering the nodes for __free_batch
+    heap_stats heap; // After freeing the tree
+} freebatch_result;
+
+/**
+ * Insert nnodes random keys. Nodes are allocated in insertion order, so the tree's shape has nothing to do with
+ * their addresses.
+ */
+static node * build_tree(long nnodes) {
+    node * root = NULL;
+    uint64_t seed = BENCH_SEED;
+    for (long i = 0; i < nnodes; i++) {
+        node * new = __malloc(sizeof(node));
+        if (new == NULL) {
+            fatal("Out of heap");
+        }
+        new->key = bench_xorshift(&seed);
+        new->left = new->right = NULL;
+        node ** link = &root;
+        while (*link != NULL) {
+            link = new->key < (*link)->key ? &(*link)->left : &(*link)->right;
+        }
+        *link = new;
+    }
+    return root;
+}
+
+//
+// Post-order, as a destructor would.
+//
+static void free_tree(node * tree, free_variant variant) {
+    if (tree == NULL) {
+        return;
+    }
+    free_tree(tree->left, variant);
+    free_tree(tree->right, variant);
+    if (variant == FREE_SIZED) {
+        __free_sized(tree, sizeof(node));
+    } else {
+        __free(tree);
+    }
+}
+
+static size_t collect_tree(node * tree, void ** nodes, size_t n) {
+    if (tree == NULL) {
+        return n;
+    }
+    n = collect_tree(tree->left, nodes, n);
+    n = collect_tree(tree->right, nodes, n);
+    nodes[n] = tree;
+    return n + 1;
+}
+
+static freebatch_result run_workload(long nnodes, free_variant variant) {
+    freebatch_result result;
+    void ** nodes = NULL;
+    if (variant == FREE_BATCH) {
+        //
+        // Mapped, and touched, before the clock starts: a caller tearing down in batches keeps such an array around.
+        //
+        nodes = mmap(NULL, nnodes * sizeof(void *), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+        if (nodes == MAP_FAILED) {
+            errExit("mmap");
+        }
+    }
+
+    double start = bench_now();
+    node * tree = build_tree(nnodes);
+    result.build_s = bench_now() - start;
+
+    start = bench_now();
+    result.collect_s = 0;
+    if (variant == FREE_BATCH) {
+        size_t n = collect_tree(tree, nodes, 0);
+        result.collect_s = bench_now() - start;
+        __free_batch(nodes, n);
+    } else {
+        free_tree(tree, variant);
+    }
+    result.free_s = bench_now() - start;
+    __malloc_get_stats(&result.heap);
+    return result;
+}
+
+typedef struct {
+    long nnodes;
+    free_variant variant;
+} freebatch_args;
+
+/**
+ * run_workload for bench_run_in_child, so that each run starts from an empty heap.
+ */
+static void run_workload_job(void * arg, void * result) {
+    freebatch_args * args = arg;
+    *(freebatch_result *) result = run_workload(args->nnodes, args->variant);
+}
+
+void chpt7_bench_freebatch(long nnodes) {
+    static const char * names[] = { "__free", "__free_sized", "__free_batch" };
+    char name[64];
+
+    for (free_variant v = FREE_EACH; v <= FREE_BATCH; v++) {
+        freebatch_result result;
+        bench_run_in_child(run_workload_job, &(freebatch_args) { nnodes, v }, &result, sizeof(result));
+        if (result.heap.nfree_blocks != 1 || result.heap.free_bytes != result.heap.heap_bytes) {
+            fatal("%s left %zu free blocks, %zu bytes of %zu", names[v], result.heap.nfree_blocks, result.heap.free_bytes, result.heap.heap_bytes);
+        }
+        snprintf(name, sizeof(name), "freebatch/%s/build", names[v]);
+        bench_report(name, 1e9 * result.build_s / nnodes, "ns/node");
+        snprintf(name, sizeof(name), "freebatch/%s/free", names[v]);
+        bench_report(name, 1e9 * result.free_s / nnodes, "ns/node");
+        if (v == FREE_BATCH) {
+            bench_report("freebatch/__free_batch/collect", 1e9 * result.collect_s / nnodes, "ns/node");
+        }
+    }
+}
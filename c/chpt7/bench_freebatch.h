@@ -0,0 +1,10 @@
+#ifndef __CHPT7_BENCH_FREEBATCH_H__
+#define __CHPT7_BENCH_FREEBATCH_H__
+
+/**
+ * Build a binary search tree of nnodes nodes with __malloc, then free it node by node with __free, with __free_sized,
+ * and all at once with __free_batch.
+ */
+void chpt7_bench_freebatch(long nnodes);
+
+#endif
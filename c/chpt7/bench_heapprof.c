@@ -0,0 +1,128 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../shared/bench.h"
+#include "../shared/errors.h"
+#include "q2.h"
+#include "heapprof.h"
+#include "bench_heapprof.h"
+
+#define HEAPPROF_BENCH_LIVE 4096 // Objects kept allocated
+#define HEAPPROF_BENCH_RUNS 5 // Of each variant, alternating, keeping the fastest
+#define HEAPPROF_BENCH_DENSE (HEAPPROF_DEFAULT_INTERVAL / 64) // Makes the cost of sampling stand out of the noise
+
+typedef struct {
+    double ops_per_s;
+    heapprof_stats stats;
+} heapprof_result;
+
+//
+// Not inlined, so that the profile's stacks have it, and the three places run_workload calls it from.
+//
+static __attribute__((noinline)) void * new_object(size_t size) {
+    void * object = __malloc(size);
+    if (object == NULL) {
+        fatal("Out of heap");
+    }
+    return object;
+}
+
+/**
+ * Replace a random one of HEAPPROF_BENCH_LIVE objects nops times: 70% small, 25% medium, 5% large ones.
+ * Profiled with a sampling interval of interval bytes, unless it's 0.
+ */
+static heapprof_result run_workload(long nops, size_t interval, const char * prefix) {
+    heapprof_result result;
+    memset(&result, 0, sizeof(result));
+    if (interval != 0 && heapprof_start(interval, prefix) == -1) {
+        errExit("heapprof_start");
+    }
+
+    void * live[HEAPPROF_BENCH_LIVE] = { NULL };
+    uint64_t seed = BENCH_SEED;
+    double start = bench_now();
+    for (long i = 0; i < nops; i++) {
+        uint64_t r = bench_xorshift(&seed);
+        void ** slot = &live[r % HEAPPROF_BENCH_LIVE];
+        __free(*slot);
+        switch ((r >> 32) % 20) {
+        case 0:
+            *slot = new_object(1024 + (r >> 40) % 7168);
+            break;
+        case 1: case 2: case 3: case 4: case 5:
+            *slot = new_object(128 + (r >> 40) % 896);
+            break;
+        default:
+            *slot = new_object(16 + (r >> 40) % 112);
+        }
+        *(uint64_t *) *slot = r;
+    }
+    result.ops_per_s = nops / (bench_now() - start);
+
+    if (interval != 0) {
+        heapprof_get_stats(&result.stats);
+        if (heapprof_dump() == -1) {
+            errExit("heapprof_dump");
+        }
+    }
+    return result;
+}
+
+typedef struct {
+    long nops;
+    size_t interval;
+    const char * prefix;
+} heapprof_args;
+
+/**
+ * run_workload for bench_run_in_child, so that each run starts from an empty heap.
+ */
+static void run_workload_job(void * arg, void * result) {
+    heapprof_args * args = arg;
+    *(heapprof_result *) result = run_workload(args->nops, args->interval, args->prefix);
+}
+
+void chpt7_bench_heapprof(long nops, const char * prefix) {
+    static const struct {
+        const char * name;
+        size_t interval;
+    } variants[] = {
+        { "off", 0 },
+        { "dense", HEAPPROF_BENCH_DENSE },
+        { "on", HEAPPROF_DEFAULT_INTERVAL }, // Last, so that its profile is the one left
+    };
+    heapprof_result best[3];
+    char name[64];
+    memset(best, 0, sizeof(best));
+
+    for (int i = 0; i < HEAPPROF_BENCH_RUNS; i++) {
+        for (int v = 0; v < 3; v++) {
+            heapprof_result result;
+            bench_run_in_child(run_workload_job, &(heapprof_args) { nops, variants[v].interval, prefix }, &result, sizeof(result));
+            if (result.ops_per_s > best[v].ops_per_s) {
+                best[v] = result;
+            }
+        }
+    }
+
+    for (int v = 0; v < 3; v++) {
+        snprintf(name, sizeof(name), "heapprof/%s", variants[v].name);
+        bench_report(name, best[v].ops_per_s, "ops/s");
+        if (v > 0) {
+            snprintf(name, sizeof(name), "heapprof/%s/overhead", variants[v].name);
+            bench_report(name, 100 * (best[0].ops_per_s / best[v].ops_per_s - 1), "%");
+            snprintf(name, sizeof(name), "heapprof/%s/samples", variants[v].name);
+            bench_report(name, best[v].stats.nsamples, "samples");
+        }
+    }
+    //
+    // The cost of each sample, from the dense profile where there are plenty of them,
+    //  gives the overhead of sampling at the default interval without the noise of comparing two close numbers.
+    //
+    double sample_ns = 1e9 * (nops / best[1].ops_per_s - nops / best[0].ops_per_s) / best[1].stats.nsamples;
+    bench_report("heapprof/sample_cost", sample_ns, "ns/sample");
+    bench_report("heapprof/on/sampling_overhead", 100 * sample_ns * 1e-9 * best[2].stats.nsamples * best[0].ops_per_s / nops, "%");
+    bench_report("heapprof/stacks", best[2].stats.nstacks, "stacks");
+    printf("Last profile in %s.0001.heap\n", prefix);
+}
@@ -0,0 +1,10 @@
+#ifndef __CHPT7_BENCH_HEAPPROF_H__
+#define __CHPT7_BENCH_HEAPPROF_H__
+
+/**
+ * Replace objects of random sizes nops times with __malloc and __free, without the heap profiler and then with it
+ * at its default sampling interval, writing the profile to PREFIX.0001.heap.
+ */
+void chpt7_bench_heapprof(long nops, const char * prefix);
+
+#endif
@@ -0,0 +1,182 @@
+#define _DEFAULT_SOURCE /** Unlocks sbrk() in glibc */
+
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "../shared/bench.h"
+#include "../shared/errors.h"
+#include "../shared/utils.h"
+#include "q2.h"
+#include "bench_hugeheap.h"
+
+#define BENCH_HUGEHEAP_OBJECT_SZ 1024
+#define BENCH_HUGEHEAP_HEADER_SLACK 64 // Room for __malloc's header in the heap, per object
+
+typedef struct {
+    int backing; // heap_backing
+    double build_ms;
+    double ns_per_access;
+    double dtlb_misses_per_access; // -1 if the counter is unavailable
+    int dtlb_errno;
+    double huge_mib; // Memory backed by huge pages, from smaps
+} hugeheap_result;
+
+static void * map_scratch(size_t size) {
+    void * p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        errExit("mmap");
+    }
+    return p;
+}
+
+/**
+ * Count the user space dTLB load misses of this thread, or return -1 if perf events aren't available
+ * (perf_event_paranoid, or no hardware counters as in many VMs).
+ */
+static int open_dtlb_counter() {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/**
+ * Memory of this process backed by huge pages, transparent or hugetlbfs, in MiB.
+ */
+static double huge_page_mib() {
+    FILE * f = fopen("/proc/self/smaps_rollup", "r");
+    char line[256];
+    long kib = 0, n;
+    while (f != NULL && fgets(line, sizeof(line), f) != NULL) {
+        if (sscanf(line, "AnonHugePages: %ld kB", &n) == 1 || sscanf(line, "Private_Hugetlb: %ld kB", &n) == 1) {
+            kib += n;
+        }
+    }
+    if (f != NULL) {
+        fclose(f);
+    }
+    return kib / 1024.0;
+}
+
+/**
+ * Fill heap_size bytes of heap with __malloc'd objects linked in a random cycle, then follow naccesses links.
+ * Each access depends on the previous one and lands on a random page, so it's bound by TLB and cache misses.
+ * Runs on a fresh heap: call it in a child that never used __malloc.
+ */
+static hugeheap_result run_heap(Boolean hugepages, size_t heap_size, long naccesses) {
+    hugeheap_result result = { .backing = HEAP_SBRK, .dtlb_misses_per_access = -1 };
+    if (hugepages && (result.backing = __malloc_use_hugepages(heap_size)) == -1) {
+        errExit("__malloc_use_hugepages");
+    }
+
+    size_t nobjects = heap_size / (BENCH_HUGEHEAP_OBJECT_SZ + BENCH_HUGEHEAP_HEADER_SLACK);
+    void ** objects = map_scratch(nobjects * sizeof(void *));
+    double start = bench_now();
+    for (size_t i = 0; i < nobjects; i++) {
+        if ((objects[i] = __malloc(BENCH_HUGEHEAP_OBJECT_SZ)) == NULL) {
+            fatal("Heap full after %zu objects", i);
+        }
+        *(void **) objects[i] = NULL; // Fault it in
+    }
+    result.build_ms = (bench_now() - start) * 1e3;
+    result.huge_mib = huge_page_mib();
+
+    //
+    // Link the objects in the order of a random permutation: Fisher-Yates shuffle, then each points to the next.
+    //
+    uint32_t * order = map_scratch(nobjects * sizeof(uint32_t));
+    uint64_t seed = BENCH_SEED;
+    for (size_t i = 0; i < nobjects; i++) {
+        order[i] = i;
+    }
+    for (size_t i = nobjects - 1; i > 0; i--) {
+        size_t j = bench_xorshift(&seed) % (i + 1);
+        uint32_t tmp = order[i];
+        order[i] = order[j];
+        order[j] = tmp;
+    }
+    for (size_t i = 0; i < nobjects; i++) {
+        *(void **) objects[order[i]] = objects[order[(i + 1) % nobjects]];
+    }
+    void * p = objects[order[0]];
+    munmap(order, nobjects * sizeof(uint32_t));
+    munmap(objects, nobjects * sizeof(void *));
+
+    int counter = open_dtlb_counter();
+    result.dtlb_errno = errno;
+    if (counter != -1) {
+        ioctl(counter, PERF_EVENT_IOC_RESET, 0);
+        ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
+    }
+    start = bench_now();
+    for (long i = 0; i < naccesses; i++) {
+        p = *(void **) p;
+    }
+    result.ns_per_access = (bench_now() - start) * 1e9 / naccesses;
+    if (counter != -1) {
+        uint64_t misses;
+        ioctl(counter, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(counter, &misses, sizeof(misses)) == sizeof(misses)) {
+            result.dtlb_misses_per_access = (double) misses / naccesses;
+        }
+        safe_close(counter);
+    }
+    //
+    // Keep the chase from being optimized away
+    //
+    if (p == NULL) {
+        fatal("Broken cycle");
+    }
+    return result;
+}
+
+typedef struct {
+    Boolean hugepages;
+    size_t heap_size;
+    long naccesses;
+} hugeheap_args;
+
+/**
+ * run_heap for bench_run_in_child, so that each run starts from an empty heap.
+ */
+static void run_heap_job(void * arg, void * result) {
+    hugeheap_args * args = arg;
+    *(hugeheap_result *) result = run_heap(args->hugepages, args->heap_size, args->naccesses);
+}
+
+void chpt7_bench_hugeheap(long heap_mib, long naccesses) {
+    static const char * names[] = { "sbrk", "mmap", "thp", "hugetlb" };
+    char name[64];
+    size_t heap_size = (size_t) heap_mib * 1024 * 1024;
+
+    for (int hugepages = FALSE; hugepages <= TRUE; hugepages++) {
+        hugeheap_result result;
+        bench_run_in_child(run_heap_job, &(hugeheap_args) { hugepages, heap_size, naccesses }, &result, sizeof(result));
+        const char * backing = names[result.backing];
+
+        snprintf(name, sizeof(name), "hugeheap/%ldMiB/%s/build", heap_mib, backing);
+        bench_report(name, result.build_ms, "ms");
+        snprintf(name, sizeof(name), "hugeheap/%ldMiB/%s/huge_pages", heap_mib, backing);
+        bench_report(name, result.huge_mib, "MiB");
+        snprintf(name, sizeof(name), "hugeheap/%ldMiB/%s/access", heap_mib, backing);
+        bench_report(name, result.ns_per_access, "ns/access");
+        if (result.dtlb_misses_per_access >= 0) {
+            snprintf(name, sizeof(name), "hugeheap/%ldMiB/%s/dtlb_misses", heap_mib, backing);
+            bench_report(name, result.dtlb_misses_per_access, "misses/access");
+        } else {
+            printf("%s: no dTLB miss counter (%s)\n", backing, strerror(result.dtlb_errno));
+        }
+    }
+}
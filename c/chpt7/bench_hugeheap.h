@@ -0,0 +1,11 @@
+#ifndef __CHPT7_BENCH_HUGEHEAP_H__
+#define __CHPT7_BENCH_HUGEHEAP_H__
+
+/**
+ * Fill a heap_mib MiB heap with 1 KiB __malloc'd objects and chase pointers between them at random, naccesses times,
+ * with the heap grown by sbrk and then in a region backed by huge pages (__malloc_use_hugepages).
+ * Reports the time to build the heap and per access, and dTLB misses per access when perf counters are available.
+ */
+void chpt7_bench_hugeheap(long heap_mib, long naccesses);
+
+#endif
@@ -0,0 +1,134 @@
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "../shared/bench.h"
+#include "../shared/errors.h"
+#include "../shared/utils.h"
+#include "q2.h"
+#include "pressure.h"
+#include "bench_pressure.h"
+
+#define PRESSURE_BENCH_MIN_BLOCK (16 * 1024)
+#define PRESSURE_BENCH_MAX_BLOCK (512 * 1024)
+
+typedef struct {
+    size_t rss; // In bytes, without LazyFree
+    size_t lazy_free; // Pages given back with MADV_FREE, but not reclaimed yet
+} memory_usage;
+
+typedef struct {
+    pressure_stats watched; // By the default monitor
+    memory_usage before;
+    memory_usage after;
+    heap_stats heap;
+    size_t released;
+    double relief_s;
+} pressure_result;
+
+/**
+ * The "Rss:" and "LazyFree:" lines of /proc/self/smaps_rollup, read without stdio which would use glibc's malloc.
+ */
+static memory_usage get_memory_usage() {
+    char buf[2048];
+    memory_usage usage = { 0, 0 };
+    int fd = open("/proc/self/smaps_rollup", O_RDONLY);
+    if (fd == -1) {
+        errExit("open /proc/self/smaps_rollup");
+    }
+    ssize_t n = read(fd, buf, sizeof(buf) - 1);
+    if (n == -1) {
+        errExit("read /proc/self/smaps_rollup");
+    }
+    buf[n] = '\0';
+    safe_close(fd);
+
+    char * line;
+    if ((line = strstr(buf, "\nRss:")) != NULL) {
+        usage.rss = strtoull(line + strlen("\nRss:"), NULL, 10) * 1024;
+    }
+    if ((line = strstr(buf, "\nLazyFree:")) != NULL) {
+        usage.lazy_free = strtoull(line + strlen("\nLazyFree:"), NULL, 10) * 1024;
+    }
+    usage.rss -= min(usage.rss, usage.lazy_free);
+    return usage;
+}
+
+/**
+ * Allocate and touch blocks up to heap_mib MiB, then free three out of four at random, and the last ones.
+ * Then relieve the heap.
+ */
+static pressure_result run_workload(long heap_mib) {
+    pressure_result result;
+    memset(&result, 0, sizeof(result));
+    //
+    // Started with the defaults, only to tell what it would watch here, before the heap like in any program.
+    //
+    if (pressure_monitor_start(NULL) == -1) {
+        errExit("pressure_monitor_start");
+    }
+    pressure_get_stats(&result.watched);
+
+    size_t max_blocks = heap_mib * 1024 * 1024 / PRESSURE_BENCH_MIN_BLOCK;
+    void ** blocks = mmap(NULL, max_blocks * sizeof(void *), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (blocks == MAP_FAILED) {
+        errExit("mmap");
+    }
+    uint64_t seed = BENCH_SEED;
+    size_t nblocks = 0;
+    for (size_t total = 0; total < (size_t) heap_mib * 1024 * 1024; nblocks++) {
+        size_t size = PRESSURE_BENCH_MIN_BLOCK + bench_xorshift(&seed) % (PRESSURE_BENCH_MAX_BLOCK - PRESSURE_BENCH_MIN_BLOCK);
+        if ((blocks[nblocks] = __malloc(size)) == NULL) {
+            fatal("Out of heap");
+        }
+        memset(blocks[nblocks], 1, size);
+        total += size;
+    }
+    for (size_t i = 0; i < nblocks; i++) {
+        if (i >= nblocks - nblocks / 8 || bench_xorshift(&seed) % 4 != 0) {
+            __free(blocks[i]);
+        }
+    }
+
+    result.before = get_memory_usage();
+    double start = bench_now();
+    result.released = pressure_relieve();
+    result.relief_s = bench_now() - start;
+    result.after = get_memory_usage();
+    __malloc_get_stats(&result.heap);
+    pressure_monitor_stop();
+    return result;
+}
+
+typedef struct {
+    long heap_mib;
+} pressure_args;
+
+/**
+ * run_workload for bench_run_in_child, so that it starts from an empty heap.
+ */
+static void run_workload_job(void * arg, void * result) {
+    pressure_args * args = arg;
+    *(pressure_result *) result = run_workload(args->heap_mib);
+}
+
+void chpt7_bench_pressure(long heap_mib) {
+    pressure_result result;
+    bench_run_in_child(run_workload_job, &(pressure_args) { heap_mib }, &result, sizeof(result));
+    printf("Watching PSI: %s, cgroup memory.high: %s\n",
+        result.watched.psi ? (result.watched.psi_trigger ? "trigger" : "polled") : "no", result.watched.cgroup ? "yes" : "no");
+
+    const double mib = 1024 * 1024;
+    bench_report("pressure/before/rss", result.before.rss / mib, "MiB");
+    bench_report("pressure/before/lazy_free", result.before.lazy_free / mib, "MiB");
+    bench_report("pressure/after/rss", result.after.rss / mib, "MiB");
+    bench_report("pressure/after/lazy_free", result.after.lazy_free / mib, "MiB");
+    bench_report("pressure/after/heap", result.heap.heap_bytes / mib, "MiB");
+    bench_report("pressure/after/heap_free", result.heap.free_bytes / mib, "MiB");
+    bench_report("pressure/released", result.released / mib, "MiB");
+    bench_report("pressure/relief_time", result.relief_s * 1e3, "ms");
+}
@@ -0,0 +1,10 @@
+#ifndef __CHPT7_BENCH_PRESSURE_H__
+#define __CHPT7_BENCH_PRESSURE_H__
+
+/**
+ * Fill heap_mib MiB of heap with blocks of random sizes, free most of them, then relieve the heap as the pressure
+ * monitor would, reporting the process's resident memory before and after.
+ */
+void chpt7_bench_pressure(long heap_mib);
+
+#endif
@@ -0,0 +1,135 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../shared/bench.h"
+#include "../shared/errors.h"
+#include "../shared/utils.h"
+#include "q2.h"
+#include "shm_heap.h"
+#include "bench_shmheap.h"
+
+#define SHMHEAP_SEGMENT_SZ (64 * 1024 * 1024)
+#define SHMHEAP_LIVE 1024 // Blocks each process keeps allocated
+
+/**
+ * Replace a random one of SHMHEAP_LIVE blocks of 16 to 256 bytes with a new one, nops times, then free them all.
+ */
+static void churn(shm_heap * heap, long nops, uint64_t seed) {
+    shm_off live[SHMHEAP_LIVE] = { SHM_OFF_NULL };
+    for (long i = 0; i < nops; i++) {
+        uint64_t r = bench_xorshift(&seed);
+        shm_off * slot = &live[r % SHMHEAP_LIVE];
+        shm_free(heap, *slot);
+        if ((*slot = shm_alloc(heap, 16 + (r >> 32) % 241)) == SHM_OFF_NULL) {
+            fatal("Shared heap full");
+        }
+        *(uint64_t *) shm_ptr(heap, *slot) = r;
+    }
+    for (int i = 0; i < SHMHEAP_LIVE; i++) {
+        shm_free(heap, live[i]);
+    }
+}
+
+/**
+ * Same as churn, with __malloc in the process's own heap.
+ */
+static void churn_private(long nops, uint64_t seed) {
+    void * live[SHMHEAP_LIVE] = { NULL };
+    for (long i = 0; i < nops; i++) {
+        uint64_t r = bench_xorshift(&seed);
+        void ** slot = &live[r % SHMHEAP_LIVE];
+        __free(*slot);
+        if ((*slot = __malloc(16 + (r >> 32) % 241)) == NULL) {
+            fatal("Out of heap");
+        }
+        *(uint64_t *) *slot = r;
+    }
+    for (int i = 0; i < SHMHEAP_LIVE; i++) {
+        __free(live[i]);
+    }
+}
+
+/**
+ * Fork nprocs processes that each map heap anew, at an address of their own, and churn on it at the same time.
+ * With heap NULL, they churn on their own heaps instead. Returns the operations per second of all of them.
+ */
+static double run_processes(shm_heap * heap, int nprocs, long nops) {
+    int start[2];
+    if (pipe(start) == -1) {
+        errExit("pipe");
+    }
+
+    fflush(stdout);
+    for (int i = 0; i < nprocs; i++) {
+        switch (fork()) {
+        case -1:
+            errExit("fork");
+        case 0: {
+            safe_close(start[1]);
+            char c;
+            if (read(start[0], &c, 1) != 0) {
+                fatal("Expected EOF on the start pipe");
+            }
+            if (heap == NULL) {
+                churn_private(nops, BENCH_SEED + i);
+                _exit(0);
+            }
+            shm_heap own;
+            int fd = dup(heap->fd);
+            if (fd == -1 || shm_heap_attach_fd(&own, fd) == -1) {
+                errExit("Attaching to the shared heap");
+            }
+            if (own.segment == heap->segment) {
+                fatal("Shared heap mapped at the same address");
+            }
+            churn(&own, nops, BENCH_SEED + i);
+            shm_heap_detach(&own);
+            _exit(0);
+        }
+        default:
+            break;
+        }
+    }
+
+    //
+    // The children are all waiting on the pipe: closing it starts them together.
+    //
+    safe_close(start[0]);
+    double begin = bench_now();
+    safe_close(start[1]);
+    for (int i = 0; i < nprocs; i++) {
+        int status;
+        if (wait(&status) == -1) {
+            errExit("wait");
+        }
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            fatal("Child failed");
+        }
+    }
+    return nprocs * nops / (bench_now() - begin);
+}
+
+void chpt7_bench_shmheap(int max_procs, long nops) {
+    char name[64];
+    shm_heap heap;
+    if (shm_heap_create(&heap, NULL, SHMHEAP_SEGMENT_SZ) == -1) {
+        errExit("shm_heap_create");
+    }
+
+    for (int nprocs = 1; nprocs <= max_procs; nprocs++) {
+        snprintf(name, sizeof(name), "shmheap/__malloc/%dprocs", nprocs);
+        bench_report(name, run_processes(NULL, nprocs, nops), "ops/s");
+        snprintf(name, sizeof(name), "shmheap/shared/%dprocs", nprocs);
+        bench_report(name, run_processes(&heap, nprocs, nops), "ops/s");
+
+        shm_heap_stats stats;
+        shm_heap_get_stats(&heap, &stats);
+        if (stats.nblocks != 0 || stats.nfree_blocks != 1) {
+            fatal("%zu blocks left allocated and %zu free blocks after %d processes", stats.nblocks, stats.nfree_blocks, nprocs);
+        }
+    }
+    shm_heap_detach(&heap);
+}
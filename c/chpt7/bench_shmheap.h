@@ -0,0 +1,10 @@
+#ifndef __CHPT7_BENCH_SHMHEAP_H__
+#define __CHPT7_BENCH_SHMHEAP_H__
+
+/**
+ * Have 1 to max_procs processes each replace nops blocks at random in a shared heap mapped at addresses of their own,
+ * all at the same time, and then in their own __malloc heaps for comparison.
+ */
+void chpt7_bench_shmheap(int max_procs, long nops);
+
+#endif
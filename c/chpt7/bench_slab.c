@@ -0,0 +1,123 @@
+#define _DEFAULT_SOURCE /** Unlocks sbrk() in glibc */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "../shared/bench.h"
+#include "../shared/errors.h"
+#include "q2.h"
+#include "slab.h"
+#include "bench_slab.h"
+
+typedef enum {
+    MALLOC,
+    SLAB,
+} slab_bench_allocator;
+
+typedef struct {
+    double allocs_per_s;
+    double frees_per_s;
+    double churn_per_s;
+    double heap_bytes_per_object;
+} slab_bench_result;
+
+static void * bench_alloc(slab_bench_allocator allocator, slab_cache * cache, size_t size) {
+    void * object = allocator == SLAB ? slab_alloc(cache) : __malloc(size);
+    if (object == NULL) {
+        fatal("Out of heap allocating %zu bytes", size);
+    }
+    *(uintptr_t *) object = (uintptr_t) object; // Touch it, as the caller would
+    return object;
+}
+
+static void bench_free(slab_bench_allocator allocator, slab_cache * cache, void * object) {
+    if (allocator == SLAB) {
+        slab_free(cache, object);
+    } else {
+        __free(object);
+    }
+}
+
+/**
+ * Allocate nobjects objects of size bytes, free them in the same order, then allocate and free one at a time.
+ * Runs on a fresh heap: call it in a child that never used __malloc.
+ */
+static slab_bench_result run_allocator(slab_bench_allocator allocator, size_t size, long nobjects) {
+    slab_bench_result result;
+    //
+    // Keep the pointers out of both heaps: glibc's malloc could move the program break under __malloc.
+    //
+    void ** objects = mmap(NULL, nobjects * sizeof(void *), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (objects == MAP_FAILED) {
+        errExit("mmap");
+    }
+
+    void * heap_start = sbrk(0);
+    slab_cache * cache = NULL;
+    if (allocator == SLAB && (cache = slab_cache_create(size, 0)) == NULL) {
+        errExit("slab_cache_create");
+    }
+
+    double start = bench_now();
+    for (long i = 0; i < nobjects; i++) {
+        objects[i] = bench_alloc(allocator, cache, size);
+    }
+    result.allocs_per_s = nobjects / (bench_now() - start);
+    result.heap_bytes_per_object = (double) (sbrk(0) - heap_start) / nobjects;
+
+    start = bench_now();
+    for (long i = 0; i < nobjects; i++) {
+        bench_free(allocator, cache, objects[i]);
+    }
+    result.frees_per_s = nobjects / (bench_now() - start);
+
+    start = bench_now();
+    for (long i = 0; i < nobjects; i++) {
+        bench_free(allocator, cache, bench_alloc(allocator, cache, size));
+    }
+    result.churn_per_s = nobjects / (bench_now() - start);
+
+    if (cache != NULL) {
+        slab_cache_destroy(cache);
+    }
+    munmap(objects, nobjects * sizeof(void *));
+    return result;
+}
+
+typedef struct {
+    slab_bench_allocator allocator;
+    size_t size;
+    long nobjects;
+} slab_bench_args;
+
+/**
+ * run_allocator for bench_run_in_child, so that each run starts from an empty heap.
+ */
+static void run_allocator_job(void * arg, void * result) {
+    slab_bench_args * args = arg;
+    *(slab_bench_result *) result = run_allocator(args->allocator, args->size, args->nobjects);
+}
+
+void chpt7_bench_slab(long nobjects) {
+    static const size_t sizes[] = { 16, 32, 64, 256 };
+    static const char * names[] = { "__malloc", "slab" };
+    char name[64];
+
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        for (slab_bench_allocator allocator = MALLOC; allocator <= SLAB; allocator++) {
+            slab_bench_result result;
+            bench_run_in_child(run_allocator_job, &(slab_bench_args) { allocator, sizes[i], nobjects }, &result, sizeof(result));
+
+            snprintf(name, sizeof(name), "slab/%zu/%s/alloc", sizes[i], names[allocator]);
+            bench_report(name, result.allocs_per_s, "allocs/s");
+            snprintf(name, sizeof(name), "slab/%zu/%s/free", sizes[i], names[allocator]);
+            bench_report(name, result.frees_per_s, "frees/s");
+            snprintf(name, sizeof(name), "slab/%zu/%s/churn", sizes[i], names[allocator]);
+            bench_report(name, result.churn_per_s, "pairs/s");
+            snprintf(name, sizeof(name), "slab/%zu/%s/heap", sizes[i], names[allocator]);
+            bench_report(name, result.heap_bytes_per_object, "bytes/object");
+        }
+    }
+}
@@ -0,0 +1,10 @@
+#ifndef __CHPT7_BENCH_SLAB_H__
+#define __CHPT7_BENCH_SLAB_H__
+
+/**
+ * Compare a slab cache with __malloc on nobjects objects of 16, 32, 64 and 256 bytes:
+ * allocation, free and alloc/free throughput, and the heap used per object.
+ */
+void chpt7_bench_slab(long nobjects);
+
+#endif
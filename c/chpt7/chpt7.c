@@ -1,12 +1,24 @@
+#include <fcntl.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 #include "../shared/errors.h"
 #include "../shared/utils.h"
 #include "q1.h"
 #include "q2.h"
+#include "bench_arena.h"
+#include "bench_falseshare.h"
+#include "bench_freebatch.h"
+#include "bench_heapprof.h"
+#include "bench_churn.h"
+#include "bench_hugeheap.h"
+#include "bench_pressure.h"
+#include "bench_shmheap.h"
+#include "bench_slab.h"
 
 void chpt7_run(const char* q, int argc, char* args[]) {
-    const char * q1_usage = "<0 < NUM_ALLOCS <= 1000000> <BLOCK_SIZE > 0> [<FREE_STEP> > 0] [<FREE_MIN> > 0] [0 < <FREE_MAX> < num_allocs]\n";
+    const char * q1_usage = "<0 < NUM_ALLOCS <= 1000000000> <BLOCK_SIZE > 0> [<FREE_STEP> > 0] [<FREE_MIN> > 0] [0 < <FREE_MAX> < num_allocs]\n";
 
     if (cmp_question(q, 1)) {
         if (argc < 3) {
@@ -37,8 +49,127 @@ void chpt7_run(const char* q, int argc, char* args[]) {
         }
 
         chpt7_q1(num_allocs, block_size, free_step, free_min, free_max);
+    } else if (strcmp(q, "q1-trace") == 0) {
+        const char * usage = "chpt7 q1-trace <glibc|q2|q2-batch> <NUM_ALLOCS> <BLOCK_SIZE> [forward|reverse|alternate|random] [SAMPLES] [CSV FILE]\n";
+        static const char * allocators[] = { "glibc", "q2", "q2-batch" };
+        static const char * patterns[] = { "forward", "reverse", "alternate", "random" };
+        q1_trace_config config = { .pattern = Q1_FORWARD, .samples = Q1_TRACE_DEFAULT_SAMPLES };
+        char * end_ptr;
+        if (argc < 4) {
+            usageErr(usage);
+        }
+        int i;
+        for (i = 0; i < 3 && strcmp(args[1], allocators[i]) != 0; i++);
+        if (i == 3) {
+            usageErr(usage);
+        }
+        config.allocator = i;
+        if ((config.num_allocs = strtol(args[2], &end_ptr, 10)) <= 0 || *end_ptr != '\0') {
+            usageErr(usage);
+        }
+        long block_size = strtol(args[3], &end_ptr, 10);
+        if (block_size <= 0 || *end_ptr != '\0') {
+            usageErr(usage);
+        }
+        config.block_size = block_size;
+        if (argc > 4) {
+            for (i = 0; i < 4 && strcmp(args[4], patterns[i]) != 0; i++);
+            if (i == 4) {
+                usageErr(usage);
+            }
+            config.pattern = i;
+        }
+        if (argc > 5 && ((config.samples = strtol(args[5], &end_ptr, 10)) <= 0 || *end_ptr != '\0')) {
+            usageErr(usage);
+        }
+        int fd = STDOUT_FILENO;
+        if (argc > 6 && (fd = open(args[6], O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1) {
+            errExit("open %s", args[6]);
+        }
+        chpt7_q1_trace(&config, fd);
     } else if (cmp_question(q, 2)) {
         chpt7_q2();
+    } else if (strcmp(q, "bench-slab") == 0) {
+        long nobjects = 1000000;
+        if (argc > 1) {
+            char * end_ptr;
+            nobjects = strtol(args[1], &end_ptr, 10);
+            if (*end_ptr != '\0' || nobjects <= 0) {
+                usageErr("chpt7 bench-slab [NUM OBJECTS]\n");
+            }
+        }
+        chpt7_bench_slab(nobjects);
+    } else if (strcmp(q, "bench-arena") == 0) {
+        long nrequests = 200000;
+        if (argc > 1) {
+            char * end_ptr;
+            nrequests = strtol(args[1], &end_ptr, 10);
+            if (*end_ptr != '\0' || nrequests <= 0) {
+                usageErr("chpt7 bench-arena [NUM REQUESTS]\n");
+            }
+        }
+        chpt7_bench_arena(nrequests);
+    } else if (strcmp(q, "bench-hugeheap") == 0) {
+        long heap_mib = 4096, naccesses = 10000000;
+        char * end_ptr;
+        if (argc > 1 && ((heap_mib = strtol(args[1], &end_ptr, 10)) <= 0 || *end_ptr != '\0')) {
+            usageErr("chpt7 bench-hugeheap [HEAP MiB] [NUM ACCESSES]\n");
+        }
+        if (argc > 2 && ((naccesses = strtol(args[2], &end_ptr, 10)) <= 0 || *end_ptr != '\0')) {
+            usageErr("chpt7 bench-hugeheap [HEAP MiB] [NUM ACCESSES]\n");
+        }
+        chpt7_bench_hugeheap(heap_mib, naccesses);
+    } else if (strcmp(q, "bench-falseshare") == 0) {
+        long nthreads = 4, nincrements = 100000000;
+        char * end_ptr;
+        if (argc > 1 && ((nthreads = strtol(args[1], &end_ptr, 10)) <= 0 || *end_ptr != '\0')) {
+            usageErr("chpt7 bench-falseshare [NUM THREADS] [NUM INCREMENTS]\n");
+        }
+        if (argc > 2 && ((nincrements = strtol(args[2], &end_ptr, 10)) <= 0 || *end_ptr != '\0')) {
+            usageErr("chpt7 bench-falseshare [NUM THREADS] [NUM INCREMENTS]\n");
+        }
+        chpt7_bench_falseshare(nthreads, nincrements);
+    } else if (strcmp(q, "bench-churn") == 0) {
+        long peak_live = 50000, ticks_per_hour = 20;
+        char * end_ptr;
+        if (argc > 1 && ((peak_live = strtol(args[1], &end_ptr, 10)) <= 0 || *end_ptr != '\0')) {
+            usageErr("chpt7 bench-churn [PEAK OBJECTS] [TICKS PER HOUR]\n");
+        }
+        if (argc > 2 && ((ticks_per_hour = strtol(args[2], &end_ptr, 10)) <= 0 || *end_ptr != '\0')) {
+            usageErr("chpt7 bench-churn [PEAK OBJECTS] [TICKS PER HOUR]\n");
+        }
+        chpt7_bench_churn(peak_live, ticks_per_hour);
+    } else if (strcmp(q, "bench-shmheap") == 0) {
+        long max_procs = 4, nops = 1000000;
+        char * end_ptr;
+        if (argc > 1 && ((max_procs = strtol(args[1], &end_ptr, 10)) <= 0 || *end_ptr != '\0')) {
+            usageErr("chpt7 bench-shmheap [MAX PROCESSES] [NUM OPERATIONS]\n");
+        }
+        if (argc > 2 && ((nops = strtol(args[2], &end_ptr, 10)) <= 0 || *end_ptr != '\0')) {
+            usageErr("chpt7 bench-shmheap [MAX PROCESSES] [NUM OPERATIONS]\n");
+        }
+        chpt7_bench_shmheap(max_procs, nops);
+    } else if (strcmp(q, "bench-heapprof") == 0) {
+        long nops = 3000000;
+        char * end_ptr;
+        if (argc > 1 && ((nops = strtol(args[1], &end_ptr, 10)) <= 0 || *end_ptr != '\0')) {
+            usageErr("chpt7 bench-heapprof [NUM OPERATIONS] [PROFILE PREFIX]\n");
+        }
+        chpt7_bench_heapprof(nops, argc > 2 ? args[2] : "/tmp/chpt7");
+    } else if (strcmp(q, "bench-freebatch") == 0) {
+        long nnodes = 10000000;
+        char * end_ptr;
+        if (argc > 1 && ((nnodes = strtol(args[1], &end_ptr, 10)) <= 0 || *end_ptr != '\0')) {
+            usageErr("chpt7 bench-freebatch [NUM NODES]\n");
+        }
+        chpt7_bench_freebatch(nnodes);
+    } else if (strcmp(q, "bench-pressure") == 0) {
+        long heap_mib = 256;
+        char * end_ptr;
+        if (argc > 1 && ((heap_mib = strtol(args[1], &end_ptr, 10)) <= 0 || *end_ptr != '\0')) {
+            usageErr("chpt7 bench-pressure [HEAP MIB]\n");
+        }
+        chpt7_bench_pressure(heap_mib);
     } else {
         usageErr("Chapter 7 has no solution for \"%s\"\n", q);
     }
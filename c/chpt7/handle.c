@@ -0,0 +1,229 @@
+#define _GNU_SOURCE /** Unlocks mremap() */
+
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#include "../shared/errors.h"
+#include "../shared/utils.h"
+#include "q2.h"
+#include "handle.h"
+
+#define HANDLE_TABLE_MIN 4096
+#define HANDLE_HEADER_SZ sizeof(uint64_t) // Each block starts with its handle, so that compaction can tell it's ours
+
+typedef struct {
+    void * block; // NULL when the handle is free
+    size_t size; // Next free handle when the handle is free
+    unsigned pins;
+} handle_entry;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+//
+// The table is mapped rather than __malloc'd: it would be the one block compaction can't move.
+//
+static handle_entry * table;
+static size_t table_size;
+static handle free_handles = HANDLE_NULL;
+static handle next_unused = HANDLE_NULL + 1;
+static handle_stats stats;
+
+static pthread_mutex_t compactor_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t compactor_wakeup = PTHREAD_COND_INITIALIZER;
+static pthread_t compactor;
+static Boolean compactor_running;
+static Boolean compactor_stopping;
+static unsigned compactor_interval_ms;
+static size_t compactor_max_bytes;
+
+/**
+ * Take a free handle, growing the table if there is none. Called with lock held.
+ */
+static handle take_handle() {
+    if (free_handles != HANDLE_NULL) {
+        handle h = free_handles;
+        free_handles = table[h].size;
+        return h;
+    }
+
+    if (next_unused >= table_size) {
+        size_t new_size = max(2 * table_size, (size_t) HANDLE_TABLE_MIN);
+        if (new_size > UINT32_MAX) {
+            return HANDLE_NULL;
+        }
+        void * new_table = table == NULL ?
+            mmap(NULL, new_size * sizeof(handle_entry), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0) :
+            mremap(table, table_size * sizeof(handle_entry), new_size * sizeof(handle_entry), MREMAP_MAYMOVE);
+        if (new_table == MAP_FAILED) {
+            return HANDLE_NULL;
+        }
+        table = new_table;
+        table_size = new_size;
+    }
+    return next_unused++;
+}
+
+static void put_handle(handle h) {
+    table[h].block = NULL;
+    table[h].size = free_handles;
+    free_handles = h;
+}
+
+handle handle_alloc(size_t size) {
+    pthread_mutex_lock(&lock);
+    handle h = take_handle();
+    void * block = h == HANDLE_NULL ? NULL : __malloc(HANDLE_HEADER_SZ + size);
+    if (block == NULL) {
+        if (h != HANDLE_NULL) {
+            put_handle(h);
+        }
+        pthread_mutex_unlock(&lock);
+        errno = ENOMEM;
+        return HANDLE_NULL;
+    }
+
+    uint64_t owner = h;
+    memcpy(block, &owner, sizeof(owner)); // __malloc blocks have no particular alignment
+    table[h] = (handle_entry) { block, size, 0 };
+    stats.nhandles++;
+    stats.live_bytes += size;
+    pthread_mutex_unlock(&lock);
+    return h;
+}
+
+void handle_free(handle h) {
+    if (h == HANDLE_NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&lock);
+    __free(table[h].block);
+    stats.nhandles--;
+    stats.live_bytes -= table[h].size;
+    put_handle(h);
+    pthread_mutex_unlock(&lock);
+}
+
+void * handle_pin(handle h) {
+    pthread_mutex_lock(&lock);
+    table[h].pins++;
+    void * memory = table[h].block + HANDLE_HEADER_SZ;
+    pthread_mutex_unlock(&lock);
+    return memory;
+}
+
+void handle_unpin(handle h) {
+    pthread_mutex_lock(&lock);
+    table[h].pins--;
+    pthread_mutex_unlock(&lock);
+}
+
+/**
+ * Handle owning the block at memory, or HANDLE_NULL if it's some other __malloc block.
+ */
+static handle owner_of(void * memory, size_t length) {
+    uint64_t owner;
+    if (length < HANDLE_HEADER_SZ) {
+        return HANDLE_NULL;
+    }
+    memcpy(&owner, memory, sizeof(owner));
+    if (owner == HANDLE_NULL || owner >= next_unused || table[owner].block != memory) {
+        return HANDLE_NULL;
+    }
+    return owner;
+}
+
+static int movable(void * memory, size_t length, void * arg) {
+    handle h = owner_of(memory, length);
+    return h != HANDLE_NULL && table[h].pins == 0;
+}
+
+static void moved(void * from, void * to, void * arg) {
+    uint64_t owner;
+    memcpy(&owner, to, sizeof(owner));
+    table[owner].block = to;
+}
+
+size_t handle_compact(size_t max_bytes) {
+    pthread_mutex_lock(&lock);
+    size_t moved_bytes = __malloc_compact(max_bytes, movable, moved, NULL);
+    stats.ncompactions++;
+    stats.moved_bytes += moved_bytes;
+    stats.trimmed_bytes += __malloc_trim(0);
+    pthread_mutex_unlock(&lock);
+    return moved_bytes;
+}
+
+static void * run_compactor(void * arg) {
+    pthread_mutex_lock(&compactor_lock);
+    while (!compactor_stopping) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += compactor_interval_ms / 1000;
+        deadline.tv_nsec += (compactor_interval_ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        int s = 0;
+        while (!compactor_stopping && s != ETIMEDOUT) {
+            s = pthread_cond_timedwait(&compactor_wakeup, &compactor_lock, &deadline);
+        }
+
+        if (!compactor_stopping) {
+            pthread_mutex_unlock(&compactor_lock);
+            handle_compact(compactor_max_bytes);
+            pthread_mutex_lock(&compactor_lock);
+        }
+    }
+    pthread_mutex_unlock(&compactor_lock);
+    return NULL;
+}
+
+int handle_compactor_start(unsigned interval_ms, size_t max_bytes) {
+    pthread_mutex_lock(&compactor_lock);
+    if (compactor_running) {
+        pthread_mutex_unlock(&compactor_lock);
+        errno = EBUSY;
+        return -1;
+    }
+    compactor_interval_ms = interval_ms;
+    compactor_max_bytes = max_bytes;
+    compactor_stopping = FALSE;
+    int s = pthread_create(&compactor, NULL, run_compactor, NULL);
+    compactor_running = s == 0;
+    pthread_mutex_unlock(&compactor_lock);
+    if (s != 0) {
+        errno = s;
+        return -1;
+    }
+    return 0;
+}
+
+void handle_compactor_stop(void) {
+    pthread_mutex_lock(&compactor_lock);
+    if (!compactor_running) {
+        pthread_mutex_unlock(&compactor_lock);
+        return;
+    }
+    compactor_stopping = TRUE;
+    pthread_cond_signal(&compactor_wakeup);
+    pthread_mutex_unlock(&compactor_lock);
+
+    int s = pthread_join(compactor, NULL);
+    if (s != 0) {
+        errExitEN(s, "pthread_join");
+    }
+    pthread_mutex_lock(&compactor_lock);
+    compactor_running = FALSE;
+    pthread_mutex_unlock(&compactor_lock);
+}
+
+void handle_get_stats(handle_stats * s) {
+    pthread_mutex_lock(&lock);
+    *s = stats;
+    __malloc_get_stats(&s->heap);
+    pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,75 @@
+#ifndef __CHPT7_HANDLE_H__
+#define __CHPT7_HANDLE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "q2.h"
+
+/**
+ * Relocatable allocations on top of __malloc, for long-lived data that would otherwise pin the heap's layout forever.
+ *
+ * handle_alloc returns a handle rather than a pointer. handle_pin gives the block's current address,
+ * which stays valid until the matching handle_unpin. In between, the block can be moved: handle_compact slides
+ * unpinned blocks down into the free space below them (__malloc_compact), then trims the free end of the heap
+ * (__malloc_trim). It can run in the background, see handle_compactor_start.
+ *
+ * All functions are thread safe with respect to each other, but not to direct __malloc and __free calls,
+ * which must not run at the same time as a compaction.
+ */
+
+typedef uint32_t handle;
+
+#define HANDLE_NULL 0
+
+/**
+ * Allocate size bytes, or return HANDLE_NULL with errno set to ENOMEM.
+ */
+handle handle_alloc(size_t size);
+
+/**
+ * Free the block of h, pinned or not. HANDLE_NULL is ignored.
+ */
+void handle_free(handle h);
+
+/**
+ * Address of the block of h, which won't move until the matching handle_unpin. Pins nest.
+ */
+void * handle_pin(handle h);
+
+void handle_unpin(handle h);
+
+/**
+ * Move up to max_bytes of unpinned blocks down the heap, then trim it. Returns the bytes moved.
+ */
+size_t handle_compact(size_t max_bytes);
+
+/**
+ * Start a thread that calls handle_compact(max_bytes) every interval_ms milliseconds.
+ * Returns 0, or -1 with errno set if it couldn't be started (EBUSY if it already is).
+ *
+ * Best started before the first __malloc on an sbrk heap: creating a thread may call glibc's malloc,
+ * and if that moves the program break __malloc can no longer grow the heap.
+ */
+int handle_compactor_start(unsigned interval_ms, size_t max_bytes);
+
+/**
+ * Stop the compactor thread and wait for it to finish. A no-op if it isn't running.
+ */
+void handle_compactor_stop(void);
+
+typedef struct {
+    size_t nhandles; // Allocated
+    size_t live_bytes; // Asked for by handle_alloc, for handles still allocated
+    size_t ncompactions; // So far
+    size_t moved_bytes; // By compactions so far
+    size_t trimmed_bytes; // Released by compactions so far
+    heap_stats heap; // Taken at the same time
+} handle_stats;
+
+/**
+ * The heap's stats are taken while no compaction runs.
+ */
+void handle_get_stats(handle_stats * stats);
+
+#endif
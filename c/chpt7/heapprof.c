@@ -0,0 +1,394 @@
+#include <errno.h>
+#include <execinfo.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "../shared/utils.h"
+#include "heapprof.h"
+
+#define HEAPPROF_SKIPPED_FRAMES 2 // __heapprof_sample and __malloc
+#define HEAPPROF_STACK_SLOTS (2 * HEAPPROF_MAX_STACKS) // Hash tables are kept at most half full
+#define HEAPPROF_LIVE_SLOTS (2 * HEAPPROF_MAX_LIVE)
+#define HEAPPROF_PATH_MAX 4096
+
+typedef struct {
+    uint64_t hash; // 0 for an empty slot
+    int depth;
+    size_t alloc_count;
+    size_t alloc_bytes;
+    size_t live_count;
+    size_t live_bytes;
+    void * frames[HEAPPROF_MAX_DEPTH];
+} heapprof_stack;
+
+typedef struct {
+    void * memory; // NULL for an empty slot
+    size_t size;
+    heapprof_stack * stack;
+} heapprof_live;
+
+long __heapprof_bytes_until_sample = LONG_MAX;
+size_t __heapprof_nlive;
+uint16_t __heapprof_filter[HEAPPROF_FILTER_SZ];
+volatile sig_atomic_t __heapprof_dump_requested;
+
+//
+// Tables are mapped rather than __malloc'd, so that the profiler never shows up in its own profiles.
+//
+static heapprof_stack * stacks;
+static heapprof_live * live;
+static heapprof_stats stats;
+static size_t interval;
+static uint64_t seed = 88172645463325252ULL;
+static char prefix[HEAPPROF_PATH_MAX];
+static int ndumps;
+static Boolean exit_handler_installed;
+
+static uint64_t xorshift(uint64_t * state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+/**
+ * Bytes until the next sample: exponentially distributed with mean interval, so that samples form a Poisson process
+ * over the bytes allocated.
+ */
+static long next_sample() {
+    double u = ((xorshift(&seed) >> 11) + 1) * 0x1p-53; // In (0, 1]
+    double bytes = -log(u) * interval;
+    return bytes < LONG_MAX / 2 ? (long) bytes : LONG_MAX / 2;
+}
+
+static size_t hash_pointer(const void * memory) {
+    return ((uintptr_t) memory * 0x9e3779b97f4a7c15ULL) >> 32; // Fibonacci hashing: the high bits are the mixed ones
+}
+
+static void request_dump(int sig) {
+    __heapprof_dump_requested = 1;
+}
+
+static void dump_at_exit() {
+    if (stacks != NULL) {
+        heapprof_dump();
+    }
+}
+
+int heapprof_start(size_t sample_interval, const char * path_prefix) {
+    if (stacks != NULL) {
+        errno = EBUSY;
+        return -1;
+    }
+    if (strlen(path_prefix) + sizeof(".0000.heap") > HEAPPROF_PATH_MAX) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    stacks = mmap(NULL, HEAPPROF_STACK_SLOTS * sizeof(heapprof_stack), PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    live = mmap(NULL, HEAPPROF_LIVE_SLOTS * sizeof(heapprof_live), PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (stacks == MAP_FAILED || live == MAP_FAILED) {
+        int saved_errno = errno;
+        if (stacks != MAP_FAILED) {
+            munmap(stacks, HEAPPROF_STACK_SLOTS * sizeof(heapprof_stack));
+        }
+        if (live != MAP_FAILED) {
+            munmap(live, HEAPPROF_LIVE_SLOTS * sizeof(heapprof_live));
+        }
+        stacks = NULL;
+        live = NULL;
+        errno = saved_errno;
+        return -1;
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = request_dump;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGUSR2, &sa, NULL) == -1) {
+        int saved_errno = errno;
+        heapprof_stop();
+        errno = saved_errno;
+        return -1;
+    }
+    if (!exit_handler_installed) {
+        atexit(dump_at_exit);
+        exit_handler_installed = TRUE;
+    }
+
+    //
+    // The unwinder is loaded on first use, and that calls malloc: do it now rather than from inside __malloc.
+    //
+    void * frames[HEAPPROF_MAX_DEPTH];
+    backtrace(frames, HEAPPROF_MAX_DEPTH);
+
+    strcpy(prefix, path_prefix);
+    interval = sample_interval == 0 ? HEAPPROF_DEFAULT_INTERVAL : sample_interval;
+    memset(&stats, 0, sizeof(stats));
+    __heapprof_nlive = 0;
+    __heapprof_bytes_until_sample = next_sample();
+    return 0;
+}
+
+void heapprof_stop(void) {
+    if (stacks == NULL) {
+        return;
+    }
+    signal(SIGUSR2, SIG_DFL);
+    munmap(stacks, HEAPPROF_STACK_SLOTS * sizeof(heapprof_stack));
+    munmap(live, HEAPPROF_LIVE_SLOTS * sizeof(heapprof_live));
+    stacks = NULL;
+    live = NULL;
+    memset(__heapprof_filter, 0, sizeof(__heapprof_filter));
+    __heapprof_nlive = 0;
+    __heapprof_bytes_until_sample = LONG_MAX;
+    __heapprof_dump_requested = 0;
+}
+
+/**
+ * Slot of the stack with these frames, added if it's new. NULL if the table is full.
+ */
+static heapprof_stack * find_stack(void ** frames, int depth) {
+    uint64_t hash = 14695981039346656037ULL; // FNV-1a
+    for (int i = 0; i < depth; i++) {
+        hash = (hash ^ (uintptr_t) frames[i]) * 1099511628211ULL;
+    }
+    hash = max(hash, (uint64_t) 1);
+
+    for (size_t i = hash % HEAPPROF_STACK_SLOTS; ; i = (i + 1) % HEAPPROF_STACK_SLOTS) {
+        heapprof_stack * stack = &stacks[i];
+        if (stack->hash == hash && stack->depth == depth && memcmp(stack->frames, frames, depth * sizeof(void *)) == 0) {
+            return stack;
+        }
+        if (stack->hash == 0) {
+            if (stats.nstacks == HEAPPROF_MAX_STACKS) {
+                return NULL;
+            }
+            stack->hash = hash;
+            stack->depth = depth;
+            memcpy(stack->frames, frames, depth * sizeof(void *));
+            stats.nstacks++;
+            return stack;
+        }
+    }
+}
+
+static void live_insert(heapprof_live entry) {
+    __heapprof_filter[__heapprof_filter_slot(entry.memory)]++;
+    size_t i = hash_pointer(entry.memory) % HEAPPROF_LIVE_SLOTS;
+    while (live[i].memory != NULL) {
+        i = (i + 1) % HEAPPROF_LIVE_SLOTS;
+    }
+    live[i] = entry;
+}
+
+/**
+ * Take the entry of memory out of the live table into removed. Returns FALSE if memory wasn't sampled.
+ */
+static Boolean live_remove(void * memory, heapprof_live * removed) {
+    size_t i = hash_pointer(memory) % HEAPPROF_LIVE_SLOTS;
+    while (live[i].memory != memory) {
+        if (live[i].memory == NULL) {
+            return FALSE;
+        }
+        i = (i + 1) % HEAPPROF_LIVE_SLOTS;
+    }
+    *removed = live[i];
+    __heapprof_filter[__heapprof_filter_slot(memory)]--;
+
+    //
+    // Shift back the entries after it that would no longer be found past the hole, as linear probing has no tombstones.
+    //
+    size_t hole = i;
+    for (size_t j = (i + 1) % HEAPPROF_LIVE_SLOTS; live[j].memory != NULL; j = (j + 1) % HEAPPROF_LIVE_SLOTS) {
+        size_t home = hash_pointer(live[j].memory) % HEAPPROF_LIVE_SLOTS;
+        //
+        // Entry j may fill the hole if its home slot isn't cyclically in (hole, j].
+        //
+        if ((j > hole && (home <= hole || home > j)) || (j < hole && home <= hole && home > j)) {
+            live[hole] = live[j];
+            hole = j;
+        }
+    }
+    live[hole].memory = NULL;
+    return TRUE;
+}
+
+void __heapprof_sample(void * memory, size_t size) {
+    if (stacks == NULL) {
+        //
+        // Not profiling, and the countdown from LONG_MAX ran out.
+        //
+        __heapprof_bytes_until_sample = LONG_MAX;
+        return;
+    }
+    __heapprof_bytes_until_sample = next_sample();
+    if (__heapprof_dump_requested) {
+        __heapprof_dump_pending();
+    }
+    if (memory == NULL) {
+        return;
+    }
+
+    void * frames[HEAPPROF_SKIPPED_FRAMES + HEAPPROF_MAX_DEPTH];
+    int depth = backtrace(frames, HEAPPROF_SKIPPED_FRAMES + HEAPPROF_MAX_DEPTH) - HEAPPROF_SKIPPED_FRAMES;
+    heapprof_stack * stack = find_stack(frames + HEAPPROF_SKIPPED_FRAMES, max(depth, 0));
+    if (stack == NULL || __heapprof_nlive == HEAPPROF_MAX_LIVE) {
+        stats.ndropped++;
+        return;
+    }
+    stats.nsamples++;
+    stack->alloc_count++;
+    stack->alloc_bytes += size;
+    stack->live_count++;
+    stack->live_bytes += size;
+
+    live_insert((heapprof_live) { memory, size, stack });
+    __heapprof_nlive++;
+}
+
+void __heapprof_dump_pending(void) {
+    __heapprof_dump_requested = 0;
+    if (stacks != NULL) {
+        heapprof_dump();
+    }
+}
+
+void __heapprof_forget(void * memory) {
+    heapprof_live entry;
+    if (live_remove(memory, &entry)) {
+        entry.stack->live_count--;
+        entry.stack->live_bytes -= entry.size;
+        __heapprof_nlive--;
+    }
+}
+
+void __heapprof_move(void * from, void * to) {
+    heapprof_live entry;
+    if (live_remove(from, &entry)) {
+        entry.memory = to;
+        live_insert(entry);
+    }
+}
+
+/**
+ * write all n bytes, resuming after short writes. Returns 0, or -1 with errno set: dumps run inside __malloc and at
+ * exit, where a full disk must not kill the process as deliver_write would.
+ */
+static int write_all(int fd, const char * buf, size_t n) {
+    while (n > 0) {
+        ssize_t written = write(fd, buf, n);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buf += written;
+        n -= written;
+    }
+    return 0;
+}
+
+/**
+ * Append the contents of /proc/self/maps, which pprof needs to find the binaries the addresses are in.
+ * Returns 0, or -1 with errno set.
+ */
+static int write_mappings(int fd) {
+    char buf[4096];
+    ssize_t n;
+    int maps = open("/proc/self/maps", O_RDONLY);
+    if (maps == -1) {
+        return 0;
+    }
+    while ((n = read(maps, buf, sizeof(buf))) > 0) {
+        if (write_all(fd, buf, n) == -1) {
+            break;
+        }
+    }
+    int saved_errno = errno;
+    close(maps);
+    errno = saved_errno;
+    return n == 0 ? 0 : -1;
+}
+
+/**
+ * The stack lines of the profile, after its header line. Returns 0, or -1 with errno set.
+ */
+static int write_stacks(int fd) {
+    char line[128 + HEAPPROF_MAX_DEPTH * 19]; // Counts, then " 0x..." frames
+    for (size_t i = 0; i < HEAPPROF_STACK_SLOTS; i++) {
+        heapprof_stack * stack = &stacks[i];
+        if (stack->hash == 0) {
+            continue;
+        }
+        int n = snprintf(line, sizeof(line), "%zu: %zu [%zu: %zu] @", stack->live_count, stack->live_bytes,
+            stack->alloc_count, stack->alloc_bytes);
+        for (int j = 0; j < stack->depth; j++) {
+            n += snprintf(line + n, sizeof(line) - n, " %p", stack->frames[j]);
+        }
+        line[n++] = '\n';
+        if (write_all(fd, line, n) == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int heapprof_dump(void) {
+    if (stacks == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    char path[sizeof(prefix) + sizeof(".00000.heap")];
+    snprintf(path, sizeof(path), "%s.%04d.heap", prefix, ++ndumps % 10000);
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        return -1;
+    }
+
+    char line[128];
+    size_t live_count = 0, live_bytes = 0, alloc_count = 0, alloc_bytes = 0;
+    for (size_t i = 0; i < HEAPPROF_STACK_SLOTS; i++) {
+        live_count += stacks[i].live_count;
+        live_bytes += stacks[i].live_bytes;
+        alloc_count += stacks[i].alloc_count;
+        alloc_bytes += stacks[i].alloc_bytes;
+    }
+    int n = snprintf(line, sizeof(line), "heap profile: %zu: %zu [%zu: %zu] @ heap_v2/%zu\n",
+        live_count, live_bytes, alloc_count, alloc_bytes, interval);
+    const char mapped[] = "\nMAPPED_LIBRARIES:\n";
+    int failed = write_all(fd, line, n) == -1 || write_stacks(fd) == -1 ||
+        write_all(fd, mapped, sizeof(mapped) - 1) == -1 || write_mappings(fd) == -1;
+    int saved_errno = errno;
+    if (close(fd) == -1 && !failed) {
+        failed = 1;
+        saved_errno = errno;
+    }
+    if (failed) {
+        //
+        // A truncated profile would only mislead pprof.
+        //
+        unlink(path);
+        errno = saved_errno;
+        return -1;
+    }
+    return 0;
+}
+
+void heapprof_get_stats(heapprof_stats * s) {
+    *s = stats;
+    s->nlive = __heapprof_nlive;
+}
@@ -0,0 +1,108 @@
+#ifndef __CHPT7_HEAPPROF_H__
+#define __CHPT7_HEAPPROF_H__
+
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Sampling heap profiler for __malloc and __free.
+ *
+ * About one allocation every interval bytes is sampled: the gaps between samples are drawn at random with that mean,
+ * so an allocation of size bytes is sampled with probability 1 - exp(-size / interval), whatever the allocations
+ * around it. Sampled allocations record the stack that made them, and stay tracked until freed.
+ *
+ * Profiles are written in the legacy heap profile format of gperftools, which pprof reads along with the binary:
+ *     pprof --text build/release/run PREFIX.0001.heap
+ * It has the sampled allocations still live and all those made since the start, by stack,
+ * and pprof scales them back up using the sampling interval.
+ *
+ * Not thread safe, like __malloc.
+ */
+
+#define HEAPPROF_DEFAULT_INTERVAL (512 * 1024)
+#define HEAPPROF_MAX_DEPTH 32 // Frames kept of each stack
+#define HEAPPROF_MAX_STACKS 4096 // Distinct stacks, later ones are dropped
+#define HEAPPROF_MAX_LIVE 65536 // Sampled allocations tracked at the same time, later ones are dropped
+
+/**
+ * Start sampling about one allocation every interval bytes (0 for HEAPPROF_DEFAULT_INTERVAL).
+ * Profiles are written to files named PREFIX.NNNN.heap: when the process gets SIGUSR2, when it exits,
+ * and on heapprof_dump.
+ * The signal handler only asks for the dump, which is written at the next __free or __free_batch, or at the next
+ * sampled allocation, whichever comes first. So a process that frees nothing and allocates less than about interval
+ * bytes after the signal doesn't dump until it exits.
+ * Returns 0, or -1 with errno set (EBUSY if already started).
+ *
+ * Best called before the first __malloc on an sbrk heap: getting stack traces loads the unwinder on first use,
+ * which calls glibc's malloc, so the first one is taken right away. If it moves the program break
+ * __malloc can no longer grow the heap.
+ */
+int heapprof_start(size_t interval, const char * prefix);
+
+/**
+ * Stop sampling and forget every sample. A no-op if not started.
+ */
+void heapprof_stop(void);
+
+/**
+ * Write a profile to the next PREFIX.NNNN.heap file. Returns 0, or -1 with errno set.
+ * Only uses system calls, and never allocates.
+ */
+int heapprof_dump(void);
+
+typedef struct {
+    size_t nsamples; // Since the start
+    size_t nlive; // Sampled allocations not freed yet
+    size_t ndropped; // Samples not recorded, for lack of room
+    size_t nstacks;
+} heapprof_stats;
+
+void heapprof_get_stats(heapprof_stats * stats);
+
+//
+// Called by __malloc and __free. Inline, so that allocations that aren't sampled only cost a subtraction,
+//  and frees a comparison while no sampled allocation is live, then a look at a small table that stays in the cache,
+//  plus the load of the flag that SIGUSR2 sets.
+//
+#define HEAPPROF_FILTER_SZ 16384
+
+extern long __heapprof_bytes_until_sample; // LONG_MAX while not profiling
+extern size_t __heapprof_nlive;
+extern uint16_t __heapprof_filter[HEAPPROF_FILTER_SZ]; // Sampled allocations live, by hash of their address
+extern volatile sig_atomic_t __heapprof_dump_requested; // Set by SIGUSR2
+
+static inline size_t __heapprof_filter_slot(const void * memory) {
+    return ((uintptr_t) memory * 0x9e3779b97f4a7c15ULL) >> (64 - 14); // 14 bits for HEAPPROF_FILTER_SZ
+}
+
+void __heapprof_sample(void * memory, size_t size);
+void __heapprof_dump_pending(void);
+void __heapprof_forget(void * memory);
+void __heapprof_move(void * from, void * to);
+
+static inline void __heapprof_malloc(void * memory, size_t size) {
+    if ((__heapprof_bytes_until_sample -= (long) size) < 0) {
+        __heapprof_sample(memory, size);
+    }
+}
+
+static inline void __heapprof_free(void * memory) {
+    if (__heapprof_dump_requested) {
+        __heapprof_dump_pending();
+    }
+    if (__heapprof_nlive != 0 && __heapprof_filter[__heapprof_filter_slot(memory)] != 0) {
+        __heapprof_forget(memory);
+    }
+}
+
+/**
+ * For __malloc_compact, which moves blocks.
+ */
+static inline void __heapprof_moved(void * from, void * to) {
+    if (__heapprof_nlive != 0 && __heapprof_filter[__heapprof_filter_slot(from)] != 0) {
+        __heapprof_move(from, to);
+    }
+}
+
+#endif
@@ -0,0 +1,28 @@
+#include <errno.h>
+
+#include "slab.h"
+#include "hot.h"
+
+#define HOT_NCLASSES (HOT_MAX_SZ / CACHE_LINE_SZ)
+
+static slab_cache * classes[HOT_NCLASSES]; // Objects of 1, 2... cache lines, created on first use
+
+void * __malloc_hot(size_t size) {
+    if (size > HOT_MAX_SZ) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    size_t lines = size == 0 ? 1 : (size + CACHE_LINE_SZ - 1) / CACHE_LINE_SZ;
+    slab_cache ** cache = &classes[lines - 1];
+    if (*cache == NULL && (*cache = slab_cache_create(lines * CACHE_LINE_SZ, CACHE_LINE_SZ)) == NULL) {
+        return NULL;
+    }
+    return slab_alloc(*cache);
+}
+
+void __free_hot(void * memory) {
+    if (memory != NULL) {
+        slab_free(slab_cache_of(memory), memory);
+    }
+}
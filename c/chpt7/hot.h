@@ -0,0 +1,32 @@
+#ifndef __CHPT7_HOT_H__
+#define __CHPT7_HOT_H__
+
+#include <stddef.h>
+
+/**
+ * Allocation classes for hot objects, and objects owned by a thread: counters, locks, per-thread state.
+ *
+ * __malloc packs each object right after its 40-byte header and right before the next block's, so two small objects
+ * written by different threads often share a cache line, which then bounces between their CPUs (false sharing).
+ * Hot objects instead start on a cache line and are padded to a whole number of lines, so they never share one.
+ * They come from slab caches of CACHE_LINE_SZ multiples, whose metadata is on the first line of each slab,
+ * away from the objects, and whose free list only goes through free objects.
+ *
+ * Not thread safe, like __malloc: allocate before starting the threads, or under a lock.
+ */
+
+#define CACHE_LINE_SZ 64
+#define HOT_MAX_SZ (4 * CACHE_LINE_SZ)
+
+/**
+ * Allocate size bytes on their own cache lines, or return NULL with errno set:
+ * EINVAL if size is larger than HOT_MAX_SZ, ENOMEM if __malloc fails.
+ */
+void * __malloc_hot(size_t size);
+
+/**
+ * Free memory from __malloc_hot. NULL is ignored.
+ */
+void __free_hot(void * memory);
+
+#endif
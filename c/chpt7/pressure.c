@@ -0,0 +1,320 @@
+#define _GNU_SOURCE /* For pipe2 and strchrnul */
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/magic.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/vfs.h>
+#include <unistd.h>
+
+#include "../shared/errors.h"
+#include "../shared/utils.h"
+#include "q2.h"
+#include "pressure.h"
+
+int __pressure_pending;
+
+static pthread_mutex_t monitor_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t monitor;
+static Boolean monitor_running;
+static int stop_pipe[2];
+static int psi_fd = -1; // Trigger, when psi_trigger
+static char psi_path[PATH_MAX];
+static char memory_high_path[PATH_MAX];
+static char memory_current_path[PATH_MAX];
+static pressure_config config;
+
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static pressure_stats stats;
+
+static struct {
+    pressure_flush flush;
+    void * arg;
+} flushes[PRESSURE_MAX_FLUSHES];
+static int nflushes;
+static size_t min_free_block = PRESSURE_DEFAULT_MIN_FREE_BLOCK;
+
+//
+// Files are read with plain system calls: stdio would allocate with glibc's malloc.
+//
+
+/**
+ * Read the start of the file at path into buf, as a string. Returns its length, or -1.
+ */
+static ssize_t read_file(const char * path, char * buf, size_t size) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+    ssize_t n = read(fd, buf, size - 1);
+    safe_close(fd);
+    if (n >= 0) {
+        buf[n] = '\0';
+    }
+    return n;
+}
+
+/**
+ * The "some avg10" of the PSI file at path: the percentage of the last 10 s some task stalled on memory. -1 if unreadable.
+ */
+static double read_avg10(const char * path) {
+    char buf[256];
+    if (read_file(path, buf, sizeof(buf)) == -1) {
+        return -1;
+    }
+    char * some = strstr(buf, "some avg10=");
+    if (some == NULL || (some != buf && some[-1] != '\n')) {
+        return -1;
+    }
+    return strtod(some + strlen("some avg10="), NULL);
+}
+
+/**
+ * The number in the cgroup file at path: ULLONG_MAX for "max", 0 if unreadable.
+ */
+static unsigned long long read_cgroup_value(const char * path) {
+    char buf[64];
+    if (read_file(path, buf, sizeof(buf)) <= 0) {
+        return 0;
+    }
+    if (strncmp(buf, "max", 3) == 0) {
+        return ULLONG_MAX;
+    }
+    return strtoull(buf, NULL, 10);
+}
+
+static Boolean cgroup_above_high() {
+    unsigned long long high = read_cgroup_value(memory_high_path);
+    return high != ULLONG_MAX && high != 0 && read_cgroup_value(memory_current_path) >= config.high_ratio * high;
+}
+
+/**
+ * Find the cgroup v2 directory of the process from its "0::PATH" line in /proc/self/cgroup, into dir.
+ * Returns 0, or -1 if it has none.
+ */
+static int own_cgroup_dir(char * dir, size_t size) {
+    char buf[4096];
+    if (read_file("/proc/self/cgroup", buf, sizeof(buf)) == -1) {
+        return -1;
+    }
+    char * line = buf;
+    while (strncmp(line, "0::", 3) != 0) {
+        if ((line = strchr(line, '\n')) == NULL) {
+            return -1;
+        }
+        line++;
+    }
+    line += 3;
+    char * end = strchrnul(line, '\n');
+    if (snprintf(dir, size, "%s%.*s", PRESSURE_CGROUP_ROOT, (int) (end - line), line) >= (int) size) {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Watch psi_path with a trigger, if it's the kernel's own file. Returns the file descriptor to poll, or -1.
+ */
+static int open_psi_trigger() {
+    struct statfs fs;
+    if (statfs(psi_path, &fs) == -1 || fs.f_type != PROC_SUPER_MAGIC) {
+        return -1;
+    }
+    int fd = open(psi_path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+    char trigger[64];
+    int len = snprintf(trigger, sizeof(trigger), "some %u %u", config.stall_us, config.window_us);
+    if (write(fd, trigger, len + 1) == -1) {
+        safe_close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void * run_monitor(void * arg) {
+    struct pollfd fds[2] = {
+        { .fd = stop_pipe[0], .events = POLLIN },
+        { .fd = psi_fd, .events = POLLPRI },
+    };
+    nfds_t nfds = stats.psi_trigger ? 2 : 1;
+    for (;;) {
+        if (poll(fds, nfds, config.interval_ms) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            errExit("poll");
+        }
+        if (fds[0].revents != 0) {
+            break;
+        }
+
+        Boolean pressure = FALSE;
+        if (stats.psi_trigger) {
+            pressure = (fds[1].revents & POLLPRI) != 0;
+        } else if (stats.psi) {
+            pressure = read_avg10(psi_path) >= config.avg10;
+        }
+        if (stats.cgroup && cgroup_above_high()) {
+            pressure = TRUE;
+        }
+        if (pressure) {
+            pthread_mutex_lock(&stats_lock);
+            stats.nevents++;
+            pthread_mutex_unlock(&stats_lock);
+            __atomic_store_n(&__pressure_pending, 1, __ATOMIC_RELEASE);
+        }
+    }
+    return NULL;
+}
+
+int pressure_monitor_start(const pressure_config * c) {
+    pthread_mutex_lock(&monitor_lock);
+    if (monitor_running) {
+        pthread_mutex_unlock(&monitor_lock);
+        errno = EBUSY;
+        return -1;
+    }
+    memset(&config, 0, sizeof(config));
+    if (c != NULL) {
+        config = *c;
+    }
+    if (config.stall_us == 0) {
+        config.stall_us = PRESSURE_DEFAULT_STALL_US;
+    }
+    if (config.window_us == 0) {
+        config.window_us = PRESSURE_DEFAULT_WINDOW_US;
+    }
+    if (config.avg10 == 0) {
+        config.avg10 = PRESSURE_DEFAULT_AVG10;
+    }
+    if (config.high_ratio == 0) {
+        config.high_ratio = PRESSURE_DEFAULT_HIGH_RATIO;
+    }
+    if (config.interval_ms == 0) {
+        config.interval_ms = PRESSURE_DEFAULT_INTERVAL_MS;
+    }
+    min_free_block = config.min_free_block != 0 ? config.min_free_block : PRESSURE_DEFAULT_MIN_FREE_BLOCK;
+
+    pthread_mutex_lock(&stats_lock);
+    memset(&stats, 0, sizeof(stats));
+    snprintf(psi_path, sizeof(psi_path), "%s", config.psi_path != NULL ? config.psi_path : PRESSURE_PSI_PATH);
+    if ((psi_fd = open_psi_trigger()) != -1) {
+        stats.psi = stats.psi_trigger = TRUE;
+    } else {
+        stats.psi = read_avg10(psi_path) != -1;
+    }
+
+    char cgroup_dir[PATH_MAX];
+    if (config.cgroup_dir != NULL) {
+        snprintf(cgroup_dir, sizeof(cgroup_dir), "%s", config.cgroup_dir);
+    } else if (own_cgroup_dir(cgroup_dir, sizeof(cgroup_dir)) == -1) {
+        cgroup_dir[0] = '\0';
+    }
+    if (cgroup_dir[0] != '\0'
+        && snprintf(memory_high_path, sizeof(memory_high_path), "%s/memory.high", cgroup_dir) < (int) sizeof(memory_high_path)
+        && snprintf(memory_current_path, sizeof(memory_current_path), "%s/memory.current", cgroup_dir) < (int) sizeof(memory_current_path)) {
+        stats.cgroup = access(memory_high_path, R_OK) == 0 && access(memory_current_path, R_OK) == 0;
+    }
+    Boolean watching = stats.psi || stats.cgroup;
+    pthread_mutex_unlock(&stats_lock);
+
+    //
+    // Nothing to watch: nothing to do.
+    //
+    if (!watching) {
+        pthread_mutex_unlock(&monitor_lock);
+        return 0;
+    }
+
+    int s = 0;
+    if (pipe2(stop_pipe, O_CLOEXEC) == -1) {
+        s = errno;
+    } else if ((s = pthread_create(&monitor, NULL, run_monitor, NULL)) != 0) {
+        safe_close(stop_pipe[0]);
+        safe_close(stop_pipe[1]);
+    }
+    if (s != 0 && psi_fd != -1) {
+        safe_close(psi_fd);
+        psi_fd = -1;
+    }
+    monitor_running = s == 0;
+    pthread_mutex_unlock(&monitor_lock);
+    if (s != 0) {
+        errno = s;
+        return -1;
+    }
+    return 0;
+}
+
+void pressure_monitor_stop(void) {
+    pthread_mutex_lock(&monitor_lock);
+    if (!monitor_running) {
+        pthread_mutex_unlock(&monitor_lock);
+        return;
+    }
+    //
+    // The monitor polls the read end: EOF stops it.
+    //
+    safe_close(stop_pipe[1]);
+    int s = pthread_join(monitor, NULL);
+    if (s != 0) {
+        errExitEN(s, "pthread_join");
+    }
+    safe_close(stop_pipe[0]);
+    if (psi_fd != -1) {
+        safe_close(psi_fd);
+        psi_fd = -1;
+    }
+    __atomic_store_n(&__pressure_pending, 0, __ATOMIC_RELAXED);
+    monitor_running = FALSE;
+    pthread_mutex_unlock(&monitor_lock);
+}
+
+size_t pressure_relieve(void) {
+    for (int i = 0; i < nflushes; i++) {
+        flushes[i].flush(flushes[i].arg);
+    }
+    size_t trimmed = __malloc_trim(0);
+    size_t released = __malloc_release_free(min_free_block);
+
+    pthread_mutex_lock(&stats_lock);
+    stats.nreliefs++;
+    stats.trimmed_bytes += trimmed;
+    stats.released_bytes += released;
+    pthread_mutex_unlock(&stats_lock);
+    return trimmed + released;
+}
+
+int pressure_register_flush(pressure_flush flush, void * arg) {
+    if (nflushes == PRESSURE_MAX_FLUSHES) {
+        errno = ENOSPC;
+        return -1;
+    }
+    flushes[nflushes].flush = flush;
+    flushes[nflushes].arg = arg;
+    nflushes++;
+    return 0;
+}
+
+void pressure_get_stats(pressure_stats * s) {
+    pthread_mutex_lock(&stats_lock);
+    *s = stats;
+    pthread_mutex_unlock(&stats_lock);
+}
+
+int __pressure_relieve_pending(void) {
+    //
+    // Cleared first: flushes may __free.
+    //
+    if (__atomic_exchange_n(&__pressure_pending, 0, __ATOMIC_ACQUIRE)) {
+        pressure_relieve();
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,105 @@
+#ifndef __CHPT7_PRESSURE_H__
+#define __CHPT7_PRESSURE_H__
+
+#include <stddef.h>
+
+/**
+ * Give memory back to the kernel when the system or our cgroup runs short of it, rather than get OOM-killed
+ * while holding free blocks.
+ *
+ * A monitor thread watches memory pressure stall information (PSI) and the cgroup's memory.current against
+ * its memory.high. When either says memory is tight, the heap is relieved: its free end is trimmed (__malloc_trim),
+ * the pages inside large free blocks are handed back with MADV_FREE (__malloc_release_free), and the caches
+ * registered with pressure_register_flush are flushed.
+ *
+ * As __malloc isn't thread safe, the monitor doesn't touch the heap: the thread calling __free next does it,
+ * or __malloc before it grows the heap. pressure_relieve does it right away.
+ *
+ * When neither PSI nor the cgroup files can be read (older kernels, cgroup v1, no /proc), the monitor does nothing.
+ */
+
+#define PRESSURE_PSI_PATH "/proc/pressure/memory"
+#define PRESSURE_CGROUP_ROOT "/sys/fs/cgroup"
+#define PRESSURE_DEFAULT_STALL_US 100000 // Tasks stalled on memory for 100 ms...
+#define PRESSURE_DEFAULT_WINDOW_US 2000000 // ...within 2 s, the shortest window allowed without privileges
+#define PRESSURE_DEFAULT_AVG10 10.0 // When polling a file, pressure is a "some avg10" from this percentage
+#define PRESSURE_DEFAULT_HIGH_RATIO 0.9 // Of memory.high
+#define PRESSURE_DEFAULT_INTERVAL_MS 1000
+#define PRESSURE_DEFAULT_MIN_FREE_BLOCK (64 * 1024) // Smaller free blocks are left alone by MADV_FREE
+#define PRESSURE_MAX_FLUSHES 8
+
+/**
+ * Fields left at 0 (or NULL) get their defaults.
+ */
+typedef struct {
+    //
+    // PSI file. On procfs, a trigger fires when tasks stall stall_us within window_us, and the monitor polls for it.
+    // Any other file is read every interval_ms instead, which allows simulating pressure with a file of our own.
+    //
+    const char * psi_path;
+    unsigned stall_us;
+    unsigned window_us;
+    double avg10;
+    //
+    // Directory with the cgroup's memory.high and memory.current. By default the process's cgroup v2 directory.
+    // Checked every interval_ms.
+    //
+    const char * cgroup_dir;
+    double high_ratio;
+    unsigned interval_ms;
+    size_t min_free_block; // Given to __malloc_release_free
+} pressure_config;
+
+typedef struct {
+    int psi; // Watched
+    int psi_trigger; // With a trigger rather than by reading it
+    int cgroup; // Watched
+    size_t nevents; // Pressure seen by the monitor
+    size_t nreliefs;
+    size_t trimmed_bytes;
+    size_t released_bytes; // With MADV_FREE
+} pressure_stats;
+
+/**
+ * Start the monitor thread, with config NULL for the defaults. If there's nothing to watch it isn't started,
+ * which isn't an error: pressure_get_stats tells. Returns 0, or -1 with errno set (EBUSY if already started).
+ *
+ * Best started before the first __malloc on an sbrk heap: creating a thread may call glibc's malloc,
+ * and if that moves the program break __malloc can no longer grow (nor trim) the heap.
+ */
+int pressure_monitor_start(const pressure_config * config);
+
+/**
+ * Stop the monitor thread and wait for it to finish. A no-op if it isn't running.
+ */
+void pressure_monitor_stop(void);
+
+/**
+ * Relieve the heap now, whether there is pressure or not. Returns the bytes given back.
+ * Not thread safe, like __malloc.
+ */
+size_t pressure_relieve(void);
+
+typedef void (*pressure_flush)(void * arg);
+
+/**
+ * Have flush(arg) called on each relief, before the heap is trimmed, to free what some cache holds on to.
+ * Returns 0, or -1 with errno set to ENOSPC past PRESSURE_MAX_FLUSHES.
+ */
+int pressure_register_flush(pressure_flush flush, void * arg);
+
+void pressure_get_stats(pressure_stats * stats);
+
+//
+// Called by __free, and by __malloc before it grows the heap. Inline, so that it only costs a load while there's
+//  no pressure. Returns whether the heap was relieved.
+//
+extern int __pressure_pending;
+
+int __pressure_relieve_pending(void);
+
+static inline int __pressure_check(void) {
+    return __atomic_load_n(&__pressure_pending, __ATOMIC_RELAXED) && __pressure_relieve_pending();
+}
+
+#endif
@@ -1,17 +1,37 @@
-#define _DEFAULT_SOURCE /** Unlocks brk() and sbrk() in glibc */
+#define _DEFAULT_SOURCE /** Unlocks brk(), sbrk() and mincore() in glibc */
 
+#include <fcntl.h>
+#include <malloc.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
 #include <unistd.h>
 
+#include "../shared/bench.h"
+#include "../shared/bufwriter.h"
 #include "../shared/errors.h"
 #include "../shared/utils.h"
 #include "q1.h"
+#include "q2.h"
+
+/**
+ * Room for n pointers, mapped rather than on the stack, which would overflow past a million of them.
+ */
+static void * map_pointers(size_t n) {
+    void * ptrs = mmap(NULL, n * sizeof(void *), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (ptrs == MAP_FAILED) {
+        errExit("mmap");
+    }
+    return ptrs;
+}
 
 void
 chpt7_q1(int num_allocs, int block_size, int free_step, int free_min, int free_max)
 {
-    char *ptr[Q1_MAX_NUM_ALLOCS];
+    char **ptr = map_pointers(num_allocs);
 
     printf("Initial program break:          %10p\n", sbrk(0));
 
@@ -32,5 +52,191 @@ chpt7_q1(int num_allocs, int block_size, int free_step, int free_min, int free_m
         free(ptr[i]);
 
     printf("After free(), program break is: %10p\n", sbrk(0));
+    munmap(ptr, num_allocs * sizeof(char *));
+}
+
+//
+// The trace is written with a buffered writer set up before the first allocation, and samples are read with
+//  system calls only: stdio would allocate with glibc's malloc, which mustn't move the program break under __malloc,
+//  and would show up in the trace.
+//
+
+typedef struct {
+    q1_trace_config config;
+    void ** ptrs;
+    unsigned char * residency; // mincore's vector, for the heap and the pointers
+    void * initial_break;
+    struct rusage initial_usage;
+    double start;
+    long page_size;
+    buffered_writer out;
+} q1_trace;
+
+static void * trace_malloc(q1_trace * trace, size_t size) {
+    return trace->config.allocator == Q1_GLIBC ? malloc(size) : __malloc(size);
+}
+
+/**
+ * Bytes resident out of the length bytes from address on.
+ */
+static size_t resident_bytes(q1_trace * trace, void * address, size_t length) {
+    uintptr_t first_page = (uintptr_t) address & ~(trace->page_size - 1);
+    size_t npages = ((uintptr_t) address + length - first_page + trace->page_size - 1) / trace->page_size;
+    if (npages == 0) {
+        return 0;
+    }
+    if (npages > Q1_TRACE_MAX_HEAP / trace->page_size) {
+        fatal("Heap over %llu bytes", (unsigned long long) Q1_TRACE_MAX_HEAP);
+    }
+    if (mincore((void *) first_page, npages * trace->page_size, trace->residency) == -1) {
+        errExit("mincore");
+    }
+    size_t resident = 0;
+    for (size_t i = 0; i < npages; i++) {
+        resident += trace->residency[i] & 1;
+    }
+    return resident * trace->page_size;
 }
 
+static size_t rss_bytes(q1_trace * trace) {
+    char buf[128];
+    int fd = open("/proc/self/statm", O_RDONLY);
+    if (fd == -1) {
+        errExit("open /proc/self/statm");
+    }
+    ssize_t n = read(fd, buf, sizeof(buf) - 1);
+    if (n == -1) {
+        errExit("read /proc/self/statm");
+    }
+    safe_close(fd);
+    buf[n] = '\0';
+    char * resident = strchr(buf, ' ');
+    return resident != NULL ? strtoull(resident, NULL, 10) * trace->page_size : 0;
+}
+
+static void sample(q1_trace * trace, const char * phase, long ops) {
+    static const char * allocators[] = { "glibc", "q2", "q2-batch" };
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == -1) {
+        errExit("getrusage");
+    }
+    void * program_break = sbrk(0);
+    char line[256];
+    int len = snprintf(line, sizeof(line), "%s,%s,%ld,%.6f,%zu,%zu,%zu,%zu,%ld,%ld\n",
+        allocators[trace->config.allocator], phase, ops, bench_now() - trace->start,
+        (size_t) (program_break - trace->initial_break),
+        resident_bytes(trace, trace->initial_break, program_break - trace->initial_break),
+        resident_bytes(trace, trace->ptrs, trace->config.num_allocs * sizeof(void *)),
+        rss_bytes(trace),
+        usage.ru_minflt - trace->initial_usage.ru_minflt,
+        usage.ru_majflt - trace->initial_usage.ru_majflt);
+    bw_write(&trace->out, line, len);
+}
+
+/**
+ * Put the pointers in the order they'll be freed in.
+ */
+static void order_frees(q1_trace * trace) {
+    void ** ptrs = trace->ptrs;
+    long n = trace->config.num_allocs;
+    uint64_t seed = BENCH_SEED;
+    switch (trace->config.pattern) {
+    case Q1_FORWARD:
+        break;
+    case Q1_REVERSE:
+        for (long i = 0, j = n - 1; i < j; i++, j--) {
+            void * swap = ptrs[i];
+            ptrs[i] = ptrs[j];
+            ptrs[j] = swap;
+        }
+        break;
+    case Q1_ALTERNATE:
+        //
+        // Even blocks first, in place: the first half of the frees leaves a hole in every other block.
+        //
+        for (long i = 1, j = 2; j < n; i++, j += 2) {
+            void * swap = ptrs[i];
+            ptrs[i] = ptrs[j];
+            ptrs[j] = swap;
+        }
+        break;
+    case Q1_RANDOM:
+        for (long i = n - 1; i > 0; i--) {
+            long j = bench_xorshift(&seed) % (i + 1);
+            void * swap = ptrs[i];
+            ptrs[i] = ptrs[j];
+            ptrs[j] = swap;
+        }
+        break;
+    }
+}
+
+void chpt7_q1_trace(const q1_trace_config * config, int fd) {
+    q1_trace trace;
+    memset(&trace, 0, sizeof(trace));
+    trace.config = *config;
+    trace.page_size = sysconf(_SC_PAGESIZE);
+    trace.ptrs = map_pointers(config->num_allocs);
+    trace.residency = mmap(NULL, Q1_TRACE_MAX_HEAP / trace.page_size, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (trace.residency == MAP_FAILED) {
+        errExit("mmap");
+    }
+    bw_init(&trace.out, fd, 64 * 1024);
+    static const char header[] = "allocator,phase,ops,seconds,heap_bytes,heap_resident_bytes,tracking_resident_bytes,"
+        "rss_bytes,minor_faults,major_faults\n";
+    bw_write(&trace.out, header, sizeof(header) - 1);
+
+    long n = config->num_allocs;
+    long every = max(1, n / config->samples);
+    trace.initial_break = sbrk(0);
+    if (getrusage(RUSAGE_SELF, &trace.initial_usage) == -1) {
+        errExit("getrusage");
+    }
+    trace.start = bench_now();
+    sample(&trace, "start", 0);
+
+    for (long i = 0; i < n; i++) {
+        if ((trace.ptrs[i] = trace_malloc(&trace, config->block_size)) == NULL) {
+            errExit("malloc");
+        }
+        memset(trace.ptrs[i], 1, config->block_size);
+        if ((i + 1) % every == 0 || i == n - 1) {
+            sample(&trace, "alloc", i + 1);
+        }
+    }
+
+    order_frees(&trace);
+    sample(&trace, "ordered", n);
+    for (long i = 0; i < n; ) {
+        long chunk = min(every - i % every, n - i);
+        switch (config->allocator) {
+        case Q1_GLIBC:
+            for (long j = i; j < i + chunk; j++) {
+                free(trace.ptrs[j]);
+            }
+            break;
+        case Q1_Q2:
+            for (long j = i; j < i + chunk; j++) {
+                __free(trace.ptrs[j]);
+            }
+            break;
+        case Q1_Q2_BATCH:
+            __free_batch(trace.ptrs + i, chunk);
+            break;
+        }
+        i += chunk;
+        sample(&trace, "free", n + i);
+    }
+
+    if (config->allocator == Q1_GLIBC) {
+        malloc_trim(0);
+    } else {
+        __malloc_trim(0);
+    }
+    sample(&trace, "trim", 2 * n);
+
+    bw_destroy(&trace.out);
+    munmap(trace.residency, Q1_TRACE_MAX_HEAP / trace.page_size);
+    munmap(trace.ptrs, n * sizeof(void *));
+}
@@ -1,8 +1,42 @@
 #ifndef __CHPT7_Q1_H__
 #define __CHPT7_Q1_H__
 
-#define Q1_MAX_NUM_ALLOCS 1000000
+#define Q1_MAX_NUM_ALLOCS 1000000000
 
 void chpt7_q1(int num_allocs, int block_size, int free_step, int free_min, int free_max);
 
-#endif
\ No newline at end of file
+#define Q1_TRACE_MAX_HEAP (1ULL << 40) // Sampled for residency
+#define Q1_TRACE_DEFAULT_SAMPLES 1000 // Per phase
+
+typedef enum {
+    Q1_GLIBC, // malloc and free
+    Q1_Q2, // __malloc and __free
+    Q1_Q2_BATCH, // __malloc, and __free_batch for all the frees between two samples
+} q1_allocator;
+
+typedef enum {
+    Q1_FORWARD, // In allocation order
+    Q1_REVERSE,
+    Q1_ALTERNATE, // Even blocks first, then odd ones
+    Q1_RANDOM,
+} q1_free_pattern;
+
+typedef struct {
+    q1_allocator allocator;
+    long num_allocs;
+    size_t block_size;
+    q1_free_pattern pattern;
+    long samples;
+} q1_trace_config;
+
+/**
+ * Scaled up q1: allocate num_allocs blocks of block_size bytes and write to them, free them all in the order of pattern,
+ * then trim the heap. About samples times in each phase, append a line to the CSV written to fd with the size of the heap
+ * (from the program break of the start), how much of it is resident (mincore), how much of the array tracking the
+ * blocks is, the process's RSS, and its minor and major faults since the start.
+ *
+ * glibc serves blocks of 128 KiB and more with mmap, so the heap columns miss them, and only rss_bytes has them.
+ */
+void chpt7_q1_trace(const q1_trace_config * config, int fd);
+
+#endif
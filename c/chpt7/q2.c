@@ -2,20 +2,90 @@
 #define _DEFAULT_SOURCE /** Unlock brk() and sbrk() in glibc */
 
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
-void * __malloc(size_t size);
-void __free(void * memory);
+#include "q2.h"
+#include "arena.h"
+#include "handle.h"
+#include "heapprof.h"
+#include "hot.h"
+#include "pressure.h"
+#include "shm_heap.h"
+#include "slab.h"
 
 static void * heap_start;
 static void * program_break;
+static void * heap_limit; // End of the region reserved by __malloc_use_hugepages. NULL when the heap grows with sbrk
+
+//
+// Push the program break by size bytes, returning -1 if it can't be done.
+// Our heap must be contiguous, so this also fails if something else (e.g. the real malloc) moved the program break
+//  since our last call: the memory is handed back and we don't touch it.
+//
+// In a reserved region, the program break is ours alone and growing is just moving it.
+//
+static int __grow_heap(size_t size) {
+    if (heap_limit != NULL) {
+        if (size > (size_t) (heap_limit - program_break)) {
+            return -1;
+        }
+        program_break += size;
+        return 0;
+    }
+
+    void * old_break = sbrk(size);
+    if (old_break == (void *) -1) {
+        return -1;
+    }
+    if (old_break != program_break) {
+        sbrk(-size);
+        return -1;
+    }
+    program_break += size;
+    return 0;
+}
 
 #define __safe_sbrk(size) \
-if (sbrk(size) == NULL) { \
-    return NULL;\
-} \
-program_break += size \
+if (__grow_heap(size) == -1) { \
+    return NULL; \
+}
+
+//
+// Pull the program break back by size bytes, returning -1 if it can't be done.
+// As when growing, the heap must still end at the program break, or the memory past ours isn't ours to release.
+//
+// In a reserved region, the pages past the new program break are handed back to the kernel but stay reserved.
+// (Unless the region has hugetlbfs pages, that madvise refuses to release in part.)
+//
+static int __shrink_heap(size_t size) {
+    if (heap_limit != NULL) {
+        uintptr_t page_size = sysconf(_SC_PAGESIZE);
+        void * new_break = program_break - size;
+        void * first_page = (void *) (((uintptr_t) new_break + page_size - 1) & ~(page_size - 1));
+        void * end_page = (void *) (((uintptr_t) program_break + page_size - 1) & ~(page_size - 1));
+        if (first_page < end_page) {
+            madvise(first_page, end_page - first_page, MADV_DONTNEED);
+        }
+        program_break = new_break;
+        return 0;
+    }
+
+    if (sbrk(0) != program_break || sbrk(-(intptr_t) size) == (void *) -1) {
+        return -1;
+    }
+    program_break -= size;
+    return 0;
+}
 
 #define VOID_PTR(p) ((void *) p)
 #define max(a,b) ((a) > (b) ? a : b)
@@ -115,6 +185,13 @@ static __alloc_block_header * last_alloc_block = NULL;
 // If size = 0, we still allocate a memory block with data length 0 that in practice occupies some memory due to metadata in the block header.
 //
 void * __malloc(size_t size) {
+    if (heap_start == NULL) {
+        //
+        // First call outside of chpt7_q2: the heap starts at the current program break.
+        //
+        heap_start = program_break = sbrk(0);
+    }
+
     if (__FREE_BLOCK_HEADER_SZ > __ALLOC_BLOCK_HEADER_SZ) {
         //
         // If size is not large enough to meet the minimum block size criteria, we allocate extra bytes, even though 
@@ -132,6 +209,12 @@ void * __malloc(size_t size) {
         // No free blocks in the heap.
         //  Expand the heap and use the memory to make a new allocated block.
         //
+        if (__pressure_check()) {
+            //
+            // Under pressure, give memory back before asking for more. Flushes may have freed blocks: start over.
+            //
+            return __malloc(size);
+        }
         new_alloc = program_break;
         __safe_sbrk(real_size);
         new_alloc->length = size;
@@ -161,6 +244,9 @@ void * __malloc(size_t size) {
             //
             // No free block available for the required size. Expand heap by the minimum amount possible.
             //
+            if (__pressure_check()) {
+                return __malloc(size); // As above: the relief may have changed the free list
+            }
             size_t size_to_expand = real_size;
             if (trailing_search_ptr->fwd_expansion_cand == NULL) {
                 //
@@ -276,15 +362,19 @@ void * __malloc(size_t size) {
             }
         }
     }
-    return VOID_PTR(new_alloc) + __ALLOC_BLOCK_HEADER_SZ; // Pointer to body of allocated block
+    void * memory = VOID_PTR(new_alloc) + __ALLOC_BLOCK_HEADER_SZ; // Pointer to body of allocated block
+    __heapprof_malloc(memory, size);
+    return memory;
 }
 
-void __free(void * memory) {
-    if (memory == NULL) {
-        return;
-    }
-
-    __alloc_block_header * header = memory - __ALLOC_BLOCK_HEADER_SZ;
+//
+// Turn the allocated block header into free space, merging it with the free blocks around it.
+// prev_free_hint, if not NULL, is a free block somewhere before header: the closest one is then searched for from it
+//  along the free list, rather than from header back along the allocated blocks.
+// Returns the free block that now holds header.
+//
+static __free_block_header * __release_block(__alloc_block_header * header, __free_block_header * prev_free_hint) {
+    __free_block_header * released;
     if (header == last_alloc_block) {
         //
         // Update last_alloc_block
@@ -321,6 +411,7 @@ void __free(void * memory) {
             header->nxt_neigh_alloc_block->back_merge_on_free = free_block_list;
             header->nxt_neigh_alloc_block->prev_neigh_alloc_block = NULL;
         }
+        released = free_block_list;
     } else if (header->back_merge_on_free != NULL && header->fwd_merge_on_free != NULL) {
         //
         // Double merge.
@@ -335,6 +426,7 @@ void __free(void * memory) {
         if (header->fwd_merge_on_free->nxt_free_block != NULL) {
             header->fwd_merge_on_free->nxt_free_block->prev_free_block = header->back_merge_on_free;
         }
+        released = header->back_merge_on_free;
     } else if (header->back_merge_on_free != NULL) {
         //
         // Merge with neighboring free block behind it.
@@ -346,6 +438,7 @@ void __free(void * memory) {
             header->nxt_neigh_alloc_block->back_merge_on_free = merging_free_block;
             header->nxt_neigh_alloc_block->prev_neigh_alloc_block = NULL;
         }
+        released = merging_free_block;
     } else if (header->fwd_merge_on_free != NULL) {
         //
         // Merge with neighboring free block ahead of it.
@@ -377,6 +470,7 @@ void __free(void * memory) {
             freed_header->back_expansion_cand->fwd_merge_on_free = freed_header;
             freed_header->back_expansion_cand->nxt_neigh_alloc_block = NULL;
         }
+        released = freed_header;
     } else {
         //
         // No surrounding free blocks to merge with.
@@ -404,10 +498,17 @@ void __free(void * memory) {
         //  allocations besides keeping a few long-lived allocations), so we have more chances to find a free block
         //  if we search first in the direction of heap_start.
         //
-        __alloc_block_header * cursor = header->prev_neigh_alloc_block;
-        while (cursor != NULL && prev_free_block_cursor == NULL) {
-            prev_free_block_cursor = cursor->back_merge_on_free;
-            cursor = cursor->prev_neigh_alloc_block;
+        if (prev_free_hint != NULL) {
+            prev_free_block_cursor = prev_free_hint;
+            while (prev_free_block_cursor->nxt_free_block != NULL && VOID_PTR(prev_free_block_cursor->nxt_free_block) < VOID_PTR(header)) {
+                prev_free_block_cursor = prev_free_block_cursor->nxt_free_block;
+            }
+        } else {
+            __alloc_block_header * cursor = header->prev_neigh_alloc_block;
+            while (cursor != NULL && prev_free_block_cursor == NULL) {
+                prev_free_block_cursor = cursor->back_merge_on_free;
+                cursor = cursor->prev_neigh_alloc_block;
+            }
         }
         if (prev_free_block_cursor != NULL) {
             //
@@ -433,7 +534,302 @@ void __free(void * memory) {
             freed_header->nxt_free_block = nxt_free_block_cursor;
         }
         // freed_header->back_expansion_cand and freed_header->fwd_expansion_cand are already filled due to struct alignment
+        released = freed_header;
+    }
+    return released;
+}
+
+void __free(void * memory) {
+    if (memory == NULL) {
+        return;
+    }
+    __heapprof_free(memory);
+    __release_block(memory - __ALLOC_BLOCK_HEADER_SZ, NULL);
+    //
+    // Memory pressure seen by the monitor is dealt with here, as __malloc and __free aren't thread safe.
+    //
+    __pressure_check();
+}
+
+void __free_sized(void * memory, size_t size) {
+    //
+    // The header is right before memory, and freeing rewrites it anyway: unlike allocators that look up the size class
+    //  of an address, there's no lookup for size to save. It's only the caller's promise, as for free_sized(3).
+    //
+    (void) size;
+    __free(memory);
+}
+
+//
+// In-place quicksort by address: qsort(3) may allocate with glibc's malloc.
+//
+static void __sort_addresses(void ** ptrs, size_t n) {
+    while (n > 16) {
+        //
+        // Median of three, so that sorted and reverse sorted batches (the usual ones) split evenly.
+        //
+        void ** mid = ptrs + n / 2, ** last = ptrs + n - 1, * swap;
+#define __SWAP(a, b) (swap = *(a), *(a) = *(b), *(b) = swap)
+        if (*mid < *ptrs) __SWAP(mid, ptrs);
+        if (*last < *ptrs) __SWAP(last, ptrs);
+        if (*last < *mid) __SWAP(last, mid);
+        void * pivot = *mid;
+        size_t i = 0, j = n - 1;
+        for (;;) {
+            while (ptrs[i] < pivot) i++;
+            while (ptrs[j] > pivot) j--;
+            if (i >= j) {
+                break;
+            }
+            __SWAP(ptrs + i, ptrs + j);
+            i++;
+            j--;
+        }
+#undef __SWAP
+        //
+        // Recurse into the smaller side and loop on the larger one, so that the stack stays O(log n) deep.
+        //
+        if (j + 1 < n - j - 1) {
+            __sort_addresses(ptrs, j + 1);
+            ptrs += j + 1;
+            n -= j + 1;
+        } else {
+            __sort_addresses(ptrs + j + 1, n - j - 1);
+            n = j + 1;
+        }
+    }
+    for (size_t i = 1; i < n; i++) {
+        void * p = ptrs[i];
+        size_t j = i;
+        for (; j > 0 && ptrs[j - 1] > p; j--) {
+            ptrs[j] = ptrs[j - 1];
+        }
+        ptrs[j] = p;
+    }
+}
+
+void __free_batch(void ** ptrs, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        if (ptrs[i] != NULL) {
+            __heapprof_free(ptrs[i]);
+        }
+    }
+    __sort_addresses(ptrs, n);
+
+    __free_block_header * prev_free = NULL;
+    size_t i = 0;
+    while (i < n && ptrs[i] == NULL) {
+        i++;
+    }
+    while (i < n) {
+        //
+        // Gather the run of allocated blocks that are neighbors into the first one, which is then freed as one block.
+        // Blocks are neighbors exactly when nxt_neigh_alloc_block links them.
+        //
+        __alloc_block_header * first = ptrs[i] - __ALLOC_BLOCK_HEADER_SZ;
+        __alloc_block_header * last = first;
+        for (i++; i < n && ptrs[i] - __ALLOC_BLOCK_HEADER_SZ == VOID_PTR(last->nxt_neigh_alloc_block); i++) {
+            last = last->nxt_neigh_alloc_block;
+        }
+        if (last != first) {
+            first->length = VOID_PTR(last) + __ALLOC_BLOCK_HEADER_SZ + last->length - (VOID_PTR(first) + __ALLOC_BLOCK_HEADER_SZ);
+            first->fwd_merge_on_free = last->fwd_merge_on_free;
+            first->nxt_neigh_alloc_block = last->nxt_neigh_alloc_block;
+            if (last == last_alloc_block) {
+                last_alloc_block = first;
+            }
+        }
+        //
+        // Runs come in address order, so the free block that took the previous run is behind this one.
+        //
+        prev_free = __release_block(first, prev_free);
+    }
+    __pressure_check();
+}
+
+size_t __malloc_trim(size_t pad) {
+    //
+    // The heap ends with a free block if the last allocated block has one ahead of it,
+    //  or if there are no allocated blocks but a free block, which then is the whole heap.
+    //
+    __free_block_header * tail = last_alloc_block != NULL ? last_alloc_block->fwd_merge_on_free : free_block_list;
+    if (tail == NULL || tail->length <= pad) {
+        return 0;
+    }
+
+    size_t release = tail->length - pad;
+    if (__shrink_heap(release) == -1) {
+        return 0;
+    }
+    tail->length = pad;
+    return release;
+}
+
+size_t __malloc_release_free(size_t min_length) {
+    uintptr_t page_size = sysconf(_SC_PAGESIZE);
+    size_t released = 0;
+    for (__free_block_header * block = free_block_list; block != NULL; block = block->nxt_free_block) {
+        if (block->length < min_length) {
+            continue;
+        }
+        //
+        // Only the whole pages of the body: the header, and the next block's, must stay.
+        //
+        uintptr_t first_page = ((uintptr_t) block + __FREE_BLOCK_HEADER_SZ + page_size - 1) & ~(page_size - 1);
+        uintptr_t end_page = ((uintptr_t) block + __FREE_BLOCK_HEADER_SZ + block->length) & ~(page_size - 1);
+        if (end_page > first_page && madvise((void *) first_page, end_page - first_page, MADV_FREE) == 0) {
+            released += end_page - first_page;
+        }
+    }
+    return released;
+}
+
+void __malloc_get_stats(heap_stats * stats) {
+    *stats = (heap_stats) { .heap_bytes = program_break - heap_start };
+    for (__free_block_header * block = free_block_list; block != NULL; block = block->nxt_free_block) {
+        stats->free_bytes += __FREE_BLOCK_HEADER_SZ + block->length;
+        stats->nfree_blocks++;
+        stats->largest_free_block = max(stats->largest_free_block, block->length);
+    }
+}
+
+//
+// Swap the free block hole with the allocated block right after it: the allocated block moves down to where the hole
+//  started, and the hole, now right after it, merges with the free block that followed the allocated one, if any.
+// Returns the free block now ahead of the moved allocated block.
+//
+static __free_block_header * __slide_down(__free_block_header * hole) {
+    __alloc_block_header * block = hole->fwd_expansion_cand;
+    __free_block_header * ahead = block->fwd_merge_on_free;
+    //
+    // Both headers get overwritten by the move, so take what we need from them first.
+    //
+    size_t hole_length = hole->length;
+    __free_block_header * prev_free_block = hole->prev_free_block;
+    __free_block_header * nxt_free_block = ahead != NULL ? ahead->nxt_free_block : hole->nxt_free_block;
+    __alloc_block_header * prev_alloc_block = hole->back_expansion_cand;
+    __alloc_block_header * nxt_alloc_block = ahead != NULL ? ahead->fwd_expansion_cand : block->nxt_neigh_alloc_block;
+    if (ahead != NULL) {
+        hole_length += __FREE_BLOCK_HEADER_SZ + ahead->length;
+    }
+    size_t block_size = __ALLOC_BLOCK_HEADER_SZ + block->length;
+
+    __alloc_block_header * moved_block = (__alloc_block_header *) hole;
+    memmove(moved_block, block, block_size);
+    moved_block->back_merge_on_free = NULL;
+    moved_block->prev_neigh_alloc_block = prev_alloc_block;
+    moved_block->nxt_neigh_alloc_block = NULL;
+    if (prev_alloc_block != NULL) {
+        prev_alloc_block->fwd_merge_on_free = NULL;
+        prev_alloc_block->nxt_neigh_alloc_block = moved_block;
+    }
+    if (last_alloc_block == block) {
+        last_alloc_block = moved_block;
+    }
+
+    __free_block_header * moved_hole = VOID_PTR(moved_block) + block_size;
+    moved_hole->length = hole_length;
+    moved_hole->prev_free_block = prev_free_block;
+    moved_hole->nxt_free_block = nxt_free_block;
+    moved_hole->back_expansion_cand = moved_block;
+    moved_hole->fwd_expansion_cand = nxt_alloc_block;
+    moved_block->fwd_merge_on_free = moved_hole;
+    if (prev_free_block != NULL) {
+        prev_free_block->nxt_free_block = moved_hole;
+    } else {
+        free_block_list = moved_hole;
+    }
+    if (nxt_free_block != NULL) {
+        nxt_free_block->prev_free_block = moved_hole;
+    }
+    if (nxt_alloc_block != NULL) {
+        nxt_alloc_block->back_merge_on_free = moved_hole;
+        nxt_alloc_block->prev_neigh_alloc_block = NULL;
+    }
+    return moved_hole;
+}
+
+//
+// Lowest free block above which at least half of the heap is free, so that sliding what's above it down moves
+//  fewer bytes than it releases. NULL if there is none.
+//
+static __free_block_header * __compaction_start() {
+    size_t free_above = 0;
+    for (__free_block_header * block = free_block_list; block != NULL; block = block->nxt_free_block) {
+        free_above += __FREE_BLOCK_HEADER_SZ + block->length;
     }
+    for (__free_block_header * block = free_block_list; block != NULL; block = block->nxt_free_block) {
+        if (2 * free_above >= (size_t) (program_break - VOID_PTR(block))) {
+            return block;
+        }
+        free_above -= __FREE_BLOCK_HEADER_SZ + block->length;
+    }
+    return NULL;
+}
+
+size_t __malloc_compact(size_t max_bytes, __malloc_movable movable, __malloc_moved moved, void * arg) {
+    size_t moved_bytes = 0;
+    __free_block_header * hole = __compaction_start();
+    //
+    // Slide the blocks after that free block down one by one, carrying it up the heap, merging it with the
+    //  free blocks it meets. A block we may not move stays put, and the next free block takes over.
+    // Each step is O(1), and the hole ends up at the end of the heap, where __malloc_trim can release it.
+    //
+    while (hole != NULL && hole->fwd_expansion_cand != NULL && moved_bytes < max_bytes) {
+        __alloc_block_header * block = hole->fwd_expansion_cand;
+        void * from = VOID_PTR(block) + __ALLOC_BLOCK_HEADER_SZ;
+        size_t length = block->length;
+
+        if (movable(from, length, arg)) {
+            hole = __slide_down(hole);
+            void * to = VOID_PTR(hole->back_expansion_cand) + __ALLOC_BLOCK_HEADER_SZ;
+            __heapprof_moved(from, to);
+            moved(from, to, arg);
+            moved_bytes += length;
+        } else {
+            hole = hole->nxt_free_block;
+        }
+    }
+    return moved_bytes;
+}
+
+int __malloc_use_hugepages(size_t size) {
+    if (heap_start != NULL) {
+        errno = EBUSY;
+        return -1;
+    }
+    size = (size + __HUGE_PAGE_SZ - 1) & ~(size_t) (__HUGE_PAGE_SZ - 1);
+
+    //
+    // hugetlbfs pages are reserved up front, so this fails unless the pool has enough of them.
+    // Their mappings are always aligned to the huge page size.
+    //
+    heap_backing backing = HEAP_HUGETLB;
+    void * region = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (region == MAP_FAILED) {
+        //
+        // Transparent huge pages instead: map a huge page more than needed, then unmap what's
+        //  around the first aligned address, so each huge page of the region can be backed by one.
+        //
+        void * mapping = mmap(NULL, size + __HUGE_PAGE_SZ, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (mapping == MAP_FAILED) {
+            return -1;
+        }
+        region = (void *) (((uintptr_t) mapping + __HUGE_PAGE_SZ - 1) & ~(uintptr_t) (__HUGE_PAGE_SZ - 1));
+        if (region != mapping) {
+            munmap(mapping, region - mapping);
+        }
+        munmap(region + size, mapping + __HUGE_PAGE_SZ - region);
+        //
+        // Fails when the kernel has no transparent huge pages, and then we still have an aligned region.
+        //
+        backing = madvise(region, size, MADV_HUGEPAGE) == 0 ? HEAP_THP : HEAP_MMAP;
+    }
+
+    heap_start = program_break = region;
+    heap_limit = region + size;
+    return backing;
 }
 
 void debug1(void * p1) {
@@ -450,6 +846,25 @@ void debug5(void *p1, void *p2, void *p3, void *p4, void *p5) {
     printf("p3=%p\np4=%p\np5=%p\n", p3, p4, p5);
 }
 
+static int __test_movable(void * memory, size_t length, void * arg) {
+    return 1;
+}
+
+//
+// Keeps the last move.
+//
+static void __test_moved(void * from, void * to, void * arg) {
+    ((void **) arg)[0] = from;
+    ((void **) arg)[1] = to;
+}
+
+static void __test_write_psi(const char * path, const char * content) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    assert(fd != -1);
+    assert(write(fd, content, strlen(content)) == strlen(content));
+    assert(close(fd) == 0);
+}
+
 void __attribute__((__noreturn__))
 chpt7_q2() {
     //
@@ -461,6 +876,26 @@ chpt7_q2() {
     //  heap space above this address.
     // We _exit(0) in the end so as not to risk further instructions after this function.
     //
+    // The heap profiler loads the unwinder on start, which calls malloc: start it once before the heap does.
+    //
+    assert(heapprof_start(1, "/tmp/chpt7_q2") == 0);
+    assert(heapprof_start(1, "/tmp/chpt7_q2") == -1 && errno == EBUSY);
+    heapprof_stop();
+    //
+    // So does the pressure monitor, which starts a thread. It's started on a fake PSI file of ours, without pressure
+    //  for now. With nothing to watch, it doesn't start.
+    //
+    pressure_config pressure = { .psi_path = "/nonexistent", .cgroup_dir = "/nonexistent", .interval_ms = 10 };
+    pressure_stats pstats;
+    assert(pressure_monitor_start(&pressure) == 0);
+    pressure_get_stats(&pstats);
+    assert(!pstats.psi && !pstats.cgroup);
+    __test_write_psi("/tmp/chpt7_q2_psi", "some avg10=0.00 avg60=0.00 avg300=0.00 total=0\nfull avg10=0.00 avg60=0.00 avg300=0.00 total=0\n");
+    pressure.psi_path = "/tmp/chpt7_q2_psi";
+    assert(pressure_monitor_start(&pressure) == 0);
+    assert(pressure_monitor_start(&pressure) == -1 && errno == EBUSY);
+    pressure_get_stats(&pstats);
+    assert(pstats.psi && !pstats.psi_trigger && !pstats.cgroup);
     heap_start = program_break = sbrk(0);
     __free_block_header * f, * ff;
     void * p, * pp, * ppp, * pppp;
@@ -957,5 +1392,349 @@ chpt7_q2() {
     assert(((__alloc_block_header *)(VOID_PTR(ppp) - __ALLOC_BLOCK_HEADER_SZ))->prev_neigh_alloc_block ==  NULL);
     assert(((__alloc_block_header *)(VOID_PTR(ppp) - __ALLOC_BLOCK_HEADER_SZ))->nxt_neigh_alloc_block == NULL);
     __free(ppp);
+    assert(last_alloc_block == NULL);
+    assert(free_block_list == heap_start);
+    assert(free_block_list->nxt_free_block == NULL);
+    //
+    // Slab caches, whose slabs come from __malloc.
+    //
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    slab_cache_stats stats;
+    slab_cache * cache = slab_cache_create(24, 0);
+    slab_cache_get_stats(cache, &stats);
+    assert(stats.object_size == 24);
+    assert(stats.objects_per_slab >= 8);
+    assert(stats.nslabs == 0);
+    assert(stats.nobjects == 0);
+    p = slab_alloc(cache);
+    pp = slab_alloc(cache);
+    assert(((uintptr_t) p & (sizeof(void *) - 1)) == 0);
+    assert(pp == p + 24); // No header between objects
+    slab_free(cache, p);
+    assert(slab_alloc(cache) == p); // Last freed, first reused
+    //
+    // Fill the first slab up: the next object comes from a new one, in another page.
+    //
+    for (size_t i = 2; i < stats.objects_per_slab; i++) {
+        assert((uintptr_t) slab_alloc(cache) / page_size == (uintptr_t) p / page_size);
+    }
+    ppp = slab_alloc(cache);
+    assert((uintptr_t) ppp / page_size != (uintptr_t) p / page_size);
+    slab_cache_get_stats(cache, &stats);
+    assert(stats.nslabs == 2);
+    assert(stats.nobjects == stats.objects_per_slab + 1);
+    //
+    // Freeing from the full slab puts it back in use before the newer one.
+    //
+    slab_free(cache, pp);
+    assert(slab_alloc(cache) == pp);
+    assert(slab_alloc(cache) == ppp + 24);
+    //
+    // Alignment rounds the object size up.
+    //
+    slab_cache * aligned_cache = slab_cache_create(40, 64);
+    slab_cache_get_stats(aligned_cache, &stats);
+    assert(stats.object_size == 64);
+    p = slab_alloc(aligned_cache);
+    pp = slab_alloc(aligned_cache);
+    assert(((uintptr_t) p & 63) == 0);
+    assert(pp == p + 64);
+    assert(slab_cache_create(8, 24) == NULL && errno == EINVAL);
+    assert(slab_cache_create(page_size / 4, 0) == NULL && errno == EINVAL);
+    assert(slab_cache_create(SIZE_MAX - 4, 0) == NULL && errno == EINVAL);
+    //
+    // Destroying the caches hands everything back to __malloc.
+    //
+    slab_cache_destroy(aligned_cache);
+    slab_cache_destroy(cache);
+    assert(last_alloc_block == NULL);
+    assert(free_block_list == heap_start);
+    assert(free_block_list->nxt_free_block == NULL);
+    //
+    // Arenas, whose chunks come from __malloc.
+    //
+    arena a;
+    arena_init(&a, 256);
+    p = arena_alloc(&a, 1);
+    pp = arena_alloc(&a, 1);
+    assert(((uintptr_t) p & (ARENA_ALIGN - 1)) == 0);
+    assert(pp == p + ARENA_ALIGN);
+    arena_mark mark = arena_save(&a);
+    ppp = arena_alloc(&a, 240); // Doesn't fit in what's left of the first chunk
+    assert((uintptr_t) ppp / 256 != (uintptr_t) p / 256);
+    pppp = arena_alloc(&a, 1000); // Larger than a chunk, gets one of its own
+    assert(pppp != NULL);
+    size_t heap_bytes = a.heap_bytes;
+    assert(heap_bytes > 256 + 256 + 1000);
+    arena_rewind(&a, mark);
+    assert(arena_alloc(&a, 1) == pp + ARENA_ALIGN);
+    //
+    // After a reset, the same allocations reuse the same chunks.
+    //
+    arena_reset(&a);
+    assert(arena_alloc(&a, 1) == p);
+    assert(arena_alloc(&a, 1) == pp);
+    assert(arena_alloc(&a, 240) == ppp);
+    assert(arena_alloc(&a, 1000) == pppp);
+    assert(a.heap_bytes == heap_bytes);
+    assert(((uintptr_t) arena_alloc_aligned(&a, 1, 64) & 63) == 0);
+    arena_destroy(&a);
+    assert(last_alloc_block == NULL);
+    assert(free_block_list == heap_start);
+    assert(free_block_list->nxt_free_block == NULL);
+    //
+    // Trimming gives back the free block at the end of the heap.
+    //
+    assert(__malloc_trim(0) > 0);
+    assert(program_break == heap_start + __FREE_BLOCK_HEADER_SZ);
+    assert(program_break == sbrk(0));
+    assert(__malloc_trim(0) == 0);
+    //
+    // Compaction slides the blocks above the hole at the bottom down, and the heap can be trimmed down to the last one.
+    //
+    p = __malloc(100);
+    pp = __malloc(100);
+    ppp = __malloc(100);
+    pppp = __malloc(100);
+    memset(pppp, 'x', 100);
+    __free(p);
+    void * moves[2] = { NULL, NULL };
+    assert(__malloc_compact(1000, __test_movable, __test_moved, moves) == 0); // Only a quarter of the heap is free
+    __free(ppp);
+    assert(__malloc_compact(1000, __test_movable, __test_moved, moves) == 200);
+    assert(moves[0] == pppp);
+    assert(moves[1] == pp);
+    assert(((char *) pp)[0] == 'x' && ((char *) pp)[99] == 'x');
+    assert(last_alloc_block == VOID_PTR(pp) - __ALLOC_BLOCK_HEADER_SZ);
+    assert(__malloc_trim(0) == 2 * (__ALLOC_BLOCK_HEADER_SZ + 100) - __FREE_BLOCK_HEADER_SZ);
+    assert(program_break == pp + 100 + __FREE_BLOCK_HEADER_SZ);
+    heap_stats hs;
+    __malloc_get_stats(&hs);
+    assert(hs.heap_bytes == (size_t) (program_break - heap_start));
+    assert(hs.nfree_blocks == 1);
+    assert(hs.free_bytes == __FREE_BLOCK_HEADER_SZ);
+    __free(p);
+    __free(pp);
+    //
+    // Handles: compaction slides unpinned handle blocks down and gives their handles the new addresses,
+    //  but leaves pinned blocks, and plain __malloc blocks, where they are.
+    //
+    __malloc_trim(0);
+    handle h_hole = handle_alloc(1000), h = handle_alloc(100), h2 = handle_alloc(100);
+    char * plain = __malloc(100);
+    handle h_top = handle_alloc(100);
+    memset(plain, 'p', 100);
+    p = handle_pin(h);
+    memset(p, 'h', 100);
+    pp = handle_pin(h2);
+    handle_unpin(h2);
+    handle_free(h_hole);
+    assert(handle_compact(SIZE_MAX) == 0); // Nothing gets past the pinned block
+    assert(handle_pin(h) == p);
+    handle_unpin(h);
+    handle_unpin(h);
+    handle_free(h_top);
+    handle_stats hstats;
+    handle_get_stats(&hstats);
+    assert(hstats.nhandles == 2 && hstats.trimmed_bytes == 0);
+    assert(handle_compact(SIZE_MAX) > 0);
+    ppp = handle_pin(h);
+    assert(ppp < p && ((char *) ppp)[0] == 'h' && ((char *) ppp)[99] == 'h');
+    assert(handle_pin(h2) < pp);
+    assert(plain[0] == 'p' && plain[99] == 'p');
+    handle_unpin(h);
+    handle_unpin(h2);
+    //
+    // The block above the plain one was freed, so the heap ends at the plain block once trimmed.
+    //
+    handle_get_stats(&hstats);
+    assert(hstats.trimmed_bytes > 0 && hstats.moved_bytes > 0 && hstats.ncompactions == 2);
+    assert(program_break == plain + 100 + __FREE_BLOCK_HEADER_SZ);
+    //
+    // Freed handles are reused.
+    //
+    assert(handle_alloc(100) == h_top);
+    handle_free(h_top);
+    handle_free(h);
+    handle_free(h2);
+    __free(plain);
+    __malloc_trim(0);
+    //
+    // Hot objects get cache lines of their own.
+    //
+    p = __malloc_hot(sizeof(long));
+    pp = __malloc_hot(sizeof(long));
+    ppp = __malloc_hot(CACHE_LINE_SZ + 1);
+    assert(((uintptr_t) p & (CACHE_LINE_SZ - 1)) == 0);
+    assert(pp == p + CACHE_LINE_SZ);
+    assert(((uintptr_t) ppp & (CACHE_LINE_SZ - 1)) == 0);
+    assert(slab_cache_of(ppp) != slab_cache_of(p));
+    assert((uintptr_t) p % page_size >= CACHE_LINE_SZ); // The slab's header has the first line
+    __free_hot(p);
+    assert(__malloc_hot(1) == p);
+    assert(__malloc_hot(HOT_MAX_SZ + 1) == NULL && errno == EINVAL);
+    __free_hot(NULL);
+    //
+    // Too late to move the heap to huge pages.
+    //
+    assert(__malloc_use_hugepages(__HUGE_PAGE_SZ) == -1 && errno == EBUSY);
+    //
+    // A shared heap mapped twice, at different addresses, has the same blocks at the same offsets.
+    // Blocks come from the end of the free block, and merge back with the free blocks on both sides.
+    //
+    shm_heap shm, shm2;
+    shm_heap_stats shm_stats;
+    assert(shm_heap_create(&shm, NULL, 1) == 0);
+    assert(shm.size == page_size);
+    assert(shm_heap_attach_fd(&shm2, dup(shm.fd)) == 0);
+    assert(shm2.segment != shm.segment);
+    shm_off off = shm_alloc(&shm, 100);
+    shm_off off2 = shm_alloc(&shm, 100);
+    assert(((uintptr_t) shm_ptr(&shm, off) & (SHM_HEAP_ALIGN - 1)) == 0);
+    assert(off2 < off && off - off2 <= 100 + 2 * SHM_HEAP_ALIGN);
+    strcpy(shm_ptr(&shm, off), "shared");
+    assert(strcmp(shm_ptr(&shm2, off), "shared") == 0);
+    shm_heap_set_root(&shm, off);
+    assert(shm_heap_get_root(&shm2) == off);
+    shm_free(&shm2, off);
+    shm_heap_get_stats(&shm, &shm_stats);
+    assert(shm_stats.nblocks == 1 && shm_stats.nfree_blocks == 2);
+    shm_free(&shm, off2);
+    shm_heap_get_stats(&shm, &shm_stats);
+    assert(shm_stats.nblocks == 0 && shm_stats.nfree_blocks == 1 && shm_stats.free_bytes == shm_stats.heap_bytes);
+    assert(shm_alloc(&shm, shm_stats.heap_bytes) == SHM_OFF_NULL && errno == ENOMEM);
+    //
+    // A process killed while holding the lock doesn't block the others: the next one to lock recovers the heap.
+    // The child spends most of its time holding the lock, so it's soon killed with it.
+    //
+    for (int attempt = 0; attempt < 100 && shm_stats.nrecoveries == 0; attempt++) {
+        pid_t child = fork();
+        assert(child != -1);
+        if (child == 0) {
+            for (;;) {
+                shm_free(&shm2, shm_alloc(&shm2, 16));
+            }
+        }
+        nanosleep(&(struct timespec) { .tv_nsec = 1000000 }, NULL);
+        assert(kill(child, SIGKILL) == 0 && waitpid(child, NULL, 0) == child);
+        assert(shm_heap_get_stats(&shm, &shm_stats) == 0);
+    }
+    assert(shm_stats.nrecoveries == 1);
+    off = shm_alloc(&shm2, 100);
+    assert(off != SHM_OFF_NULL && shm_free(&shm, off) == 0);
+    shm_heap_detach(&shm2);
+    shm_heap_detach(&shm);
+    //
+    // Sampling about every byte, any allocation is sampled, and tracked until freed.
+    //
+    heapprof_stats prof_stats;
+    assert(heapprof_start(1, "/tmp/chpt7_q2") == 0);
+    p = __malloc(100);
+    pp = __malloc(100);
+    heapprof_get_stats(&prof_stats);
+    assert(prof_stats.nsamples == 2 && prof_stats.nlive == 2 && prof_stats.nstacks == 2);
+    //
+    // SIGUSR2 only asks for a dump. The next __free writes it, without waiting for a sampled allocation.
+    //
+    raise(SIGUSR2);
+    assert(access("/tmp/chpt7_q2.0001.heap", F_OK) == -1 && errno == ENOENT);
+    __free(p);
+    assert(unlink("/tmp/chpt7_q2.0001.heap") == 0);
+    heapprof_get_stats(&prof_stats);
+    assert(prof_stats.nsamples == 2 && prof_stats.nlive == 1);
+    assert(heapprof_dump() == 0);
+    assert(unlink("/tmp/chpt7_q2.0002.heap") == 0);
+    //
+    // A dump that can't be written fails, without a truncated profile nor killing the process.
+    //
+    struct rlimit fsize, tiny_fsize;
+    assert(getrlimit(RLIMIT_FSIZE, &fsize) == 0);
+    tiny_fsize = (struct rlimit) { 16, fsize.rlim_max };
+    signal(SIGXFSZ, SIG_IGN);
+    assert(setrlimit(RLIMIT_FSIZE, &tiny_fsize) == 0);
+    assert(heapprof_dump() == -1 && errno == EFBIG);
+    assert(setrlimit(RLIMIT_FSIZE, &fsize) == 0);
+    signal(SIGXFSZ, SIG_DFL);
+    assert(access("/tmp/chpt7_q2.0003.heap", F_OK) == -1 && errno == ENOENT);
+    __free(pp);
+    heapprof_stop();
+    //
+    // A batch frees each run of neighboring blocks as one, here 0-1 and 3-4, in any order. The block between them
+    //  then merges both.
+    //
+    heap_stats before, after;
+    void * batch[6];
+    for (int i = 0; i < 6; i++) {
+        batch[i] = __malloc(1000);
+    }
+    p = batch[0];
+    pp = batch[2];
+    ppp = batch[5]; // Stays allocated after the others
+    __malloc_get_stats(&before);
+    void * shuffled[] = { batch[3], NULL, batch[0], batch[4], batch[1] };
+    __free_batch(shuffled, 5);
+    assert(shuffled[0] == NULL && shuffled[1] == batch[0] && shuffled[4] == batch[4]);
+    __malloc_get_stats(&after);
+    assert(after.nfree_blocks == before.nfree_blocks + 2);
+    assert(after.free_bytes == before.free_bytes + 4 * (__ALLOC_BLOCK_HEADER_SZ + 1000));
+    __free_sized(pp, 1000);
+    __malloc_get_stats(&after);
+    assert(after.nfree_blocks == before.nfree_blocks + 1);
+    assert(__malloc(5 * (__ALLOC_BLOCK_HEADER_SZ + 1000) - __ALLOC_BLOCK_HEADER_SZ) == p);
+    __free_batch(&p, 1);
+    __free_batch(&ppp, 1);
+    __free_batch(NULL, 0);
+    //
+    // Under memory pressure, the next __free trims the free end of the heap and gives back the pages of the large free
+    //  block below.
+    //
+    p = __malloc(256 * 1024);
+    pp = __malloc(100);
+    ppp = __malloc(256 * 1024);
+    __free(p);
+    pressure_get_stats(&pstats);
+    assert(pstats.nevents == 0 && pstats.nreliefs == 0);
+    __test_write_psi("/tmp/chpt7_q2_psi", "some avg10=42.00 avg60=8.00 avg300=2.00 total=5000000\nfull avg10=0.00 avg60=0.00 avg300=0.00 total=0\n");
+    for (int i = 0; pstats.nevents == 0; i++) {
+        assert(i < 5000); // 5 s
+        nanosleep(&(struct timespec) { .tv_nsec = 1000000 }, NULL);
+        pressure_get_stats(&pstats);
+    }
+    assert(pstats.nreliefs == 0);
+    __free(ppp);
+    pressure_monitor_stop();
+    pressure_get_stats(&pstats);
+    assert(pstats.nreliefs == 1);
+    assert(pstats.trimmed_bytes >= 256 * 1024);
+    assert(pstats.released_bytes >= 256 * 1024 - 2 * page_size);
+    //
+    // Relieved right away: the whole of p and pp is now free at the end of the heap.
+    //
+    __free(pp);
+    assert(pressure_relieve() > 256 * 1024);
+    //
+    // Pending pressure is also relieved by the next __malloc that grows the heap, but not by one that reuses a free
+    //  block.
+    //
+    p = __malloc(256 * 1024);
+    pp = __malloc(100);
+    __free(p);
+    pressure_get_stats(&pstats);
+    pressure_stats before_pstats = pstats;
+    void * old_break = program_break;
+    __atomic_store_n(&__pressure_pending, 1, __ATOMIC_RELAXED);
+    ppp = __malloc(100);
+    assert(ppp != NULL && program_break == old_break);
+    pressure_get_stats(&pstats);
+    assert(pstats.nreliefs == before_pstats.nreliefs);
+    void * grown = __malloc(512 * 1024);
+    assert(grown != NULL && __atomic_load_n(&__pressure_pending, __ATOMIC_RELAXED) == 0);
+    pressure_get_stats(&pstats);
+    assert(pstats.nreliefs == before_pstats.nreliefs + 1);
+    assert(pstats.released_bytes >= before_pstats.released_bytes + 256 * 1024 - 2 * page_size);
+    __free(grown);
+    __free(ppp);
+    __free(pp);
+    assert(unlink("/tmp/chpt7_q2_psi") == 0);
     _exit(0);
 }
\ No newline at end of file
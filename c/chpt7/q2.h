@@ -1,6 +1,94 @@
 #ifndef __CHPT7_Q2_H__
 #define __CHPT7_Q2_H__
 
+#include <stddef.h>
+
+/**
+ * malloc(3) and free(3) over our own heap, grown with sbrk from the program break of the first call.
+ * Not thread safe. Don't mix them with code that moves the program break on its own (glibc's malloc does, for small
+ * allocations): __malloc returns NULL rather than growing a heap that's no longer contiguous.
+ */
+void * __malloc(size_t size);
+void __free(void * memory);
+
+/**
+ * __free for a block of size bytes, as malloc'ed: size is the caller's promise, like for free_sized(3).
+ */
+void __free_sized(void * memory, size_t size);
+
+/**
+ * __free the n blocks of ptrs, which may hold NULLs, and sorts ptrs by address on the way. Blocks that are neighbors in
+ * the heap are freed together as a single one, and each run of them is linked into the free list from where the
+ * previous run was, in a single sweep up the heap. Costs O(n log n) for the sort, but no search along the allocated
+ * blocks for each block, as __free may do.
+ */
+void __free_batch(void ** ptrs, size_t n);
+
+/**
+ * Give back to the kernel the free block at the end of the heap, if any, beyond pad bytes. Returns the bytes released.
+ */
+size_t __malloc_trim(size_t pad);
+
+/**
+ * Give the whole pages inside free blocks of at least min_length bytes back to the kernel with MADV_FREE: they stay
+ * mapped, and are only reclaimed if memory runs short. Returns the bytes advised.
+ */
+size_t __malloc_release_free(size_t min_length);
+
+typedef struct {
+    size_t heap_bytes; // From the start of the heap to the program break
+    size_t free_bytes; // In free blocks, headers included
+    size_t nfree_blocks;
+    size_t largest_free_block;
+} heap_stats;
+
+/**
+ * Walks the free list.
+ */
+void __malloc_get_stats(heap_stats * stats);
+
+/**
+ * Whether the allocated block at memory, of length bytes, may be moved. Its owner must be able to tell from its contents.
+ */
+typedef int (*__malloc_movable)(void * memory, size_t length, void * arg);
+
+/**
+ * A block was moved from one address to the other.
+ */
+typedef void (*__malloc_moved)(void * from, void * to, void * arg);
+
+/**
+ * Slide allocated blocks towards the start of the heap, so that the free space gathers at its end where
+ * __malloc_trim can release it. Starts from the lowest free block above which at least half the heap is free, so it
+ * never moves more than it frees. Each block that movable accepts is moved right after the block below it, then moved
+ * is called; a block it refuses stays where it is. Stops after moving max_bytes, and returns the bytes moved.
+ *
+ * Any pointer into a moved block is left dangling: only use it on blocks accessed through some indirection.
+ */
+size_t __malloc_compact(size_t max_bytes, __malloc_movable movable, __malloc_moved moved, void * arg);
+
+#define __HUGE_PAGE_SZ (2 * 1024 * 1024)
+
+typedef enum {
+    HEAP_SBRK, // Grown with sbrk, the default
+    HEAP_MMAP, // Reserved region with regular pages
+    HEAP_THP, // Reserved region with transparent huge pages
+    HEAP_HUGETLB, // Reserved region with hugetlbfs pages
+} heap_backing;
+
+/**
+ * Have __malloc grow its heap in a region of size bytes (rounded up to __HUGE_PAGE_SZ) reserved with mmap instead of
+ * with sbrk, aligned to __HUGE_PAGE_SZ to be backed by huge pages: hugetlbfs pages if the pool has enough of them,
+ * else transparent huge pages (madvise MADV_HUGEPAGE), else regular pages. Memory is only used as the heap grows
+ * into the region, except with hugetlbfs which reserves all of its pages right away.
+ * Large heaps then need far fewer TLB entries, and slab caches and arenas, which take their memory from __malloc,
+ * pack their objects in the same huge pages. __malloc fails once the region is full.
+ *
+ * Must be called before the first __malloc. Returns the heap_backing, or -1 with errno set
+ * (EBUSY if __malloc was already used).
+ */
+int __malloc_use_hugepages(size_t size);
+
 void __attribute__((__noreturn__)) chpt7_q2();
 
-#endif
\ No newline at end of file
+#endif
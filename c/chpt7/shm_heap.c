@@ -0,0 +1,312 @@
+#define _GNU_SOURCE /** Unlocks memfd_create() */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../shared/utils.h"
+#include "shm_heap.h"
+
+#define SHM_HEAP_MAGIC 0x73686d68656170ULL // "shmheap"
+
+/**
+ * Header of every block, free or allocated, as in __malloc's heap. Free blocks are linked in address order.
+ */
+typedef struct {
+    size_t length; // Of the block's body, a multiple of SHM_HEAP_ALIGN
+    shm_off nxt_free_block; // Only for free blocks. SHM_OFF_NULL if it's the last one
+} shm_block;
+
+#define SHM_BLOCK_HEADER_SZ sizeof(shm_block) // Keeps bodies aligned, as SHM_HEAP_ALIGN is a multiple of it
+
+struct shm_segment {
+    uint64_t magic; // Set once the heap is ready
+    size_t size;
+    pthread_mutex_t lock;
+    shm_off free_block_list;
+    shm_off heap_start; // First block, right after this header
+    shm_off root;
+    size_t nblocks;
+    size_t nrecoveries;
+};
+
+static size_t align_up(size_t n, size_t align) {
+    return (n + align - 1) & ~(align - 1);
+}
+
+static shm_block * block_at(shm_heap * heap, shm_off offset) {
+    return shm_ptr(heap, offset);
+}
+
+/**
+ * Whether the free list is still sound: in the heap, in address order, and without overlaps.
+ */
+static Boolean free_list_valid(shm_heap * heap) {
+    shm_segment * segment = heap->segment;
+    shm_off end = segment->heap_start; // Of the previous free block
+    for (shm_off offset = segment->free_block_list; offset != SHM_OFF_NULL; ) {
+        if (offset < end || offset % SHM_HEAP_ALIGN != 0 || offset > segment->size - SHM_BLOCK_HEADER_SZ) {
+            return FALSE;
+        }
+        shm_block * block = block_at(heap, offset);
+        if (block->length % SHM_HEAP_ALIGN != 0 || block->length > segment->size - offset - SHM_BLOCK_HEADER_SZ) {
+            return FALSE;
+        }
+        end = offset + SHM_BLOCK_HEADER_SZ + block->length;
+        offset = block->nxt_free_block;
+    }
+    return TRUE;
+}
+
+/**
+ * Lock the heap. Returns 0, or -1 with errno set.
+ *
+ * The lock is robust: when its owner died holding it, we get it with EOWNERDEAD instead of waiting forever.
+ * Every update of the free list is ordered so that it stays sound whatever store the owner died after,
+ * at worst losing the block being allocated or freed, so the heap is checked and the lock made consistent again.
+ * Should the check fail, the lock is released inconsistent: it and every later call fail with ENOTRECOVERABLE.
+ */
+static int lock_heap(shm_heap * heap) {
+    shm_segment * segment = heap->segment;
+    int s = pthread_mutex_lock(&segment->lock);
+    if (s == EOWNERDEAD) {
+        if (free_list_valid(heap)) {
+            pthread_mutex_consistent(&segment->lock);
+            segment->nrecoveries++;
+            s = 0;
+        } else {
+            pthread_mutex_unlock(&segment->lock);
+            s = ENOTRECOVERABLE;
+        }
+    }
+    if (s != 0) {
+        errno = s;
+        return -1;
+    }
+    return 0;
+}
+
+static int map_segment(shm_heap * heap, int fd, size_t size) {
+    void * segment = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (segment == MAP_FAILED) {
+        return -1;
+    }
+    *heap = (shm_heap) { segment, size, fd };
+    return 0;
+}
+
+int shm_heap_create(shm_heap * heap, const char * name, size_t size) {
+    size = align_up(size, sysconf(_SC_PAGESIZE));
+    shm_off heap_start = align_up(sizeof(shm_segment), SHM_HEAP_ALIGN);
+    if (size < heap_start + SHM_BLOCK_HEADER_SZ) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    int fd = name == NULL ? memfd_create("shm_heap", MFD_CLOEXEC) : shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd == -1) {
+        return -1;
+    }
+    if (ftruncate(fd, size) == -1 || map_segment(heap, fd, size) == -1) {
+        int saved_errno = errno;
+        if (name != NULL) {
+            shm_unlink(name);
+        }
+        close(fd);
+        errno = saved_errno;
+        return -1;
+    }
+
+    //
+    // Nobody else can use the heap before it's returned, but a process attaching by name might map it already:
+    //  it tells an initialized heap by its magic number, written last.
+    //
+    shm_segment * segment = heap->segment;
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&segment->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    segment->size = size;
+    segment->heap_start = segment->free_block_list = heap_start;
+    shm_block * block = block_at(heap, heap_start);
+    block->length = size - heap_start - SHM_BLOCK_HEADER_SZ;
+    block->nxt_free_block = SHM_OFF_NULL;
+    __atomic_store_n(&segment->magic, SHM_HEAP_MAGIC, __ATOMIC_RELEASE);
+    return 0;
+}
+
+int shm_heap_attach_fd(shm_heap * heap, int fd) {
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        return -1;
+    }
+    if ((size_t) st.st_size < sizeof(shm_segment)) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (map_segment(heap, fd, st.st_size) == -1) {
+        return -1;
+    }
+    if (__atomic_load_n(&heap->segment->magic, __ATOMIC_ACQUIRE) != SHM_HEAP_MAGIC || heap->segment->size != heap->size) {
+        munmap(heap->segment, heap->size);
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+int shm_heap_attach(shm_heap * heap, const char * name) {
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd == -1) {
+        return -1;
+    }
+    if (shm_heap_attach_fd(heap, fd) == -1) {
+        int saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+        return -1;
+    }
+    return 0;
+}
+
+void shm_heap_detach(shm_heap * heap) {
+    munmap(heap->segment, heap->size);
+    safe_close(heap->fd);
+    *heap = (shm_heap) { NULL, 0, -1 };
+}
+
+shm_off shm_alloc(shm_heap * heap, size_t size) {
+    if (size > heap->size) {
+        errno = ENOMEM;
+        return SHM_OFF_NULL;
+    }
+    size = align_up(size, SHM_HEAP_ALIGN);
+    size_t real_size = SHM_BLOCK_HEADER_SZ + size;
+
+    shm_segment * segment = heap->segment;
+    if (lock_heap(heap) == -1) {
+        return SHM_OFF_NULL;
+    }
+    //
+    // First fit, like __malloc. There's no program break to push here: if nothing fits, the heap is full.
+    //
+    shm_off * link = &segment->free_block_list;
+    shm_block * free_block = NULL;
+    while (*link != SHM_OFF_NULL) {
+        free_block = block_at(heap, *link);
+        if (SHM_BLOCK_HEADER_SZ + free_block->length >= real_size) {
+            break;
+        }
+        link = &free_block->nxt_free_block;
+    }
+    if (*link == SHM_OFF_NULL) {
+        pthread_mutex_unlock(&segment->lock);
+        errno = ENOMEM;
+        return SHM_OFF_NULL;
+    }
+
+    shm_off block;
+    if (free_block->length >= real_size) {
+        //
+        // Split, allocating from the end of the free block as __malloc does, so the list doesn't change.
+        //
+        free_block->length -= real_size;
+        block = *link + SHM_BLOCK_HEADER_SZ + free_block->length;
+        block_at(heap, block)->length = size;
+    } else {
+        //
+        // Too small to leave a free block behind: allocate all of it.
+        //
+        block = *link;
+        *link = free_block->nxt_free_block;
+    }
+    segment->nblocks++;
+    pthread_mutex_unlock(&segment->lock);
+    return block + SHM_BLOCK_HEADER_SZ;
+}
+
+int shm_free(shm_heap * heap, shm_off offset) {
+    if (offset == SHM_OFF_NULL) {
+        return 0;
+    }
+
+    shm_off block = offset - SHM_BLOCK_HEADER_SZ;
+    shm_block * header = block_at(heap, block);
+    shm_segment * segment = heap->segment;
+    if (lock_heap(heap) == -1) {
+        return -1;
+    }
+    //
+    // Find the free blocks around this one. Unlike __malloc's, blocks don't know their neighbors,
+    //  which keeps their headers small, at the cost of walking the list.
+    //
+    shm_off prev = SHM_OFF_NULL;
+    shm_off nxt = segment->free_block_list;
+    while (nxt != SHM_OFF_NULL && nxt < block) {
+        prev = nxt;
+        nxt = block_at(heap, nxt)->nxt_free_block;
+    }
+
+    if (nxt != SHM_OFF_NULL && block + SHM_BLOCK_HEADER_SZ + header->length == nxt) {
+        shm_block * merged = block_at(heap, nxt);
+        header->length += SHM_BLOCK_HEADER_SZ + merged->length;
+        header->nxt_free_block = merged->nxt_free_block;
+    } else {
+        header->nxt_free_block = nxt;
+    }
+
+    shm_block * prev_header = block_at(heap, prev);
+    if (prev == SHM_OFF_NULL) {
+        segment->free_block_list = block;
+    } else if (prev + SHM_BLOCK_HEADER_SZ + prev_header->length == block) {
+        //
+        // Link first, so that prev never overlaps the block after it: see lock_heap.
+        //
+        prev_header->nxt_free_block = header->nxt_free_block;
+        __atomic_signal_fence(__ATOMIC_SEQ_CST); // Nor may the compiler swap them
+        prev_header->length += SHM_BLOCK_HEADER_SZ + header->length;
+    } else {
+        prev_header->nxt_free_block = block;
+    }
+    segment->nblocks--;
+    pthread_mutex_unlock(&segment->lock);
+    return 0;
+}
+
+int shm_heap_set_root(shm_heap * heap, shm_off root) {
+    if (lock_heap(heap) == -1) {
+        return -1;
+    }
+    heap->segment->root = root;
+    pthread_mutex_unlock(&heap->segment->lock);
+    return 0;
+}
+
+shm_off shm_heap_get_root(shm_heap * heap) {
+    if (lock_heap(heap) == -1) {
+        return SHM_OFF_NULL;
+    }
+    shm_off root = heap->segment->root;
+    pthread_mutex_unlock(&heap->segment->lock);
+    return root;
+}
+
+int shm_heap_get_stats(shm_heap * heap, shm_heap_stats * stats) {
+    shm_segment * segment = heap->segment;
+    if (lock_heap(heap) == -1) {
+        return -1;
+    }
+    *stats = (shm_heap_stats) { .heap_bytes = segment->size - segment->heap_start, .nblocks = segment->nblocks,
+        .nrecoveries = segment->nrecoveries };
+    for (shm_off offset = segment->free_block_list; offset != SHM_OFF_NULL; offset = block_at(heap, offset)->nxt_free_block) {
+        stats->free_bytes += SHM_BLOCK_HEADER_SZ + block_at(heap, offset)->length;
+        stats->nfree_blocks++;
+    }
+    pthread_mutex_unlock(&segment->lock);
+    return 0;
+}
@@ -0,0 +1,107 @@
+#ifndef __CHPT7_SHM_HEAP_H__
+#define __CHPT7_SHM_HEAP_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Heap in a shared memory segment, for data shared between processes such as large lookup tables.
+ *
+ * The same first fit as __malloc, with blocks carved from the end of the first free block that fits and merged
+ * back with their free neighbors, but every link is an offset from the start of the segment instead of a pointer.
+ * Each process can map the segment at a different address: a shm_off means the same block in all of them,
+ * shm_ptr turns it into a pointer valid in the calling process only.
+ *
+ * The segment is either a memfd, whose descriptor is shared by forking or passed over a UNIX socket,
+ * or a named POSIX shared memory object. It has a fixed size, chosen when it's created.
+ *
+ * All functions are safe to call from any number of processes and threads: the heap is guarded by a
+ * process-shared mutex living in the segment. The mutex is robust: when a process dies holding it, the next one
+ * to lock it checks the free list and goes on, losing at most the block the dead process was allocating or freeing.
+ * If the free list is damaged, the heap is given up: every function fails with ENOTRECOVERABLE from then on.
+ */
+
+typedef uint64_t shm_off;
+
+#define SHM_OFF_NULL 0 // The segment's header is at offset 0, so no block ever is
+#define SHM_HEAP_ALIGN 16 // Alignment of the blocks, enough for any type
+
+typedef struct shm_segment shm_segment;
+
+/**
+ * A mapping of the segment in this process.
+ */
+typedef struct {
+    shm_segment * segment; // Where it's mapped
+    size_t size;
+    int fd;
+} shm_heap;
+
+/**
+ * Create a segment of size bytes (rounded up to pages) with an empty heap, and map it.
+ * With name NULL it's a memfd, otherwise a POSIX shared memory object that mustn't exist yet.
+ * Returns 0, or -1 with errno set.
+ */
+int shm_heap_create(shm_heap * heap, const char * name, size_t size);
+
+/**
+ * Map the segment open on fd, such as the memfd of a heap created by some other process. fd is then owned by heap.
+ * Returns 0, or -1 with errno set (EINVAL if it doesn't hold a heap).
+ */
+int shm_heap_attach_fd(shm_heap * heap, int fd);
+
+/**
+ * Map the segment of a heap created with a name.
+ */
+int shm_heap_attach(shm_heap * heap, const char * name);
+
+/**
+ * Unmap the segment and close its descriptor. The segment lives on until no process has it mapped,
+ * and for a named one, until it's shm_unlink'ed.
+ */
+void shm_heap_detach(shm_heap * heap);
+
+/**
+ * Allocate size bytes aligned to SHM_HEAP_ALIGN, or return SHM_OFF_NULL with errno set
+ * (ENOMEM, or ENOTRECOVERABLE).
+ */
+shm_off shm_alloc(shm_heap * heap, size_t size);
+
+/**
+ * Free the block at offset. SHM_OFF_NULL is ignored. Returns 0, or -1 with errno set to ENOTRECOVERABLE.
+ */
+int shm_free(shm_heap * heap, shm_off offset);
+
+/**
+ * A single offset stored in the segment, for the process building a shared structure to publish it to the others.
+ * Returns 0, or -1 with errno set to ENOTRECOVERABLE.
+ */
+int shm_heap_set_root(shm_heap * heap, shm_off root);
+
+/**
+ * The root, or SHM_OFF_NULL: with errno set to ENOTRECOVERABLE if the heap was given up.
+ */
+shm_off shm_heap_get_root(shm_heap * heap);
+
+static inline void * shm_ptr(const shm_heap * heap, shm_off offset) {
+    return offset == SHM_OFF_NULL ? NULL : (char *) heap->segment + offset;
+}
+
+static inline shm_off shm_off_of(const shm_heap * heap, const void * memory) {
+    return memory == NULL ? SHM_OFF_NULL : (shm_off) ((const char *) memory - (const char *) heap->segment);
+}
+
+typedef struct {
+    size_t heap_bytes; // Usable by blocks, headers included
+    size_t free_bytes;
+    size_t nfree_blocks;
+    size_t nblocks; // Allocated, which may be off by the blocks lost by the recoveries
+    size_t nrecoveries; // From processes dying while holding the lock
+} shm_heap_stats;
+
+/**
+ * Returns 0, or -1 with errno set to ENOTRECOVERABLE.
+ */
+int shm_heap_get_stats(shm_heap * heap, shm_heap_stats * stats);
+
+#endif
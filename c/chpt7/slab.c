@@ -0,0 +1,202 @@
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "../shared/utils.h"
+#include "q2.h"
+#include "slab.h"
+
+#define SLAB_MIN_OBJECTS 8
+
+typedef struct slab slab;
+typedef struct slab_chunk slab_chunk;
+
+/**
+ * Header at the start of each slab's page.
+ */
+struct slab {
+    slab_cache * cache;
+    slab * next; // Next in the cache's partial list. Slabs only ever leave it from the front, when they fill up
+    void * free_objects; // Freed objects, linked through their first bytes
+    char * unused; // Next object never handed out, objects from here to the end of the page are free too
+    size_t nobjects; // Objects allocated from this slab
+};
+
+/**
+ * Header of each __malloc block the slabs are carved from, linking them for slab_cache_destroy.
+ */
+struct slab_chunk {
+    slab_chunk * next;
+};
+
+struct slab_cache {
+    size_t object_size;
+    size_t first_object; // Offset of the first object in a slab, after its header
+    size_t objects_per_slab;
+    slab * partial; // Slabs with free objects. The ones we freed to last come first, as they're warm in the cache
+    slab_chunk * chunks;
+    char * next_slab; // Slabs of the latest chunk not used yet
+    size_t slabs_left;
+    size_t nslabs;
+    size_t nobjects;
+    size_t heap_bytes;
+};
+
+static size_t page_size; // Slabs are a page long
+
+static size_t align_up(size_t n, size_t align) {
+    return (n + align - 1) & ~(align - 1);
+}
+
+slab_cache * slab_cache_create(size_t size, size_t align) {
+    if (page_size == 0) {
+        page_size = sysconf(_SC_PAGESIZE);
+    }
+
+    //
+    // Free objects hold a pointer, so they must be at least as large and aligned as one.
+    //
+    align = max(align, sizeof(void *));
+    //
+    // Sizes past a page are rejected before rounding up, which could wrap them around to 0.
+    //
+    if ((align & (align - 1)) != 0 || align >= page_size || size > page_size) {
+        errno = EINVAL;
+        return NULL;
+    }
+    size_t object_size = align_up(max(size, sizeof(void *)), align);
+    size_t first_object = align_up(sizeof(slab), align);
+    if (object_size > page_size || (page_size - first_object) / object_size < SLAB_MIN_OBJECTS) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    slab_cache * cache = __malloc(sizeof(slab_cache));
+    if (cache == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    *cache = (slab_cache) {
+        .object_size = object_size,
+        .first_object = first_object,
+        .objects_per_slab = (page_size - first_object) / object_size,
+        .heap_bytes = sizeof(slab_cache),
+    };
+    return cache;
+}
+
+void slab_cache_destroy(slab_cache * cache) {
+    slab_chunk * chunk = cache->chunks;
+    while (chunk != NULL) {
+        slab_chunk * next = chunk->next;
+        __free(chunk);
+        chunk = next;
+    }
+    __free(cache);
+}
+
+/**
+ * Take a new slab from the current chunk, getting a new chunk from __malloc when it's used up.
+ */
+static slab * slab_new(slab_cache * cache) {
+    if (cache->slabs_left == 0) {
+        //
+        // __malloc blocks are not page-aligned: ask for one page more than needed, less a byte,
+        //  to be able to round the first slab up to a page boundary.
+        //
+        size_t chunk_size = sizeof(slab_chunk) + (SLAB_CHUNK_PAGES + 1) * page_size - 1;
+        slab_chunk * chunk = __malloc(chunk_size);
+        if (chunk == NULL) {
+            errno = ENOMEM;
+            return NULL;
+        }
+        chunk->next = cache->chunks;
+        cache->chunks = chunk;
+        cache->heap_bytes += chunk_size;
+        cache->next_slab = (char *) align_up((uintptr_t) (chunk + 1), page_size);
+        cache->slabs_left = SLAB_CHUNK_PAGES;
+    }
+
+    slab * s = (slab *) cache->next_slab;
+    cache->next_slab += page_size;
+    cache->slabs_left--;
+    cache->nslabs++;
+
+    *s = (slab) {
+        .cache = cache,
+        .unused = (char *) s + cache->first_object,
+    };
+    return s;
+}
+
+void * slab_alloc(slab_cache * cache) {
+    slab * s = cache->partial;
+    if (s == NULL) {
+        if ((s = slab_new(cache)) == NULL) {
+            return NULL;
+        }
+        cache->partial = s;
+    }
+
+    void * object;
+    if (s->free_objects != NULL) {
+        object = s->free_objects;
+        s->free_objects = *(void **) object;
+    } else {
+        //
+        // Every object handed out so far is still allocated, so there must be room left at the end of the slab.
+        //
+        object = s->unused;
+        s->unused += cache->object_size;
+    }
+    cache->nobjects++;
+
+    if (++s->nobjects == cache->objects_per_slab) {
+        //
+        // Full: drop it from the partial list, where it is first.
+        //
+        cache->partial = s->next;
+        s->next = NULL;
+    }
+    return object;
+}
+
+/**
+ * Slabs are aligned to the page size: round an object's address down to it to find its slab.
+ */
+static slab * slab_of(const void * object) {
+    return (slab *) ((uintptr_t) object & ~(page_size - 1));
+}
+
+slab_cache * slab_cache_of(const void * object) {
+    return slab_of(object)->cache;
+}
+
+void slab_free(slab_cache * cache, void * object) {
+    if (object == NULL) {
+        return;
+    }
+
+    slab * s = slab_of(object);
+    *(void **) object = s->free_objects;
+    s->free_objects = object;
+    cache->nobjects--;
+
+    if (s->nobjects-- == cache->objects_per_slab) {
+        //
+        // Was full: it's back in the partial list, first so the next allocations reuse it while it's warm.
+        //
+        s->next = cache->partial;
+        cache->partial = s;
+    }
+}
+
+void slab_cache_get_stats(const slab_cache * cache, slab_cache_stats * stats) {
+    *stats = (slab_cache_stats) {
+        .object_size = cache->object_size,
+        .objects_per_slab = cache->objects_per_slab,
+        .nslabs = cache->nslabs,
+        .nobjects = cache->nobjects,
+        .heap_bytes = cache->heap_bytes,
+    };
+}
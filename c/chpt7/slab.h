@@ -0,0 +1,58 @@
+#ifndef __CHPT7_SLAB_H__
+#define __CHPT7_SLAB_H__
+
+#include <stddef.h>
+
+/**
+ * Object caches for hot fixed-size allocations, on top of __malloc.
+ *
+ * A cache hands out objects of a single size and alignment from page-sized, page-aligned slabs.
+ * Each slab starts with a small header, followed by its objects back to back: objects carry no header of their own,
+ * and free ones are linked through their first bytes. Freeing finds the slab by rounding the address down to its page.
+ * Slabs are carved SLAB_CHUNK_PAGES at a time out of a single __malloc block, and are only handed back to __malloc
+ * when the cache is destroyed.
+ *
+ * Not thread safe, like __malloc.
+ */
+
+#define SLAB_CHUNK_PAGES 16
+
+typedef struct slab_cache slab_cache;
+
+typedef struct {
+    size_t object_size; // Size of each object, after rounding up to the alignment
+    size_t objects_per_slab;
+    size_t nslabs;
+    size_t nobjects; // Objects currently allocated
+    size_t heap_bytes; // Bytes taken from __malloc, cache included
+} slab_cache_stats;
+
+/**
+ * Create a cache of objects of size bytes, aligned to align bytes (a power of two, 0 for pointer alignment).
+ * Returns NULL with errno set to EINVAL if less than 8 objects fit in a slab, or to ENOMEM if __malloc fails.
+ */
+slab_cache * slab_cache_create(size_t size, size_t align);
+
+/**
+ * Return every slab of cache to __malloc, and the cache itself. Objects still allocated from it are freed too.
+ */
+void slab_cache_destroy(slab_cache * cache);
+
+/**
+ * Allocate an object from cache, or return NULL with errno set to ENOMEM.
+ */
+void * slab_alloc(slab_cache * cache);
+
+/**
+ * Free an object allocated from cache. NULL is ignored.
+ */
+void slab_free(slab_cache * cache, void * object);
+
+/**
+ * Cache an object was allocated from.
+ */
+slab_cache * slab_cache_of(const void * object);
+
+void slab_cache_get_stats(const slab_cache * cache, slab_cache_stats * stats);
+
+#endif
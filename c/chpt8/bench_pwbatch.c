@@ -0,0 +1,144 @@
+#include <errno.h>
+#include <pthread.h>
+#include <pwd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "../shared/bench.h"
+#include "../shared/errors.h"
+#include "../shared/utils.h"
+#include "bench_pwbatch.h"
+#include "pwcache.h"
+#include "synthdb.h"
+
+#define BENCH_PWBATCH_PATH "/tmp/cracking-the-linux-prog-interface-passwd"
+#define BENCH_PWBATCH_LOOKUPS 4000000
+#define BENCH_PWBATCH_HOT_UIDS 100
+#define BENCH_PWBATCH_HOT_PERCENT 90
+#define BENCH_PWBATCH_SIZE 1024
+#define BENCH_PWBATCH_BUF_SZ (BENCH_PWBATCH_SIZE * 128)
+#define BENCH_PWBATCH_MAX_THREADS 8
+
+typedef struct {
+    const uid_t * uids;
+    long nuids;
+    pthread_barrier_t * start_barrier;
+} batch_worker;
+
+/**
+ * Resolve the worker's share of the stream in batches of BENCH_PWBATCH_SIZE, with its own results and buffer.
+ */
+static void * resolve_batches(void * arg) {
+    batch_worker * worker = arg;
+    struct passwd * results = malloc(BENCH_PWBATCH_SIZE * sizeof(struct passwd));
+    char * buf = malloc(BENCH_PWBATCH_BUF_SZ);
+    if (results == NULL || buf == NULL) {
+        errExit("malloc");
+    }
+    pthread_barrier_wait(worker->start_barrier);
+    for (long i = 0; i < worker->nuids; i += BENCH_PWBATCH_SIZE) {
+        size_t nfound, n = min(BENCH_PWBATCH_SIZE, worker->nuids - i);
+        if (__getpwuid_batch(worker->uids + i, n, results, buf, BENCH_PWBATCH_BUF_SZ, &nfound) != 0 || nfound != n) {
+            fatal("batch at %ld failed\n", i);
+        }
+    }
+    free(buf);
+    free(results);
+    return NULL;
+}
+
+/**
+ * Split the stream of uids between nthreads threads resolving it at the same time.
+ */
+static void run_threads(const uid_t * uids, int nthreads, long nusers) {
+    pthread_t threads[BENCH_PWBATCH_MAX_THREADS];
+    batch_worker workers[BENCH_PWBATCH_MAX_THREADS];
+    pthread_barrier_t start_barrier;
+    pthread_barrier_init(&start_barrier, NULL, nthreads + 1);
+    long share = BENCH_PWBATCH_LOOKUPS / nthreads;
+    for (int i = 0; i < nthreads; i++) {
+        workers[i] = (batch_worker) { uids + i * share, share, &start_barrier };
+        if ((errno = pthread_create(&threads[i], NULL, resolve_batches, &workers[i])) != 0) {
+            errExit("pthread_create");
+        }
+    }
+
+    pthread_barrier_wait(&start_barrier);
+    double start = bench_now();
+    for (int i = 0; i < nthreads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    double elapsed = bench_now() - start;
+    pthread_barrier_destroy(&start_barrier);
+
+    char label[64];
+    snprintf(label, sizeof(label), "pwbatch/%ld/__getpwuid_batch(%d)/%dthreads", nusers, BENCH_PWBATCH_SIZE, nthreads);
+    bench_report(label, nthreads * share / elapsed, "lookups/s");
+}
+
+void chpt8_bench_pwbatch(long nusers) {
+    synth_passwd(BENCH_PWBATCH_PATH, nusers);
+    pwcache_set_source(BENCH_PWBATCH_PATH, NULL);
+    char label[64];
+
+    // Most records come from a few busy users
+    uid_t * uids = malloc(BENCH_PWBATCH_LOOKUPS * sizeof(uid_t));
+    struct passwd * results = malloc(BENCH_PWBATCH_SIZE * sizeof(struct passwd));
+    char * buf = malloc(BENCH_PWBATCH_BUF_SZ);
+    if (uids == NULL || results == NULL || buf == NULL) {
+        errExit("malloc");
+    }
+    srand(42);
+    for (long i = 0; i < BENCH_PWBATCH_LOOKUPS; i++) {
+        long user = (rand() % 100 < BENCH_PWBATCH_HOT_PERCENT) ? rand() % BENCH_PWBATCH_HOT_UIDS : rand() % nusers;
+        uids[i] = SYNTH_FIRST_UID + user;
+    }
+
+    // glibc resolves through NSS, so it can only be pointed at the real /etc/passwd: root is a hit like any other
+    struct passwd pwd, * result;
+    double start = bench_now();
+    for (long i = 0; i < BENCH_PWBATCH_LOOKUPS / 10; i++) {
+        if (getpwuid_r(0, &pwd, buf, BENCH_PWBATCH_BUF_SZ, &result) != 0 || result == NULL) {
+            fatal("uid 0 not found\n");
+        }
+    }
+    bench_report("pwbatch/glibc_getpwuid_r(/etc/passwd)", BENCH_PWBATCH_LOOKUPS / 10 / (bench_now() - start), "lookups/s");
+
+    if (__getpwuid_r(0, &pwd, buf, BENCH_PWBATCH_BUF_SZ, &result) != 0) { // Build the index outside the timings
+        errExit("__getpwuid_r");
+    }
+    start = bench_now();
+    for (long i = 0; i < BENCH_PWBATCH_LOOKUPS; i++) {
+        if (__getpwuid_r(uids[i], &pwd, buf, BENCH_PWBATCH_BUF_SZ, &result) != 0 || result == NULL) {
+            fatal("uid %ld not found\n", (long) uids[i]);
+        }
+    }
+    snprintf(label, sizeof(label), "pwbatch/%ld/__getpwuid_r", nusers);
+    bench_report(label, BENCH_PWBATCH_LOOKUPS / (bench_now() - start), "lookups/s");
+
+    for (long batch_sz = 16; batch_sz <= BENCH_PWBATCH_SIZE; batch_sz *= 8) {
+        start = bench_now();
+        for (long i = 0; i < BENCH_PWBATCH_LOOKUPS; i += batch_sz) {
+            size_t nfound, n = min(batch_sz, BENCH_PWBATCH_LOOKUPS - i);
+            if (__getpwuid_batch(uids + i, n, results, buf, BENCH_PWBATCH_BUF_SZ, &nfound) != 0 || nfound != n) {
+                fatal("batch at %ld failed\n", i);
+            }
+        }
+        snprintf(label, sizeof(label), "pwbatch/%ld/__getpwuid_batch(%ld)", nusers, batch_sz);
+        bench_report(label, BENCH_PWBATCH_LOOKUPS / (bench_now() - start), "lookups/s");
+    }
+
+    // Log enrichment spread over threads, which only contend on the LRU set they probe
+    for (int nthreads = 1; nthreads <= BENCH_PWBATCH_MAX_THREADS; nthreads *= 2) {
+        run_threads(uids, nthreads, nusers);
+    }
+
+    free(buf);
+    free(results);
+    free(uids);
+    pwcache_set_source(NULL, NULL);
+    if (unlink(BENCH_PWBATCH_PATH) == -1) {
+        errExit("unlink");
+    }
+}
@@ -0,0 +1,11 @@
+#ifndef __CHPT8_BENCH_PWBATCH_H__
+#define __CHPT8_BENCH_PWBATCH_H__
+
+/**
+ * Compare per-call getpwuid_r and __getpwuid_r with __getpwuid_batch on a skewed stream of uids,
+ * like the ones found in logs, over a synthetic passwd file with nusers entries.
+ * Then split the batches between 1 to 8 threads, to see them scale.
+ */
+void chpt8_bench_pwbatch(long nusers);
+
+#endif
@@ -0,0 +1,68 @@
+#include <pwd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../shared/bench.h"
+#include "../shared/errors.h"
+#include "../shared/utils.h"
+#include "bench_pwcache.h"
+#include "pwcache.h"
+#include "synthdb.h"
+
+#define BENCH_PWCACHE_PATH "/tmp/cracking-the-linux-prog-interface-passwd"
+#define BENCH_PWCACHE_LOOKUPS 1000000
+#define BENCH_PWCACHE_SCANNED_ENTRIES 20000000 // Bound the scan benchmark to about this many parsed entries
+
+void chpt8_bench_pwcache(long nusers) {
+    synth_passwd(BENCH_PWCACHE_PATH, nusers);
+    char name[32], label[64];
+    srand(42);
+
+    long nscans = max(BENCH_PWCACHE_SCANNED_ENTRIES / nusers, 10L);
+    double start = bench_now();
+    for (long i = 0; i < nscans; i++) {
+        synth_user_name(name, sizeof(name), rand() % nusers);
+        if (scan_getpwnam(BENCH_PWCACHE_PATH, name) == NULL) {
+            fatal("%s not found\n", name);
+        }
+    }
+    snprintf(label, sizeof(label), "pwcache/%ld/scan_getpwnam", nusers);
+    bench_report(label, nscans / (bench_now() - start), "lookups/s");
+
+    struct passwd pwd, * result;
+    char buf[1024];
+    pwcache_set_source(BENCH_PWCACHE_PATH, NULL);
+
+    start = bench_now();
+    if (__getpwuid_r(0, &pwd, buf, sizeof(buf), &result) != 0) {
+        errExit("__getpwuid_r");
+    }
+    snprintf(label, sizeof(label), "pwcache/%ld/build", nusers);
+    bench_report(label, (bench_now() - start) * 1e3, "ms");
+
+    start = bench_now();
+    for (long i = 0; i < BENCH_PWCACHE_LOOKUPS; i++) {
+        synth_user_name(name, sizeof(name), rand() % nusers);
+        if (__getpwnam_r(name, &pwd, buf, sizeof(buf), &result) != 0 || result == NULL) {
+            fatal("%s not found\n", name);
+        }
+    }
+    snprintf(label, sizeof(label), "pwcache/%ld/__getpwnam_r", nusers);
+    bench_report(label, BENCH_PWCACHE_LOOKUPS / (bench_now() - start), "lookups/s");
+
+    start = bench_now();
+    for (long i = 0; i < BENCH_PWCACHE_LOOKUPS; i++) {
+        if (__getpwuid_r(SYNTH_FIRST_UID + rand() % nusers, &pwd, buf, sizeof(buf), &result) != 0 || result == NULL) {
+            fatal("uid not found\n");
+        }
+    }
+    snprintf(label, sizeof(label), "pwcache/%ld/__getpwuid_r", nusers);
+    bench_report(label, BENCH_PWCACHE_LOOKUPS / (bench_now() - start), "lookups/s");
+
+    pwcache_set_source(NULL, NULL);
+    if (unlink(BENCH_PWCACHE_PATH) == -1) {
+        errExit("unlink");
+    }
+}
@@ -0,0 +1,10 @@
+#ifndef __CHPT8_BENCH_PWCACHE_H__
+#define __CHPT8_BENCH_PWCACHE_H__
+
+/**
+ * Compare scanning the passwd file per lookup (what __getpwnam does) with the indexed __getpwnam_r/__getpwuid_r,
+ * on a synthetic passwd file with nusers entries.
+ */
+void chpt8_bench_pwcache(long nusers);
+
+#endif
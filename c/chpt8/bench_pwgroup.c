@@ -0,0 +1,100 @@
+#include <grp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../shared/bench.h"
+#include "../shared/errors.h"
+#include "bench_pwgroup.h"
+#include "pwcache.h"
+#include "synthdb.h"
+
+#define BENCH_PWGROUP_PASSWD_PATH "/tmp/cracking-the-linux-prog-interface-passwd"
+#define BENCH_PWGROUP_GROUP_PATH "/tmp/cracking-the-linux-prog-interface-group"
+#define BENCH_PWGROUP_USERS 20000
+#define BENCH_PWGROUP_SCANS 5
+#define BENCH_PWGROUP_LOOKUPS 200000
+#define BENCH_PWGROUP_MAX_GIDS 65536
+#define BENCH_PWGROUP_BUF_SZ (1 << 20)
+
+void chpt8_bench_pwgroup(long ngroups, long nmembers) {
+    synth_passwd(BENCH_PWGROUP_PASSWD_PATH, BENCH_PWGROUP_USERS);
+    synth_group(BENCH_PWGROUP_GROUP_PATH, ngroups, BENCH_PWGROUP_USERS, nmembers);
+    char name[32], label[64];
+    gid_t * gids = malloc(BENCH_PWGROUP_MAX_GIDS * sizeof(gid_t));
+    char * buf = malloc(BENCH_PWGROUP_BUF_SZ);
+    if (gids == NULL || buf == NULL) {
+        errExit("malloc");
+    }
+    srand(42);
+
+    long total_gids = 0;
+    double start = bench_now();
+    for (long i = 0; i < BENCH_PWGROUP_SCANS; i++) {
+        int ngids = BENCH_PWGROUP_MAX_GIDS;
+        synth_user_name(name, sizeof(name), rand() % BENCH_PWGROUP_USERS);
+        if (scan_getgrouplist(BENCH_PWGROUP_GROUP_PATH, name, 0, gids, &ngids) == -1) {
+            fatal("too many groups for %s\n", name);
+        }
+        total_gids += ngids;
+    }
+    snprintf(label, sizeof(label), "pwgroup/%ldx%ld/scan_getgrouplist", ngroups, nmembers);
+    bench_report(label, BENCH_PWGROUP_SCANS / (bench_now() - start), "lookups/s");
+    snprintf(label, sizeof(label), "pwgroup/%ldx%ld/groups_per_user", ngroups, nmembers);
+    bench_report(label, (double) total_gids / BENCH_PWGROUP_SCANS, "gids");
+
+    pwcache_set_source(BENCH_PWGROUP_PASSWD_PATH, BENCH_PWGROUP_GROUP_PATH);
+    pwcache_stats stats;
+    start = bench_now();
+    pwcache_get_stats(&stats);
+    snprintf(label, sizeof(label), "pwgroup/%ldx%ld/build", ngroups, nmembers);
+    bench_report(label, (bench_now() - start) * 1e3, "ms");
+
+    struct stat st;
+    if (stat(BENCH_PWGROUP_GROUP_PATH, &st) == -1) {
+        errExit("stat");
+    }
+    snprintf(label, sizeof(label), "pwgroup/%ldx%ld/group_file", ngroups, nmembers);
+    bench_report(label, st.st_size / 1024.0, "KB");
+    snprintf(label, sizeof(label), "pwgroup/%ldx%ld/index(passwd+group)", ngroups, nmembers);
+    bench_report(label, (stats.pool_bytes + stats.index_bytes) / 1024.0, "KB");
+
+    start = bench_now();
+    for (long i = 0; i < BENCH_PWGROUP_LOOKUPS; i++) {
+        int ngids = BENCH_PWGROUP_MAX_GIDS;
+        synth_user_name(name, sizeof(name), rand() % BENCH_PWGROUP_USERS);
+        if (__getgrouplist(name, 0, gids, &ngids) == -1) {
+            errExit("__getgrouplist %s", name);
+        }
+    }
+    snprintf(label, sizeof(label), "pwgroup/%ldx%ld/__getgrouplist", ngroups, nmembers);
+    bench_report(label, BENCH_PWGROUP_LOOKUPS / (bench_now() - start), "lookups/s");
+
+    struct group grp, * result;
+    start = bench_now();
+    for (long i = 0; i < BENCH_PWGROUP_LOOKUPS; i++) {
+        if (__getgrgid_r(SYNTH_FIRST_GID + rand() % ngroups, &grp, buf, BENCH_PWGROUP_BUF_SZ, &result) != 0 || result == NULL) {
+            fatal("gid not found\n");
+        }
+    }
+    snprintf(label, sizeof(label), "pwgroup/%ldx%ld/__getgrgid_r", ngroups, nmembers);
+    bench_report(label, BENCH_PWGROUP_LOOKUPS / (bench_now() - start), "lookups/s");
+
+    start = bench_now();
+    for (long i = 0; i < BENCH_PWGROUP_LOOKUPS; i++) {
+        snprintf(name, sizeof(name), "group%ld", rand() % ngroups);
+        if (__getgrnam_r(name, &grp, buf, BENCH_PWGROUP_BUF_SZ, &result) != 0 || result == NULL) {
+            fatal("%s not found\n", name);
+        }
+    }
+    snprintf(label, sizeof(label), "pwgroup/%ldx%ld/__getgrnam_r", ngroups, nmembers);
+    bench_report(label, BENCH_PWGROUP_LOOKUPS / (bench_now() - start), "lookups/s");
+
+    free(buf);
+    free(gids);
+    pwcache_set_source(NULL, NULL);
+    if (unlink(BENCH_PWGROUP_PASSWD_PATH) == -1 || unlink(BENCH_PWGROUP_GROUP_PATH) == -1) {
+        errExit("unlink");
+    }
+}
@@ -0,0 +1,10 @@
+#ifndef __CHPT8_BENCH_PWGROUP_H__
+#define __CHPT8_BENCH_PWGROUP_H__
+
+/**
+ * Compare scanning the group file per call (what getgrouplist does) with the indexed
+ * __getgrnam_r/__getgrgid_r/__getgrouplist, on a synthetic group file with ngroups entries of nmembers members each.
+ */
+void chpt8_bench_pwgroup(long ngroups, long nmembers);
+
+#endif
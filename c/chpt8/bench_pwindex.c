@@ -0,0 +1,122 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pwd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../shared/bench.h"
+#include "../shared/errors.h"
+#include "../shared/utils.h"
+#include "bench_pwindex.h"
+#include "pwcache.h"
+#include "synthdb.h"
+
+#define BENCH_PWINDEX_PASSWD_PATH "/tmp/cracking-the-linux-prog-interface-passwd"
+#define BENCH_PWINDEX_GROUP_PATH "/tmp/cracking-the-linux-prog-interface-group"
+#define BENCH_PWINDEX_PATH "/tmp/cracking-the-linux-prog-interface-pwcache.idx"
+#define BENCH_PWINDEX_MEMBERS 20
+#define BENCH_PWINDEX_STARTS 20
+#define BENCH_PWINDEX_LOOKUPS 1000000
+
+/**
+ * Drop a file from the page cache, so that the next read comes from the disk.
+ */
+static void evict(const char * path) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        errExit("open %s", path);
+    }
+    if (fsync(fd) == -1) { // Dirty pages can't be dropped
+        errExit("fsync");
+    }
+    int err = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    if (err != 0) {
+        errno = err;
+        errExit("posix_fadvise");
+    }
+    safe_close(fd);
+}
+
+/**
+ * Average latency of the first lookup after the index was dropped, like in a new process.
+ */
+static double first_lookup_ms(long nusers, const char * index_path, Boolean cold_cache) {
+    char name[32];
+    struct passwd pwd, * result;
+    char buf[1024];
+    double total = 0;
+    pwcache_set_index(index_path);
+    for (int i = 0; i < BENCH_PWINDEX_STARTS; i++) {
+        if (cold_cache) {
+            evict(BENCH_PWINDEX_PASSWD_PATH);
+            evict(BENCH_PWINDEX_GROUP_PATH);
+            if (index_path != NULL) {
+                evict(index_path);
+            }
+        }
+        pwcache_set_source(BENCH_PWINDEX_PASSWD_PATH, BENCH_PWINDEX_GROUP_PATH);
+        synth_user_name(name, sizeof(name), rand() % nusers);
+        double start = bench_now();
+        if (__getpwnam_r(name, &pwd, buf, sizeof(buf), &result) != 0 || result == NULL) {
+            fatal("%s not found\n", name);
+        }
+        total += bench_now() - start;
+    }
+    pwcache_stats stats;
+    pwcache_get_stats(&stats);
+    if (stats.from_index != (index_path != NULL)) {
+        fatal("The index was%s used\n", stats.from_index ? "" : " not");
+    }
+    return total / BENCH_PWINDEX_STARTS * 1e3;
+}
+
+void chpt8_bench_pwindex(long nusers) {
+    synth_passwd(BENCH_PWINDEX_PASSWD_PATH, nusers);
+    synth_group(BENCH_PWINDEX_GROUP_PATH, max(nusers / 10, 1L), nusers, BENCH_PWINDEX_MEMBERS);
+    pwcache_set_source(BENCH_PWINDEX_PASSWD_PATH, BENCH_PWINDEX_GROUP_PATH);
+    char label[64];
+    srand(42);
+
+    double start = bench_now();
+    if (pwcache_compile(BENCH_PWINDEX_PATH) == -1) {
+        errExit("pwcache_compile");
+    }
+    snprintf(label, sizeof(label), "pwindex/%ld/compile", nusers);
+    bench_report(label, (bench_now() - start) * 1e3, "ms");
+    struct stat st;
+    if (stat(BENCH_PWINDEX_PATH, &st) == -1) {
+        errExit("stat");
+    }
+    snprintf(label, sizeof(label), "pwindex/%ld/index_file", nusers);
+    bench_report(label, st.st_size / 1024.0, "KB");
+
+    snprintf(label, sizeof(label), "pwindex/%ld/first_lookup/parse", nusers);
+    bench_report(label, first_lookup_ms(nusers, NULL, FALSE), "ms");
+    snprintf(label, sizeof(label), "pwindex/%ld/first_lookup/mapped", nusers);
+    bench_report(label, first_lookup_ms(nusers, BENCH_PWINDEX_PATH, FALSE), "ms");
+    snprintf(label, sizeof(label), "pwindex/%ld/first_lookup/parse(cold cache)", nusers);
+    bench_report(label, first_lookup_ms(nusers, NULL, TRUE), "ms");
+    snprintf(label, sizeof(label), "pwindex/%ld/first_lookup/mapped(cold cache)", nusers);
+    bench_report(label, first_lookup_ms(nusers, BENCH_PWINDEX_PATH, TRUE), "ms");
+
+    // Steady state, from the mapped index
+    char name[32], buf[1024];
+    struct passwd pwd, * result;
+    start = bench_now();
+    for (long i = 0; i < BENCH_PWINDEX_LOOKUPS; i++) {
+        synth_user_name(name, sizeof(name), rand() % nusers);
+        if (__getpwnam_r(name, &pwd, buf, sizeof(buf), &result) != 0 || result == NULL) {
+            fatal("%s not found\n", name);
+        }
+    }
+    snprintf(label, sizeof(label), "pwindex/%ld/__getpwnam_r(mapped)", nusers);
+    bench_report(label, BENCH_PWINDEX_LOOKUPS / (bench_now() - start), "lookups/s");
+
+    pwcache_set_index(PWCACHE_DEFAULT_INDEX);
+    pwcache_set_source(NULL, NULL);
+    if (unlink(BENCH_PWINDEX_PASSWD_PATH) == -1 || unlink(BENCH_PWINDEX_GROUP_PATH) == -1 || unlink(BENCH_PWINDEX_PATH) == -1) {
+        errExit("unlink");
+    }
+}
@@ -0,0 +1,10 @@
+#ifndef __CHPT8_BENCH_PWINDEX_H__
+#define __CHPT8_BENCH_PWINDEX_H__
+
+/**
+ * Measure the latency of the first lookup of a process, which pays for the index: parsing the sources,
+ * or mapping a compiled index. On a synthetic passwd file with nusers entries and a group file with nusers / 10 entries.
+ */
+void chpt8_bench_pwindex(long nusers);
+
+#endif
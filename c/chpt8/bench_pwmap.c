@@ -0,0 +1,90 @@
+#include <pwd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "../shared/bench.h"
+#include "../shared/errors.h"
+#include "../shared/utils.h"
+#include "bench_pwmap.h"
+#include "pwmap.h"
+#include "synthdb.h"
+
+#define BENCH_PWMAP_PATH "/tmp/cracking-the-linux-prog-interface-passwd"
+#define BENCH_PWMAP_SCANNED_ENTRIES 10000000 // Bound each linear benchmark to about this many visited entries
+
+static void bench_size(long nusers) {
+    char name[32], label[64];
+    long nlookups = max(BENCH_PWMAP_SCANNED_ENTRIES / nusers, 10L);
+    synth_passwd(BENCH_PWMAP_PATH, nusers);
+
+    double start = bench_now();
+    for (long i = 0; i < nlookups; i++) {
+        synth_user_name(name, sizeof(name), rand() % nusers);
+        if (scan_getpwnam(BENCH_PWMAP_PATH, name) == NULL) {
+            fatal("%s not found\n", name);
+        }
+    }
+    snprintf(label, sizeof(label), "pwmap/%ld/scan_getpwnam", nusers);
+    bench_report(label, (bench_now() - start) / nlookups * 1e3, "ms/lookup");
+
+    pwmap map;
+    struct passwd pwd;
+    start = bench_now();
+    if (pwmap_open(&map, BENCH_PWMAP_PATH, PWMAP_PASSWD) == -1) {
+        errExit("pwmap_open");
+    }
+    snprintf(label, sizeof(label), "pwmap/%ld/open", nusers);
+    bench_report(label, (bench_now() - start) * 1e3, "ms");
+
+    start = bench_now();
+    for (long i = 0; i < nlookups; i++) {
+        synth_user_name(name, sizeof(name), rand() % nusers);
+        ssize_t line = pwmap_find_name(&map, name);
+        if (line == -1) {
+            fatal("%s not found\n", name);
+        }
+        pwmap_passwd(&map, line, &pwd);
+    }
+    snprintf(label, sizeof(label), "pwmap/%ld/find_name", nusers);
+    bench_report(label, (bench_now() - start) / nlookups * 1e3, "ms/lookup");
+    pwmap_close(&map);
+
+    //
+    // Cost of a single lookup in a fresh process: open, split and search once
+    //
+    start = bench_now();
+    for (long i = 0; i < nlookups; i++) {
+        synth_user_name(name, sizeof(name), rand() % nusers);
+        if (pwmap_open(&map, BENCH_PWMAP_PATH, PWMAP_PASSWD) == -1) {
+            errExit("pwmap_open");
+        }
+        if (pwmap_find_name(&map, name) == -1) {
+            fatal("%s not found\n", name);
+        }
+        pwmap_close(&map);
+    }
+    snprintf(label, sizeof(label), "pwmap/%ld/open+find_name", nusers);
+    bench_report(label, (bench_now() - start) / nlookups * 1e3, "ms/lookup");
+
+    if (unlink(BENCH_PWMAP_PATH) == -1) {
+        errExit("unlink");
+    }
+}
+
+void chpt8_bench_pwmap() {
+    srand(42);
+
+    const long nlookups = 10000;
+    double start = bench_now();
+    for (long i = 0; i < nlookups; i++) {
+        if (getpwnam("root") == NULL) {
+            errExit("getpwnam");
+        }
+    }
+    bench_report("pwmap/etc_passwd/glibc_getpwnam", (bench_now() - start) / nlookups * 1e3, "ms/lookup");
+
+    bench_size(1000);
+    bench_size(100000);
+    bench_size(1000000);
+}
@@ -0,0 +1,10 @@
+#ifndef __CHPT8_BENCH_PWMAP_H__
+#define __CHPT8_BENCH_PWMAP_H__
+
+/**
+ * Compare the mmap passwd reader with per-lookup fgetpwent scans on synthetic files of 1k, 100k and 1M entries,
+ * and report glibc getpwnam on /etc/passwd for reference.
+ */
+void chpt8_bench_pwmap();
+
+#endif
@@ -1,15 +1,81 @@
 #include <stdlib.h>
+#include <string.h>
 
 #include "../shared/errors.h"
 #include "../shared/utils.h"
 #include "q1.h"
 #include "q2.h"
+#include "pwcache.h"
+#include "test_pwcache.h"
+#include "test_pwmap.h"
+#include "bench_pwbatch.h"
+#include "bench_pwcache.h"
+#include "bench_pwgroup.h"
+#include "bench_pwindex.h"
+#include "bench_pwmap.h"
 
 void chpt8_run(const char* q, int argc, char* args[]) {
     if (cmp_question(q, 1)) {
         chpt8_q1();
     } else if (cmp_question(q, 2)) {
         chpt8_q2();
+    } else if (strcmp(q, "test-pwcache") == 0) {
+        chpt8_test_pwcache();
+    } else if (strcmp(q, "test-pwmap") == 0) {
+        chpt8_test_pwmap();
+    } else if (strcmp(q, "bench-pwcache") == 0) {
+        long nusers = 200000;
+        if (argc > 1) {
+            char * end_ptr;
+            nusers = strtol(args[1], &end_ptr, 10);
+            if (*end_ptr != '\0' || nusers <= 0) {
+                usageErr("chpt8 bench-pwcache [NUM USERS]\n");
+            }
+        }
+        chpt8_bench_pwcache(nusers);
+    } else if (strcmp(q, "bench-pwbatch") == 0) {
+        long nusers = 200000;
+        if (argc > 1) {
+            char * end_ptr;
+            nusers = strtol(args[1], &end_ptr, 10);
+            if (*end_ptr != '\0' || nusers <= 0) {
+                usageErr("chpt8 bench-pwbatch [NUM USERS]\n");
+            }
+        }
+        chpt8_bench_pwbatch(nusers);
+    } else if (strcmp(q, "bench-pwgroup") == 0) {
+        long ngroups = 50000, nmembers = 100;
+        char * end_ptr;
+        if (argc > 1 && ((ngroups = strtol(args[1], &end_ptr, 10)) <= 0 || *end_ptr != '\0')) {
+            usageErr("chpt8 bench-pwgroup [NUM GROUPS] [NUM MEMBERS]\n");
+        }
+        if (argc > 2 && ((nmembers = strtol(args[2], &end_ptr, 10)) <= 0 || *end_ptr != '\0')) {
+            usageErr("chpt8 bench-pwgroup [NUM GROUPS] [NUM MEMBERS]\n");
+        }
+        chpt8_bench_pwgroup(ngroups, nmembers);
+    } else if (strcmp(q, "bench-pwindex") == 0) {
+        long nusers = 200000;
+        if (argc > 1) {
+            char * end_ptr;
+            nusers = strtol(args[1], &end_ptr, 10);
+            if (*end_ptr != '\0' || nusers <= 0) {
+                usageErr("chpt8 bench-pwindex [NUM USERS]\n");
+            }
+        }
+        chpt8_bench_pwindex(nusers);
+    } else if (strcmp(q, "pwindex") == 0) {
+        // Compile the passwd and group databases (NSS by default) into an index
+        if (argc != 2 && argc != 4) {
+            usageErr("chpt8 pwindex INDEX [PASSWD GROUP]\n");
+        }
+        if (argc == 4) {
+            pwcache_set_source(args[2], args[3]);
+        }
+        if (pwcache_compile(args[1]) == -1) {
+            errExit("Failed to compile %s", args[1]);
+        }
+    } else if (strcmp(q, "bench-pwmap") == 0) {
+        chpt8_bench_pwmap();
     } else {
         usageErr("Chapter 8 has no solution for \"%s\"\n", q);
     }
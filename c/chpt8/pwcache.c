@@ -0,0 +1,1429 @@
+#define _GNU_SOURCE /* For fgetpwent, fgetgrent */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../shared/errors.h"
+#include "../shared/utils.h"
+#include "pwcache.h"
+
+//
+// The index only holds offsets, never pointers: arrays of fixed size records and one pool with all their strings.
+// Strings are interned, so a user name listed in thousands of groups, or the shell of every user, is stored once.
+//
+typedef struct {
+    uint32_t name; // Offsets into the string pool
+    uint32_t passwd;
+    uint32_t gecos;
+    uint32_t dir;
+    uint32_t shell;
+    uint32_t uid;
+    uint32_t gid;
+} pwcache_user;
+
+typedef struct {
+    uint32_t name; // Offsets into the string pool
+    uint32_t passwd;
+    uint32_t gid;
+    uint32_t members; // Position of the first member in member_names
+    uint32_t nmembers;
+} pwcache_group;
+
+//
+// The groups a user name is listed in, in file order. Not to be confused with its primary group.
+//
+typedef struct {
+    uint32_t name; // Offset into the string pool
+    uint32_t gids; // Position of the first gid in member_gids
+    uint32_t ngids;
+} pwcache_membership;
+
+//
+// Hash and displace perfect hash table: a key hashes to a bucket, whose displacement picks the only slot the key can be in.
+// Lookups cost a single probe, and the table can be used in place from a mapped file.
+//
+typedef struct {
+    uint32_t nbuckets;
+    uint32_t nslots;
+    uint64_t seed;
+    uint32_t * displacements; // One per bucket
+    uint32_t * slots; // Position of the key in its array + 1. 0 marks an empty slot.
+} pwcache_phf;
+
+typedef struct {
+    pwcache_user * users;
+    size_t nusers;
+    pwcache_group * groups;
+    size_t ngroups;
+    uint32_t * member_names; // Offsets into the string pool, nmembers per group
+    size_t nmember_names;
+    pwcache_membership * memberships;
+    size_t nmemberships;
+    uint32_t * member_gids; // ngids per membership
+    size_t nmember_gids;
+    char * pool;
+    size_t pool_sz;
+    pwcache_phf by_user_name;
+    pwcache_phf by_uid;
+    pwcache_phf by_group_name;
+    pwcache_phf by_gid;
+    pwcache_phf by_member; // Over memberships
+    void * mapping; // When set, everything above points into this mapped index file
+    size_t mapping_sz;
+} pwcache_db;
+
+static pthread_rwlock_t db_lock = PTHREAD_RWLOCK_INITIALIZER;
+static pwcache_db * db = NULL;
+static unsigned long db_generation = 0; // Bumped every time db is replaced
+
+static pthread_mutex_t refresh_lock = PTHREAD_MUTEX_INITIALIZER;
+static char * source_path = NULL; // NULL means NSS
+static char * group_source_path = NULL; // NULL means NSS
+static struct stat source_stat;
+static struct stat group_source_stat;
+static int64_t next_check_ns = 0;
+static const char * index_path = PWCACHE_DEFAULT_INDEX; // NULL means parse the sources
+static char * index_path_copy = NULL; // Owns index_path once set by pwcache_set_index
+
+static uint32_t str_hash(const char * s) {
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    while (*s != '\0') {
+        hash ^= (unsigned char) *s++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static uint32_t uid_hash(uint32_t uid) {
+    // Multiplicative hashing spreads sequential uids over the table
+    return uid * 2654435761u;
+}
+
+//
+// The perfect hash tables need 64 bit hashes: with 32 bits, a few of 200k names would share their hash
+// and could never be told apart by a displacement.
+//
+#define PHF_GOLDEN 0x9e3779b97f4a7c15ull
+
+static uint64_t mix64(uint64_t x) {
+    // splitmix64 finalizer. A bijection, so distinct ids keep distinct hashes.
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ull;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+static uint64_t phf_str_hash(const char * s, uint64_t seed) {
+    // FNV-1a 64
+    uint64_t hash = 14695981039346656037ull ^ seed;
+    while (*s != '\0') {
+        hash ^= (unsigned char) *s++;
+        hash *= 1099511628211ull;
+    }
+    return mix64(hash);
+}
+
+static uint64_t phf_id_hash(uint32_t id, uint64_t seed) {
+    return mix64(seed ^ id);
+}
+
+/**
+ * Map 32 random bits to [0, n) with a multiplication instead of a division.
+ */
+static uint32_t phf_reduce(uint32_t bits, uint32_t n) {
+    return ((uint64_t) bits * n) >> 32;
+}
+
+static uint32_t phf_bucket(uint64_t hash, uint32_t nbuckets) {
+    return phf_reduce(hash >> 32, nbuckets);
+}
+
+static uint32_t phf_slot(uint64_t hash, uint32_t displacement, uint32_t nslots) {
+    return phf_reduce(mix64(hash + displacement * PHF_GOLDEN), nslots);
+}
+
+/**
+ * Position of the only key in the table that can have this hash, or -1. The caller compares keys.
+ * count bounds positions, so that a corrupted index file can't send lookups out of their array.
+ */
+static int64_t phf_find(const pwcache_phf * t, uint64_t hash, size_t count) {
+    uint32_t pos = t->slots[phf_slot(hash, t->displacements[phf_bucket(hash, t->nbuckets)], t->nslots)];
+    return (pos != 0 && pos <= count) ? (int64_t) pos - 1 : -1;
+}
+
+//
+// Building
+//
+
+typedef struct {
+    uint32_t hash;
+    uint32_t offset; // Offset into the pool + 1. 0 marks an empty slot.
+} intern_slot;
+
+typedef struct {
+    pwcache_user * users;
+    size_t nusers, users_capacity;
+    pwcache_group * groups;
+    size_t ngroups, groups_capacity;
+    uint32_t * member_names;
+    size_t nmember_names, member_names_capacity;
+    char * pool;
+    size_t pool_sz, pool_capacity;
+    intern_slot * intern_slots;
+    size_t nstrings, intern_capacity;
+} pwcache_builder;
+
+/**
+ * Make room for needed elements of size bytes in *array.
+ */
+static void builder_reserve(void ** array, size_t * capacity, size_t size, size_t needed) {
+    if (needed > *capacity) {
+        *capacity = max(2 * *capacity, max(needed, (size_t) 64));
+        *array = realloc(*array, *capacity * size);
+        if (*array == NULL) {
+            errExit("realloc");
+        }
+    }
+}
+
+static void builder_rehash_strings(pwcache_builder * b) {
+    size_t old_capacity = b->intern_capacity;
+    intern_slot * old_slots = b->intern_slots;
+    b->intern_capacity = max(2 * old_capacity, (size_t) 1024);
+    b->intern_slots = calloc(b->intern_capacity, sizeof(intern_slot));
+    if (b->intern_slots == NULL) {
+        errExit("calloc");
+    }
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old_slots[i].offset != 0) {
+            size_t j = old_slots[i].hash & (b->intern_capacity - 1);
+            while (b->intern_slots[j].offset != 0) {
+                j = (j + 1) & (b->intern_capacity - 1);
+            }
+            b->intern_slots[j] = old_slots[i];
+        }
+    }
+    free(old_slots);
+}
+
+/**
+ * Return the offset of s in the pool, adding it if it's not there yet.
+ */
+static uint32_t builder_add_string(pwcache_builder * b, const char * s) {
+    if (s == NULL) {
+        s = "";
+    }
+    if (2 * (b->nstrings + 1) > b->intern_capacity) { // Keep load factor under 1/2
+        builder_rehash_strings(b);
+    }
+    uint32_t hash = str_hash(s);
+    size_t i = hash & (b->intern_capacity - 1);
+    while (b->intern_slots[i].offset != 0) {
+        if (b->intern_slots[i].hash == hash && strcmp(b->pool + b->intern_slots[i].offset - 1, s) == 0) {
+            return b->intern_slots[i].offset - 1;
+        }
+        i = (i + 1) & (b->intern_capacity - 1);
+    }
+
+    size_t len = strlen(s) + 1;
+    builder_reserve((void **) &b->pool, &b->pool_capacity, 1, b->pool_sz + len);
+    memcpy(b->pool + b->pool_sz, s, len);
+    b->intern_slots[i].hash = hash;
+    b->intern_slots[i].offset = b->pool_sz + 1;
+    b->nstrings++;
+    b->pool_sz += len;
+    return b->pool_sz - len;
+}
+
+static void builder_add_user(pwcache_builder * b, const struct passwd * pw) {
+    builder_reserve((void **) &b->users, &b->users_capacity, sizeof(pwcache_user), b->nusers + 1);
+    pwcache_user * u = &b->users[b->nusers++];
+    u->name = builder_add_string(b, pw->pw_name);
+    u->passwd = builder_add_string(b, pw->pw_passwd);
+    u->gecos = builder_add_string(b, pw->pw_gecos);
+    u->dir = builder_add_string(b, pw->pw_dir);
+    u->shell = builder_add_string(b, pw->pw_shell);
+    u->uid = pw->pw_uid;
+    u->gid = pw->pw_gid;
+}
+
+static void builder_add_group(pwcache_builder * b, const struct group * gr) {
+    builder_reserve((void **) &b->groups, &b->groups_capacity, sizeof(pwcache_group), b->ngroups + 1);
+    pwcache_group * g = &b->groups[b->ngroups++];
+    g->name = builder_add_string(b, gr->gr_name);
+    g->passwd = builder_add_string(b, gr->gr_passwd);
+    g->gid = gr->gr_gid;
+    g->members = b->nmember_names;
+    g->nmembers = 0;
+    for (char ** member = gr->gr_mem; member != NULL && *member != NULL; member++) {
+        builder_reserve((void **) &b->member_names, &b->member_names_capacity, sizeof(uint32_t), b->nmember_names + 1);
+        b->member_names[b->nmember_names++] = builder_add_string(b, *member);
+        g->nmembers++;
+    }
+}
+
+static size_t slots_for(size_t count) {
+    size_t nslots = 64;
+    while (nslots < 2 * count) { // Keep load factor under 1/2
+        nslots *= 2;
+    }
+    return nslots;
+}
+
+static uint32_t * alloc_slots(size_t nslots) {
+    uint32_t * slots = calloc(nslots, sizeof(uint32_t));
+    if (slots == NULL) {
+        errExit("calloc");
+    }
+    return slots;
+}
+
+typedef enum {
+    KEY_USER_NAME,
+    KEY_UID,
+    KEY_GROUP_NAME,
+    KEY_GID,
+    KEY_MEMBER,
+} pwcache_key;
+
+/**
+ * What identifies the key at pos: an id, or an offset into the pool since equal names are interned to equal offsets.
+ */
+static uint32_t key_identity(const pwcache_db * d, pwcache_key kind, uint32_t pos) {
+    switch (kind) {
+        case KEY_USER_NAME:
+            return d->users[pos].name;
+        case KEY_UID:
+            return d->users[pos].uid;
+        case KEY_GROUP_NAME:
+            return d->groups[pos].name;
+        case KEY_GID:
+            return d->groups[pos].gid;
+        default:
+            return d->memberships[pos].name;
+    }
+}
+
+static uint64_t key_hash(const pwcache_db * d, pwcache_key kind, uint32_t pos, uint64_t seed) {
+    if (kind == KEY_UID || kind == KEY_GID) {
+        return phf_id_hash(key_identity(d, kind, pos), seed);
+    }
+    return phf_str_hash(d->pool + key_identity(d, kind, pos), seed);
+}
+
+#define PHF_KEYS_PER_BUCKET 4
+#define PHF_MAX_DISPLACEMENT (1 << 20)
+#define PHF_MAX_SEEDS 64
+
+/**
+ * Try to place every key with the current seed, the biggest buckets first while there's most room.
+ * by_bucket lists key positions grouped by bucket, bucket b being by_bucket[bucket_start[b]] to by_bucket[bucket_start[b + 1]].
+ */
+static Boolean phf_place(pwcache_phf * t, const uint64_t * hashes, const uint32_t * by_bucket, const uint32_t * bucket_start,
+    const uint32_t * bucket_order, uint32_t * candidates) {
+    for (uint32_t ob = 0; ob < t->nbuckets; ob++) {
+        uint32_t b = bucket_order[ob];
+        uint32_t k = bucket_start[b + 1] - bucket_start[b];
+        if (k == 0) {
+            break; // Buckets are ordered by decreasing size
+        }
+        const uint32_t * keys = by_bucket + bucket_start[b];
+        uint32_t displacement = 0;
+        for (; displacement < PHF_MAX_DISPLACEMENT; displacement++) {
+            uint32_t j = 0;
+            for (; j < k; j++) {
+                candidates[j] = phf_slot(hashes[keys[j]], displacement, t->nslots);
+                if (t->slots[candidates[j]] != 0) {
+                    break;
+                }
+                uint32_t other = 0;
+                while (other < j && candidates[other] != candidates[j]) {
+                    other++;
+                }
+                if (other < j) {
+                    break;
+                }
+            }
+            if (j == k) {
+                break;
+            }
+        }
+        if (displacement == PHF_MAX_DISPLACEMENT) {
+            return FALSE;
+        }
+        t->displacements[b] = displacement;
+        for (uint32_t j = 0; j < k; j++) {
+            t->slots[candidates[j]] = keys[j] + 1;
+        }
+    }
+    return TRUE;
+}
+
+/**
+ * Build t over the keys of kind at positions 0 to count - 1.
+ * Like getpwnam/getpwuid, the first entry wins on duplicates: later ones are left out of the table.
+ */
+static void phf_build(const pwcache_db * d, pwcache_phf * t, pwcache_key kind, size_t count) {
+    // Drop duplicates, with a throwaway open addressing set
+    uint32_t * positions = malloc(max(count, (size_t) 1) * sizeof(uint32_t));
+    size_t nseen = slots_for(count);
+    uint32_t * seen = alloc_slots(nseen);
+    if (positions == NULL) {
+        errExit("malloc");
+    }
+    size_t nkeys = 0;
+    for (uint32_t pos = 0; pos < count; pos++) {
+        uint32_t identity = key_identity(d, kind, pos);
+        size_t i = uid_hash(identity) & (nseen - 1);
+        while (seen[i] != 0 && key_identity(d, kind, seen[i] - 1) != identity) {
+            i = (i + 1) & (nseen - 1);
+        }
+        if (seen[i] == 0) {
+            seen[i] = pos + 1;
+            positions[nkeys++] = pos;
+        }
+    }
+    free(seen);
+
+    t->nbuckets = nkeys / PHF_KEYS_PER_BUCKET + 1;
+    t->nslots = nkeys + nkeys / 4 + 1; // Load factor 0.8
+    t->displacements = alloc_slots(t->nbuckets);
+    t->slots = alloc_slots(t->nslots);
+    uint64_t * hashes = malloc(max(count, (size_t) 1) * sizeof(uint64_t));
+    uint32_t * by_bucket = malloc(max(nkeys, (size_t) 1) * sizeof(uint32_t));
+    uint32_t * bucket_start = alloc_slots(t->nbuckets + 1);
+    uint32_t * bucket_order = malloc(t->nbuckets * sizeof(uint32_t));
+    if (hashes == NULL || by_bucket == NULL || bucket_order == NULL) {
+        errExit("malloc");
+    }
+
+    Boolean placed = FALSE;
+    for (uint64_t attempt = 0; attempt < PHF_MAX_SEEDS && !placed; attempt++) {
+        t->seed = mix64(attempt + 1);
+        memset(t->displacements, 0, t->nbuckets * sizeof(uint32_t));
+        memset(t->slots, 0, t->nslots * sizeof(uint32_t));
+        memset(bucket_start, 0, (t->nbuckets + 1) * sizeof(uint32_t));
+
+        // Counting sort of the keys by bucket
+        for (size_t i = 0; i < nkeys; i++) {
+            hashes[positions[i]] = key_hash(d, kind, positions[i], t->seed);
+            bucket_start[phf_bucket(hashes[positions[i]], t->nbuckets) + 1]++;
+        }
+        uint32_t max_bucket = 0;
+        for (uint32_t b = 0; b < t->nbuckets; b++) {
+            max_bucket = max(max_bucket, bucket_start[b + 1]);
+            bucket_start[b + 1] += bucket_start[b];
+        }
+        for (size_t i = 0; i < nkeys; i++) {
+            uint32_t b = phf_bucket(hashes[positions[i]], t->nbuckets);
+            by_bucket[bucket_start[b]++] = positions[i];
+        }
+        memmove(bucket_start + 1, bucket_start, t->nbuckets * sizeof(uint32_t)); // Back to bucket starts
+        bucket_start[0] = 0;
+
+        // Counting sort of the buckets by decreasing size
+        uint32_t * size_start = alloc_slots(max_bucket + 2);
+        for (uint32_t b = 0; b < t->nbuckets; b++) {
+            size_start[max_bucket - (bucket_start[b + 1] - bucket_start[b]) + 1]++;
+        }
+        for (uint32_t size = 0; size <= max_bucket; size++) {
+            size_start[size + 1] += size_start[size];
+        }
+        for (uint32_t b = 0; b < t->nbuckets; b++) {
+            bucket_order[size_start[max_bucket - (bucket_start[b + 1] - bucket_start[b])]++] = b;
+        }
+        uint32_t * candidates = alloc_slots(max_bucket + 1);
+        placed = phf_place(t, hashes, by_bucket, bucket_start, bucket_order, candidates);
+        free(candidates);
+        free(size_start);
+    }
+    if (!placed) {
+        fatal("Can't build a perfect hash table over %zu keys\n", nkeys);
+    }
+
+    free(bucket_order);
+    free(bucket_start);
+    free(by_bucket);
+    free(hashes);
+    free(positions);
+}
+
+static void free_phf(pwcache_phf * t) {
+    free(t->displacements);
+    free(t->slots);
+}
+
+/**
+ * Invert the member lists of all groups into the list of groups of each member.
+ * nstrings is the number of distinct strings in the pool, so there can't be more distinct member names.
+ */
+static void index_memberships(pwcache_db * d, size_t nstrings) {
+    size_t max_members = min(nstrings, d->nmember_names);
+    size_t nslots = slots_for(max_members);
+    size_t mask = nslots - 1;
+    uint32_t * member_slots = alloc_slots(nslots); // Throwaway open addressing table, replaced by by_member
+    d->memberships = malloc(max(max_members, (size_t) 1) * sizeof(pwcache_membership));
+    d->member_gids = malloc(max(d->nmember_names, (size_t) 1) * sizeof(uint32_t));
+    if (d->memberships == NULL || d->member_gids == NULL) {
+        errExit("malloc");
+    }
+
+    // Count the groups of each member
+    d->nmemberships = 0;
+    for (size_t m = 0; m < d->nmember_names; m++) {
+        uint32_t name = d->member_names[m];
+        size_t i = str_hash(d->pool + name) & mask;
+        while (member_slots[i] != 0 && d->memberships[member_slots[i] - 1].name != name) {
+            i = (i + 1) & mask;
+        }
+        if (member_slots[i] == 0) {
+            member_slots[i] = d->nmemberships + 1;
+            d->memberships[d->nmemberships].name = name;
+            d->memberships[d->nmemberships].ngids = 0;
+            d->nmemberships++;
+        }
+        d->memberships[member_slots[i] - 1].ngids++;
+    }
+    uint32_t start = 0;
+    for (size_t pos = 0; pos < d->nmemberships; pos++) {
+        d->memberships[pos].gids = start;
+        start += d->memberships[pos].ngids;
+        d->memberships[pos].ngids = 0;
+    }
+
+    // Fill in the gids. Walking groups in file order keeps each member's gids in file order.
+    for (size_t pos = 0; pos < d->ngroups; pos++) {
+        const pwcache_group * g = &d->groups[pos];
+        for (uint32_t m = g->members; m < g->members + g->nmembers; m++) {
+            size_t i = str_hash(d->pool + d->member_names[m]) & mask;
+            while (d->memberships[member_slots[i] - 1].name != d->member_names[m]) {
+                i = (i + 1) & mask;
+            }
+            pwcache_membership * ms = &d->memberships[member_slots[i] - 1];
+            // A member listed twice in the same group only counts once
+            if (ms->ngids == 0 || d->member_gids[ms->gids + ms->ngids - 1] != g->gid) {
+                d->member_gids[ms->gids + ms->ngids++] = g->gid;
+            }
+        }
+    }
+    d->nmember_gids = 0;
+    for (size_t pos = 0; pos < d->nmemberships; pos++) {
+        d->nmember_gids += d->memberships[pos].ngids;
+    }
+    free(member_slots);
+}
+
+static void builder_discard(pwcache_builder * b) {
+    free(b->users);
+    free(b->groups);
+    free(b->member_names);
+    free(b->pool);
+    free(b->intern_slots);
+}
+
+/**
+ * Add every user of the passwd file at path, or of NSS if path is NULL. Returns 0, or an error number.
+ */
+static int read_users(pwcache_builder * b, const char * path) {
+    struct passwd * pw;
+    if (path != NULL) {
+        FILE * f = fopen(path, "r");
+        if (f == NULL) {
+            return errno;
+        }
+        while ((pw = fgetpwent(f)) != NULL) {
+            builder_add_user(b, pw);
+        }
+        fclose(f);
+        return 0;
+    }
+
+    setpwent();
+    errno = 0;
+    while ((pw = getpwent()) != NULL) {
+        builder_add_user(b, pw);
+        errno = 0;
+    }
+    int err = errno;
+    endpwent();
+    return err == ENOENT ? 0 : err;
+}
+
+/**
+ * Same as read_users, for groups.
+ */
+static int read_groups(pwcache_builder * b, const char * path) {
+    struct group * gr;
+    if (path != NULL) {
+        FILE * f = fopen(path, "r");
+        if (f == NULL) {
+            return errno;
+        }
+        while ((gr = fgetgrent(f)) != NULL) {
+            builder_add_group(b, gr);
+        }
+        fclose(f);
+        return 0;
+    }
+
+    setgrent();
+    errno = 0;
+    while ((gr = getgrent()) != NULL) {
+        builder_add_group(b, gr);
+        errno = 0;
+    }
+    int err = errno;
+    endgrent();
+    return err == ENOENT ? 0 : err;
+}
+
+/**
+ * Read the whole passwd and group databases. Returns NULL with errno set on failure.
+ */
+static pwcache_db * build_db() {
+    pwcache_builder b = { 0 };
+    int err = read_users(&b, source_path);
+    if (err == 0) {
+        err = read_groups(&b, group_source_path);
+    }
+    if (err != 0) {
+        builder_discard(&b);
+        errno = err;
+        return NULL;
+    }
+    free(b.intern_slots);
+
+    pwcache_db * d = malloc(sizeof(pwcache_db));
+    if (d == NULL) {
+        errExit("malloc");
+    }
+    d->users = b.users;
+    d->nusers = b.nusers;
+    d->groups = b.groups;
+    d->ngroups = b.ngroups;
+    d->member_names = b.member_names;
+    d->nmember_names = b.nmember_names;
+    d->pool = b.pool;
+    d->pool_sz = b.pool_sz;
+    d->mapping = NULL;
+    d->mapping_sz = 0;
+    index_memberships(d, b.nstrings);
+    phf_build(d, &d->by_user_name, KEY_USER_NAME, d->nusers);
+    phf_build(d, &d->by_uid, KEY_UID, d->nusers);
+    phf_build(d, &d->by_group_name, KEY_GROUP_NAME, d->ngroups);
+    phf_build(d, &d->by_gid, KEY_GID, d->ngroups);
+    phf_build(d, &d->by_member, KEY_MEMBER, d->nmemberships);
+    return d;
+}
+
+static void free_db(pwcache_db * d) {
+    if (d == NULL) {
+        return;
+    }
+    if (d->mapping != NULL) {
+        munmap(d->mapping, d->mapping_sz);
+    } else {
+        free(d->users);
+        free(d->groups);
+        free(d->member_names);
+        free(d->memberships);
+        free(d->member_gids);
+        free(d->pool);
+        free_phf(&d->by_user_name);
+        free_phf(&d->by_uid);
+        free_phf(&d->by_group_name);
+        free_phf(&d->by_gid);
+        free_phf(&d->by_member);
+    }
+    free(d);
+}
+
+//
+// On-disk index: the arrays of a pwcache_db one after the other, each 8 byte aligned, after a header saying where they are
+// and what the sources looked like when they were read. Offsets are from the start of the file, in host byte order.
+//
+#define PWINDEX_MAGIC 0x58445750 // "PWDX"
+#define PWINDEX_VERSION 1
+#define PWINDEX_PATH_MAX 256
+
+typedef struct {
+    char path[PWINDEX_PATH_MAX]; // Empty for NSS
+    uint64_t ino;
+    uint64_t size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+} pwindex_source;
+
+typedef struct {
+    uint64_t offset;
+    uint64_t count; // Elements, not bytes
+} pwindex_section;
+
+typedef struct {
+    uint32_t nbuckets;
+    uint32_t nslots;
+    uint64_t seed;
+    uint64_t displacements; // Offsets
+    uint64_t slots;
+} pwindex_phf;
+
+typedef struct {
+    uint32_t magic; // Also tells the byte order apart
+    uint32_t version;
+    uint64_t file_sz;
+    pwindex_source sources[2]; // passwd, group
+    pwindex_section users;
+    pwindex_section groups;
+    pwindex_section member_names;
+    pwindex_section memberships;
+    pwindex_section member_gids;
+    pwindex_section pool;
+    pwindex_phf by_user_name;
+    pwindex_phf by_uid;
+    pwindex_phf by_group_name;
+    pwindex_phf by_gid;
+    pwindex_phf by_member;
+} pwindex_header;
+
+#define PWINDEX_MAX_IOV 64
+
+typedef struct {
+    struct iovec iov[PWINDEX_MAX_IOV];
+    int iovcnt;
+    uint64_t offset;
+} pwindex_writer;
+
+static uint64_t writer_add(pwindex_writer * w, const void * data, size_t bytes) {
+    static const char padding[8] = { 0 };
+    uint64_t offset = w->offset;
+    w->iov[w->iovcnt].iov_base = (void *) data;
+    w->iov[w->iovcnt++].iov_len = bytes;
+    w->offset += bytes;
+    if (w->offset % 8 != 0) {
+        w->iov[w->iovcnt].iov_base = (void *) padding;
+        w->iov[w->iovcnt++].iov_len = 8 - w->offset % 8;
+        w->offset += 8 - w->offset % 8;
+    }
+    return offset;
+}
+
+static void writer_add_section(pwindex_writer * w, pwindex_section * section, const void * data, size_t count, size_t size) {
+    section->offset = writer_add(w, data, count * size);
+    section->count = count;
+}
+
+static void writer_add_phf(pwindex_writer * w, pwindex_phf * out, const pwcache_phf * t) {
+    out->nbuckets = t->nbuckets;
+    out->nslots = t->nslots;
+    out->seed = t->seed;
+    out->displacements = writer_add(w, t->displacements, t->nbuckets * sizeof(uint32_t));
+    out->slots = writer_add(w, t->slots, t->nslots * sizeof(uint32_t));
+}
+
+/**
+ * Record the state of a source in the header. Returns 0, or an error number.
+ */
+static int describe_source(pwindex_source * out, const char * path, const char * watched) {
+    struct stat st;
+    if (path != NULL && strlen(path) >= PWINDEX_PATH_MAX) {
+        return ENAMETOOLONG;
+    }
+    if (stat(watched, &st) == -1) {
+        return errno;
+    }
+    strcpy(out->path, path != NULL ? path : "");
+    out->ino = st.st_ino;
+    out->size = st.st_size;
+    out->mtime_sec = st.st_mtim.tv_sec;
+    out->mtime_nsec = st.st_mtim.tv_nsec;
+    return 0;
+}
+
+static Boolean source_matches(const pwindex_source * s, const char * path, const struct stat * st) {
+    return strncmp(s->path, path != NULL ? path : "", PWINDEX_PATH_MAX) == 0 && s->ino == (uint64_t) st->st_ino &&
+        s->size == (uint64_t) st->st_size && s->mtime_sec == st->st_mtim.tv_sec && s->mtime_nsec == st->st_mtim.tv_nsec;
+}
+
+/**
+ * writev all of iov, resuming after short writes. Returns 0, or -1 with errno set: unlike deliver_writev, a full disk
+ * is the caller's to report.
+ */
+static int writev_all(int fd, struct iovec * iov, int iovcnt) {
+    while (iovcnt > 0) {
+        ssize_t n = writev(fd, iov, iovcnt);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        for (; iovcnt > 0 && (size_t) n >= iov->iov_len; iov++, iovcnt--) {
+            n -= iov->iov_len;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *) iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+int pwcache_compile(const char * path) {
+    pwindex_header header;
+    memset(&header, 0, sizeof(header));
+    header.magic = PWINDEX_MAGIC;
+    header.version = PWINDEX_VERSION;
+
+    // Sources are described before they are read: if they change meanwhile, the index won't match them and won't be used
+    pthread_mutex_lock(&refresh_lock);
+    int err = describe_source(&header.sources[0], source_path, source_path != NULL ? source_path : "/etc/passwd");
+    if (err == 0) {
+        err = describe_source(&header.sources[1], group_source_path, group_source_path != NULL ? group_source_path : "/etc/group");
+    }
+    pwcache_db * d = err == 0 ? build_db() : NULL;
+    if (err == 0 && d == NULL) {
+        err = errno;
+    }
+    pthread_mutex_unlock(&refresh_lock);
+    if (err != 0) {
+        errno = err;
+        return -1;
+    }
+
+    pwindex_writer w = { .iovcnt = 0, .offset = 0 };
+    writer_add(&w, &header, sizeof(header));
+    writer_add_section(&w, &header.users, d->users, d->nusers, sizeof(pwcache_user));
+    writer_add_section(&w, &header.groups, d->groups, d->ngroups, sizeof(pwcache_group));
+    writer_add_section(&w, &header.member_names, d->member_names, d->nmember_names, sizeof(uint32_t));
+    writer_add_section(&w, &header.memberships, d->memberships, d->nmemberships, sizeof(pwcache_membership));
+    writer_add_section(&w, &header.member_gids, d->member_gids, d->nmember_gids, sizeof(uint32_t));
+    writer_add_section(&w, &header.pool, d->pool, d->pool_sz, 1);
+    writer_add_phf(&w, &header.by_user_name, &d->by_user_name);
+    writer_add_phf(&w, &header.by_uid, &d->by_uid);
+    writer_add_phf(&w, &header.by_group_name, &d->by_group_name);
+    writer_add_phf(&w, &header.by_gid, &d->by_gid);
+    writer_add_phf(&w, &header.by_member, &d->by_member);
+    header.file_sz = w.offset;
+
+    // Write a temporary file and rename it over the index, so that readers see either the old or the new one
+    size_t tmp_sz = strlen(path) + 8;
+    char * tmp_path = malloc(tmp_sz);
+    if (tmp_path == NULL) {
+        errExit("malloc");
+    }
+    snprintf(tmp_path, tmp_sz, "%s.XXXXXX", path);
+    int fd = mkstemp(tmp_path);
+    if (fd != -1) {
+        if (writev_all(fd, w.iov, w.iovcnt) == -1 || fchmod(fd, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH) == -1 || fsync(fd) == -1) {
+            err = errno;
+        }
+        if (close(fd) == -1 && err == 0) {
+            err = errno;
+        }
+        if (err == 0 && rename(tmp_path, path) == -1) {
+            err = errno;
+        }
+        if (err != 0) {
+            unlink(tmp_path);
+        }
+    } else {
+        err = errno;
+    }
+    free(tmp_path);
+    free_db(d);
+    if (err != 0) {
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Point to a section of the mapped index, if it lies within it.
+ */
+static Boolean map_section(const pwcache_db * d, const pwindex_section * section, size_t size, void ** out, size_t * count) {
+    if (section->offset % 8 != 0 || section->offset > d->mapping_sz || section->count > (d->mapping_sz - section->offset) / size) {
+        return FALSE;
+    }
+    *out = (char *) d->mapping + section->offset;
+    *count = section->count;
+    return TRUE;
+}
+
+static Boolean map_phf(const pwcache_db * d, const pwindex_phf * in, pwcache_phf * t) {
+    pwindex_section displacements = { in->displacements, in->nbuckets }, slots = { in->slots, in->nslots };
+    size_t count;
+    t->nbuckets = in->nbuckets;
+    t->nslots = in->nslots;
+    t->seed = in->seed;
+    return in->nbuckets > 0 && in->nslots > 0 &&
+        map_section(d, &displacements, sizeof(uint32_t), (void **) &t->displacements, &count) &&
+        map_section(d, &slots, sizeof(uint32_t), (void **) &t->slots, &count);
+}
+
+static Boolean in_pool(const pwcache_db * d, uint32_t offset) {
+    return offset < d->pool_sz;
+}
+
+/**
+ * Whether every string offset and every range in the records lies within its section, so that a truncated, stale or
+ * planted index can't send lookups out of the mapping. The pool ends with a null byte, so any string starting in it
+ * ends in it too. Costs a pass over the records, far less than parsing the sources.
+ */
+static Boolean records_valid(const pwcache_db * d) {
+    for (size_t i = 0; i < d->nusers; i++) {
+        const pwcache_user * u = &d->users[i];
+        if (!in_pool(d, u->name) || !in_pool(d, u->passwd) || !in_pool(d, u->gecos) || !in_pool(d, u->dir) || !in_pool(d, u->shell)) {
+            return FALSE;
+        }
+    }
+    for (size_t i = 0; i < d->ngroups; i++) {
+        const pwcache_group * g = &d->groups[i];
+        if (!in_pool(d, g->name) || !in_pool(d, g->passwd) || g->members > d->nmember_names || g->nmembers > d->nmember_names - g->members) {
+            return FALSE;
+        }
+    }
+    for (size_t i = 0; i < d->nmember_names; i++) {
+        if (!in_pool(d, d->member_names[i])) {
+            return FALSE;
+        }
+    }
+    for (size_t i = 0; i < d->nmemberships; i++) {
+        const pwcache_membership * m = &d->memberships[i];
+        if (!in_pool(d, m->name) || m->gids > d->nmember_gids || m->ngids > d->nmember_gids - m->gids) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+/**
+ * Map the index file, if it was compiled from the current sources as they are now (st and group_st).
+ * Returns NULL when there is no usable index, and the sources are parsed instead.
+ *
+ * Besides the header and section bounds, every record is checked against the sections it points into:
+ * the index may be truncated, stale, or not written by pwcache_compile at all.
+ */
+static pwcache_db * load_index(const struct stat * st, const struct stat * group_st) {
+    int fd = open(index_path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return NULL;
+    }
+    struct stat index_st;
+    void * mapping = MAP_FAILED;
+    if (fstat(fd, &index_st) == 0 && (size_t) index_st.st_size >= sizeof(pwindex_header)) {
+        mapping = mmap(NULL, index_st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    safe_close(fd);
+    if (mapping == MAP_FAILED) {
+        return NULL;
+    }
+
+    const pwindex_header * header = mapping;
+    pwcache_db * d = malloc(sizeof(pwcache_db));
+    if (d == NULL) {
+        errExit("malloc");
+    }
+    d->mapping = mapping;
+    d->mapping_sz = index_st.st_size;
+    Boolean ok = header->magic == PWINDEX_MAGIC && header->version == PWINDEX_VERSION && header->file_sz == d->mapping_sz &&
+        source_matches(&header->sources[0], source_path, st) && source_matches(&header->sources[1], group_source_path, group_st) &&
+        map_section(d, &header->users, sizeof(pwcache_user), (void **) &d->users, &d->nusers) &&
+        map_section(d, &header->groups, sizeof(pwcache_group), (void **) &d->groups, &d->ngroups) &&
+        map_section(d, &header->member_names, sizeof(uint32_t), (void **) &d->member_names, &d->nmember_names) &&
+        map_section(d, &header->memberships, sizeof(pwcache_membership), (void **) &d->memberships, &d->nmemberships) &&
+        map_section(d, &header->member_gids, sizeof(uint32_t), (void **) &d->member_gids, &d->nmember_gids) &&
+        map_section(d, &header->pool, 1, (void **) &d->pool, &d->pool_sz) &&
+        d->pool_sz > 0 && d->pool[d->pool_sz - 1] == '\0' &&
+        map_phf(d, &header->by_user_name, &d->by_user_name) && map_phf(d, &header->by_uid, &d->by_uid) &&
+        map_phf(d, &header->by_group_name, &d->by_group_name) && map_phf(d, &header->by_gid, &d->by_gid) &&
+        map_phf(d, &header->by_member, &d->by_member) &&
+        records_valid(d);
+    if (!ok) {
+        free_db(d);
+        return NULL;
+    }
+    return d;
+}
+
+//
+// Invalidation
+//
+
+static int64_t now_ns() {
+    struct timespec ts;
+    // The coarse clock is served by the vDSO, so checking it costs no syscall
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static Boolean same_file_state(const struct stat * a, const struct stat * b) {
+    return a->st_ino == b->st_ino && a->st_dev == b->st_dev && a->st_size == b->st_size &&
+        a->st_mtim.tv_sec == b->st_mtim.tv_sec && a->st_mtim.tv_nsec == b->st_mtim.tv_nsec &&
+        a->st_ctim.tv_sec == b->st_ctim.tv_sec && a->st_ctim.tv_nsec == b->st_ctim.tv_nsec;
+}
+
+/**
+ * Stat path into st, and tell whether it's unchanged since last_st was taken.
+ * A file that can't be stat'ed never counts as unchanged.
+ */
+static Boolean source_unchanged(const char * path, struct stat * st, const struct stat * last_st) {
+    if (stat(path, st) == -1) {
+        memset(st, 0, sizeof(struct stat));
+        return FALSE;
+    }
+    return same_file_state(st, last_st);
+}
+
+/**
+ * Build the index if there is none, or rebuild it if a source changed since it was built.
+ * Returns 0, or an error number if a database can't be read.
+ */
+static int refresh() {
+    int64_t now = now_ns();
+    if (__atomic_load_n(&db, __ATOMIC_ACQUIRE) != NULL && now < __atomic_load_n(&next_check_ns, __ATOMIC_RELAXED)) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&refresh_lock);
+    int err = 0;
+    if (db == NULL || now >= next_check_ns) {
+        struct stat st, group_st;
+        // Evaluate both, so both stats are taken
+        Boolean users_unchanged = source_unchanged(source_path != NULL ? source_path : "/etc/passwd", &st, &source_stat);
+        Boolean groups_unchanged = source_unchanged(group_source_path != NULL ? group_source_path : "/etc/group", &group_st, &group_source_stat);
+        if (db == NULL || !users_unchanged || !groups_unchanged) {
+            pwcache_db * new_db = index_path != NULL ? load_index(&st, &group_st) : NULL;
+            if (new_db == NULL) {
+                new_db = build_db();
+            }
+            if (new_db == NULL) {
+                err = errno;
+            } else {
+                pthread_rwlock_wrlock(&db_lock);
+                pwcache_db * old_db = db;
+                __atomic_store_n(&db, new_db, __ATOMIC_RELEASE);
+                db_generation++;
+                pthread_rwlock_unlock(&db_lock);
+                free_db(old_db);
+                source_stat = st;
+                group_source_stat = group_st;
+            }
+        }
+        __atomic_store_n(&next_check_ns, now + PWCACHE_RECHECK_MS * 1000000LL, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&refresh_lock);
+    return err;
+}
+
+static void replace_path(char ** current, const char * path) {
+    free(*current);
+    *current = NULL;
+    if (path != NULL && (*current = strdup(path)) == NULL) {
+        errExit("strdup");
+    }
+}
+
+/**
+ * Drop the current index, so that the next lookup builds or loads it again. Requires refresh_lock.
+ */
+static void drop_db() {
+    pthread_rwlock_wrlock(&db_lock);
+    free_db(db);
+    __atomic_store_n(&db, NULL, __ATOMIC_RELEASE);
+    db_generation++;
+    pthread_rwlock_unlock(&db_lock);
+}
+
+void pwcache_set_source(const char * passwd_path, const char * group_path) {
+    pthread_mutex_lock(&refresh_lock);
+    replace_path(&source_path, passwd_path);
+    replace_path(&group_source_path, group_path);
+    drop_db();
+    pthread_mutex_unlock(&refresh_lock);
+}
+
+void pwcache_set_index(const char * path) {
+    pthread_mutex_lock(&refresh_lock);
+    replace_path(&index_path_copy, path);
+    index_path = index_path_copy;
+    drop_db();
+    pthread_mutex_unlock(&refresh_lock);
+}
+
+void pwcache_get_stats(pwcache_stats * stats) {
+    memset(stats, 0, sizeof(pwcache_stats));
+    if (refresh() != 0) {
+        return;
+    }
+    pthread_rwlock_rdlock(&db_lock);
+    if (db != NULL) {
+        stats->nusers = db->nusers;
+        stats->ngroups = db->ngroups;
+        stats->nmemberships = db->nmember_names;
+        stats->pool_bytes = db->pool_sz;
+        stats->index_bytes = db->nusers * sizeof(pwcache_user) + db->ngroups * sizeof(pwcache_group) +
+            (db->nmember_names + db->nmember_gids) * sizeof(uint32_t) + db->nmemberships * sizeof(pwcache_membership);
+        const pwcache_phf * tables[] = { &db->by_user_name, &db->by_uid, &db->by_group_name, &db->by_gid, &db->by_member };
+        for (int i = 0; i < 5; i++) {
+            stats->index_bytes += (tables[i]->nbuckets + tables[i]->nslots) * sizeof(uint32_t);
+        }
+        stats->from_index = db->mapping != NULL;
+    }
+    pthread_rwlock_unlock(&db_lock);
+}
+
+//
+// Lookups
+//
+
+/**
+ * Copy the string at offset in the pool to buf after the first *used bytes, and point *dest to it. Advances *used.
+ */
+static int copy_string(const pwcache_db * d, uint32_t offset, char ** dest, char * buf, size_t buflen, size_t * used) {
+    const char * s = d->pool + offset;
+    size_t len = strlen(s) + 1;
+    if (*used + len > buflen) {
+        return ERANGE;
+    }
+    memcpy(buf + *used, s, len);
+    *dest = buf + *used;
+    *used += len;
+    return 0;
+}
+
+/**
+ * Copy a user into pwd, with its strings in buf after the first *used bytes. Advances *used.
+ */
+static int fill_passwd(const pwcache_db * d, const pwcache_user * u, struct passwd * pwd, char * buf, size_t buflen, size_t * used) {
+    const uint32_t offsets[] = { u->name, u->passwd, u->gecos, u->dir, u->shell };
+    char ** fields[] = { &pwd->pw_name, &pwd->pw_passwd, &pwd->pw_gecos, &pwd->pw_dir, &pwd->pw_shell };
+    for (int i = 0; i < 5; i++) {
+        int err = copy_string(d, offsets[i], fields[i], buf, buflen, used);
+        if (err != 0) {
+            return err;
+        }
+    }
+    pwd->pw_uid = u->uid;
+    pwd->pw_gid = u->gid;
+    return 0;
+}
+
+/**
+ * Copy a group into grp. buf holds the NULL terminated member array, then all the strings.
+ */
+static int fill_group(const pwcache_db * d, const pwcache_group * g, struct group * grp, char * buf, size_t buflen) {
+    // The member array must be aligned for pointers
+    size_t used = (-(uintptr_t) buf) & (__alignof__(char *) - 1);
+    size_t array_sz = (g->nmembers + 1) * sizeof(char *);
+    if (used + array_sz > buflen) {
+        return ERANGE;
+    }
+    grp->gr_mem = (char **) (buf + used);
+    used += array_sz;
+
+    int err = copy_string(d, g->name, &grp->gr_name, buf, buflen, &used);
+    if (err == 0) {
+        err = copy_string(d, g->passwd, &grp->gr_passwd, buf, buflen, &used);
+    }
+    for (uint32_t m = 0; m < g->nmembers && err == 0; m++) {
+        err = copy_string(d, d->member_names[g->members + m], &grp->gr_mem[m], buf, buflen, &used);
+    }
+    grp->gr_mem[g->nmembers] = NULL;
+    grp->gr_gid = g->gid;
+    return err;
+}
+
+static const pwcache_user * find_name(const pwcache_db * d, const char * name) {
+    int64_t pos = phf_find(&d->by_user_name, phf_str_hash(name, d->by_user_name.seed), d->nusers);
+    return (pos != -1 && strcmp(d->pool + d->users[pos].name, name) == 0) ? &d->users[pos] : NULL;
+}
+
+static const pwcache_user * find_uid(const pwcache_db * d, uid_t uid) {
+    int64_t pos = phf_find(&d->by_uid, phf_id_hash(uid, d->by_uid.seed), d->nusers);
+    return (pos != -1 && d->users[pos].uid == uid) ? &d->users[pos] : NULL;
+}
+
+static const pwcache_group * find_group_name(const pwcache_db * d, const char * name) {
+    int64_t pos = phf_find(&d->by_group_name, phf_str_hash(name, d->by_group_name.seed), d->ngroups);
+    return (pos != -1 && strcmp(d->pool + d->groups[pos].name, name) == 0) ? &d->groups[pos] : NULL;
+}
+
+static const pwcache_group * find_gid(const pwcache_db * d, gid_t gid) {
+    int64_t pos = phf_find(&d->by_gid, phf_id_hash(gid, d->by_gid.seed), d->ngroups);
+    return (pos != -1 && d->groups[pos].gid == gid) ? &d->groups[pos] : NULL;
+}
+
+static const pwcache_membership * find_membership(const pwcache_db * d, const char * name) {
+    int64_t pos = phf_find(&d->by_member, phf_str_hash(name, d->by_member.seed), d->nmemberships);
+    return (pos != -1 && strcmp(d->pool + d->memberships[pos].name, name) == 0) ? &d->memberships[pos] : NULL;
+}
+
+/**
+ * Refresh the index and take its read lock. Returns 0, or an error number without holding the lock.
+ */
+static int lock_db() {
+    int err = refresh();
+    if (err != 0) {
+        return err;
+    }
+    pthread_rwlock_rdlock(&db_lock);
+    if (db == NULL) {
+        // Source changed concurrently and the index was dropped
+        pthread_rwlock_unlock(&db_lock);
+        return EAGAIN;
+    }
+    return 0;
+}
+
+int __getpwnam_r(const char * name, struct passwd * pwd, char * buf, size_t buflen, struct passwd ** result) {
+    *result = NULL;
+    if (name == NULL) {
+        return 0;
+    }
+    int err = lock_db();
+    if (err != 0) {
+        return err;
+    }
+    const pwcache_user * u = find_name(db, name);
+    size_t used = 0;
+    if (u != NULL && (err = fill_passwd(db, u, pwd, buf, buflen, &used)) == 0) {
+        *result = pwd;
+    }
+    pthread_rwlock_unlock(&db_lock);
+    return err;
+}
+
+int __getpwuid_r(uid_t uid, struct passwd * pwd, char * buf, size_t buflen, struct passwd ** result) {
+    *result = NULL;
+    int err = lock_db();
+    if (err != 0) {
+        return err;
+    }
+    const pwcache_user * u = find_uid(db, uid);
+    size_t used = 0;
+    if (u != NULL && (err = fill_passwd(db, u, pwd, buf, buflen, &used)) == 0) {
+        *result = pwd;
+    }
+    pthread_rwlock_unlock(&db_lock);
+    return err;
+}
+
+int __getgrnam_r(const char * name, struct group * grp, char * buf, size_t buflen, struct group ** result) {
+    *result = NULL;
+    if (name == NULL) {
+        return 0;
+    }
+    int err = lock_db();
+    if (err != 0) {
+        return err;
+    }
+    const pwcache_group * g = find_group_name(db, name);
+    if (g != NULL && (err = fill_group(db, g, grp, buf, buflen)) == 0) {
+        *result = grp;
+    }
+    pthread_rwlock_unlock(&db_lock);
+    return err;
+}
+
+int __getgrgid_r(gid_t gid, struct group * grp, char * buf, size_t buflen, struct group ** result) {
+    *result = NULL;
+    int err = lock_db();
+    if (err != 0) {
+        return err;
+    }
+    const pwcache_group * g = find_gid(db, gid);
+    if (g != NULL && (err = fill_group(db, g, grp, buf, buflen)) == 0) {
+        *result = grp;
+    }
+    pthread_rwlock_unlock(&db_lock);
+    return err;
+}
+
+int __getgrouplist(const char * user, gid_t group, gid_t * groups, int * ngroups) {
+    int err = lock_db();
+    if (err != 0) {
+        errno = err;
+        return -1;
+    }
+    int count = 0;
+    if (count < *ngroups) {
+        groups[count] = group;
+    }
+    count++;
+    const pwcache_membership * ms = user != NULL ? find_membership(db, user) : NULL;
+    for (uint32_t i = 0; ms != NULL && i < ms->ngids; i++) {
+        gid_t gid = db->member_gids[ms->gids + i];
+        if (gid != group) {
+            if (count < *ngroups) {
+                groups[count] = gid;
+            }
+            count++;
+        }
+    }
+    pthread_rwlock_unlock(&db_lock);
+
+    Boolean fits = count <= *ngroups;
+    *ngroups = count;
+    return fits ? count : -1;
+}
+
+//
+// Batch lookups
+//
+
+//
+// Set-associative LRU in front of the uid table for hot ids: a uid can only live in one small set,
+// which is kept ordered from most to least recently used. Being tiny it stays in the CPU caches,
+// while a probe in the full index of a large database usually misses them.
+//
+// Each set has its own lock, held for one probe only, so that concurrent batches only wait for each other
+// when they probe the same set at the same time. Sets are a cache line apart, not to share one between threads.
+//
+typedef struct {
+    uint32_t uid;
+    const pwcache_user * user; // NULL marks an empty way
+} lru_way;
+
+typedef struct {
+    pthread_mutex_t lock;
+    unsigned long generation; // The db's when the ways were filled, to drop them once it's replaced
+    lru_way ways[PWCACHE_LRU_WAYS];
+} __attribute__((aligned(64))) lru_set;
+
+static lru_set lru[PWCACHE_LRU_SETS] = {
+    [0 ... PWCACHE_LRU_SETS - 1] = { .lock = PTHREAD_MUTEX_INITIALIZER },
+};
+
+/**
+ * Look uid up in d through the LRU. The caller holds db_lock.
+ */
+static const pwcache_user * lru_find_uid(const pwcache_db * d, uint32_t uid) {
+    lru_set * set = &lru[(uid_hash(uid) >> 16) % PWCACHE_LRU_SETS];
+    lru_way * ways = set->ways;
+    pthread_mutex_lock(&set->lock);
+    if (set->generation != db_generation) {
+        memset(ways, 0, sizeof(set->ways));
+        set->generation = db_generation;
+    }
+    for (int w = 0; w < PWCACHE_LRU_WAYS && ways[w].user != NULL; w++) {
+        if (ways[w].uid == uid) {
+            // Hit. Move to front.
+            lru_way hit = ways[w];
+            memmove(ways + 1, ways, w * sizeof(lru_way));
+            ways[0] = hit;
+            pthread_mutex_unlock(&set->lock);
+            return hit.user;
+        }
+    }
+
+    const pwcache_user * u = find_uid(d, uid);
+    if (u != NULL) {
+        // Evict the least recently used way
+        memmove(ways + 1, ways, (PWCACHE_LRU_WAYS - 1) * sizeof(lru_way));
+        ways[0].uid = uid;
+        ways[0].user = u;
+    }
+    pthread_mutex_unlock(&set->lock);
+    return u;
+}
+
+typedef struct {
+    uint32_t hash;
+    uint32_t first; // Position in the batch of the first occurrence of the key + 1. 0 marks an empty slot.
+} dedup_slot;
+
+#define PWCACHE_DEDUP_STACK_SLOTS 1024
+
+/**
+ * Resolve either uids or names, n keys in total.
+ */
+static int batch_resolve(const uid_t * uids, const char * const * names, size_t n,
+    struct passwd * results, char * buf, size_t buflen, size_t * nfound) {
+    *nfound = 0;
+    int err = refresh();
+    if (err != 0) {
+        return err;
+    }
+
+    dedup_slot stack_slots[PWCACHE_DEDUP_STACK_SLOTS];
+    size_t nslots = slots_for(n);
+    dedup_slot * slots = stack_slots;
+    if (nslots > PWCACHE_DEDUP_STACK_SLOTS) {
+        slots = malloc(nslots * sizeof(dedup_slot));
+        if (slots == NULL) {
+            return ENOMEM;
+        }
+    }
+    memset(slots, 0, nslots * sizeof(dedup_slot));
+    size_t mask = nslots - 1;
+
+    pthread_rwlock_rdlock(&db_lock);
+    if (db == NULL) {
+        pthread_rwlock_unlock(&db_lock);
+        if (slots != stack_slots) {
+            free(slots);
+        }
+        return EAGAIN;
+    }
+    size_t used = 0;
+    for (size_t k = 0; k < n && err == 0; k++) {
+        uint32_t hash = (uids != NULL) ? uid_hash(uids[k]) : (names[k] != NULL ? str_hash(names[k]) : 0);
+        size_t i = hash & mask;
+        while (slots[i].first != 0) {
+            size_t first = slots[i].first - 1;
+            if (slots[i].hash == hash && (uids != NULL ? uids[first] == uids[k] : (names[first] == names[k] ||
+                (names[first] != NULL && names[k] != NULL && strcmp(names[first], names[k]) == 0)))) {
+                break;
+            }
+            i = (i + 1) & mask;
+        }
+        if (slots[i].first != 0) {
+            // Repeated key. Share the strings copied for its first occurrence.
+            results[k] = results[slots[i].first - 1];
+            if (results[k].pw_name != NULL) {
+                (*nfound)++;
+            }
+            continue;
+        }
+        slots[i].hash = hash;
+        slots[i].first = k + 1;
+
+        const pwcache_user * u;
+        if (uids != NULL) {
+            u = lru_find_uid(db, uids[k]);
+        } else {
+            u = names[k] != NULL ? find_name(db, names[k]) : NULL;
+        }
+        if (u == NULL) {
+            memset(&results[k], 0, sizeof(struct passwd));
+        } else if ((err = fill_passwd(db, u, &results[k], buf, buflen, &used)) == 0) {
+            (*nfound)++;
+        }
+    }
+
+    pthread_rwlock_unlock(&db_lock);
+    if (slots != stack_slots) {
+        free(slots);
+    }
+    return err;
+}
+
+int __getpwuid_batch(const uid_t * uids, size_t n, struct passwd * results, char * buf, size_t buflen, size_t * nfound) {
+    return batch_resolve(uids, NULL, n, results, buf, buflen, nfound);
+}
+
+int __getpwnam_batch(const char * const * names, size_t n, struct passwd * results, char * buf, size_t buflen, size_t * nfound) {
+    return batch_resolve(NULL, names, n, results, buf, buflen, nfound);
+}
@@ -0,0 +1,111 @@
+#ifndef __CHPT8_PWCACHE_H__
+#define __CHPT8_PWCACHE_H__
+
+#include <grp.h>
+#include <pwd.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "../shared/utils.h"
+
+/**
+ * Reentrant passwd and group lookups backed by an in-memory index.
+ *
+ * The first lookup reads the whole passwd and group databases once and builds hash tables by name and by id,
+ * plus the list of groups each user name is a member of.
+ * Later lookups are O(1) and copy the entry into the caller's buffer, like getpwnam_r(3).
+ * The index is rebuilt when either source file changes (inode, size, mtime or ctime), checked at most every PWCACHE_RECHECK_MS.
+ *
+ * Building it means parsing both databases, which takes tens of milliseconds on large ones: too much for short-lived processes.
+ * pwcache_compile saves it to a file that later processes map instead, as long as the sources haven't changed since.
+ *
+ * Safe to call from multiple threads.
+ */
+
+#define PWCACHE_RECHECK_MS 100
+#define PWCACHE_LRU_SETS 64
+#define PWCACHE_LRU_WAYS 4
+#define PWCACHE_DEFAULT_INDEX "/var/cache/pwcache.idx"
+
+/**
+ * Read users and groups from the passwd and group files at these paths instead of going through NSS (getpwent, getgrent),
+ * which is the default. NULL goes back to NSS for that database, watching /etc/passwd or /etc/group for changes.
+ * Drops the current index.
+ */
+void pwcache_set_source(const char * passwd_path, const char * group_path);
+
+/**
+ * Map the index compiled at path when it matches the sources, instead of parsing them. NULL always parses.
+ * Defaults to PWCACHE_DEFAULT_INDEX. Drops the current index.
+ */
+void pwcache_set_index(const char * path);
+
+/**
+ * Build the index from the current sources and save it to path, atomically replacing any previous one.
+ * It records the inode, size and mtime of the sources, and is only used while they all match.
+ * Returns 0, or -1 with errno set.
+ */
+int pwcache_compile(const char * path);
+
+typedef struct {
+    size_t nusers;
+    size_t ngroups;
+    size_t nmemberships; // Sum of the member list lengths of all groups
+    size_t pool_bytes; // Interned strings
+    size_t index_bytes; // Records and hash tables
+    Boolean from_index; // Mapped from a compiled index file, rather than parsed
+} pwcache_stats;
+
+/**
+ * Size of the current index, building it if needed. All zeroes if it can't be built.
+ */
+void pwcache_get_stats(pwcache_stats * stats);
+
+/**
+ * Same contract as getpwnam_r(3):
+ * return 0 and set *result to pwd when found, return 0 and set *result to NULL when not found,
+ * return an error number (e.g. ERANGE when buf is too small) and set *result to NULL on errors.
+ */
+int __getpwnam_r(const char * name, struct passwd * pwd, char * buf, size_t buflen, struct passwd ** result);
+
+/**
+ * Same contract as getpwuid_r(3). See __getpwnam_r.
+ */
+int __getpwuid_r(uid_t uid, struct passwd * pwd, char * buf, size_t buflen, struct passwd ** result);
+
+/**
+ * Same contract as getgrnam_r(3). See __getpwnam_r.
+ */
+int __getgrnam_r(const char * name, struct group * grp, char * buf, size_t buflen, struct group ** result);
+
+/**
+ * Same contract as getgrgid_r(3). See __getpwnam_r.
+ */
+int __getgrgid_r(gid_t gid, struct group * grp, char * buf, size_t buflen, struct group ** result);
+
+/**
+ * Same contract as getgrouplist(3): store group, then the gids of all groups listing user as a member, in file order.
+ * Return their count if they fit in *ngroups entries, -1 otherwise. Either way *ngroups is set to their count.
+ * Unlike getgrouplist(3), it answers from the index instead of scanning the group database on each call.
+ *
+ * Return -1 with errno set if the index can't be built.
+ */
+int __getgrouplist(const char * user, gid_t group, gid_t * groups, int * ngroups);
+
+/**
+ * Resolve n uids in one call, taking the index lock and checking for changes once for the whole batch.
+ *
+ * results[i] receives the entry for uids[i], or has pw_name == NULL when not found.
+ * Strings are copied into buf once per distinct key: results for repeated uids share them.
+ * Hot uids are served from a small LRU in front of the index.
+ *
+ * Returns 0 and sets *nfound to the number of results found, or an error number (ERANGE when buf is too small).
+ */
+int __getpwuid_batch(const uid_t * uids, size_t n, struct passwd * results, char * buf, size_t buflen, size_t * nfound);
+
+/**
+ * Same as __getpwuid_batch, for user names. NULL names are not found.
+ */
+int __getpwnam_batch(const char * const * names, size_t n, struct passwd * results, char * buf, size_t buflen, size_t * nfound);
+
+#endif
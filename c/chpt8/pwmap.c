@@ -0,0 +1,194 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../shared/errors.h"
+#include "../shared/utils.h"
+#include "pwmap.h"
+
+#define PWMAP_PASSWD_FIELDS 7
+#define PWMAP_GROUP_FIELDS 4
+
+/**
+ * Map size bytes of fd privately plus one trailing writable byte,
+ * so the last line can be null terminated even without a final newline.
+ * Splitting writes to every page with a separator, so the kernel ends up copying most of them.
+ */
+static char * map_with_terminator(int fd, size_t size) {
+    char * data = mmap(NULL, size + 1, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (data == MAP_FAILED) {
+        return NULL;
+    }
+    if (size > 0 && mmap(data, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        int saved_errno = errno;
+        munmap(data, size + 1);
+        errno = saved_errno;
+        return NULL;
+    }
+    data[size] = '\n';
+    return data;
+}
+
+/**
+ * Replace every sep in [begin, end) with a null byte. Returns how many were replaced.
+ */
+static size_t split(char * begin, char * end, char sep) {
+    size_t n = 0;
+    char * p = begin;
+    while ((p = memchr(p, sep, end - p)) != NULL) {
+        *p++ = '\0';
+        n++;
+    }
+    return n;
+}
+
+int pwmap_open(pwmap * map, const char * path, pwmap_kind kind) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        safe_close(fd);
+        return -1;
+    }
+    if (st.st_size >= UINT32_MAX) {
+        safe_close(fd);
+        errno = EFBIG;
+        return -1;
+    }
+
+    size_t size = st.st_size;
+    char * data = map_with_terminator(fd, size);
+    safe_close(fd); // The mapping keeps its own reference to the file
+    if (data == NULL) {
+        return -1;
+    }
+
+    size_t nfields = (kind == PWMAP_PASSWD) ? PWMAP_PASSWD_FIELDS : PWMAP_GROUP_FIELDS;
+    size_t capacity = 64, nlines = 0;
+    pwmap_line * lines = malloc(capacity * sizeof(pwmap_line));
+    if (lines == NULL) {
+        errExit("malloc");
+    }
+
+    char * end = data + size + 1;
+    char * line = data;
+    char * nl;
+    while (line < end && (nl = memchr(line, '\n', end - line)) != NULL) {
+        *nl = '\0';
+        if (line < nl && line[0] != '#' && split(line, nl, ':') == nfields - 1) {
+            if (kind == PWMAP_GROUP) {
+                // Member list is the last field
+                char * members = line;
+                for (size_t f = 0; f < nfields - 1; f++) {
+                    members += strlen(members) + 1;
+                }
+                split(members, nl, ',');
+            }
+            if (nlines == capacity) {
+                capacity *= 2;
+                lines = realloc(lines, capacity * sizeof(pwmap_line));
+                if (lines == NULL) {
+                    errExit("realloc");
+                }
+            }
+            lines[nlines].start = line - data;
+            lines[nlines].end = nl - data;
+            nlines++;
+        }
+        line = nl + 1;
+    }
+
+    map->kind = kind;
+    map->data = data;
+    map->map_sz = size + 1;
+    map->lines = lines;
+    map->nlines = nlines;
+    return 0;
+}
+
+void pwmap_close(pwmap * map) {
+    munmap(map->data, map->map_sz);
+    free(map->lines);
+    map->data = NULL;
+    map->lines = NULL;
+    map->nlines = 0;
+}
+
+/**
+ * Point fields[] at the first nfields null terminated strings of line i.
+ */
+static char * line_fields(const pwmap * map, size_t i, char ** fields, size_t nfields) {
+    char * p = map->data + map->lines[i].start;
+    for (size_t f = 0; f < nfields; f++) {
+        fields[f] = p;
+        p += strlen(p) + 1;
+    }
+    return p;
+}
+
+void pwmap_passwd(const pwmap * map, size_t i, struct passwd * pwd) {
+    char * fields[PWMAP_PASSWD_FIELDS];
+    line_fields(map, i, fields, PWMAP_PASSWD_FIELDS);
+    pwd->pw_name = fields[0];
+    pwd->pw_passwd = fields[1];
+    pwd->pw_uid = strtoul(fields[2], NULL, 10);
+    pwd->pw_gid = strtoul(fields[3], NULL, 10);
+    pwd->pw_gecos = fields[4];
+    pwd->pw_dir = fields[5];
+    pwd->pw_shell = fields[6];
+}
+
+int pwmap_group(const pwmap * map, size_t i, struct group * grp, char ** members, size_t max_members) {
+    char * fields[PWMAP_GROUP_FIELDS - 1];
+    char * member = line_fields(map, i, fields, PWMAP_GROUP_FIELDS - 1);
+    char * end = map->data + map->lines[i].end;
+    grp->gr_name = fields[0];
+    grp->gr_passwd = fields[1];
+    grp->gr_gid = strtoul(fields[2], NULL, 10);
+
+    size_t nmembers = 0;
+    for (; member < end; member += strlen(member) + 1) {
+        if (*member == '\0') {
+            continue; // Empty member list or stray comma
+        }
+        if (nmembers + 1 >= max_members) {
+            return ERANGE;
+        }
+        members[nmembers++] = member;
+    }
+    if (max_members == 0) {
+        return ERANGE;
+    }
+    members[nmembers] = NULL;
+    grp->gr_mem = members;
+    return 0;
+}
+
+ssize_t pwmap_find_name(const pwmap * map, const char * name) {
+    for (size_t i = 0; i < map->nlines; i++) {
+        if (strcmp(map->data + map->lines[i].start, name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+ssize_t pwmap_find_id(const pwmap * map, uint32_t id) {
+    for (size_t i = 0; i < map->nlines; i++) {
+        // The id is the third field in both files
+        const char * p = map->data + map->lines[i].start;
+        p += strlen(p) + 1;
+        p += strlen(p) + 1;
+        char * id_end;
+        if (strtoul(p, &id_end, 10) == id && *id_end == '\0' && id_end != p) {
+            return i;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,63 @@
+#ifndef __CHPT8_PWMAP_H__
+#define __CHPT8_PWMAP_H__
+
+#include <grp.h>
+#include <pwd.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/**
+ * Direct reader for passwd(5) and group(5) files that doesn't go through NSS.
+ *
+ * The file is mapped privately and split in place when opened: line and field separators found with memchr
+ * (vectorized by glibc) are overwritten with null bytes, so that fields are C strings. The file itself is untouched,
+ * but each write copies the page it's in, which is nearly every page: opening costs about a copy of the file.
+ * After that, the struct passwd and struct group views returned point into the mapping without copying fields.
+ * They stay valid until pwmap_close.
+ *
+ * Lines with the wrong number of fields, comments and empty lines are skipped.
+ */
+
+typedef enum { PWMAP_PASSWD, PWMAP_GROUP } pwmap_kind;
+
+typedef struct {
+    uint32_t start; // Offset of the first field
+    uint32_t end; // Offset of the null byte ending the last field
+} pwmap_line;
+
+typedef struct {
+    pwmap_kind kind;
+    char * data;
+    size_t map_sz;
+    pwmap_line * lines;
+    size_t nlines;
+} pwmap;
+
+/**
+ * Map and split the file at path. Returns 0, or -1 with errno set.
+ * Files over 4 GiB are rejected with EFBIG.
+ */
+int pwmap_open(pwmap * map, const char * path, pwmap_kind kind);
+
+void pwmap_close(pwmap * map);
+
+/**
+ * View of the i-th valid line of a PWMAP_PASSWD map.
+ */
+void pwmap_passwd(const pwmap * map, size_t i, struct passwd * pwd);
+
+/**
+ * View of the i-th valid line of a PWMAP_GROUP map.
+ * members receives the gr_mem list (NULL terminated), so it must hold up to max_members pointers.
+ * Returns 0, or ERANGE when the group has more members than fit.
+ */
+int pwmap_group(const pwmap * map, size_t i, struct group * grp, char ** members, size_t max_members);
+
+/**
+ * Linear lookups returning the index of the first matching line, or -1 if none matches.
+ */
+ssize_t pwmap_find_name(const pwmap * map, const char * name);
+ssize_t pwmap_find_id(const pwmap * map, uint32_t id);
+
+#endif
@@ -0,0 +1,103 @@
+#define _GNU_SOURCE /* For fgetpwent, fgetgrent */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../shared/bufwriter.h"
+#include "../shared/errors.h"
+#include "../shared/utils.h"
+#include "synthdb.h"
+
+void synth_user_name(char * buf, size_t buflen, long n) {
+    snprintf(buf, buflen, "user%ld", n);
+}
+
+void synth_passwd(const char * path, long nusers) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (fd == -1) {
+        errExit("Failed to create %s\n", path);
+    }
+    buffered_writer bw;
+    bw_init(&bw, fd, 1 << 16);
+
+    char line[256];
+    for (long n = 0; n < nusers; n++) {
+        int len = snprintf(line, sizeof(line), "user%ld:x:%ld:%ld:Synthetic User %ld,,,:/home/user%ld:/bin/bash\n",
+            n, SYNTH_FIRST_UID + n, SYNTH_FIRST_UID + n, n, n);
+        bw_write(&bw, line, len);
+    }
+
+    bw_destroy(&bw);
+    safe_close(fd);
+}
+
+void synth_group(const char * path, long ngroups, long nusers, long nmembers) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (fd == -1) {
+        errExit("Failed to create %s\n", path);
+    }
+    buffered_writer bw;
+    bw_init(&bw, fd, 1 << 16);
+
+    nmembers = min(nmembers, nusers);
+    long stride = nusers / nmembers;
+    char line[64];
+    for (long n = 0; n < ngroups; n++) {
+        int len = snprintf(line, sizeof(line), "group%ld:x:%ld:", n, SYNTH_FIRST_GID + n);
+        bw_write(&bw, line, len);
+        for (long m = 0; m < nmembers; m++) {
+            // Members m * stride apart, shifted by one user for each group, are distinct
+            len = snprintf(line, sizeof(line), m == 0 ? "user%ld" : ",user%ld", (n + m * stride) % nusers);
+            bw_write(&bw, line, len);
+        }
+        bw_write(&bw, "\n", 1);
+    }
+
+    bw_destroy(&bw);
+    safe_close(fd);
+}
+
+struct passwd * scan_getpwnam(const char * path, const char * name) {
+    FILE * f = fopen(path, "r");
+    if (f == NULL) {
+        errExit("fopen %s", path);
+    }
+    struct passwd * entry;
+    while ((entry = fgetpwent(f)) != NULL && strcmp(entry->pw_name, name) != 0) {
+    }
+    fclose(f);
+    return entry;
+}
+
+int scan_getgrouplist(const char * path, const char * user, gid_t group, gid_t * groups, int * ngroups) {
+    FILE * f = fopen(path, "r");
+    if (f == NULL) {
+        errExit("fopen %s", path);
+    }
+    int count = 0;
+    if (count < *ngroups) {
+        groups[count] = group;
+    }
+    count++;
+    struct group * entry;
+    while ((entry = fgetgrent(f)) != NULL) {
+        if (entry->gr_gid == group) {
+            continue;
+        }
+        for (char ** member = entry->gr_mem; *member != NULL; member++) {
+            if (strcmp(*member, user) == 0) {
+                if (count < *ngroups) {
+                    groups[count] = entry->gr_gid;
+                }
+                count++;
+                break;
+            }
+        }
+    }
+    fclose(f);
+
+    Boolean fits = count <= *ngroups;
+    *ngroups = count;
+    return fits ? count : -1;
+}
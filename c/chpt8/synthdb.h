@@ -0,0 +1,40 @@
+#ifndef __CHPT8_SYNTHDB_H__
+#define __CHPT8_SYNTHDB_H__
+
+#include <grp.h>
+#include <pwd.h>
+#include <stddef.h> /* For size_t */
+
+/**
+ * Write a passwd file with nusers entries named user<N> with uid 10000+N, for benchmarks.
+ */
+void synth_passwd(const char * path, long nusers);
+
+/**
+ * Name of the N-th synthetic user.
+ */
+void synth_user_name(char * buf, size_t buflen, long n);
+
+#define SYNTH_FIRST_UID 10000
+
+/**
+ * Write a group file with ngroups entries named group<N> with gid 100000+N,
+ * each listing nmembers distinct synthetic users out of nusers, spread so that every user is in about as many groups.
+ */
+void synth_group(const char * path, long ngroups, long nusers, long nmembers);
+
+#define SYNTH_FIRST_GID 100000
+
+/**
+ * Reference lookup for benchmarks: what __getpwnam does, but on the file at path.
+ * Parses entries with fgetpwent until one matches. Returns a static buffer, NULL if not found.
+ */
+struct passwd * scan_getpwnam(const char * path, const char * name);
+
+/**
+ * Reference lookup for benchmarks: what getgrouplist(3) does, but on the file at path.
+ * Parses every entry with fgetgrent, collecting the gids of the groups listing user. Same contract as getgrouplist.
+ */
+int scan_getgrouplist(const char * path, const char * user, gid_t group, gid_t * groups, int * ngroups);
+
+#endif
@@ -0,0 +1,193 @@
+#define _GNU_SOURCE /* For memmem */
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <grp.h>
+#include <pwd.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "../shared/errors.h"
+#include "../shared/utils.h"
+#include "pwcache.h"
+#include "test_pwcache.h"
+
+void chpt8_test_pwcache() {
+    //
+    // Reentrant versions of q2's __getpwnam. Results don't overwrite each other.
+    //
+    struct passwd root_pwd, daemon_pwd, * result;
+    char root_buf[1024], daemon_buf[1024], tiny_buf[4];
+    assert(__getpwnam_r("root", &root_pwd, root_buf, sizeof(root_buf), &result) == 0 && result == &root_pwd);
+    assert(__getpwuid_r(1, &daemon_pwd, daemon_buf, sizeof(daemon_buf), &result) == 0 && result == &daemon_pwd);
+    assert(strcmp(root_pwd.pw_name, "root") == 0 && root_pwd.pw_uid == 0);
+    assert(daemon_pwd.pw_uid == 1 && strcmp(daemon_pwd.pw_name, getpwuid(1)->pw_name) == 0);
+    assert(__getpwnam_r("afjdnajskldfn", &root_pwd, root_buf, sizeof(root_buf), &result) == 0 && result == NULL);
+    assert(__getpwnam_r(NULL, &root_pwd, root_buf, sizeof(root_buf), &result) == 0 && result == NULL);
+    assert(__getpwuid_r(4294967294u, &root_pwd, root_buf, sizeof(root_buf), &result) == 0 && result == NULL);
+    assert(__getpwnam_r("root", &root_pwd, tiny_buf, sizeof(tiny_buf), &result) == ERANGE && result == NULL);
+
+    //
+    // The index is rebuilt when its source file changes
+    //
+    char source_template[] = "/tmp/cracking-the-linux-prog-interface-XXXXXX";
+    int source_fd = mkstemp(source_template);
+    if (source_fd == -1) {
+        errExit("mkstemp");
+    }
+    deliver_write(source_fd, "alice:x:2000:2000::/home/alice:/bin/sh\n", 39);
+    pwcache_set_source(source_template, NULL);
+    assert(__getpwnam_r("alice", &root_pwd, root_buf, sizeof(root_buf), &result) == 0 && result != NULL && root_pwd.pw_uid == 2000);
+    assert(__getpwnam_r("bob", &root_pwd, root_buf, sizeof(root_buf), &result) == 0 && result == NULL);
+    deliver_write(source_fd, "bob:x:2001:2001::/home/bob:/bin/sh\n", 35);
+    usleep(2 * PWCACHE_RECHECK_MS * 1000);
+    assert(__getpwnam_r("bob", &root_pwd, root_buf, sizeof(root_buf), &result) == 0 && result != NULL && root_pwd.pw_uid == 2001);
+    assert(__getpwuid_r(2000, &root_pwd, root_buf, sizeof(root_buf), &result) == 0 && result != NULL && strcmp(root_pwd.pw_name, "alice") == 0);
+
+    //
+    // Batch lookups. Repeated keys share their strings, missing keys have pw_name == NULL.
+    //
+    uid_t batch_uids[] = { 2001, 7, 2000, 2001, 2001 };
+    const char * batch_names[] = { "alice", NULL, "carol", "alice" };
+    struct passwd batch[5];
+    char batch_buf[256];
+    size_t nfound;
+    for (int round = 0; round < 2; round++) { // The second round is served by the LRU
+        assert(__getpwuid_batch(batch_uids, 5, batch, batch_buf, sizeof(batch_buf), &nfound) == 0 && nfound == 4);
+        assert(strcmp(batch[0].pw_name, "bob") == 0 && batch[1].pw_name == NULL && strcmp(batch[2].pw_name, "alice") == 0);
+        assert(batch[3].pw_name == batch[0].pw_name && batch[4].pw_dir == batch[0].pw_dir && batch[4].pw_uid == 2001);
+    }
+    assert(__getpwnam_batch(batch_names, 4, batch, batch_buf, sizeof(batch_buf), &nfound) == 0 && nfound == 2);
+    assert(batch[0].pw_uid == 2000 && batch[1].pw_name == NULL && batch[2].pw_name == NULL && batch[3].pw_name == batch[0].pw_name);
+    assert(__getpwuid_batch(batch_uids, 5, batch, tiny_buf, sizeof(tiny_buf), &nfound) == ERANGE);
+    assert(__getpwuid_batch(batch_uids, 0, batch, batch_buf, sizeof(batch_buf), &nfound) == 0 && nfound == 0);
+    deliver_write(source_fd, "carol:x:2002:2002::/home/carol:/bin/sh\n", 39);
+    usleep(2 * PWCACHE_RECHECK_MS * 1000);
+    assert(__getpwnam_batch(batch_names, 4, batch, batch_buf, sizeof(batch_buf), &nfound) == 0 && nfound == 3);
+    assert(__getpwuid_batch(batch_uids, 5, batch, batch_buf, sizeof(batch_buf), &nfound) == 0 && nfound == 4);
+    assert(strcmp(batch[2].pw_name, "alice") == 0);
+
+    //
+    // Groups, from the same index
+    //
+    char group_template[] = "/tmp/cracking-the-linux-prog-interface-XXXXXX";
+    int group_fd = mkstemp(group_template);
+    if (group_fd == -1) {
+        errExit("mkstemp");
+    }
+    const char groups_file[] = "admins:x:3000:alice,bob\nstaff:x:3001:bob,bob\nempty:x:3002:\n";
+    deliver_write(group_fd, groups_file, sizeof(groups_file) - 1);
+    pwcache_set_source(source_template, group_template);
+    struct group grp, * grp_result;
+    char grp_buf[256];
+    assert(__getgrnam_r("admins", &grp, grp_buf, sizeof(grp_buf), &grp_result) == 0 && grp_result == &grp && grp.gr_gid == 3000);
+    assert(strcmp(grp.gr_mem[0], "alice") == 0 && strcmp(grp.gr_mem[1], "bob") == 0 && grp.gr_mem[2] == NULL);
+    assert(__getgrgid_r(3002, &grp, grp_buf, sizeof(grp_buf), &grp_result) == 0 && grp_result == &grp);
+    assert(strcmp(grp.gr_name, "empty") == 0 && grp.gr_mem[0] == NULL);
+    assert(__getgrgid_r(4000, &grp, grp_buf, sizeof(grp_buf), &grp_result) == 0 && grp_result == NULL);
+    assert(__getgrnam_r("admins", &grp, tiny_buf, sizeof(tiny_buf), &grp_result) == ERANGE && grp_result == NULL);
+
+    gid_t gids[8];
+    int ngids = 8;
+    assert(__getgrouplist("bob", 2001, gids, &ngids) == 3 && ngids == 3);
+    assert(gids[0] == 2001 && gids[1] == 3000 && gids[2] == 3001);
+    ngids = 1;
+    assert(__getgrouplist("bob", 2001, gids, &ngids) == -1 && ngids == 3 && gids[0] == 2001);
+    ngids = 8;
+    assert(__getgrouplist("alice", 3000, gids, &ngids) == 1 && gids[0] == 3000);
+    ngids = 8;
+    assert(__getgrouplist("nobody-at-all", 5, gids, &ngids) == 1 && gids[0] == 5);
+
+    pwcache_stats stats;
+    pwcache_get_stats(&stats);
+    assert(stats.nusers == 3 && stats.ngroups == 3 && stats.nmemberships == 4 && !stats.from_index);
+
+    //
+    // Compiled index, only used while it matches the sources
+    //
+    char index_template[] = "/tmp/cracking-the-linux-prog-interface-XXXXXX";
+    int index_fd = mkstemp(index_template);
+    if (index_fd == -1) {
+        errExit("mkstemp");
+    }
+    safe_close(index_fd);
+    assert(pwcache_compile(index_template) == 0);
+    pwcache_set_index(index_template);
+    pwcache_get_stats(&stats);
+    assert(stats.from_index && stats.nusers == 3 && stats.ngroups == 3 && stats.nmemberships == 4);
+    assert(__getpwnam_r("carol", &root_pwd, root_buf, sizeof(root_buf), &result) == 0 && result != NULL && root_pwd.pw_uid == 2002);
+    assert(__getpwuid_r(2000, &root_pwd, root_buf, sizeof(root_buf), &result) == 0 && result != NULL && strcmp(root_pwd.pw_name, "alice") == 0);
+    assert(__getpwnam_r("nobody-at-all", &root_pwd, root_buf, sizeof(root_buf), &result) == 0 && result == NULL);
+    assert(__getgrgid_r(3000, &grp, grp_buf, sizeof(grp_buf), &grp_result) == 0 && grp_result != NULL && strcmp(grp.gr_mem[1], "bob") == 0);
+    ngids = 8;
+    assert(__getgrouplist("bob", 2001, gids, &ngids) == 3 && gids[1] == 3000 && gids[2] == 3001);
+
+    deliver_write(source_fd, "dave:x:2003:2003::/home/dave:/bin/sh\n", 37);
+    usleep(2 * PWCACHE_RECHECK_MS * 1000);
+    assert(__getpwnam_r("dave", &root_pwd, root_buf, sizeof(root_buf), &result) == 0 && result != NULL && root_pwd.pw_uid == 2003);
+    pwcache_get_stats(&stats);
+    assert(!stats.from_index && stats.nusers == 4);
+    assert(pwcache_compile(index_template) == 0);
+    pwcache_set_index(index_template);
+    pwcache_get_stats(&stats);
+    assert(stats.from_index && stats.nusers == 4);
+
+    // So is one whose records point out of the string pool: dave's shell, right before his uid and gid
+    int corrupt_fd = open(index_template, O_RDWR);
+    char index_buf[8192];
+    ssize_t index_sz = read(corrupt_fd, index_buf, sizeof(index_buf));
+    assert(corrupt_fd != -1 && index_sz > 0 && index_sz < (ssize_t) sizeof(index_buf));
+    const uint32_t dave_ids[] = { 2003, 2003 }, out_of_pool = UINT32_MAX;
+    char * dave = memmem(index_buf, index_sz, dave_ids, sizeof(dave_ids));
+    assert(dave != NULL && dave - index_buf >= (ssize_t) sizeof(out_of_pool));
+    assert(pwrite(corrupt_fd, &out_of_pool, sizeof(out_of_pool), dave - index_buf - sizeof(out_of_pool)) == sizeof(out_of_pool));
+    safe_close(corrupt_fd);
+    pwcache_set_index(index_template);
+    pwcache_get_stats(&stats);
+    assert(!stats.from_index && stats.nusers == 4);
+    assert(__getpwnam_r("dave", &root_pwd, root_buf, sizeof(root_buf), &result) == 0 && result != NULL && strcmp(root_pwd.pw_shell, "/bin/sh") == 0);
+
+    // Failing to write the index is reported, and leaves no temporary file behind
+    struct rlimit fsize;
+    getrlimit(RLIMIT_FSIZE, &fsize);
+    struct rlimit tiny_fsize = { 100, fsize.rlim_max };
+    signal(SIGXFSZ, SIG_IGN);
+    assert(setrlimit(RLIMIT_FSIZE, &tiny_fsize) == 0);
+    assert(pwcache_compile(index_template) == -1 && errno == EFBIG);
+    assert(setrlimit(RLIMIT_FSIZE, &fsize) == 0);
+    signal(SIGXFSZ, SIG_DFL);
+    char tmp_pattern[sizeof(index_template) + 8];
+    snprintf(tmp_pattern, sizeof(tmp_pattern), "%s.??????", index_template);
+    glob_t leftovers;
+    assert(glob(tmp_pattern, 0, NULL, &leftovers) == GLOB_NOMATCH);
+
+    // A damaged index is ignored
+    if (truncate(index_template, 100) == -1) {
+        errExit("truncate");
+    }
+    pwcache_set_index(index_template);
+    pwcache_get_stats(&stats);
+    assert(!stats.from_index && stats.nusers == 4);
+    pwcache_set_index(PWCACHE_DEFAULT_INDEX);
+    unlink(index_template);
+    pwcache_set_source(NULL, NULL);
+
+    assert(__getgrnam_r("root", &grp, grp_buf, sizeof(grp_buf), &grp_result) == 0 && grp_result != NULL && grp.gr_gid == 0);
+    gid_t glibc_gids[64];
+    int glibc_ngids = 64;
+    ngids = 8;
+    assert(getgrouplist("root", 0, glibc_gids, &glibc_ngids) == __getgrouplist("root", 0, gids, &ngids));
+    assert(ngids == glibc_ngids && memcmp(gids, glibc_gids, ngids * sizeof(gid_t)) == 0);
+    safe_close(group_fd);
+    unlink(group_template);
+
+    safe_close(source_fd);
+    unlink(source_template);
+}
@@ -0,0 +1,10 @@
+#ifndef __CHPT8_TEST_PWCACHE_H__
+#define __CHPT8_TEST_PWCACHE_H__
+
+/**
+ * Tests of pwcache: the reentrant, batch and group lookups, rebuilding the index when its sources change,
+ * and the compiled index.
+ */
+void chpt8_test_pwcache();
+
+#endif
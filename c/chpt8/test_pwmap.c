@@ -0,0 +1,57 @@
+#include <assert.h>
+#include <errno.h>
+#include <grp.h>
+#include <pwd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../shared/errors.h"
+#include "../shared/utils.h"
+#include "pwmap.h"
+#include "test_pwmap.h"
+
+void chpt8_test_pwmap() {
+    pwmap map;
+    struct passwd pwd, * found;
+    struct group grp;
+    char source_template[] = "/tmp/cracking-the-linux-prog-interface-XXXXXX";
+    int source_fd = mkstemp(source_template);
+    if (source_fd == -1) {
+        errExit("mkstemp");
+    }
+
+    //
+    // Comments, blank and malformed lines are skipped, and the last line needn't end with a newline
+    //
+    const char malformed[] = "# comment\n\nbroken:line\ncarol:x:3000:3000:Carol:/home/carol:/bin/sh\n"
+        "dave:x:3001:3001::/home/dave:/bin/false"; // No final newline
+    deliver_write(source_fd, malformed, sizeof(malformed) - 1);
+    assert(pwmap_open(&map, source_template, PWMAP_PASSWD) == 0 && map.nlines == 2);
+    assert(pwmap_find_name(&map, "broken") == -1);
+    assert(pwmap_find_id(&map, 3001) == 1);
+    pwmap_passwd(&map, pwmap_find_name(&map, "dave"), &pwd);
+    assert(strcmp(pwd.pw_shell, "/bin/false") == 0 && pwd.pw_uid == 3001 && strcmp(pwd.pw_gecos, "") == 0);
+    pwmap_close(&map);
+
+    //
+    // The same entries as glibc's
+    //
+    assert(pwmap_open(&map, "/etc/passwd", PWMAP_PASSWD) == 0);
+    ssize_t root_line = pwmap_find_name(&map, "root");
+    assert(root_line != -1 && pwmap_find_id(&map, 0) == root_line);
+    pwmap_passwd(&map, root_line, &pwd);
+    found = getpwnam("root");
+    assert(pwd.pw_uid == found->pw_uid && strcmp(pwd.pw_dir, found->pw_dir) == 0 && strcmp(pwd.pw_shell, found->pw_shell) == 0);
+    pwmap_close(&map);
+
+    char * members[1024];
+    assert(pwmap_open(&map, "/etc/group", PWMAP_GROUP) == 0);
+    ssize_t root_group = pwmap_find_name(&map, "root");
+    assert(root_group != -1 && pwmap_group(&map, root_group, &grp, members, 1024) == 0 && grp.gr_gid == 0);
+    assert(pwmap_group(&map, root_group, &grp, members, 0) == ERANGE);
+    pwmap_close(&map);
+
+    safe_close(source_fd);
+    unlink(source_template);
+}
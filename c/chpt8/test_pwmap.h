@@ -0,0 +1,9 @@
+#ifndef __CHPT8_TEST_PWMAP_H__
+#define __CHPT8_TEST_PWMAP_H__
+
+/**
+ * Tests of the mmap passwd and group reader.
+ */
+void chpt8_test_pwmap();
+
+#endif
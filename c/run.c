@@ -3,6 +3,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "chpt3/chpt3.h"
 #include "chpt4/chpt4.h"
 #include "chpt5/chpt5.h"
 #include "chpt6/chpt6.h"
@@ -45,7 +46,9 @@ int main(int argc, char* argv[]) {
         exit(1);
     }
     argc -= 2; // Point to the question arg as the new argv[0]
-    if (cmp_chpt(argv[1], 4)) {
+    if (cmp_chpt(argv[1], 3)) {
+        chpt3_run(argv[2], argc, argv+2);
+    } else if (cmp_chpt(argv[1], 4)) {
         chpt4_run(argv[2], argc, argv+2);
     } else if (cmp_chpt(argv[1], 5)) {
         chpt5_run(argv[2], argc, argv+2);
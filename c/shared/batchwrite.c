@@ -0,0 +1,47 @@
+#define _GNU_SOURCE /* For pwritev2 and the RWF_* flags */
+
+#include <errno.h>
+#include <unistd.h>
+
+#include "batchwrite.h"
+
+//
+// Kernel support doesn't change while we run, so remember a failure and don't probe again.
+//
+static int pwritev2_unsupported = 0;
+
+static ssize_t batch_pwritev_fallback(int fd, const struct iovec * iov, int iovcnt, off_t offset, int flags) {
+    ssize_t nwritten;
+    if (flags & RWF_APPEND) {
+        if (lseek(fd, 0, SEEK_END) == -1) {
+            return -1;
+        }
+        nwritten = writev(fd, iov, iovcnt);
+    } else if (offset == -1) {
+        nwritten = writev(fd, iov, iovcnt);
+    } else {
+        nwritten = pwritev(fd, iov, iovcnt, offset);
+    }
+
+    if (nwritten != -1 && (flags & RWF_DSYNC) && fdatasync(fd) == -1) {
+        return -1;
+    }
+    return nwritten;
+}
+
+ssize_t batch_pwritev(int fd, const struct iovec * iov, int iovcnt, off_t offset, int flags) {
+    if (!pwritev2_unsupported) {
+        ssize_t nwritten = pwritev2(fd, iov, iovcnt, offset, flags);
+        if (nwritten != -1) {
+            return nwritten;
+        }
+        if (errno == ENOSYS) {
+            // No pwritev2 at all
+            pwritev2_unsupported = 1;
+        } else if (errno != EOPNOTSUPP) {
+            // A real error. EOPNOTSUPP means one of the flags is unknown to this kernel or file.
+            return -1;
+        }
+    }
+    return batch_pwritev_fallback(fd, iov, iovcnt, offset, flags);
+}
@@ -0,0 +1,23 @@
+#ifndef __SHARED_BATCHWRITE_H__
+#define __SHARED_BATCHWRITE_H__
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/**
+ * Vectored write with per-call flags, built on pwritev2(2).
+ * The RWF_* flags are only declared when compiling with _GNU_SOURCE.
+ *
+ * offset -1 writes at the current file offset, like writev.
+ * flags may combine RWF_APPEND, RWF_DSYNC, RWF_NOWAIT and RWF_HIPRI.
+ *
+ * On kernels without pwritev2 or without support for one of the flags it falls back to pwritev/writev:
+ * - RWF_APPEND seeks the end before writing, which is NOT atomic like O_APPEND.
+ * - RWF_DSYNC calls fdatasync after writing.
+ * - RWF_NOWAIT and RWF_HIPRI are hints and are dropped, so the call may block.
+ *
+ * Returns the number of bytes written or -1 with errno set, like the syscalls it wraps.
+ */
+ssize_t batch_pwritev(int fd, const struct iovec * iov, int iovcnt, off_t offset, int flags);
+
+#endif
@@ -0,0 +1,51 @@
+#include <stdio.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "errors.h"
+#include "utils.h"
+
+double bench_now() {
+    struct timespec ts;
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1) {
+        errExit("clock_gettime");
+    }
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void bench_report(const char * name, double value, const char * unit) {
+    printf("%-48s %16.3f %s\n", name, value, unit);
+    fflush(stdout);
+}
+
+void bench_run_in_child(bench_workload fn, void * arg, void * result, size_t size) {
+    int fds[2];
+    if (pipe(fds) == -1) {
+        errExit("pipe");
+    }
+
+    fflush(stdout);
+    switch (fork()) {
+    case -1:
+        errExit("fork");
+    case 0:
+        safe_close(fds[0]);
+        fn(arg, result);
+        deliver_write(fds[1], result, size);
+        _exit(0);
+    default:
+        safe_close(fds[1]);
+    }
+
+    ssize_t n = read(fds[0], result, size);
+    int status;
+    if (wait(&status) == -1) {
+        errExit("wait");
+    }
+    if (n != (ssize_t) size || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fatal("Benchmark workload failed");
+    }
+    safe_close(fds[0]);
+}
@@ -0,0 +1,39 @@
+#ifndef __SHARED_BENCH_H__
+#define __SHARED_BENCH_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Seconds elapsed on the monotonic clock since an arbitrary point.
+ */
+double bench_now();
+
+/**
+ * Print a benchmark result as a "<name> <value> <unit>" line on stdout.
+ * Keep one result per line so runs can be compared with diff.
+ */
+void bench_report(const char * name, double value, const char * unit);
+
+typedef void (*bench_workload)(void * arg, void * result);
+
+/**
+ * Call fn(arg, result) in a child process and copy the size bytes it left in result back into result,
+ * so that each run starts from a fresh heap and leaves nothing behind. Exits if the child fails.
+ */
+void bench_run_in_child(bench_workload fn, void * arg, void * result, size_t size);
+
+#define BENCH_SEED 88172645463325252ULL
+
+/**
+ * Next number of Marsaglia's xorshift64 generator, from a nonzero state such as BENCH_SEED.
+ * Fast and reproducible: the same seed gives every run the same workload.
+ */
+static inline uint64_t bench_xorshift(uint64_t * state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+#endif
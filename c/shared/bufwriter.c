@@ -0,0 +1,70 @@
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#include "bufwriter.h"
+#include "errors.h"
+#include "utils.h"
+
+void bw_init(buffered_writer * bw, int fd, size_t capacity) {
+    if (capacity == 0) {
+        fatal("Buffered writer capacity must be positive\n");
+    }
+    bw->buffer = malloc(capacity);
+    if (bw->buffer == NULL) {
+        errExit("malloc");
+    }
+    bw->fd = fd;
+    bw->capacity = capacity;
+    bw->pending = 0;
+}
+
+void bw_write(buffered_writer * bw, const void * buffer, size_t nbytes) {
+    if (bw->pending + nbytes < bw->capacity) {
+        memcpy(bw->buffer + bw->pending, buffer, nbytes);
+        bw->pending += nbytes;
+        return;
+    }
+
+    if (bw->pending + nbytes == bw->capacity) {
+        // Exactly fills the buffer. Complete it and deliver it whole.
+        memcpy(bw->buffer + bw->pending, buffer, nbytes);
+        bw->pending = bw->capacity;
+        bw_flush(bw);
+        return;
+    }
+
+    //
+    // Doesn't fit. Rather than copying in pieces, send pending data and the user buffer in one go.
+    //
+    struct iovec iov[] = {
+        {
+            .iov_base = bw->buffer,
+            .iov_len = bw->pending
+        },
+        {
+            .iov_base = (void *) buffer,
+            .iov_len = nbytes
+        }
+    };
+    if (bw->pending == 0) {
+        deliver_writev(bw->fd, iov+1, 1);
+    } else {
+        deliver_writev(bw->fd, iov, 2);
+    }
+    bw->pending = 0;
+}
+
+void bw_flush(buffered_writer * bw) {
+    if (bw->pending > 0) {
+        deliver_write(bw->fd, bw->buffer, bw->pending);
+        bw->pending = 0;
+    }
+}
+
+void bw_destroy(buffered_writer * bw) {
+    bw_flush(bw);
+    free(bw->buffer);
+    bw->buffer = NULL;
+    bw->capacity = 0;
+}
@@ -0,0 +1,41 @@
+#ifndef __SHARED_BUFWRITER_H__
+#define __SHARED_BUFWRITER_H__
+
+#include <stddef.h> /* For size_t */
+
+/**
+ * Write buffer in front of a file descriptor.
+ * Small writes are accumulated in memory and delivered with deliver_write/deliver_writev once the buffer fills up,
+ * trading one syscall per write for one syscall per capacity bytes.
+ */
+typedef struct buffered_writer buffered_writer;
+
+struct buffered_writer {
+    int fd;
+    char * buffer;
+    size_t capacity;
+    size_t pending; // Bytes in buffer not yet delivered to fd.
+};
+
+/**
+ * Allocate a buffer of capacity bytes for writing into fd. capacity must be positive.
+ */
+void bw_init(buffered_writer * bw, int fd, size_t capacity);
+
+/**
+ * Append nbytes to the buffer. When they don't fit, pending data and the user buffer
+ * are delivered together in a single writev instead of being copied.
+ */
+void bw_write(buffered_writer * bw, const void * buffer, size_t nbytes);
+
+/**
+ * Deliver all pending data to the descriptor.
+ */
+void bw_flush(buffered_writer * bw);
+
+/**
+ * Flush pending data and release the buffer. The descriptor is left open.
+ */
+void bw_destroy(buffered_writer * bw);
+
+#endif
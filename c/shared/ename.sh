@@ -0,0 +1,28 @@
+#!/bin/sh
+# Generate the errno names table of errors.c from the system headers, so it
+# covers every errno of the platform: sh ename.sh [CC] > ename.c.inc
+#
+# Each entry is indexed by the errno value and holds its name, followed by
+# any aliases: [11] = "EAGAIN/EWOULDBLOCK".
+
+CC=${1:-cc}
+
+echo '#include <errno.h>' | $CC -E -dM -x c - | awk '
+$1 == "#define" && $2 ~ /^E[A-Z0-9]+$/ {
+    if ($3 ~ /^[0-9]+$/) {
+        value[$2] = $3
+        if ($3 in name)
+            name[$3] = name[$3] "/" $2
+        else
+            name[$3] = $2
+    } else {
+        alias[$2] = $3
+    }
+}
+END {
+    for (a in alias)
+        if (alias[a] in value)
+            name[value[alias[a]]] = name[value[alias[a]]] "/" a
+    for (v in name)
+        printf "    [%d] = \"%s\",\n", v, name[v]
+}' | sort -t '[' -k 2 -n
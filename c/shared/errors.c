@@ -1,46 +1,36 @@
+#define _GNU_SOURCE
 #include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <signal.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/uio.h>
+#include <time.h>
 #include <unistd.h>
 
 
 #include "errors.h"
 #include "utils.h"
 
-#define MAX_ENAME 132
-
+/* Generated from <errno.h> by ename.sh at build time, with gaps for unused
+values */
 static const char *ename[] = {
-/* 0 */ "",
-/* 1 */ "EPERM", "ENOENT", "ESRCH", "EINTR", "EIO", "ENXIO", "E2BIG",
-/* 8 */ "ENOEXEC", "EBADF", "ECHILD", "EAGAIN/EWOULDBLOCK", "ENOMEM",
-/* 13 */ "EACCES", "EFAULT", "ENOTBLK", "EBUSY", "EEXIST", "EXDEV",
-/* 19 */ "ENODEV", "ENOTDIR", "EISDIR", "EINVAL", "ENFILE", "EMFILE",
-/* 25 */ "ENOTTY", "ETXTBSY", "EFBIG", "ENOSPC", "ESPIPE", "EROFS",
-/* 31 */ "EMLINK", "EPIPE", "EDOM", "ERANGE", "EDEADLK/EDEADLOCK",
-/* 36 */ "ENAMETOOLONG", "ENOLCK", "ENOSYS", "ENOTEMPTY", "ELOOP", "",
-/* 42 */ "ENOMSG", "EIDRM", "ECHRNG", "EL2NSYNC", "EL3HLT", "EL3RST",
-/* 48 */ "ELNRNG", "EUNATCH", "ENOCSI", "EL2HLT", "EBADE", "EBADR",
-/* 54 */ "EXFULL", "ENOANO", "EBADRQC", "EBADSLT", "", "EBFONT", "ENOSTR",
-/* 61 */ "ENODATA", "ETIME", "ENOSR", "ENONET", "ENOPKG", "EREMOTE",
-/* 67 */ "ENOLINK", "EADV", "ESRMNT", "ECOMM", "EPROTO", "EMULTIHOP",
-/* 73 */ "EDOTDOT", "EBADMSG", "EOVERFLOW", "ENOTUNIQ", "EBADFD",
-/* 78 */ "EREMCHG", "ELIBACC", "ELIBBAD", "ELIBSCN", "ELIBMAX",
-/* 83 */ "ELIBEXEC", "EILSEQ", "ERESTART", "ESTRPIPE", "EUSERS",
-/* 88 */ "ENOTSOCK", "EDESTADDRREQ", "EMSGSIZE", "EPROTOTYPE",
-/* 92 */ "ENOPROTOOPT", "EPROTONOSUPPORT", "ESOCKTNOSUPPORT",
-/* 95 */ "EOPNOTSUPP/ENOTSUP", "EPFNOSUPPORT", "EAFNOSUPPORT",
-/* 98 */ "EADDRINUSE", "EADDRNOTAVAIL", "ENETDOWN", "ENETUNREACH",
-/* 102 */ "ENETRESET", "ECONNABORTED", "ECONNRESET", "ENOBUFS", "EISCONN",
-/* 107 */ "ENOTCONN", "ESHUTDOWN", "ETOOMANYREFS", "ETIMEDOUT",
-/* 111 */ "ECONNREFUSED", "EHOSTDOWN", "EHOSTUNREACH", "EALREADY",
-/* 115 */ "EINPROGRESS", "ESTALE", "EUCLEAN", "ENOTNAM", "ENAVAIL",
-/* 120 */ "EISNAM", "EREMOTEIO", "EDQUOT", "ENOMEDIUM", "EMEDIUMTYPE",
-/* 125 */ "ECANCELED", "ENOKEY", "EKEYEXPIRED", "EKEYREVOKED",
-/* 129 */ "EKEYREJECTED", "EOWNERDEAD", "ENOTRECOVERABLE", "ERFKILL"
+#include "ename.c.inc"
 };
 
+#define MAX_ENAME ((int) (sizeof(ename) / sizeof(ename[0])) - 1)
+
+static const char *
+errorName(int err)
+{
+    return (err > 0 && err <= MAX_ENAME && ename[err] != NULL) ? ename[err] : "?UNKNOWN?";
+}
+
 static void NORETURN terminate(Boolean useExit3) {
     char *s;
     /* Dump core if EF_DUMPCORE environment variable is defined and
@@ -56,30 +46,727 @@ static void NORETURN terminate(Boolean useExit3) {
     }
 }
 
-static void outputError(Boolean useErr, int err, Boolean flushStdout, const char *format, va_list ap) {
-    #define BUF_SIZE 500
-    char buf[3*BUF_SIZE], userMsg[BUF_SIZE], errText[BUF_SIZE];
+/*
+ * Everything below up to outputError() must stay async-signal-safe: no stdio,
+ * no malloc, no locks, and only functions POSIX lists as safe.
+ */
+
+typedef struct {
+    Boolean left, zero, plus, space, alt;
+    int width, precision; /* precision is -1 when absent */
+} FmtSpec;
+
+typedef struct {
+    char *buf;
+    size_t size;
+    size_t len; /* Counts what didn't fit too, like vsnprintf */
+} FmtOut;
+
+/* Copy in bulk, not a character at a time: it's the main cost of formatting */
+
+static void
+fmtWrite(FmtOut *out, const char *s, size_t n)
+{
+    if (out->len + 1 < out->size)
+        memcpy(out->buf + out->len, s, min(n, out->size - 1 - out->len));
+    out->len += n;
+}
+
+static void
+fmtPad(FmtOut *out, char c, long n)
+{
+    if (n <= 0)
+        return;
+    if (out->len + 1 < out->size)
+        memset(out->buf + out->len, c, min((size_t) n, out->size - 1 - out->len));
+    out->len += n;
+}
+
+static void
+fmtString(FmtOut *out, const char *s, const FmtSpec *spec)
+{
+    size_t n;
+
+    if (s == NULL)
+        s = "(null)";
+    /* strnlen, unlike memchr, doesn't look past the end of s */
+    n = spec->precision < 0 ? strlen(s) : strnlen(s, spec->precision);
+
+    if (!spec->left)
+        fmtPad(out, ' ', spec->width - (long) n);
+    fmtWrite(out, s, n);
+    if (spec->left)
+        fmtPad(out, ' ', spec->width - (long) n);
+}
+
+static void
+fmtInteger(FmtOut *out, unsigned long long value, Boolean negative, unsigned base,
+           Boolean upper, const char *prefix, const FmtSpec *spec)
+{
+    const char *digitChars = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+    char digits[3 * sizeof(value)]; /* Enough for octal */
+    char *first = digits + sizeof(digits);
+    char sign = negative ? '-' : spec->plus ? '+' : spec->space ? ' ' : '\0';
+
+    /* As in printf, a zero precision prints nothing for 0 */
+    for (; value != 0 || (first == digits + sizeof(digits) && spec->precision != 0); value /= base)
+        *--first = digitChars[value % base];
+    long ndigits = digits + sizeof(digits) - first;
+
+    long zeros = max(spec->precision - ndigits, 0);
+    long total = (sign != '\0') + (long) strlen(prefix) + zeros + ndigits;
+    if (spec->zero && !spec->left && spec->precision < 0 && spec->width > total) {
+        zeros += spec->width - total;
+        total = spec->width;
+    }
+
+    if (!spec->left)
+        fmtPad(out, ' ', spec->width - total);
+    if (sign != '\0')
+        fmtWrite(out, &sign, 1);
+    fmtWrite(out, prefix, strlen(prefix));
+    fmtPad(out, '0', zeros);
+    fmtWrite(out, first, ndigits);
+    if (spec->left)
+        fmtPad(out, ' ', spec->width - total);
+}
+
+int
+errFormat(char *buf, size_t size, const char *format, va_list ap)
+{
+    FmtOut out = { buf, size, 0 };
+    const char *p = format;
+
+    while (*p != '\0') {
+        if (*p != '%') {
+            const char *literal = p;
+            while (*p != '\0' && *p != '%')
+                p++;
+            fmtWrite(&out, literal, p - literal);
+            continue;
+        }
+
+        const char *conversion = p++;
+        FmtSpec spec = { FALSE, FALSE, FALSE, FALSE, FALSE, 0, -1 };
+        for (;; p++) {
+            if (*p == '-')
+                spec.left = TRUE;
+            else if (*p == '0')
+                spec.zero = TRUE;
+            else if (*p == '+')
+                spec.plus = TRUE;
+            else if (*p == ' ')
+                spec.space = TRUE;
+            else if (*p == '#')
+                spec.alt = TRUE;
+            else
+                break;
+        }
+
+        if (*p == '*') {
+            spec.width = va_arg(ap, int);
+            if (spec.width < 0) {
+                spec.left = TRUE;
+                spec.width = -spec.width;
+            }
+            p++;
+        } else {
+            for (; *p >= '0' && *p <= '9'; p++)
+                spec.width = spec.width * 10 + (*p - '0');
+        }
+
+        if (*p == '.') {
+            p++;
+            if (*p == '*') {
+                spec.precision = va_arg(ap, int);
+                if (spec.precision < 0)
+                    spec.precision = -1; /* As if absent */
+                p++;
+            } else {
+                for (spec.precision = 0; *p >= '0' && *p <= '9'; p++)
+                    spec.precision = spec.precision * 10 + (*p - '0');
+            }
+        }
+
+        /* Length modifiers: 'H' for hh and 'q' for ll */
+        char length = '\0';
+        if (*p == 'h' || *p == 'l' || *p == 'z' || *p == 'j' || *p == 't') {
+            length = *p++;
+            if (length == 'h' && *p == 'h') {
+                length = 'H';
+                p++;
+            } else if (length == 'l' && *p == 'l') {
+                length = 'q';
+                p++;
+            }
+        }
+
+        char c = *p++;
+        if (c == 'd' || c == 'i') {
+            long long v;
+            switch (length) {
+            case 'H': v = (signed char) va_arg(ap, int); break;
+            case 'h': v = (short) va_arg(ap, int); break;
+            case 'l': v = va_arg(ap, long); break;
+            case 'q': v = va_arg(ap, long long); break;
+            case 'z': v = va_arg(ap, ssize_t); break;
+            case 'j': v = va_arg(ap, intmax_t); break;
+            case 't': v = va_arg(ap, ptrdiff_t); break;
+            default: v = va_arg(ap, int); break;
+            }
+            /* Negate unsigned, so LLONG_MIN doesn't overflow */
+            fmtInteger(&out, v < 0 ? 0ULL - (unsigned long long) v : (unsigned long long) v,
+                       v < 0, 10, FALSE, "", &spec);
+        } else if (c == 'u' || c == 'x' || c == 'X' || c == 'o') {
+            unsigned long long v;
+            switch (length) {
+            case 'H': v = (unsigned char) va_arg(ap, unsigned); break;
+            case 'h': v = (unsigned short) va_arg(ap, unsigned); break;
+            case 'l': v = va_arg(ap, unsigned long); break;
+            case 'q': v = va_arg(ap, unsigned long long); break;
+            case 'z': v = va_arg(ap, size_t); break;
+            case 'j': v = va_arg(ap, uintmax_t); break;
+            case 't': v = (unsigned long long) va_arg(ap, ptrdiff_t); break;
+            default: v = va_arg(ap, unsigned); break;
+            }
+            unsigned base = c == 'u' ? 10 : c == 'o' ? 8 : 16;
+            const char *prefix = !spec.alt || v == 0 ? "" : c == 'x' ? "0x" : c == 'X' ? "0X" : c == 'o' ? "0" : "";
+            fmtInteger(&out, v, FALSE, base, c == 'X', prefix, &spec);
+        } else if (c == 'p') {
+            void *ptr = va_arg(ap, void *);
+            if (ptr == NULL)
+                fmtString(&out, "(nil)", &spec);
+            else
+                fmtInteger(&out, (uintptr_t) ptr, FALSE, 16, FALSE, "0x", &spec);
+        } else if (c == 'c') {
+            char ch = (char) va_arg(ap, int);
+            if (!spec.left)
+                fmtPad(&out, ' ', spec.width - 1);
+            fmtWrite(&out, &ch, 1);
+            if (spec.left)
+                fmtPad(&out, ' ', spec.width - 1);
+        } else if (c == 's') {
+            fmtString(&out, va_arg(ap, const char *), &spec);
+        } else if (c == '%') {
+            fmtWrite(&out, "%", 1);
+        } else {
+            /* Unsupported: the remaining arguments can't be located, so copy the rest as is */
+            fmtWrite(&out, conversion, strlen(conversion));
+            break;
+        }
+    }
+
+    if (size > 0)
+        buf[min(out.len, size - 1)] = '\0';
+    return (int) out.len;
+}
+
+static int
+formatf(char *buf, size_t size, const char *format, ...)
+{
+    va_list argList;
+    int len;
+
+    va_start(argList, format);
+    len = errFormat(buf, size, format, argList);
+    va_end(argList);
+
+    return len;
+}
+
+/* Format "ERROR [ENAME description] message" (or "ERROR: message" if
+!useErr) and a newline into buf, which holds ERR_LINE_MAX bytes. Returns
+the length of the line, which isn't NUL-terminated. */
+
+static size_t
+formatLine(char *buf, Boolean useErr, int err, const char *format, va_list ap)
+{
+    size_t len;
 
-    vsnprintf(userMsg, BUF_SIZE, format, ap);
     if (useErr) {
-        snprintf(
-            errText,
-            BUF_SIZE, 
-            " [%s %s]",
-            (err > 0 && err <= MAX_ENAME) ? ename[err] : "?UNKNOWN?", 
-            strerror(err)
-        );
-    }
-    else {
-        snprintf(errText, BUF_SIZE, ":");
-    }
-    snprintf(buf, 3*BUF_SIZE, "ERROR%s %s\n", errText, userMsg);
+        /* Unlike strerror(), strerrordesc_np() doesn't translate, so doesn't
+        touch the locale and is async-signal-safe */
+        const char *description = strerrordesc_np(err);
+        len = formatf(buf, ERR_LINE_MAX, "ERROR [%s %s] ", errorName(err),
+                description != NULL ? description : "Unknown error");
+    } else {
+        len = formatf(buf, ERR_LINE_MAX, "ERROR: ");
+    }
+    len = min(len, ERR_LINE_MAX - 1);
+    len += errFormat(buf + len, ERR_LINE_MAX - len, format, ap);
+    len = min(len, ERR_LINE_MAX - 1);
+
+    buf[len++] = '\n';
+    return len;
+}
+
+/* write(2) all of iov to stderr, a single call unless it gets interrupted
+or stderr is full. Errors are dropped: there's nowhere left to report them. */
+
+static void
+writeLines(struct iovec *iov, int iovcnt)
+{
+    while (iovcnt > 0) {
+        ssize_t written = writev(STDERR_FILENO, iov, iovcnt);
+        if (written == -1) {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+        for (; iovcnt > 0 && (size_t) written >= iov->iov_len; iov++, iovcnt--)
+            written -= iov->iov_len;
+        if (iovcnt > 0) {
+            iov->iov_base = (char *) iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+}
+
+static void
+writeLine(char *line, size_t len)
+{
+    struct iovec iov = { line, len };
+    writeLines(&iov, 1);
+}
+
+/*
+ * The ring is a bounded multi-producer queue (Vyukov's): each slot's
+ * sequence number says whether it's free for position pos (seq == pos) or
+ * holds the line pushed at pos (seq == pos + 1). Producers claim a position
+ * with a CAS on ringTail, so pushing never blocks, which is what makes it
+ * safe from a signal handler interrupting another push.
+ */
+
+#define RING_BATCH 64 /* Lines per writev() from the drainer */
+#define RING_DRAIN_WAIT_NS 100000000L /* Longest wait for the drainer to make room or catch up */
+#define RING_PAUSE_NS 50000L
+
+typedef struct {
+    size_t seq;
+    size_t len;
+    char line[ERR_LINE_MAX];
+} RingSlot;
+
+static RingSlot *ring;
+static size_t ringMask;
+static size_t ringTail;
+static size_t ringHead;
+static int ringActive;
+static int ringInflight; /* Pushes that may still touch the ring */
+static int ringStopping;
+static int ringSleeping; /* Set while the drainer waits on ringSem */
+static sem_t ringSem;
+static pthread_t ringThread;
+
+static Boolean
+ringPush(const char *line, size_t len)
+{
+    struct timespec pause = { 0, RING_PAUSE_NS };
+    long waited = 0;
+    Boolean pushed = FALSE;
+
+    if (!__atomic_load_n(&ringActive, __ATOMIC_SEQ_CST))
+        return FALSE;
+
+    __atomic_add_fetch(&ringInflight, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ringActive, __ATOMIC_SEQ_CST)) {
+        size_t pos = __atomic_load_n(&ringTail, __ATOMIC_RELAXED);
+        for (;;) {
+            RingSlot *slot = &ring[pos & ringMask];
+            intptr_t diff = (intptr_t) __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - (intptr_t) pos;
+            if (diff == 0) {
+                if (__atomic_compare_exchange_n(&ringTail, &pos, pos + 1, TRUE,
+                                                __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                    memcpy(slot->line, line, len);
+                    slot->len = len;
+                    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+                    /* Only wake the drainer if it sleeps: sem_post is a syscall then */
+                    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+                    if (__atomic_load_n(&ringSleeping, __ATOMIC_RELAXED))
+                        sem_post(&ringSem);
+                    pushed = TRUE;
+                    break;
+                }
+            } else if (diff < 0) {
+                /* Full: wait for the drainer, but not forever, as it may be
+                stuck behind a push this signal handler interrupted */
+                if (waited >= RING_DRAIN_WAIT_NS)
+                    break;
+                nanosleep(&pause, NULL);
+                waited += pause.tv_nsec;
+                pos = __atomic_load_n(&ringTail, __ATOMIC_RELAXED);
+            } else {
+                pos = __atomic_load_n(&ringTail, __ATOMIC_RELAXED);
+            }
+        }
+    }
+    __atomic_sub_fetch(&ringInflight, 1, __ATOMIC_SEQ_CST);
+
+    return pushed;
+}
+
+/* Write out the lines published so far, in order, stopping at the first
+slot that's claimed but not yet filled */
+
+static void
+ringWriteOut(void)
+{
+    struct iovec iov[RING_BATCH];
+
+    for (;;) {
+        size_t head = ringHead;
+        int n;
+
+        for (n = 0; n < RING_BATCH; n++) {
+            RingSlot *slot = &ring[(head + n) & ringMask];
+            if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != head + n + 1)
+                break;
+            iov[n].iov_base = slot->line;
+            iov[n].iov_len = slot->len;
+        }
+        if (n == 0)
+            return;
+
+        writeLines(iov, n);
+        for (int i = 0; i < n; i++)
+            __atomic_store_n(&ring[(head + i) & ringMask].seq, head + i + ringMask + 1, __ATOMIC_RELEASE);
+        __atomic_store_n(&ringHead, head + n, __ATOMIC_RELEASE);
+    }
+}
+
+static void *
+ringDrain(void *arg)
+{
+    for (;;) {
+        ringWriteOut();
+        if (__atomic_load_n(&ringStopping, __ATOMIC_ACQUIRE)) {
+            ringWriteOut();
+            return NULL;
+        }
+
+        /* Say we're going to sleep, then look again: a push either sees
+        ringSleeping and posts, or published before we look */
+        __atomic_store_n(&ringSleeping, 1, __ATOMIC_SEQ_CST);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        size_t head = ringHead;
+        if (__atomic_load_n(&ring[head & ringMask].seq, __ATOMIC_ACQUIRE) != head + 1 &&
+                !__atomic_load_n(&ringStopping, __ATOMIC_ACQUIRE)) {
+            while (sem_wait(&ringSem) == -1 && errno == EINTR)
+                continue;
+        }
+        __atomic_store_n(&ringSleeping, 0, __ATOMIC_RELAXED);
+    }
+}
+
+/* Give the drainer a moment to write out what's queued, so that a line
+written directly doesn't overtake them */
+
+static void
+ringWaitDrained(void)
+{
+    struct timespec pause = { 0, RING_PAUSE_NS };
+
+    if (!__atomic_load_n(&ringActive, __ATOMIC_SEQ_CST))
+        return;
+    for (long waited = 0; waited < RING_DRAIN_WAIT_NS &&
+            __atomic_load_n(&ringHead, __ATOMIC_ACQUIRE) != __atomic_load_n(&ringTail, __ATOMIC_ACQUIRE);
+            waited += pause.tv_nsec)
+        nanosleep(&pause, NULL);
+}
+
+/* The drainer doesn't survive fork(), so the child writes directly */
+
+static void
+ringForkChild(void)
+{
+    ringActive = 0;
+    ringInflight = 0;
+    ring = NULL;
+}
+
+int
+errRingStart(size_t nslots)
+{
+    static Boolean registered = FALSE;
+    sigset_t all, saved;
+    size_t n = 2;
+    int s;
+
+    if (ring != NULL) {
+        errno = EBUSY;
+        return -1;
+    }
+    while (n < nslots)
+        n <<= 1;
+
+    ring = malloc(n * sizeof(RingSlot));
+    if (ring == NULL)
+        return -1;
+    for (size_t i = 0; i < n; i++)
+        ring[i].seq = i;
+    ringMask = n - 1;
+    ringTail = ringHead = 0;
+    ringStopping = 0;
+    sem_init(&ringSem, 0, 0);
+
+    /* Signals are for the application's threads, not the drainer */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &saved);
+    s = pthread_create(&ringThread, NULL, ringDrain, NULL);
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
+    if (s != 0) {
+        sem_destroy(&ringSem);
+        free(ring);
+        ring = NULL;
+        errno = s;
+        return -1;
+    }
+
+    if (!registered) {
+        pthread_atfork(NULL, NULL, ringForkChild);
+        atexit(errRingStop);
+        registered = TRUE;
+    }
+    __atomic_store_n(&ringActive, 1, __ATOMIC_SEQ_CST);
+    return 0;
+}
+
+void
+errRingStop(void)
+{
+    if (ring == NULL)
+        return;
+
+    /* New lines go straight to stderr; wait for pushes that already got in */
+    __atomic_store_n(&ringActive, 0, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&ringInflight, __ATOMIC_SEQ_CST) > 0)
+        sched_yield();
+
+    __atomic_store_n(&ringStopping, 1, __ATOMIC_RELEASE);
+    sem_post(&ringSem);
+    pthread_join(ringThread, NULL);
+
+    sem_destroy(&ringSem);
+    free(ring);
+    ring = NULL;
+}
+
+static void
+emitLine(char *line, size_t len)
+{
+    if (!ringPush(line, len))
+        writeLine(line, len);
+}
+
+static void
+logLine(Boolean useErr, int err, const char *format, va_list ap)
+{
+    /* On the stack rather than in a per-thread static buffer: a signal
+    handler logging while this thread formats would clobber it */
+    char buf[ERR_LINE_MAX];
+    size_t len = formatLine(buf, useErr, err, format, ap);
+
+    emitLine(buf, len);
+}
+
+void
+errLog(const char *format, ...)
+{
+    va_list argList;
+    int savedErrno;
+
+    savedErrno = errno;
+
+    va_start(argList, format);
+    logLine(TRUE, savedErrno, format, argList);
+    va_end(argList);
+
+    errno = savedErrno;
+}
+
+void
+errLogEN(int errnum, const char *format, ...)
+{
+    va_list argList;
+    int savedErrno;
+
+    savedErrno = errno;
+
+    va_start(argList, format);
+    logLine(errnum != 0, errnum, format, argList);
+    va_end(argList);
+
+    errno = savedErrno;
+}
+
+/*
+ * Structured events. The rate limit is a fixed window per call site: the
+ * first errEventLimit events of each window go out, and the rest only bump
+ * a counter that the next emitted event reports.
+ */
+
+#define EVENT_TAIL_MAX 64 /* Room kept for ,"suppressed":N,"truncated":true}\n */
+#define EVENT_NAME_MAX 128
+
+static unsigned eventLimit = ERR_EVENT_LIMIT;
+static long long eventWindowNs = ERR_EVENT_WINDOW_MS * 1000000LL;
+
+static long long
+monotonicNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void
+errEventSetLimit(unsigned limit, unsigned windowMs)
+{
+    __atomic_store_n(&eventWindowNs, max(windowMs, 1U) * 1000000LL, __ATOMIC_RELAXED);
+    __atomic_store_n(&eventLimit, limit, __ATOMIC_RELAXED);
+}
+
+int
+errEventAllow(ErrEventSite *site)
+{
+    unsigned limit = __atomic_load_n(&eventLimit, __ATOMIC_RELAXED);
+
+    if (limit == 0)
+        return TRUE;
+
+    long long window = monotonicNs() / __atomic_load_n(&eventWindowNs, __ATOMIC_RELAXED);
+    long long seen = __atomic_load_n(&site->window, __ATOMIC_RELAXED);
+    if (seen != window &&
+            __atomic_compare_exchange_n(&site->window, &seen, window, FALSE, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        __atomic_store_n(&site->emitted, 0, __ATOMIC_RELAXED);
+
+    if (__atomic_fetch_add(&site->emitted, 1, __ATOMIC_RELAXED) < limit)
+        return TRUE;
+    __atomic_fetch_add(&site->suppressed, 1, __ATOMIC_RELAXED);
+    return FALSE;
+}
+
+/* Append s, or its first maxLen bytes, as a JSON string */
+
+static void
+jsonString(FmtOut *out, const char *s, size_t maxLen)
+{
+    static const char hex[] = "0123456789abcdef";
+    const char *end = s + strnlen(s, maxLen);
+
+    fmtWrite(out, "\"", 1);
+    while (s < end) {
+        const char *run = s;
+        while (s < end && *s != '"' && *s != '\\' && (unsigned char) *s >= 0x20)
+            s++;
+        fmtWrite(out, run, s - run);
+        if (s == end)
+            break;
+
+        char escape[6] = { '\\', *s, '0', '0', hex[(unsigned char) *s >> 4], hex[*s & 0xf] };
+        if (*s == '"' || *s == '\\') {
+            fmtWrite(out, escape, 2);
+        } else {
+            escape[1] = 'u';
+            fmtWrite(out, escape, 6);
+        }
+        s++;
+    }
+    fmtWrite(out, "\"", 1);
+}
+
+static void
+jsonInteger(FmtOut *out, long long value)
+{
+    static const FmtSpec plain = { FALSE, FALSE, FALSE, FALSE, FALSE, 0, -1 };
+    fmtInteger(out, value < 0 ? 0ULL - (unsigned long long) value : (unsigned long long) value,
+               value < 0, 10, FALSE, "", &plain);
+}
+
+static void
+jsonUnsigned(FmtOut *out, unsigned long long value)
+{
+    static const FmtSpec plain = { FALSE, FALSE, FALSE, FALSE, FALSE, 0, -1 };
+    fmtInteger(out, value, FALSE, 10, FALSE, "", &plain);
+}
+
+void
+errEventEmit(ErrEventSite *site, int err, const ErrField *fields)
+{
+    char buf[ERR_LINE_MAX];
+    char siteName[EVENT_NAME_MAX];
+    FmtOut out = { buf, ERR_LINE_MAX - EVENT_TAIL_MAX, 0 };
+    Boolean truncated = FALSE;
+    int savedErrno = errno;
+
+    fmtWrite(&out, "{\"ts_ns\":", 9);
+    jsonInteger(&out, monotonicNs());
+    fmtWrite(&out, ",\"event\":", 9);
+    jsonString(&out, site->name, EVENT_NAME_MAX);
+    formatf(siteName, sizeof(siteName), "%s:%d", site->file, site->line);
+    fmtWrite(&out, ",\"site\":", 8);
+    jsonString(&out, siteName, sizeof(siteName));
+    if (err != 0) {
+        const char *description = strerrordesc_np(err);
+        fmtWrite(&out, ",\"errno\":", 9);
+        jsonString(&out, errorName(err), EVENT_NAME_MAX);
+        fmtWrite(&out, ",\"errnum\":", 10);
+        jsonInteger(&out, err);
+        fmtWrite(&out, ",\"error\":", 9);
+        jsonString(&out, description != NULL ? description : "Unknown error", EVENT_NAME_MAX);
+    }
+
+    for (const ErrField *field = fields; field->type != ERR_FIELD_END; field++) {
+        size_t before = out.len;
+        fmtWrite(&out, ",", 1);
+        jsonString(&out, field->key, EVENT_NAME_MAX);
+        fmtWrite(&out, ":", 1);
+        switch (field->type) {
+        case ERR_FIELD_STR:
+            if (field->value.s == NULL)
+                fmtWrite(&out, "null", 4);
+            else
+                jsonString(&out, field->value.s, ERR_LINE_MAX);
+            break;
+        case ERR_FIELD_INT: jsonInteger(&out, field->value.i); break;
+        case ERR_FIELD_UINT: jsonUnsigned(&out, field->value.u); break;
+        case ERR_FIELD_END: break;
+        }
+        if (out.len + 1 >= out.size) {
+            out.len = before;
+            truncated = TRUE;
+            break;
+        }
+    }
+
+    /* The header is short enough that it never gets here truncated */
+    out.size = ERR_LINE_MAX;
+    unsigned long suppressed = __atomic_exchange_n(&site->suppressed, 0, __ATOMIC_RELAXED);
+    if (suppressed > 0) {
+        fmtWrite(&out, ",\"suppressed\":", 14);
+        jsonUnsigned(&out, suppressed);
+    }
+    if (truncated)
+        fmtWrite(&out, ",\"truncated\":true", 17);
+    fmtWrite(&out, "}\n", 2);
+
+    emitLine(buf, out.len);
+    errno = savedErrno;
+}
+
+static void
+outputError(Boolean useErr, int err, Boolean flushStdout, const char *format, va_list ap)
+{
+    char buf[ERR_LINE_MAX];
+    size_t len = formatLine(buf, useErr, err, format, ap);
+
     if (flushStdout) {
         fflush(stdout); /* Flush any pending stdout */
     }
-    
-    fputs(buf, stderr);
-    fflush(stderr); /* In case stderr is not line-buffered */
+
+    ringWaitDrained();
+    writeLine(buf, len);
 }
 
 void
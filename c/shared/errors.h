@@ -1,6 +1,13 @@
 #ifndef __SHARED_ERRORS_H__
 #define __SHARED_ERRORS_H__
 
+#include <stdarg.h>
+#include <stddef.h>
+
+/* Longest line the error functions emit, newline included. Longer messages are truncated.
+Kept below PIPE_BUF so a line written to a pipe is never split. */
+#define ERR_LINE_MAX 1024
+
 void errMsg(const char *format, ...);
 
 #ifdef __GNUC__
@@ -20,4 +27,97 @@ void fatal(const char *format, ...) NORETURN ;
 void usageErr(const char *format, ...) NORETURN ;
 void cmdLineErr(const char *format, ...) NORETURN ;
 
+/**
+ * Async-signal-safe, allocation-free vsnprintf for the conversions error messages use:
+ * d i u x X o c s p %, with the -0+ # flags, width and precision (also as *), and the hh h l ll z j t sizes.
+ * Formatting stops at anything else (e.g. floating point), which is copied as is.
+ * Returns the length the full output would have had, like vsnprintf.
+ */
+int errFormat(char *buf, size_t size, const char *format, va_list ap);
+
+/**
+ * Like errMsg, but safe to call from signal handlers and from many threads:
+ * the line is formatted on the caller's stack and emitted with a single write(2), so lines never interleave.
+ * stdout isn't flushed, and errno is preserved. errLogEN takes the error number instead,
+ * and with errnum 0 the line is "ERROR: <message>", like fatal.
+ */
+void errLog(const char *format, ...);
+void errLogEN(int errnum, const char *format, ...);
+
+/**
+ * Hand errLog lines to a background thread instead of writing them, through a lock-free ring of nslots lines
+ * (rounded up to a power of 2). Pushing a line stays async-signal-safe. A push waits for room in a full ring,
+ * and writes the line directly if the drainer doesn't make any within 100ms.
+ * The errExit family waits for queued lines before writing its own, and the ring is drained at exit.
+ * Returns 0, or -1 with errno set.
+ */
+int errRingStart(size_t nslots);
+
+/**
+ * Drain the ring, stop its thread and go back to direct writes. Not async-signal-safe.
+ */
+void errRingStop(void);
+
+/*
+ * Structured diagnostic events: one JSON object per line on stderr, through the errLog path, e.g.
+ *     {"ts_ns":1234,"event":"copy.read","site":"q2.c:42","errno":"EIO","errnum":5,"error":"Input/output error","offset":4096}
+ * ts_ns is on the monotonic clock. Each call site is rate limited on its own, and the next event it emits
+ * carries the number it dropped as "suppressed". Fields that don't fit in ERR_LINE_MAX are dropped,
+ * and the event then carries "truncated":true.
+ */
+
+#define ERR_EVENT_LIMIT 10        /* Default events per window and call site */
+#define ERR_EVENT_WINDOW_MS 1000
+
+typedef enum { ERR_FIELD_END, ERR_FIELD_STR, ERR_FIELD_INT, ERR_FIELD_UINT } ErrFieldType;
+
+typedef struct {
+    const char *key;
+    ErrFieldType type;
+    union {
+        const char *s;
+        long long i;
+        unsigned long long u;
+    } value;
+} ErrField;
+
+#define EV_STR(k, v) ((ErrField) { (k), ERR_FIELD_STR, { .s = (v) } })
+#define EV_INT(k, v) ((ErrField) { (k), ERR_FIELD_INT, { .i = (v) } })
+#define EV_UINT(k, v) ((ErrField) { (k), ERR_FIELD_UINT, { .u = (v) } })
+
+typedef struct {
+    const char *name;
+    const char *file;
+    int line;
+    long long window;       /* Rate limiting window the counters below are for */
+    unsigned emitted;
+    unsigned long suppressed;
+} ErrEventSite;
+
+/**
+ * Emit event name (a string literal) with error number err (0 for none) and EV_* fields:
+ *     errEvent("copy.read", errno, EV_STR("path", path), EV_INT("offset", offset));
+ * Once the call site is over its limit, the event costs a clock read and two atomic adds:
+ * err and the fields aren't even evaluated. Async-signal-safe, and errno is preserved.
+ */
+#define errEvent(name, err, ...) do { \
+    static ErrEventSite errEventSite_ = { (name), __FILE__, __LINE__, -1, 0, 0 }; \
+    if (errEventAllow(&errEventSite_)) { \
+        errEventEmit(&errEventSite_, (err), \
+            (const ErrField[]) { __VA_ARGS__ __VA_OPT__(,) { NULL, ERR_FIELD_END, { NULL } } }); \
+    } \
+} while (0)
+
+/**
+ * Let each call site emit at most limit events per window of windowMs (limit 0 for no limit).
+ */
+void errEventSetLimit(unsigned limit, unsigned windowMs);
+
+/**
+ * Count an event against its call site's limit. Returns 0 if it must be dropped.
+ */
+int errEventAllow(ErrEventSite *site);
+
+void errEventEmit(ErrEventSite *site, int err, const ErrField *fields);
+
 #endif
\ No newline at end of file
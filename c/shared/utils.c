@@ -8,6 +8,8 @@ plus EXIT_SUCCESS and EXIT_FAILURE constants */
 #include <fcntl.h> /* Prototypes for open and flags */
 #include <errno.h> /* Declares errno and defines error constants */
 #include <string.h> /* Commonly used string-handling functions */
+#include <poll.h> /* For waiting on nonblocking descriptors */
+#include <sys/uio.h> /* For writev and struct iovec */
 
 #include "errors.h" /* Declares our error-handling functions */
 #include "utils.h"
@@ -38,15 +40,57 @@ int cmp_question(const char* candidate, int question_number) {
 }
 
 
+/**
+ * Block until fd is writable. Used when a write on a nonblocking descriptor fails with EAGAIN.
+ */
+static void wait_writable(int fd) {
+	struct pollfd pfd = { .fd = fd, .events = POLLOUT };
+	while (poll(&pfd, 1, -1) == -1) {
+		if (errno != EINTR) {
+			errExit("Error on poll for writing\n");
+		}
+	}
+}
+
 void deliver_write(int fd, const void * buffer, size_t nbytes) {
 	size_t total_written = 0;
-	ssize_t nwritten = write(fd, buffer+total_written, nbytes-total_written);
-	while(nwritten > 0) {
+	while (total_written < nbytes) {
+		ssize_t nwritten = write(fd, buffer+total_written, nbytes-total_written);
+		if (nwritten == -1) {
+			if (errno == EINTR) {
+				continue;
+			} else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				wait_writable(fd);
+				continue;
+			}
+			errExit("Error on writing data\n");
+		}
 		total_written += nwritten;
-		nwritten = write(fd, buffer+total_written, nbytes-total_written);
 	}
-	if (nwritten == -1) {
-		errExit("Error on writing data\n");
+}
+
+void deliver_writev(int fd, struct iovec * iov, int iovcnt) {
+	while (iovcnt > 0) {
+		ssize_t nwritten = writev(fd, iov, iovcnt);
+		if (nwritten == -1) {
+			if (errno == EINTR) {
+				continue;
+			} else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				wait_writable(fd);
+				continue;
+			}
+			errExit("Error on writing data\n");
+		}
+		// Skip the elements fully written and advance into the partially written one
+		while (iovcnt > 0 && (size_t) nwritten >= iov->iov_len) {
+			nwritten -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (iovcnt > 0) {
+			iov->iov_base += nwritten;
+			iov->iov_len -= nwritten;
+		}
 	}
 }
 
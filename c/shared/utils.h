@@ -2,6 +2,7 @@
 #define __SHARED_UTILS_H__
 
 #include <stddef.h> /* For size_t */
+#include <sys/uio.h> /* For struct iovec */
 
 typedef enum { FALSE, TRUE } Boolean;
 
@@ -15,9 +16,16 @@ int cmp_question(const char* candidate, int question_number);
 
 /**
  * Like a write, but is guaranteed to deliver all bytes (or die trying!)
+ * Writes interrupted by signals are retried and nonblocking descriptors are polled until writable.
  */
 void deliver_write(int fd, const void * buffer, size_t nbytes);
 
+/**
+ * Like a writev, but is guaranteed to deliver all bytes (or die trying!)
+ * NOTE: iov is used as scratch space to track partial writes, so its contents are clobbered.
+ */
+void deliver_writev(int fd, struct iovec * iov, int iovcnt);
+
 /**
  * Like a close, but is guaranteed to close successfully (or die trying!)
  */